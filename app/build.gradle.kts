@@ -52,7 +52,6 @@ dependencies {
     implementation("androidx.constraintlayout:constraintlayout:2.1.4")
     implementation("io.github.ParkSangGwon:tedpermission-normal:3.3.0")
     implementation("commons-io:commons-io:2.15.1")
-    implementation("org:jaudiotagger:2.0.3")
     testImplementation("junit:junit:4.13.2")
     androidTestImplementation("androidx.test.ext:junit:1.1.5")
     androidTestImplementation("androidx.test.espresso:espresso-core:3.5.1")
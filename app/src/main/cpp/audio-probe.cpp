@@ -0,0 +1,321 @@
+#include "audio-probe.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <thread>
+#include "render-report.h"
+#include "sox.h"
+#include "sox-ops.h"
+
+#define ID3_HEADER_BYTES 10
+/* Longer text frames are not tags the app shows */
+#define ID3_MAX_TEXT_BYTES 4096
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t be32(uint8_t const * p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint32_t syncsafe32(uint8_t const * p) {
+    return ((uint32_t) (p[0] & 0x7f) << 21) | ((uint32_t) (p[1] & 0x7f) << 14)
+           | ((uint32_t) (p[2] & 0x7f) << 7) | (p[3] & 0x7f);
+}
+
+static void append_utf8(std::string & out, uint32_t c) {
+    if (c < 0x80) {
+        out += (char) c;
+    } else if (c < 0x800) {
+        out += (char) (0xc0 | (c >> 6));
+        out += (char) (0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+        out += (char) (0xe0 | (c >> 12));
+        out += (char) (0x80 | ((c >> 6) & 0x3f));
+        out += (char) (0x80 | (c & 0x3f));
+    } else {
+        out += (char) (0xf0 | (c >> 18));
+        out += (char) (0x80 | ((c >> 12) & 0x3f));
+        out += (char) (0x80 | ((c >> 6) & 0x3f));
+        out += (char) (0x80 | (c & 0x3f));
+    }
+}
+
+/* First value of an ID3v2 text frame, as UTF-8 */
+static std::string id3_text(uint8_t const * data, size_t size) {
+    std::string text;
+    if (size < 1) {
+        return text;
+    }
+    uint8_t encoding = data[0];
+    data++;
+    size--;
+    if (encoding == 0 || encoding == 3) {
+        /* ISO-8859-1 or UTF-8 */
+        for (size_t i = 0; i < size && data[i]; i++) {
+            if (encoding == 0) {
+                append_utf8(text, data[i]);
+            } else {
+                text += (char) data[i];
+            }
+        }
+        return text;
+    }
+
+    /* UTF-16 with a byte order mark, or big endian without one */
+    bool bigEndian = true;
+    if (encoding == 1 && size >= 2) {
+        bigEndian = !(data[0] == 0xff && data[1] == 0xfe);
+        if ((data[0] == 0xff && data[1] == 0xfe) || (data[0] == 0xfe && data[1] == 0xff)) {
+            data += 2;
+            size -= 2;
+        }
+    }
+    uint32_t high = 0;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        uint32_t unit = bigEndian ? (data[i] << 8) | data[i + 1] : (data[i + 1] << 8) | data[i];
+        if (unit == 0) {
+            break;
+        }
+        if (unit >= 0xd800 && unit < 0xdc00) {
+            high = unit;
+            continue;
+        }
+        if (unit >= 0xdc00 && unit < 0xe000) {
+            if (high) {
+                append_utf8(text, 0x10000 + ((high - 0xd800) << 10) + (unit - 0xdc00));
+            }
+        } else {
+            append_utf8(text, unit);
+        }
+        high = 0;
+    }
+    return text;
+}
+
+static std::string * id3_field(AudioProbe * probe, char const * id) {
+    static struct {
+        char const * v22;
+        char const * v23;
+        std::string AudioProbe::* field;
+    } const frames[] = {
+        {"TT2", "TIT2", &AudioProbe::title},
+        {"TP1", "TPE1", &AudioProbe::artist},
+        {"TAL", "TALB", &AudioProbe::album},
+        {"TYE", "TYER", &AudioProbe::year},
+        {"TYE", "TDRC", &AudioProbe::year},
+        {"TRK", "TRCK", &AudioProbe::track},
+        {"TCO", "TCON", &AudioProbe::genre},
+    };
+    for (auto const & frame : frames) {
+        if (strcmp(id, frame.v22) == 0 || strcmp(id, frame.v23) == 0) {
+            return &(probe->*frame.field);
+        }
+    }
+    return NULL;
+}
+
+/* Fills the tags still empty from the ID3v2 tag at the start of path */
+static void read_id3v2(char const * path, AudioProbe * probe) {
+    FILE * f = fopen(path, "rb");
+    if (!f) {
+        return;
+    }
+    uint8_t header[ID3_HEADER_BYTES];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "ID3", 3) != 0
+            || header[3] < 2 || header[3] > 4 || (header[5] & 0x80)) {
+        /* No tag, an unknown version or a tag-wide unsynchronisation */
+        fclose(f);
+        return;
+    }
+    unsigned version = header[3];
+    long end = ID3_HEADER_BYTES + (long) syncsafe32(header + 6);
+    if (version >= 3 && (header[5] & 0x40)) {
+        uint8_t ext[4];
+        if (fread(ext, 1, sizeof(ext), f) != sizeof(ext)) {
+            fclose(f);
+            return;
+        }
+        long extSize = version == 3 ? 4 + (long) be32(ext) : (long) syncsafe32(ext);
+        fseek(f, ID3_HEADER_BYTES + extSize, SEEK_SET);
+    }
+
+    size_t idBytes = version == 2 ? 3 : 4;
+    size_t headerBytes = version == 2 ? 6 : 10;
+    std::vector<uint8_t> data;
+    for (;;) {
+        uint8_t frame[10];
+        long pos = ftell(f);
+        if (pos < 0 || pos + (long) headerBytes > end || fread(frame, 1, headerBytes, f) != headerBytes
+                || frame[0] == 0) {
+            break;
+        }
+        char id[5] = {0};
+        memcpy(id, frame, idBytes);
+        uint32_t size = version == 2 ? (frame[3] << 16) | (frame[4] << 8) | frame[5]
+                                     : version == 3 ? be32(frame + 4) : syncsafe32(frame + 4);
+        long next = pos + (long) headerBytes + size;
+        if (next > end) {
+            break;
+        }
+
+        /* Compressed, encrypted or unsynchronised frames are left out */
+        bool plain = version == 2 || (version == 3 ? (frame[9] & 0xc0) == 0 : (frame[9] & 0x0e) == 0);
+        /* Group id and data length ahead of the text */
+        size_t skip = version == 3 ? (frame[9] & 0x20 ? 1 : 0)
+                    : version == 4 ? (frame[9] & 0x40 ? 1 : 0) + (frame[9] & 0x01 ? 4 : 0) : 0;
+        std::string * field = id3_field(probe, id);
+        if (field && field->empty() && plain && size > skip && size <= ID3_MAX_TEXT_BYTES) {
+            data.resize(size);
+            if (fread(data.data(), 1, size, f) != size) {
+                break;
+            }
+            *field = id3_text(data.data() + skip, size - skip);
+        }
+        if (fseek(f, next, SEEK_SET) != 0) {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void read_comments(sox_comments_t comments, AudioProbe * probe) {
+    static struct {
+        char const * key;
+        std::string AudioProbe::* field;
+    } const keys[] = {
+        {"Title", &AudioProbe::title},
+        {"Artist", &AudioProbe::artist},
+        {"Album", &AudioProbe::album},
+        {"Year", &AudioProbe::year},
+        {"Date", &AudioProbe::year},
+        {"Tracknumber", &AudioProbe::track},
+        {"Genre", &AudioProbe::genre},
+    };
+    for (auto const & key : keys) {
+        char const * value = sox_find_comment(comments, key.key);
+        if (value && (probe->*key.field).empty()) {
+            probe->*key.field = value;
+        }
+    }
+}
+
+int audio_probe(char const * path, AudioProbe * probe) {
+    Clock::time_point start = Clock::now();
+    *probe = AudioProbe();
+    probe->path = path;
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        probe->error = "sox_init failed";
+        return RESULT_ERROR;
+    }
+    sox_format_t * in = sox_open_read(path, NULL, NULL, NULL);
+    if (!in) {
+        probe->error = std::string("cannot open input: ") + path;
+        probe->probe_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        return RESULT_ERROR;
+    }
+
+    probe->filetype = in->filetype;
+    probe->rate = in->signal.rate;
+    probe->channels = in->signal.channels;
+    probe->bits = in->signal.precision;
+    if (in->signal.length != SOX_UNKNOWN_LEN && in->signal.channels > 0) {
+        probe->samples = in->signal.length / in->signal.channels;
+    }
+    if (probe->rate > 0) {
+        probe->duration_s = probe->samples / probe->rate;
+    }
+    read_comments(in->oob.comments, probe);
+    bool mp3 = probe->filetype == "mp3";
+    sox_close(in);
+
+    if (mp3) {
+        read_id3v2(path, probe);
+    }
+    /* Dates of Vorbis comments and ID3v2.4 are full ISO dates */
+    if (probe->year.size() > 4) {
+        probe->year.resize(4);
+    }
+
+    probe->result = RESULT_SUCCESS;
+    probe->probe_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return RESULT_SUCCESS;
+}
+
+std::vector<AudioProbe> audio_probe_batch(std::vector<std::string> const & paths, unsigned threads) {
+    std::vector<AudioProbe> probes(paths.size());
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            audio_probe(paths[i].c_str(), &probes[i]);
+        }
+    };
+
+    threads = std::max(1u, std::min<unsigned>(threads, paths.size()));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+    return probes;
+}
+
+std::vector<std::string> audio_probe_list_dir(char const * dir) {
+    static char const * const extensions[] = {".mp3", ".flac", ".ogg", ".wav"};
+    std::vector<std::string> paths;
+    DIR * d = opendir(dir);
+    if (!d) {
+        return paths;
+    }
+    while (dirent * e = readdir(d)) {
+        std::string name = e->d_name;
+        for (char const * extension : extensions) {
+            size_t length = strlen(extension);
+            if (name.size() > length && strcasecmp(name.c_str() + name.size() - length, extension) == 0) {
+                paths.push_back(std::string(dir) + "/" + name);
+                break;
+            }
+        }
+    }
+    closedir(d);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::string probe_to_json(AudioProbe const & probe) {
+    std::string out = "{";
+    json_field(out, "path", probe.path);
+    json_field(out, "result", probe.result);
+    json_field(out, "error", probe.error);
+    json_field(out, "filetype", probe.filetype);
+    json_field(out, "rate", probe.rate);
+    json_field(out, "channels", (uint64_t) probe.channels);
+    json_field(out, "bits", (uint64_t) probe.bits);
+    json_field(out, "samples", probe.samples);
+    json_field(out, "duration_s", probe.duration_s);
+    json_field(out, "title", probe.title);
+    json_field(out, "artist", probe.artist);
+    json_field(out, "album", probe.album);
+    json_field(out, "year", probe.year);
+    json_field(out, "track", probe.track);
+    json_field(out, "genre", probe.genre);
+    json_field(out, "probe_ms", probe.probe_ms);
+    out += "}";
+    return out;
+}
+
+std::string probes_to_json(std::vector<AudioProbe> const & probes) {
+    std::string out = "[";
+    for (size_t i = 0; i < probes.size(); i++) {
+        out += (i > 0 ? "," : "") + probe_to_json(probes[i]);
+    }
+    out += "]";
+    return out;
+}
@@ -0,0 +1,52 @@
+#ifndef SOXTEST_AUDIO_PROBE_H
+#define SOXTEST_AUDIO_PROBE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Metadata of an audio file read from its headers only.
+ *
+ * The signal comes from sox_open_read(), which parses the container header
+ * (and, for an MP3 without a Xing/Info header, walks the frame headers to
+ * count samples) but does not decode the stream, bar the first MP3 frame
+ * its reader decodes to sync; the tags from the comments libSoX
+ * collected while opening (Vorbis comments of FLAC and OGG, WAV INFO).
+ * libSoX only reads ID3 tags when built with libid3tag, so for MP3 the
+ * text frames of the ID3v2 tag are also read here, seeking past pictures
+ * and other frames without loading them */
+struct AudioProbe {
+    std::string path;
+    int result = -1;           /* RESULT_SUCCESS once probed            */
+    std::string error;
+
+    std::string filetype;
+    double rate = 0;
+    unsigned channels = 0;
+    unsigned bits = 0;         /* precision of the samples               */
+    uint64_t samples = 0;      /* per channel, 0 if the length is unknown */
+    double duration_s = 0;
+
+    std::string title;
+    std::string artist;
+    std::string album;
+    std::string year;
+    std::string track;
+    std::string genre;
+
+    double probe_ms = 0;
+};
+
+int audio_probe(char const * path, AudioProbe * probe);
+
+/* Probes the files on up to threads threads; the results are in the order
+ * of paths, failed probes included */
+std::vector<AudioProbe> audio_probe_batch(std::vector<std::string> const & paths, unsigned threads);
+
+/* Files in dir with an audio extension the app handles, sorted by name */
+std::vector<std::string> audio_probe_list_dir(char const * dir);
+
+std::string probe_to_json(AudioProbe const & probe);
+std::string probes_to_json(std::vector<AudioProbe> const & probes);
+
+#endif //SOXTEST_AUDIO_PROBE_H
@@ -0,0 +1,241 @@
+#include "checkpoint.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "mapped-io.h"
+#include "native-log.h"
+#include "rate-plans.h"
+#include "sox-ops.h"
+
+#define COPY_BLOCK_SAMPLES 65536
+
+static std::atomic<double> interval_seconds(0);
+
+void checkpoint_set_interval(double seconds) {
+    interval_seconds = seconds;
+}
+
+double checkpoint_interval() {
+    return interval_seconds;
+}
+
+int checkpoint_load(std::string const & path, Checkpoint * checkpoint) {
+    FILE * f = fopen(path.c_str(), "r");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+
+    Checkpoint loaded;
+    bool complete = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char * value = strchr(line, '=');
+        if (!value) {
+            continue;
+        }
+        *value++ = 0;
+        if (strcmp(line, "job") == 0) {
+            loaded.job = value;
+        } else if (strcmp(line, "data_offset") == 0) {
+            loaded.data_offset = strtoull(value, NULL, 10);
+        } else if (strcmp(line, "out_samples") == 0) {
+            loaded.out_samples = strtoull(value, NULL, 10);
+        } else if (strcmp(line, "data_bytes") == 0) {
+            loaded.data_bytes = strtoull(value, NULL, 10);
+            complete = true;
+        }
+    }
+    fclose(f);
+
+    if (!complete || loaded.job.empty()) {
+        return RESULT_ERROR;
+    }
+    *checkpoint = loaded;
+    return RESULT_SUCCESS;
+}
+
+int checkpoint_save(std::string const & path, Checkpoint const & checkpoint) {
+    std::string tmpPath = path + ".tmp";
+    FILE * f = fopen(tmpPath.c_str(), "w");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+    fprintf(f, "job=%s\n", checkpoint.job.c_str());
+    fprintf(f, "data_offset=%llu\n", (unsigned long long) checkpoint.data_offset);
+    fprintf(f, "out_samples=%llu\n", (unsigned long long) checkpoint.out_samples);
+    fprintf(f, "data_bytes=%llu\n", (unsigned long long) checkpoint.data_bytes);
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+int checkpoint_copy_partial(std::string const & partPath, Checkpoint const & checkpoint,
+                            sox_format_t * out) {
+    /* The header of a killed render was never finalised, so the samples are
+     * read as raw data in the output's own encoding */
+    sox_encodinginfo_t encoding = out->encoding;
+    encoding.reverse_bytes = sox_option_no;
+    sox_format_t * in = sox_open_read(partPath.c_str(), &out->signal, &encoding, "raw");
+    if (!in) {
+        return RESULT_ERROR;
+    }
+    if (fseeko((FILE *) in->fp, (off_t) checkpoint.data_offset, SEEK_SET) != 0) {
+        sox_close(in);
+        return RESULT_ERROR;
+    }
+
+    std::vector<sox_sample_t> buf(COPY_BLOCK_SAMPLES);
+    uint64_t left = checkpoint.out_samples;
+    int result = RESULT_SUCCESS;
+    while (left > 0 && result == RESULT_SUCCESS) {
+        size_t want = left < buf.size() ? (size_t) left : buf.size();
+        size_t got = sox_read(in, buf.data(), want);
+        if (got != want || sox_write(out, buf.data(), got) != got) {
+            result = RESULT_ERROR;
+        }
+        left -= got;
+    }
+    sox_close(in);
+    return result;
+}
+
+int checkpoint_commit(CheckpointSink * sink) {
+    /* Survive a power cut as well as a process kill: a mapped output is
+     * written back by msync(), as its stream has no descriptor */
+    uint64_t end;
+    if (sink->output->sync(sink->out, &end) != RESULT_SUCCESS) {
+        LOG_E("checkpoint: cannot sync the output");
+        return RESULT_ERROR;
+    }
+    sink->checkpoint.out_samples = sink->out->olength;
+    sink->checkpoint.data_bytes = end - sink->checkpoint.data_offset;
+    sink->since_last = 0;
+    return checkpoint_save(sink->path, sink->checkpoint);
+}
+
+int checkpoint_sink_write(CheckpointSink * sink, sox_sample_t const * ibuf, size_t len) {
+    if (sink->skip > 0) {
+        /* Replaying up to the checkpoint: already in the output file */
+        size_t drop = sink->skip < len ? (size_t) sink->skip : len;
+        sink->skip -= drop;
+        ibuf += drop;
+        len -= drop;
+    }
+    if (len > 0 && sox_write(sink->out, ibuf, len) != len) {
+        return RESULT_ERROR;
+    }
+
+    sink->since_last += len;
+    if (sink->interval > 0 && sink->since_last >= sink->interval) {
+        /* A failed checkpoint only costs progress on a resume */
+        checkpoint_commit(sink);
+    }
+    return RESULT_SUCCESS;
+}
+
+static int LSX_API sink_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * /* obuf */,
+                             size_t * isamp, size_t * osamp) {
+    CheckpointSink * sink = *(CheckpointSink **) effp->priv;
+    *osamp = 0;
+    return checkpoint_sink_write(sink, ibuf, *isamp) == RESULT_SUCCESS ? SOX_SUCCESS : SOX_EOF;
+}
+
+static sox_effect_handler_t const * sink_handler() {
+    static sox_effect_handler_t handler = {
+            "output", NULL, SOX_EFF_MCHAN, NULL, NULL, sink_flow, NULL, NULL, NULL,
+            sizeof(CheckpointSink *)
+    };
+    return &handler;
+}
+
+sox_effect_t * checkpoint_sink_create(CheckpointSink * sink) {
+    sox_effect_t * e = sox_create_effect(sink_handler());
+    if (e) {
+        *(CheckpointSink **) e->priv = sink;
+    }
+    return e;
+}
+
+std::string checkpoint_job(char const * operation, char const * inPath, sox_signalinfo_t const & out) {
+    struct stat in_stat = {};
+    stat(inPath, &in_stat);
+    return std::string(operation) + "|" + inPath + "|" + std::to_string(in_stat.st_size)
+            + "|" + std::to_string(in_stat.st_mtime) + "|" + std::to_string(out.rate)
+            + "|bits " + std::to_string(out.precision) + "|dft " + std::to_string(rate_plans_default_dft());
+}
+
+void checkpoint_job_add(std::string * job, EffectSpec const & spec, size_t log2DftSize) {
+    *job += "|" + spec.name;
+    for (std::string const & arg : spec.args) {
+        *job += " " + arg;
+    }
+    if (spec.name == "rate") {
+        *job += " dft " + std::to_string(log2DftSize);
+    }
+}
+
+bool checkpoint_run_begin(CheckpointRun * run, char const * outPath) {
+    size_t len = strlen(outPath);
+    if (checkpoint_interval() <= 0 || len < 4 || strcasecmp(outPath + len - 4, ".wav") != 0) {
+        return false;
+    }
+    run->out_path = outPath;
+    run->part_path = run->out_path + ".part";
+    run->old_part_path = run->part_path + ".old";
+    run->checkpoint_path = run->out_path + ".ckpt";
+    run->resumable = checkpoint_load(run->checkpoint_path, &run->previous) == RESULT_SUCCESS
+            && rename(run->part_path.c_str(), run->old_part_path.c_str()) == 0;
+    return true;
+}
+
+int checkpoint_run_resume(CheckpointRun * run, std::string const & job, sox_format_t * out,
+                          MappedOutput * output, CheckpointSink * sink) {
+    fflush((FILE *) out->fp);
+    sink->out = out;
+    sink->output = output;
+    sink->path = run->checkpoint_path;
+    sink->checkpoint.job = job;
+    sink->checkpoint.data_offset = ftello((FILE *) out->fp);
+    sink->interval = (uint64_t) (checkpoint_interval() * out->signal.rate) * out->signal.channels;
+
+    Checkpoint const & previous = run->previous;
+    struct stat part_stat;
+    int result = RESULT_SUCCESS;
+    if (run->resumable && previous.job == job && previous.data_offset == sink->checkpoint.data_offset
+            && stat(run->old_part_path.c_str(), &part_stat) == 0
+            && (uint64_t) part_stat.st_size >= previous.data_offset + previous.data_bytes) {
+        if (checkpoint_copy_partial(run->old_part_path, previous, out) != RESULT_SUCCESS) {
+            remove(run->checkpoint_path.c_str());
+            result = RESULT_ERROR;
+        } else {
+            sink->skip = previous.out_samples;
+            run->resumed = previous.out_samples;
+            LOG_I("checkpoint: resuming %s at %llu samples", run->out_path.c_str(),
+                  (unsigned long long) previous.out_samples);
+        }
+    }
+    remove(run->old_part_path.c_str());
+    return result;
+}
+
+int checkpoint_run_end(CheckpointRun * run, int result) {
+    if (result != RESULT_SUCCESS) {
+        if (access(run->old_part_path.c_str(), F_OK) == 0) {
+            /* Never got to resume; keep the interrupted part for the next try */
+            rename(run->old_part_path.c_str(), run->part_path.c_str());
+        }
+        return result;
+    }
+    result = rename(run->part_path.c_str(), run->out_path.c_str()) == 0 ? RESULT_SUCCESS : RESULT_ERROR;
+    remove(run->checkpoint_path.c_str());
+    return result;
+}
@@ -0,0 +1,103 @@
+#ifndef SOXTEST_CHECKPOINT_H
+#define SOXTEST_CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include "sox.h"
+
+/* Checkpointed, resumable renders to WAV.
+ *
+ * While checkpoints are enabled, sox_render() writes a WAV output to
+ * <out>.part through a sink effect that flushes the file and records a
+ * checkpoint in <out>.ckpt every checkpoint_interval() seconds of output.
+ * Only the partial output is kept: libSoX has no way to save the state of
+ * its effects, so a resumed render of the same job (same input, effects
+ * and tuning; see Checkpoint::job) copies the committed samples into a
+ * fresh <out>.part and replays the chain from the start with the first
+ * out_samples of its output dropped. A plain conversion seeks the input
+ * instead. Either way the writer sees the same sample sequence as an
+ * uninterrupted run, so the finished file is byte-identical. On success
+ * the part is renamed to <out> and the checkpoint removed */
+
+struct Checkpoint {
+    std::string job;           /* signature of the render, see sox_render() */
+    uint64_t data_offset = 0;  /* bytes of WAV header before the samples    */
+    uint64_t out_samples = 0;  /* samples safely on disk                    */
+    uint64_t data_bytes = 0;   /* their size in the file                    */
+};
+
+/* Seconds of output between checkpoints; 0 (the default) disables them */
+void checkpoint_set_interval(double seconds);
+double checkpoint_interval();
+
+int checkpoint_load(std::string const & path, Checkpoint * checkpoint);
+/* Written atomically, so a kill leaves either the old or the new one */
+int checkpoint_save(std::string const & path, Checkpoint const & checkpoint);
+
+/* Appends the committed samples of an earlier partial output to out, which
+ * must be freshly opened with the same signal and encoding */
+int checkpoint_copy_partial(std::string const & partPath, Checkpoint const & checkpoint,
+                            sox_format_t * out);
+
+class MappedOutput;
+
+/* State of the sink effect; owned by the caller for the length of the flow */
+struct CheckpointSink {
+    sox_format_t * out = NULL;
+    MappedOutput * output = NULL;  /* that opened out, see mapped-io.h */
+    std::string path;          /* of the .ckpt file */
+    Checkpoint checkpoint;
+    uint64_t skip = 0;         /* output samples still to drop on a replay */
+    uint64_t interval = 0;     /* samples between checkpoints */
+    uint64_t since_last = 0;
+};
+
+/* Last effect of a checkpointed chain, in place of "output"; created with
+ * checkpoint_sink_create() */
+sox_effect_t * checkpoint_sink_create(CheckpointSink * sink);
+
+/* Puts the output on the storage and records its position; nothing is
+ * recorded if the sync fails */
+int checkpoint_commit(CheckpointSink * sink);
+
+/* What the sink effect does with a buffer: drops the samples still to
+ * skip, writes the rest and commits every interval */
+int checkpoint_sink_write(CheckpointSink * sink, sox_sample_t const * buf, size_t len);
+
+struct EffectSpec;
+
+/* Signature of a render: the operation, the input file by path, size and
+ * modification time, the output rate and precision and the default DFT
+ * size; checkpoint_job_add() appends each effect in chain order */
+std::string checkpoint_job(char const * operation, char const * inPath, sox_signalinfo_t const & out);
+/* log2DftSize: that a `rate' effect started with */
+void checkpoint_job_add(std::string * job, EffectSpec const & spec, size_t log2DftSize);
+
+/* The files of one checkpointed render */
+struct CheckpointRun {
+    std::string out_path;
+    std::string part_path;       /* written in place of out_path */
+    std::string old_part_path;   /* of an interrupted run, until the job is known */
+    std::string checkpoint_path;
+    Checkpoint previous;
+    bool resumable = false;
+    uint64_t resumed = 0;        /* output samples taken over from it */
+};
+
+/* Whether a render to outPath is checkpointed: an interval is set and the
+ * output is a WAV. If so, sets the part of an interrupted run aside */
+bool checkpoint_run_begin(CheckpointRun * run, char const * outPath);
+
+/* Readies sink for job once the part is open as out with its header
+ * written. If the part set aside is of the same job, its committed samples
+ * are copied into out and sink->skip is set to their count, for the render
+ * to drop from its output again (or to seek past) */
+int checkpoint_run_resume(CheckpointRun * run, std::string const & job, sox_format_t * out,
+                          MappedOutput * output, CheckpointSink * sink);
+
+/* After the render, with out closed: renames the part into place on
+ * success; a failed run keeps an interrupted part it never resumed from
+ * for the next try */
+int checkpoint_run_end(CheckpointRun * run, int result);
+
+#endif //SOXTEST_CHECKPOINT_H
@@ -0,0 +1,354 @@
+#include "flac-parallel.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "md5.h"
+#include "native-log.h"
+#include "sox-ops.h"
+
+#define ID3V2_HEADER_SIZE 10
+#define METADATA_HEADER_SIZE 4
+#define STREAMINFO_SIZE 34
+#define STREAMINFO_MD5_OFFSET 18
+#define METADATA_STREAMINFO 0
+#define METADATA_SEEKTABLE 3
+#define SEEKPOINT_SIZE 18
+#define SEEKPOINT_PLACEHOLDER UINT64_MAX
+/* Longest frame header: sync to CRC-8 with a 7-byte number, 16-bit block
+ * size and 16-bit rate */
+#define MAX_FRAME_HEADER 16
+/* How far past an estimated offset to look for a frame header */
+#define SCAN_WINDOW (1 << 20)
+
+struct FlacStream {
+    unsigned min_block_size = 0;
+    unsigned max_block_size = 0;
+    unsigned rate = 0;
+    unsigned channels = 0;
+    unsigned bits = 0;
+    uint64_t total_samples = 0;     /* per channel; 0 if unknown */
+    uint8_t md5[16] = {};
+    size_t first_frame = 0;         /* file offset of the first frame */
+    std::vector<uint8_t> header;    /* fLaC + STREAMINFO with the MD5 unset */
+    struct SeekPoint {
+        uint64_t sample;
+        uint64_t offset;            /* from the first frame */
+    };
+    std::vector<SeekPoint> seek_points;
+};
+
+/* Where a chunk starts: a frame and its first sample (per channel) */
+struct FlacBoundary {
+    size_t offset;
+    uint64_t sample;
+};
+
+static uint32_t be(uint8_t const * p, int bytes) {
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint8_t crc8(uint8_t const * p, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= p[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (uint8_t) ((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+static int parse_stream(MappedFile const & file, FlacStream * stream) {
+    uint8_t const * data = file.data();
+    size_t size = file.size();
+
+    size_t pos = 0;
+    if (size >= ID3V2_HEADER_SIZE && memcmp(data, "ID3", 3) == 0) {
+        uint8_t const * h = data + 3;
+        size_t tagSize = ((size_t) (h[3] & 0x7f) << 21) | ((size_t) (h[4] & 0x7f) << 14)
+                | ((size_t) (h[5] & 0x7f) << 7) | (h[6] & 0x7f);
+        pos = ID3V2_HEADER_SIZE + tagSize + ((h[2] & 0x10) ? ID3V2_HEADER_SIZE : 0);
+    }
+    if (pos + 4 > size || memcmp(data + pos, "fLaC", 4) != 0) {
+        return RESULT_ERROR;
+    }
+    pos += 4;
+
+    bool haveInfo = false, last = false;
+    while (!last) {
+        if (pos + METADATA_HEADER_SIZE > size) {
+            return RESULT_ERROR;
+        }
+        last = data[pos] & 0x80;
+        int type = data[pos] & 0x7f;
+        size_t length = be(data + pos + 1, 3);
+        uint8_t const * block = data + pos + METADATA_HEADER_SIZE;
+        pos += METADATA_HEADER_SIZE + length;
+        if (pos > size) {
+            return RESULT_ERROR;
+        }
+
+        if (type == METADATA_STREAMINFO && length == STREAMINFO_SIZE) {
+            stream->min_block_size = be(block, 2);
+            stream->max_block_size = be(block + 2, 2);
+            stream->rate = (block[10] << 12) | (block[11] << 4) | (block[12] >> 4);
+            stream->channels = ((block[12] >> 1) & 7) + 1;
+            stream->bits = (((block[12] & 1) << 4) | (block[13] >> 4)) + 1;
+            stream->total_samples = ((uint64_t) (block[13] & 0x0f) << 32) | be(block + 14, 4);
+            memcpy(stream->md5, block + STREAMINFO_MD5_OFFSET, 16);
+
+            /* The only metadata a chunk needs; without the MD5, which only
+             * holds for the whole stream */
+            uint8_t blockHeader[METADATA_HEADER_SIZE] = {0x80 | METADATA_STREAMINFO, 0, 0, STREAMINFO_SIZE};
+            stream->header.assign((uint8_t const *) "fLaC", (uint8_t const *) "fLaC" + 4);
+            stream->header.insert(stream->header.end(), blockHeader, blockHeader + METADATA_HEADER_SIZE);
+            stream->header.insert(stream->header.end(), block, block + STREAMINFO_SIZE);
+            std::fill(stream->header.end() - 16, stream->header.end(), 0);
+            haveInfo = true;
+        } else if (type == METADATA_SEEKTABLE) {
+            for (size_t i = 0; i + SEEKPOINT_SIZE <= length; i += SEEKPOINT_SIZE) {
+                uint64_t sample = ((uint64_t) be(block + i, 4) << 32) | be(block + i + 4, 4);
+                uint64_t offset = ((uint64_t) be(block + i + 8, 4) << 32) | be(block + i + 12, 4);
+                if (sample != SEEKPOINT_PLACEHOLDER) {
+                    stream->seek_points.push_back({sample, offset});
+                }
+            }
+        }
+    }
+    stream->first_frame = pos;
+
+    if (!haveInfo || stream->total_samples == 0 || stream->rate == 0 || stream->max_block_size == 0) {
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+/* Parses the frame header at p and checks it against the stream; false if
+ * it is not a frame header (or not one of this stream) */
+static bool parse_frame_header(uint8_t const * p, FlacStream const & stream, uint64_t * firstSample) {
+    if (p[0] != 0xff || (p[1] & 0xfe) != 0xf8) {
+        return false;
+    }
+    bool variable = p[1] & 1;
+    int blockCode = p[2] >> 4;
+    int rateCode = p[2] & 0x0f;
+    int channelCode = p[3] >> 4;
+    int bitsCode = (p[3] >> 1) & 7;
+    if (blockCode == 0 || rateCode == 15 || channelCode > 10 || bitsCode == 3 || (p[3] & 1)) {
+        return false;
+    }
+
+    /* Frame or sample number, UTF-8 style */
+    size_t pos = 4;
+    uint8_t x = p[pos++];
+    int extra;
+    uint64_t number;
+    if (!(x & 0x80)) {
+        number = x, extra = 0;
+    } else if ((x & 0xe0) == 0xc0) {
+        number = x & 0x1f, extra = 1;
+    } else if ((x & 0xf0) == 0xe0) {
+        number = x & 0x0f, extra = 2;
+    } else if ((x & 0xf8) == 0xf0) {
+        number = x & 0x07, extra = 3;
+    } else if ((x & 0xfc) == 0xf8) {
+        number = x & 0x03, extra = 4;
+    } else if ((x & 0xfe) == 0xfc) {
+        number = x & 0x01, extra = 5;
+    } else if (x == 0xfe && variable) {
+        number = 0, extra = 6;
+    } else {
+        return false;
+    }
+    for (int i = 0; i < extra; i++, pos++) {
+        if ((p[pos] & 0xc0) != 0x80) {
+            return false;
+        }
+        number = (number << 6) | (p[pos] & 0x3f);
+    }
+
+    unsigned blockSize;
+    if (blockCode == 1) {
+        blockSize = 192;
+    } else if (blockCode <= 5) {
+        blockSize = 576u << (blockCode - 2);
+    } else if (blockCode == 6) {
+        blockSize = p[pos++] + 1;
+    } else if (blockCode == 7) {
+        blockSize = be(p + pos, 2) + 1;
+        pos += 2;
+    } else {
+        blockSize = 256u << (blockCode - 8);
+    }
+
+    static unsigned const rates[12] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+                                       32000, 44100, 48000, 96000};
+    unsigned rate = stream.rate;
+    if (rateCode == 12) {
+        rate = p[pos++] * 1000;
+    } else if (rateCode == 13) {
+        rate = be(p + pos, 2);
+        pos += 2;
+    } else if (rateCode == 14) {
+        rate = be(p + pos, 2) * 10;
+        pos += 2;
+    } else if (rateCode > 0) {
+        rate = rates[rateCode];
+    }
+
+    static unsigned const bits[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    unsigned channels = channelCode < 8 ? channelCode + 1 : 2;
+    unsigned frameBits = bitsCode ? bits[bitsCode] : stream.bits;
+
+    if (crc8(p, pos) != p[pos] || rate != stream.rate || channels != stream.channels
+            || frameBits != stream.bits || blockSize > stream.max_block_size) {
+        return false;
+    }
+    *firstSample = variable ? number : number * stream.max_block_size;
+    return *firstSample < stream.total_samples;
+}
+
+static bool find_frame(MappedFile const & file, FlacStream const & stream, size_t from, size_t to,
+                       FlacBoundary * found) {
+    uint8_t const * data = file.data();
+    to = std::min(to, file.size() - MAX_FRAME_HEADER);
+    while (from < to) {
+        uint8_t const * p = (uint8_t const *) memchr(data + from, 0xff, to - from);
+        if (!p) {
+            return false;
+        }
+        from = p - data;
+        if (parse_frame_header(p, stream, &found->sample)) {
+            found->offset = from;
+            return true;
+        }
+        from++;
+    }
+    return false;
+}
+
+/* The frame starting at a seek point, if the point holds */
+static bool seek_point_frame(MappedFile const & file, FlacStream const & stream,
+                             FlacStream::SeekPoint const & point, FlacBoundary * found) {
+    if (point.offset > file.size() - stream.first_frame - MAX_FRAME_HEADER) {
+        return false;
+    }
+    found->offset = stream.first_frame + point.offset;
+    return parse_frame_header(file.data() + found->offset, stream, &found->sample)
+            && found->sample == point.sample;
+}
+
+static int plan_chunks(MappedFile const & file, FlacStream const & stream, double chunkSeconds,
+                       std::vector<DecodeChunk> * chunks) {
+    if (file.size() < stream.first_frame + MAX_FRAME_HEADER) {
+        return RESULT_ERROR;
+    }
+    std::vector<FlacBoundary> bounds = {{stream.first_frame, 0}};
+    uint64_t firstSample;
+    if (!parse_frame_header(file.data() + stream.first_frame, stream, &firstSample) || firstSample != 0) {
+        return RESULT_ERROR;
+    }
+
+    uint64_t chunkSamples = std::max((uint64_t) stream.max_block_size, (uint64_t) (chunkSeconds * stream.rate));
+    size_t frameBytes = file.size() - stream.first_frame;
+    for (uint64_t target = chunkSamples; target < stream.total_samples; target += chunkSamples) {
+        FlacBoundary const & previous = bounds.back();
+        FlacBoundary found = {};
+        bool ok = false;
+
+        /* The last seek point at or before the target */
+        FlacStream::SeekPoint const * best = NULL;
+        for (FlacStream::SeekPoint const & point : stream.seek_points) {
+            if (point.sample > previous.sample && point.sample <= target) {
+                best = &point;
+            }
+        }
+        if (best) {
+            ok = seek_point_frame(file, stream, *best, &found);
+        }
+        if (!ok) {
+            size_t estimate = stream.first_frame + (size_t) ((double) frameBytes * target / stream.total_samples);
+            ok = find_frame(file, stream, std::max(estimate, previous.offset + 1), estimate + SCAN_WINDOW, &found);
+        }
+        if (ok && found.offset > previous.offset && found.sample > previous.sample) {
+            bounds.push_back(found);
+        }
+    }
+
+    chunks->clear();
+    for (size_t i = 0; i < bounds.size(); i++) {
+        bool last = i + 1 == bounds.size();
+        size_t end = last ? file.size() : bounds[i + 1].offset;
+        uint64_t endSample = last ? stream.total_samples : bounds[i + 1].sample;
+        DecodeChunk chunk;
+        chunk.prefix = &stream.header;
+        chunk.ranges.push_back({bounds[i].offset, end - bounds[i].offset});
+        chunk.samples = (endSample - bounds[i].sample) * stream.channels;
+        chunks->push_back(chunk);
+    }
+    return RESULT_SUCCESS;
+}
+
+/* Feeds samples to the MD5 the way FLAC computes it: each sample as a
+ * little-endian signed integer of the stream's width in whole bytes */
+static void md5_update_samples(Md5 * md5, sox_sample_t const * samples, size_t count, unsigned bits,
+                               std::vector<uint8_t> & bytes) {
+    unsigned width = (bits + 7) / 8;
+    bytes.resize(count * width);
+    uint8_t * p = bytes.data();
+    for (size_t i = 0; i < count; i++) {
+        int32_t v = samples[i] >> (32 - bits);
+        for (unsigned b = 0; b < width; b++) {
+            *p++ = (uint8_t) (v >> (8 * b));
+        }
+    }
+    md5->update(bytes.data(), bytes.size());
+}
+
+int flac_convert_parallel(char const * inPath, char const * outPath, double chunkSeconds,
+                          unsigned threads, RenderReport * report, DecodeObserver const & observer,
+                          unsigned precision) {
+    MappedFile file(inPath);
+    FlacStream stream;
+    std::vector<DecodeChunk> chunks;
+    if (!file.ok() || parse_stream(file, &stream) != RESULT_SUCCESS || stream.bits > 24
+            || plan_chunks(file, stream, chunkSeconds, &chunks) != RESULT_SUCCESS || chunks.size() < 2) {
+        return RESULT_ERROR;
+    }
+
+    static uint8_t const unset[16] = {};
+    bool checkMd5 = memcmp(stream.md5, unset, 16) != 0;
+    Md5 md5;
+    std::vector<uint8_t> bytes;
+    DecodeObserver observe = observer;
+    if (checkMd5) {
+        observe = [&](sox_sample_t const * samples, size_t count) {
+            md5_update_samples(&md5, samples, count, stream.bits, bytes);
+            if (observer) {
+                observer(samples, count);
+            }
+        };
+    }
+
+    int result = parallel_decode_file("flac-parallel", inPath, outPath, file, "flac", chunks,
+                                      std::min(threads, (unsigned) chunks.size()), report, observe, precision);
+    if (result != RESULT_SUCCESS || !checkMd5) {
+        return result;
+    }
+
+    uint8_t digest[16];
+    md5.finish(digest);
+    if (memcmp(digest, stream.md5, 16) != 0) {
+        LOG_E("flac-parallel: MD5 mismatch in %s", inPath);
+        remove(outPath);
+        report->result = RESULT_ERROR;
+        report->error = "STREAMINFO MD5 mismatch";
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
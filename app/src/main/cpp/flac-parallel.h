@@ -0,0 +1,26 @@
+#ifndef SOXTEST_FLAC_PARALLEL_H
+#define SOXTEST_FLAC_PARALLEL_H
+
+#include "parallel-decode.h"
+
+/* Parallel decoding of FLAC files, see parallel-decode.h.
+ *
+ * FLAC frames carry no decoder state across frame boundaries, so a chunk
+ * is just a run of whole frames behind a minimal stream header (fLaC and
+ * STREAMINFO). Chunk boundaries come from the SEEKTABLE where it has a
+ * point near them and otherwise from the first frame header found past an
+ * estimated byte offset; a header only counts when its CRC-8 holds and it
+ * matches STREAMINFO. The sample number in each boundary header tells how
+ * many samples every chunk must decode to.
+ *
+ * After reassembly the decoded samples are checked against the STREAMINFO
+ * MD5 (unless the encoder left it unset). Fails, leaving no output, for
+ * streams of unknown length, when no boundaries can be found or when the
+ * MD5 does not match; the caller then decodes serially. observer and
+ * precision are those of parallel_decode_file(); the observer has seen the
+ * samples by the time the MD5 is checked */
+int flac_convert_parallel(char const * inPath, char const * outPath, double chunkSeconds,
+                          unsigned threads, RenderReport * report, DecodeObserver const & observer = nullptr,
+                          unsigned precision = 0);
+
+#endif //SOXTEST_FLAC_PARALLEL_H
@@ -0,0 +1,48 @@
+#include "job-arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+static std::atomic<bool> arenas_enabled(true);
+
+void JobArena::set_enabled(bool enabled) {
+    arenas_enabled = enabled;
+}
+
+JobArena::JobArena(size_t blockSize) : block_size(blockSize), cursor(NULL), limit(NULL), used(0) {
+}
+
+JobArena::~JobArena() {
+    for (char * block : blocks) {
+        free(block);
+    }
+}
+
+void * JobArena::allocate(size_t size, size_t align) {
+    used += size;
+    if (!arenas_enabled) {
+        char * block = static_cast<char *>(aligned_alloc(align, (size + align - 1) / align * align));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(block);
+        return block;
+    }
+
+    uintptr_t aligned = ((uintptr_t) cursor + align - 1) & ~(uintptr_t) (align - 1);
+    if (!cursor || aligned + size > (uintptr_t) limit) {
+        /* Oversized requests get a block of their own */
+        size_t capacity = size + align > block_size ? size + align : block_size;
+        char * block = static_cast<char *>(malloc(capacity));
+        if (!block) {
+            throw std::bad_alloc();
+        }
+        blocks.push_back(block);
+        cursor = block;
+        limit = block + capacity;
+        aligned = ((uintptr_t) cursor + align - 1) & ~(uintptr_t) (align - 1);
+    }
+    cursor = (char *) (aligned + size);
+    return (void *) aligned;
+}
@@ -0,0 +1,51 @@
+#ifndef SOXTEST_JOB_ARENA_H
+#define SOXTEST_JOB_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/* Bump allocator owning the scratch memory of one render job: telemetry
+ * probe tables, block buffers of the fused pipelines and the like. Memory
+ * is carved from a few large blocks and released in one go when the arena
+ * is destroyed, so a long batch of jobs does not leave small holes behind
+ * in the heap. Only trivially destructible objects may live in an arena.
+ *
+ * libSoX's own allocations (effects, their private data and buffers) are
+ * made inside the library with plain malloc and cannot be redirected */
+class JobArena {
+public:
+    explicit JobArena(size_t blockSize = 64 * 1024);
+    ~JobArena();
+
+    JobArena(JobArena const &) = delete;
+    JobArena & operator=(JobArena const &) = delete;
+
+    void * allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+    /* Value-initialised array of n objects */
+    template<class T>
+    T * allocate_array(size_t n) {
+        T * array = static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; i++) {
+            new (&array[i]) T();
+        }
+        return array;
+    }
+
+    size_t bytes_used() const { return used; }
+    size_t block_count() const { return blocks.size(); }
+
+    /* With arenas disabled every allocate() is its own heap allocation
+     * (still freed with the arena); used to benchmark the difference */
+    static void set_enabled(bool enabled);
+
+private:
+    size_t block_size;
+    std::vector<char *> blocks;
+    char * cursor;
+    char * limit;
+    size_t used;
+};
+
+#endif //SOXTEST_JOB_ARENA_H
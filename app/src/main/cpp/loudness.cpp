@@ -0,0 +1,339 @@
+#include "loudness.h"
+
+#include <algorithm>
+#include <cmath>
+#include "sox-ops.h"
+
+#define SUBBLOCK_SECONDS 0.1
+#define MOMENTARY_SUBBLOCKS 4
+#define ABSOLUTE_GATE_LUFS -70.0
+#define INTEGRATED_RELATIVE_GATE_LU -10.0
+#define RANGE_RELATIVE_GATE_LU -20.0
+#define RANGE_LOW_PERCENTILE 0.10
+#define RANGE_HIGH_PERCENTILE 0.95
+/* 0.1 LU from the absolute gate up to +30 LUFS */
+#define HISTOGRAM_BINS 1000
+#define HISTOGRAM_STEP 0.1
+/* Keeps the filter states off denormals in silence; removed again by the
+ * high pass */
+#define ANTI_DENORMAL 1e-20
+
+static double loudness_of(double energy) {
+    return energy > 0 ? std::max(LOUDNESS_SILENCE, -0.691 + 10 * std::log10(energy)) : LOUDNESS_SILENCE;
+}
+
+/* BS.1770 channel weights in the WAV/SMPTE order L R C LFE Ls Rs */
+static double channel_weight(unsigned channel, unsigned channels) {
+    if (channels == 6) {
+        static double const weights[] = {1.0, 1.0, 1.0, 0.0, 1.41, 1.41};
+        return weights[channel];
+    }
+    return 1.0;
+}
+
+/* Coefficients of BS.1770's K-weighting at any rate, from the analog
+ * prototypes of the 48 kHz filters given in the standard */
+static void k_weighting(double rate, LoudnessMeter * meter) {
+    double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+    double k = std::tan(M_PI * f0 / rate);
+    double vh = std::pow(10.0, gain / 20.0);
+    double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    meter->shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+    meter->shelf_b[1] = 2.0 * (k * k - vh) / a0;
+    meter->shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+    meter->shelf_a[0] = 1.0;
+    meter->shelf_a[1] = 2.0 * (k * k - 1.0) / a0;
+    meter->shelf_a[2] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = std::tan(M_PI * f0 / rate);
+    a0 = 1.0 + k / q + k * k;
+    meter->highpass_b[0] = 1.0;
+    meter->highpass_b[1] = -2.0;
+    meter->highpass_b[2] = 1.0;
+    meter->highpass_a[0] = 1.0;
+    meter->highpass_a[1] = 2.0 * (k * k - 1.0) / a0;
+    meter->highpass_a[2] = (1.0 - k / q + k * k) / a0;
+}
+
+/* Hann-windowed sinc interpolator, one lane per phase, each phase
+ * normalised to unity gain at DC */
+static void true_peak_filter(unsigned oversample, f32x4 * phases) {
+    unsigned taps = LOUDNESS_TRUE_PEAK_TAPS * oversample;
+    double center = (taps - 1) / 2.0;
+    for (unsigned p = 0; p < 4; p++) {
+        double sum = 0;
+        double h[LOUDNESS_TRUE_PEAK_TAPS] = {};
+        for (unsigned k = 0; k < LOUDNESS_TRUE_PEAK_TAPS && p < oversample; k++) {
+            unsigned n = k * oversample + p;
+            double t = (n - center) / oversample;
+            double sinc = t == 0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+            double window = 0.5 - 0.5 * std::cos(2 * M_PI * (n + 1) / (taps + 1));
+            h[k] = sinc * window;
+            sum += h[k];
+        }
+        for (unsigned k = 0; k < LOUDNESS_TRUE_PEAK_TAPS; k++) {
+            phases[k][p] = sum != 0 ? (float) (h[k] / sum) : 0.0f;
+        }
+    }
+}
+
+int loudness_meter_init(LoudnessMeter * meter, double rate, unsigned channels) {
+    *meter = LoudnessMeter();
+    if (rate <= 0 || channels == 0) {
+        return RESULT_ERROR;
+    }
+    meter->rate = rate;
+    meter->channels = channels;
+    meter->lanes = (channels + 1) / 2;
+    k_weighting(rate, meter);
+    meter->weights.resize(meter->lanes);
+    for (unsigned lane = 0; lane < meter->lanes; lane++) {
+        unsigned c = 2 * lane;
+        meter->weights[lane] = f64x2{channel_weight(c, channels),
+                                     c + 1 < channels ? channel_weight(c + 1, channels) : 0.0};
+    }
+    meter->state.assign(4 * meter->lanes, f64x2{0, 0});
+    meter->energy.assign(meter->lanes, f64x2{0, 0});
+    meter->subblock_frames = std::max<uint64_t>(1, (uint64_t) std::llround(rate * SUBBLOCK_SECONDS));
+    meter->block_counts.assign(HISTOGRAM_BINS, 0);
+    meter->block_energy.assign(HISTOGRAM_BINS, 0);
+    meter->short_term_counts.assign(HISTOGRAM_BINS, 0);
+    meter->short_term_energy.assign(HISTOGRAM_BINS, 0);
+
+    meter->oversample = rate < 96000 ? 4 : rate < 192000 ? 2 : 1;
+    if (meter->oversample > 1) {
+        true_peak_filter(meter->oversample, meter->phases);
+    }
+    meter->history.assign(2 * LOUDNESS_TRUE_PEAK_TAPS * channels, 0.0f);
+    return RESULT_SUCCESS;
+}
+
+static void count_block(double energy, std::vector<uint64_t> & counts, std::vector<double> & energies) {
+    double lufs = loudness_of(energy);
+    if (lufs < ABSOLUTE_GATE_LUFS) {
+        return;
+    }
+    size_t bin = std::min<size_t>(HISTOGRAM_BINS - 1,
+                                  (size_t) ((lufs - ABSOLUTE_GATE_LUFS) / HISTOGRAM_STEP));
+    counts[bin]++;
+    energies[bin] += energy;
+}
+
+/* Mean of the last n sub-blocks */
+static double recent_energy(LoudnessMeter const & meter, unsigned n) {
+    double sum = 0;
+    for (unsigned i = 1; i <= n; i++) {
+        sum += meter.subblocks[(meter.subblocks_done - i) % LOUDNESS_SHORT_TERM_SUBBLOCKS];
+    }
+    return sum / n;
+}
+
+static void end_subblock(LoudnessMeter * meter) {
+    double energy = 0;
+    for (f64x2 & lane : meter->energy) {
+        energy += lane[0] + lane[1];
+        lane = f64x2{0, 0};
+    }
+    meter->subblocks[meter->subblocks_done % LOUDNESS_SHORT_TERM_SUBBLOCKS] = energy / meter->subblock_frames;
+    meter->subblocks_done++;
+    meter->subblock_pos = 0;
+
+    if (meter->subblocks_done >= MOMENTARY_SUBBLOCKS) {
+        double momentary = recent_energy(*meter, MOMENTARY_SUBBLOCKS);
+        meter->momentary_max = std::max(meter->momentary_max, momentary);
+        count_block(momentary, meter->block_counts, meter->block_energy);
+    }
+    if (meter->subblocks_done >= LOUDNESS_SHORT_TERM_SUBBLOCKS) {
+        double shortTerm = recent_energy(*meter, LOUDNESS_SHORT_TERM_SUBBLOCKS);
+        meter->short_term_max = std::max(meter->short_term_max, shortTerm);
+        count_block(shortTerm, meter->short_term_counts, meter->short_term_energy);
+    }
+}
+
+static void add_true_peak(LoudnessMeter * meter, sox_sample_t const * samples, size_t frames) {
+    float const scale = 1.0f / 2147483648.0f;
+    unsigned channels = meter->channels;
+    float samplePeak = meter->sample_peak;
+    f32x4 peak = meter->true_peak;
+    for (unsigned c = 0; c < channels; c++) {
+        float * history = &meter->history[c * 2 * LOUDNESS_TRUE_PEAK_TAPS];
+        unsigned pos = meter->history_pos;
+        for (size_t i = 0; i < frames; i++) {
+            float x = samples[i * channels + c] * scale;
+            samplePeak = std::max(samplePeak, std::fabs(x));
+            if (meter->oversample == 1) {
+                continue;
+            }
+            /* Doubled, so that the newest taps are contiguous: x[n - k]
+             * is history[pos + taps - k] */
+            history[pos] = history[pos + LOUDNESS_TRUE_PEAK_TAPS] = x;
+            float const * window = history + pos + LOUDNESS_TRUE_PEAK_TAPS;
+            f32x4 acc = meter->phases[0] * window[0];
+            for (unsigned k = 1; k < LOUDNESS_TRUE_PEAK_TAPS; k++) {
+                acc += meter->phases[k] * window[-(int) k];
+            }
+            peak = f32x4_max(peak, f32x4_abs(acc));
+            pos = pos + 1 == LOUDNESS_TRUE_PEAK_TAPS ? 0 : pos + 1;
+        }
+    }
+    meter->history_pos = (unsigned) ((meter->history_pos + frames) % LOUDNESS_TRUE_PEAK_TAPS);
+    meter->sample_peak = samplePeak;
+    meter->true_peak = peak;
+}
+
+void loudness_meter_add(LoudnessMeter * meter, sox_sample_t const * samples, size_t count) {
+    unsigned channels = meter->channels;
+    size_t frames = count / channels;
+    double const scale = 1.0 / 2147483648.0;
+    f64x2 sb0 = f64x2_splat(meter->shelf_b[0]), sb1 = f64x2_splat(meter->shelf_b[1]);
+    f64x2 sb2 = f64x2_splat(meter->shelf_b[2]);
+    f64x2 sa1 = f64x2_splat(meter->shelf_a[1]), sa2 = f64x2_splat(meter->shelf_a[2]);
+    f64x2 ha1 = f64x2_splat(meter->highpass_a[1]), ha2 = f64x2_splat(meter->highpass_a[2]);
+
+    for (size_t i = 0; i < frames; i++) {
+        sox_sample_t const * frame = samples + i * channels;
+        for (unsigned lane = 0; lane < meter->lanes; lane++) {
+            unsigned c = 2 * lane;
+            f64x2 x = {frame[c] * scale + ANTI_DENORMAL,
+                       c + 1 < channels ? frame[c + 1] * scale + ANTI_DENORMAL : 0.0};
+            /* Both stages in transposed direct form II; the high pass has
+             * b = {1, -2, 1} */
+            f64x2 * s = &meter->state[4 * lane];
+            f64x2 y = sb0 * x + s[0];
+            s[0] = sb1 * x - sa1 * y + s[1];
+            s[1] = sb2 * x - sa2 * y;
+            f64x2 z = y + s[2];
+            s[2] = -2.0 * y - ha1 * z + s[3];
+            s[3] = y - ha2 * z;
+            meter->energy[lane] += meter->weights[lane] * z * z;
+        }
+        if (++meter->subblock_pos == meter->subblock_frames) {
+            end_subblock(meter);
+        }
+    }
+    add_true_peak(meter, samples, frames);
+    meter->frames += frames;
+}
+
+/* Mean energy of the blocks of the histogram at or above gate */
+static double gated_energy(std::vector<uint64_t> const & counts, std::vector<double> const & energies,
+                           double gateLufs, uint64_t * blocks) {
+    double sum = 0;
+    *blocks = 0;
+    for (size_t bin = 0; bin < counts.size(); bin++) {
+        if (counts[bin] > 0 && loudness_of(energies[bin] / counts[bin]) >= gateLufs) {
+            sum += energies[bin];
+            *blocks += counts[bin];
+        }
+    }
+    return *blocks > 0 ? sum / *blocks : 0;
+}
+
+/* Loudness at the given fraction of the blocks at or above gate */
+static double percentile_lufs(std::vector<uint64_t> const & counts, std::vector<double> const & energies,
+                              double gateLufs, uint64_t blocks, double fraction) {
+    uint64_t rank = (uint64_t) std::llround(fraction * (blocks - 1));
+    uint64_t seen = 0;
+    for (size_t bin = 0; bin < counts.size(); bin++) {
+        if (counts[bin] == 0 || loudness_of(energies[bin] / counts[bin]) < gateLufs) {
+            continue;
+        }
+        seen += counts[bin];
+        if (seen > rank) {
+            return ABSOLUTE_GATE_LUFS + (bin + 0.5) * HISTOGRAM_STEP;
+        }
+    }
+    return LOUDNESS_SILENCE;
+}
+
+void loudness_meter_finish(LoudnessMeter const & meter, LoudnessReport * report) {
+    *report = LoudnessReport();
+    report->measured = meter.channels > 0;
+    report->frames = meter.frames;
+
+    uint64_t blocks;
+    double ungated = gated_energy(meter.block_counts, meter.block_energy, ABSOLUTE_GATE_LUFS, &blocks);
+    if (blocks > 0) {
+        double gate = loudness_of(ungated) + INTEGRATED_RELATIVE_GATE_LU;
+        report->integrated_lufs = loudness_of(gated_energy(meter.block_counts, meter.block_energy, gate, &blocks));
+    }
+
+    ungated = gated_energy(meter.short_term_counts, meter.short_term_energy, ABSOLUTE_GATE_LUFS, &blocks);
+    if (blocks > 0) {
+        double gate = loudness_of(ungated) + RANGE_RELATIVE_GATE_LU;
+        gated_energy(meter.short_term_counts, meter.short_term_energy, gate, &blocks);
+        if (blocks > 0) {
+            report->range_lu = percentile_lufs(meter.short_term_counts, meter.short_term_energy, gate, blocks,
+                                               RANGE_HIGH_PERCENTILE)
+                    - percentile_lufs(meter.short_term_counts, meter.short_term_energy, gate, blocks,
+                                      RANGE_LOW_PERCENTILE);
+        }
+    }
+
+    report->momentary_max_lufs = loudness_of(meter.momentary_max);
+    report->short_term_max_lufs = loudness_of(meter.short_term_max);
+    float truePeak = std::max(f32x4_hmax(meter.true_peak), meter.sample_peak);
+    report->true_peak_dbtp = truePeak > 0 ? 20 * std::log10(truePeak) : LOUDNESS_SILENCE;
+    report->sample_peak_dbfs = meter.sample_peak > 0 ? 20 * std::log10(meter.sample_peak) : LOUDNESS_SILENCE;
+}
+
+double loudness_gain_db(LoudnessReport const & report, double targetLufs, double maxTruePeakDbtp) {
+    if (!report.measured || report.integrated_lufs <= LOUDNESS_SILENCE) {
+        return 0;
+    }
+    double gain = targetLufs - report.integrated_lufs;
+    if (report.true_peak_dbtp > LOUDNESS_SILENCE) {
+        gain = std::min(gain, maxTruePeakDbtp - report.true_peak_dbtp);
+    }
+    return gain;
+}
+
+static double shifted(double level, double gainDb) {
+    return level > LOUDNESS_SILENCE ? level + gainDb : level;
+}
+
+LoudnessReport loudness_after_gain(LoudnessReport const & report, double gainDb) {
+    LoudnessReport out = report;
+    out.integrated_lufs = shifted(report.integrated_lufs, gainDb);
+    out.momentary_max_lufs = shifted(report.momentary_max_lufs, gainDb);
+    out.short_term_max_lufs = shifted(report.short_term_max_lufs, gainDb);
+    out.true_peak_dbtp = shifted(report.true_peak_dbtp, gainDb);
+    out.sample_peak_dbfs = shifted(report.sample_peak_dbfs, gainDb);
+    return out;
+}
+
+static int LSX_API tap_start(sox_effect_t * effp) {
+    LoudnessMeter * meter = *(LoudnessMeter **) effp->priv;
+    return loudness_meter_init(meter, effp->in_signal.rate, effp->in_signal.channels) == RESULT_SUCCESS
+            ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int LSX_API tap_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * obuf,
+                            size_t * isamp, size_t * osamp) {
+    LoudnessMeter * meter = *(LoudnessMeter **) effp->priv;
+    size_t len = std::min(*isamp, *osamp);
+    len -= len % meter->channels;
+    std::copy(ibuf, ibuf + len, obuf);
+    loudness_meter_add(meter, ibuf, len);
+    *isamp = *osamp = len;
+    return SOX_SUCCESS;
+}
+
+static sox_effect_handler_t const * tap_handler() {
+    static sox_effect_handler_t handler = {
+            LOUDNESS_EFFECT, NULL, SOX_EFF_MCHAN | SOX_EFF_MODIFY, NULL, tap_start, tap_flow, NULL, NULL, NULL,
+            sizeof(LoudnessMeter *)
+    };
+    return &handler;
+}
+
+sox_effect_t * loudness_tap_create(LoudnessMeter * meter) {
+    sox_effect_t * e = sox_create_effect(tap_handler());
+    if (e) {
+        *(LoudnessMeter **) e->priv = meter;
+    }
+    return e;
+}
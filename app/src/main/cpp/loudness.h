@@ -0,0 +1,102 @@
+#ifndef SOXTEST_LOUDNESS_H
+#define SOXTEST_LOUDNESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "simd.h"
+#include "sox.h"
+
+/* EBU R128 loudness measured while a render flows.
+ *
+ * A tap effect (LOUDNESS_EFFECT in an EffectSpec list, see sox_render())
+ * passes the samples through unchanged and feeds them to a meter after
+ * ITU-R BS.1770-4: K-weighting, 400 ms momentary and 3 s short-term
+ * blocks every 100 ms, the gated integrated loudness, the loudness range
+ * of EBU Tech 3342 and the true peak of a 4x (2x at 96 kHz and up)
+ * oversampled signal. The results come back in the render report, so a
+ * measurement costs no pass over the file of its own.
+ *
+ * The K-weighting filters run on channel pairs and the oversampling FIR
+ * on its four phases at once (simd.h). Gating blocks are counted into
+ * histograms of 0.1 LU, so the meter takes constant memory however long
+ * the render; the integrated loudness and the range are exact to within
+ * that resolution */
+
+#define LOUDNESS_EFFECT "loudness"
+
+/* Reported for silence: below any gate or level there is */
+#define LOUDNESS_SILENCE -144.0
+
+struct LoudnessReport {
+    bool measured = false;
+    uint64_t frames = 0;
+    double integrated_lufs = LOUDNESS_SILENCE;
+    double range_lu = 0;
+    double momentary_max_lufs = LOUDNESS_SILENCE;
+    double short_term_max_lufs = LOUDNESS_SILENCE;
+    double true_peak_dbtp = LOUDNESS_SILENCE;
+    double sample_peak_dbfs = LOUDNESS_SILENCE;
+};
+
+#define LOUDNESS_SHORT_TERM_SUBBLOCKS 30
+#define LOUDNESS_TRUE_PEAK_TAPS 12   /* per phase */
+
+/* State of one measurement; set up with loudness_meter_init() */
+struct LoudnessMeter {
+    double rate = 0;
+    unsigned channels = 0;
+    unsigned lanes = 0;               /* channel pairs */
+    uint64_t frames = 0;
+
+    /* K-weighting: the pre-filter shelf and the RLB high pass */
+    double shelf_b[3] = {}, shelf_a[3] = {};
+    double highpass_b[3] = {}, highpass_a[3] = {};
+    std::vector<f64x2> weights;       /* of the channels, per lane    */
+    std::vector<f64x2> state;         /* 4 per lane                   */
+    std::vector<f64x2> energy;        /* of the current 100 ms        */
+
+    uint64_t subblock_frames = 0;
+    uint64_t subblock_pos = 0;
+    uint64_t subblocks_done = 0;
+    double subblocks[LOUDNESS_SHORT_TERM_SUBBLOCKS] = {};
+    double momentary_max = 0;         /* mean square energies */
+    double short_term_max = 0;
+
+    /* Gating blocks above the absolute gate, by loudness */
+    std::vector<uint64_t> block_counts;
+    std::vector<double> block_energy;
+    std::vector<uint64_t> short_term_counts;
+    std::vector<double> short_term_energy;
+
+    unsigned oversample = 1;
+    f32x4 phases[LOUDNESS_TRUE_PEAK_TAPS] = {};
+    std::vector<float> history;       /* 2 * taps per channel */
+    unsigned history_pos = 0;
+    f32x4 true_peak = {};
+    float sample_peak = 0;
+};
+
+int loudness_meter_init(LoudnessMeter * meter, double rate, unsigned channels);
+/* Interleaved samples, whole frames */
+void loudness_meter_add(LoudnessMeter * meter, sox_sample_t const * samples, size_t count);
+void loudness_meter_finish(LoudnessMeter const & meter, LoudnessReport * report);
+
+/* Ceiling of normalisation, as EBU R128 recommends for distribution */
+#define LOUDNESS_MAX_TRUE_PEAK -1.0
+
+/* Gain bringing the integrated loudness to targetLufs, held back so the
+ * true peak stays at or under maxTruePeakDbtp; 0 for silence or a report
+ * that was not measured */
+double loudness_gain_db(LoudnessReport const & report, double targetLufs,
+                        double maxTruePeakDbtp = LOUDNESS_MAX_TRUE_PEAK);
+/* The statistics of the audio after a gain that does not clip: the levels
+ * move by it and the range stays. Blocks crossing the absolute gate on the
+ * way are not accounted for, which only matters near silence */
+LoudnessReport loudness_after_gain(LoudnessReport const & report, double gainDb);
+
+/* The tap; initialises the meter for the signal at its place in the chain.
+ * The meter is owned by the caller for the length of the flow */
+sox_effect_t * loudness_tap_create(LoudnessMeter * meter);
+
+#endif //SOXTEST_LOUDNESS_H
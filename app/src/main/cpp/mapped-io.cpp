@@ -0,0 +1,198 @@
+#include "mapped-io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "native-log.h"
+#include "sox-ops.h"
+
+/* Room for libSoX's WAV header, extensible format and all */
+#define WAV_HEADER_BOUND 4096
+
+static std::atomic<bool> enabled(true);
+
+MappedFile::MappedFile(char const * path, int advice) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void * p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            data_ = (uint8_t *) p;
+            size_ = (size_t) st.st_size;
+            if (advice != MADV_NORMAL) {
+                madvise(p, size_, advice);
+            }
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        munmap(data_, size_);
+    }
+}
+
+void mapped_io_set_enabled(bool value) {
+    enabled = value;
+}
+
+bool mapped_io_enabled() {
+    return enabled;
+}
+
+static bool is_wav(char const * path, char const * filetype) {
+    if (filetype) {
+        return strcmp(filetype, "wav") == 0;
+    }
+    size_t length = strlen(path);
+    return length >= 4 && strcasecmp(path + length - 4, ".wav") == 0;
+}
+
+MappedInput::~MappedInput() {
+    delete file_;
+}
+
+sox_format_t * MappedInput::open(char const * path, sox_signalinfo_t const * signal, char const * filetype) {
+    if (enabled && !file_ && is_wav(path, filetype)) {
+        file_ = new MappedFile(path, MADV_SEQUENTIAL);
+        sox_format_t * in = file_->ok()
+                ? sox_open_mem_read((void *) file_->data(), file_->size(), signal, NULL, "wav") : NULL;
+        if (in) {
+            /* The memory stream seeks, but has no descriptor for libSoX to
+             * find that out from */
+            in->seekable = sox_true;
+            return in;
+        }
+        delete file_;
+        file_ = NULL;
+    }
+    return sox_open_read(path, signal, NULL, filetype);
+}
+
+MappedAudio::MappedAudio(char const * path) : file_(path, MADV_RANDOM) {
+    if (!file_.ok() || sox_runtime_init() != RESULT_SUCCESS) {
+        return;
+    }
+    sox_format_t * in = sox_open_mem_read((void *) file_.data(), file_.size(), NULL, NULL, "wav");
+    if (!in) {
+        return;
+    }
+    uint64_t offset = in->data_start;
+    if (in->encoding.encoding == SOX_ENCODING_SIGN2 && in->encoding.bits_per_sample == 32
+            && in->encoding.reverse_bytes != sox_option_yes && offset % sizeof(sox_sample_t) == 0
+            && in->signal.length != SOX_UNKNOWN_LEN
+            && offset + in->signal.length * sizeof(sox_sample_t) <= file_.size()) {
+        view_.signal = in->signal;
+        view_.samples = (sox_sample_t const *) (file_.data() + offset);
+        view_.count = in->signal.length;
+    } else {
+        LOG_E("Not a 32-bit WAV to map: %s", path);
+    }
+    sox_close(in);
+}
+
+MappedOutput::~MappedOutput() {
+    unmap();
+}
+
+void MappedOutput::unmap() {
+    if (data_) {
+        munmap(data_, capacity_);
+        data_ = NULL;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+sox_format_t * MappedOutput::open(char const * path, sox_signalinfo_t const * signal, char const * filetype,
+                                  uint64_t capacity) {
+    if (enabled && !data_ && capacity > 0 && capacity <= SIZE_MAX && is_wav(path, filetype)) {
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        void * p = MAP_FAILED;
+        if (fd_ >= 0 && ftruncate(fd_, (off_t) capacity) == 0) {
+            p = mmap(NULL, (size_t) capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        }
+        if (p != MAP_FAILED) {
+            data_ = (uint8_t *) p;
+            capacity_ = (size_t) capacity;
+            madvise(p, capacity_, MADV_SEQUENTIAL);
+            sox_format_t * out = sox_open_mem_write(data_, capacity_, signal, NULL, "wav", NULL);
+            if (out) {
+                /* Seekable, so that libSoX writes the final header on close */
+                out->seekable = sox_true;
+                return out;
+            }
+        }
+        LOG_E("mapped output: cannot map %s, writing it through stdio", path);
+        unmap();
+    }
+    return sox_open_write(path, signal, NULL, filetype, NULL, NULL);
+}
+
+int MappedOutput::close(sox_format_t * out) {
+    if (!data_) {
+        return sox_close(out) == SOX_SUCCESS ? RESULT_SUCCESS : RESULT_ERROR;
+    }
+    FILE * fp = (FILE *) out->fp;
+    fflush(fp);
+    uint64_t end = (uint64_t) ftello(fp);
+    /* The memory stream keeps a byte for its terminating null */
+    full_ = end + 1 >= capacity_;
+    int result = sox_close(out) == SOX_SUCCESS ? RESULT_SUCCESS : RESULT_ERROR;
+
+    /* The RIFF size of the final header covers everything but its own
+     * 8 bytes, a pad byte included */
+    uint64_t length = end;
+    if (memcmp(data_, "RIFF", 4) == 0) {
+        uint32_t riff = data_[4] | data_[5] << 8 | data_[6] << 16 | (uint32_t) data_[7] << 24;
+        if (riff + 8ull <= capacity_ && riff + 8ull >= end) {
+            length = riff + 8ull;
+        }
+    }
+    munmap(data_, capacity_);
+    data_ = NULL;
+    if (ftruncate(fd_, (off_t) length) != 0) {
+        result = RESULT_ERROR;
+    }
+    unmap();
+    return result;
+}
+
+int MappedOutput::sync(sox_format_t * out, uint64_t * end) {
+    FILE * fp = (FILE *) out->fp;
+    if (fflush(fp) != 0) {
+        return RESULT_ERROR;
+    }
+    off_t offset = ftello(fp);
+    if (offset < 0) {
+        return RESULT_ERROR;
+    }
+    /* The mapping starts at the start of the file, so the offset into the
+     * memory stream is the offset into the file */
+    *end = (uint64_t) offset;
+    if (!data_) {
+        return fsync(fileno(fp)) == 0 ? RESULT_SUCCESS : RESULT_ERROR;
+    }
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t length = std::min(capacity_, ((size_t) offset + page - 1) / page * page);
+    if (msync(data_, length, MS_SYNC) != 0 || fsync(fd_) != 0) {
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+uint64_t mapped_wav_bound(sox_signalinfo_t const & signal, uint64_t samples) {
+    unsigned bytes = signal.precision > 0 && signal.precision <= 16 ? 2
+            : signal.precision > 0 && signal.precision <= 24 ? 3 : 4;
+    return WAV_HEADER_BOUND + samples * bytes;
+}
@@ -0,0 +1,112 @@
+#ifndef SOXTEST_MAPPED_IO_H
+#define SOXTEST_MAPPED_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/mman.h>
+#include "sox-ops.h"
+#include "sox.h"
+
+/* WAV intermediates through memory mappings.
+ *
+ * The intermediates a render reads are mapped with MADV_SEQUENTIAL and
+ * handed to libSoX with sox_open_mem_read(), so the reads come from the
+ * page cache without a read() per buffer; the kernel reads ahead and drops
+ * the pages behind. The WAVs a render writes go to a shared mapping of a
+ * file pre-sized to a bound on the output (sox_open_mem_write()) that is
+ * trimmed to the written length on close. Other formats and outputs of
+ * unknown length take libSoX's own stdio path */
+
+/* Read-only mapping of a whole file */
+class MappedFile {
+public:
+    /* advice is passed to madvise(), e.g. MADV_SEQUENTIAL for one pass */
+    explicit MappedFile(char const * path, int advice = MADV_NORMAL);
+    ~MappedFile();
+    MappedFile(MappedFile const &) = delete;
+    MappedFile & operator=(MappedFile const &) = delete;
+
+    bool ok() const { return data_ != NULL; }
+    uint8_t const * data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    uint8_t * data_ = NULL;
+    size_t size_ = 0;
+};
+
+/* On by default; off, every file goes through stdio (for the benchmarks) */
+void mapped_io_set_enabled(bool enabled);
+bool mapped_io_enabled();
+
+/* Opens an input as sox_open_read() does; a WAV file is read from a
+ * sequential mapping, which must outlive the returned format: sox_close()
+ * it before the MappedInput goes away */
+class MappedInput {
+public:
+    MappedInput() = default;
+    ~MappedInput();
+    MappedInput(MappedInput const &) = delete;
+    MappedInput & operator=(MappedInput const &) = delete;
+
+    sox_format_t * open(char const * path, sox_signalinfo_t const * signal = NULL,
+                        char const * filetype = NULL);
+    bool mapped() const { return file_ != NULL; }
+
+private:
+    MappedFile * file_ = NULL;
+};
+
+/* Opens an output as sox_open_write() does; a WAV file with a bound on its
+ * size in bytes (capacity, 0 if there is none) is written to a mapping of
+ * the file pre-sized to it. Close the format with close(), not sox_close().
+ * A write past the capacity fails like a full disk */
+class MappedOutput {
+public:
+    MappedOutput() = default;
+    ~MappedOutput();
+    MappedOutput(MappedOutput const &) = delete;
+    MappedOutput & operator=(MappedOutput const &) = delete;
+
+    sox_format_t * open(char const * path, sox_signalinfo_t const * signal, char const * filetype,
+                        uint64_t capacity);
+    /* Closes out and trims the file to the WAV's length */
+    int close(sox_format_t * out);
+    /* Puts what was written to out so far on the storage, mapped or not,
+     * and gives its end as an offset into the file */
+    int sync(sox_format_t * out, uint64_t * end);
+    bool mapped() const { return data_ != NULL; }
+    /* True once the writes reached the capacity, i.e. the bound was wrong */
+    bool full() const { return full_; }
+
+private:
+    void unmap();
+
+    int fd_ = -1;
+    uint8_t * data_ = NULL;
+    size_t capacity_ = 0;
+    bool full_ = false;
+};
+
+/* The samples of a 32-bit WAV, e.g. a session stage, in place: a mapping
+ * for random reads that the view points into, so nothing is copied to
+ * memory of the process. Fails for WAVs with other encodings */
+class MappedAudio {
+public:
+    explicit MappedAudio(char const * path);
+    MappedAudio(MappedAudio const &) = delete;
+    MappedAudio & operator=(MappedAudio const &) = delete;
+
+    bool ok() const { return view_.samples != NULL; }
+    AudioView const & view() const { return view_; }
+
+private:
+    MappedFile file_;
+    AudioView view_;
+};
+
+/* Bytes of a WAV of the given signal, precision and length in samples (all
+ * channels) written by libSoX, plus a margin for the header */
+uint64_t mapped_wav_bound(sox_signalinfo_t const & signal, uint64_t samples);
+
+#endif //SOXTEST_MAPPED_IO_H
@@ -0,0 +1,23 @@
+#ifndef SOXTEST_MD5_H
+#define SOXTEST_MD5_H
+
+#include <cstddef>
+#include <cstdint>
+
+/* MD5 (RFC 1321), for checking decoded audio against the signature FLAC
+ * keeps in its STREAMINFO block */
+class Md5 {
+public:
+    Md5();
+    void update(void const * data, size_t size);
+    void finish(uint8_t digest[16]);
+
+private:
+    void transform(uint8_t const block[64]);
+
+    uint32_t state_[4];
+    uint64_t bytes_ = 0;
+    uint8_t buffer_[64];
+};
+
+#endif //SOXTEST_MD5_H
@@ -0,0 +1,60 @@
+#include "memory-budget.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+
+/* Reading /proc costs a few microseconds; the flow callback runs after
+ * every buffer */
+#define CHECK_INTERVAL_MS 20
+
+static std::atomic<uint64_t> default_budget(0);
+
+void memory_budget_set(uint64_t bytes) {
+    default_budget = bytes;
+}
+
+uint64_t memory_budget_get() {
+    return default_budget;
+}
+
+uint64_t memory_rss_bytes() {
+    FILE * f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long long size = 0, resident = 0;
+    int fields = fscanf(f, "%llu %llu", &size, &resident);
+    fclose(f);
+    return fields == 2 ? resident * (uint64_t) sysconf(_SC_PAGESIZE) : 0;
+}
+
+static double now_ms() {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void memory_watch_start(MemoryWatch * watch, uint64_t budget) {
+    *watch = MemoryWatch();
+    watch->budget = budget;
+    watch->baseline = watch->peak = memory_rss_bytes();
+    watch->next_check_ms = now_ms() + CHECK_INTERVAL_MS;
+}
+
+bool memory_watch_check(MemoryWatch * watch) {
+    double now = now_ms();
+    if (now < watch->next_check_ms) {
+        return !watch->exceeded;
+    }
+    watch->next_check_ms = now + CHECK_INTERVAL_MS;
+
+    uint64_t rss = memory_rss_bytes();
+    if (rss > watch->peak) {
+        watch->peak = rss;
+    }
+    if (watch->budget > 0 && rss > watch->baseline + watch->budget) {
+        watch->exceeded = true;
+    }
+    return !watch->exceeded;
+}
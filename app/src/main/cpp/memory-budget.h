@@ -0,0 +1,38 @@
+#ifndef SOXTEST_MEMORY_BUDGET_H
+#define SOXTEST_MEMORY_BUDGET_H
+
+#include <cstdint>
+
+/* Per-job memory budget. The effects the app runs all stream: their
+ * buffers do not grow with the length of the input (`reverse' spools to
+ * a temporary file under sox_globals.tmp_path, not to memory). The budget
+ * is the guard for anything that breaks this: sox_render() samples the
+ * resident set size while the chain flows and stops the job with an error
+ * once it has grown by more than the budget since the job started, well
+ * before the low memory killer would step in.
+ *
+ * RSS is per process, so with renders running side by side a job may be
+ * charged for another's growth; the budget is meant as a ceiling, not as
+ * an accounting tool */
+
+/* Process-wide default for jobs that set none; 0 (the default) disables it */
+void memory_budget_set(uint64_t bytes);
+uint64_t memory_budget_get();
+
+/* Resident set size of the process; 0 where /proc is unavailable */
+uint64_t memory_rss_bytes();
+
+struct MemoryWatch {
+    uint64_t budget = 0;
+    uint64_t baseline = 0;   /* RSS when the job started */
+    uint64_t peak = 0;
+    double next_check_ms = 0;
+    bool exceeded = false;
+};
+
+void memory_watch_start(MemoryWatch * watch, uint64_t budget);
+
+/* Samples the RSS (at most every few ms); false once over budget */
+bool memory_watch_check(MemoryWatch * watch);
+
+#endif //SOXTEST_MEMORY_BUDGET_H
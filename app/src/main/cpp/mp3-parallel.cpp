@@ -0,0 +1,180 @@
+#include "mp3-parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include "sox-ops.h"
+
+#define ID3V2_HEADER_SIZE 10
+#define MAX_RESERVOIR_BYTES 511
+/* Frames decoded ahead of a chunk besides the reservoir: one for the IMDCT
+ * overlap, one for the synthesis filterbank history */
+#define OVERLAP_FRAMES 2
+
+struct Mp3Frame {
+    int version;      /* 3: MPEG-1, 2: MPEG-2, 0: MPEG-2.5 */
+    int layer;        /* 1, 2 or 3 */
+    unsigned rate;
+    unsigned channels;
+    unsigned samples; /* per channel */
+    size_t size;      /* bytes, header included */
+    size_t side_info; /* bytes of header, CRC and side information */
+};
+
+static unsigned const bitrates[2][3][15] = {
+    {   /* MPEG-1 */
+        {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+        {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}
+    },
+    {   /* MPEG-2 and 2.5 */
+        {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+        {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}
+    }
+};
+
+static unsigned const sample_rates[3] = {44100, 48000, 32000};
+
+/* Parses the 4-byte frame header at p; false if it is not one we can size */
+static bool parse_header(uint8_t const * p, Mp3Frame * frame) {
+    if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) {
+        return false;
+    }
+    int version = (p[1] >> 3) & 3;
+    int layerBits = (p[1] >> 1) & 3;
+    int bitrateIndex = p[2] >> 4;
+    int rateIndex = (p[2] >> 2) & 3;
+    if (version == 1 || layerBits == 0 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3) {
+        return false;
+    }
+
+    frame->version = version;
+    frame->layer = 4 - layerBits;
+    frame->rate = sample_rates[rateIndex] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+    frame->channels = (p[3] >> 6) == 3 ? 1 : 2;
+    bool lsf = version != 3;
+    unsigned bitrate = bitrates[lsf ? 1 : 0][frame->layer - 1][bitrateIndex] * 1000;
+    unsigned padding = (p[2] >> 1) & 1;
+
+    if (frame->layer == 1) {
+        frame->samples = 384;
+        frame->size = (12 * bitrate / frame->rate + padding) * 4;
+    } else if (frame->layer == 2 || !lsf) {
+        frame->samples = 1152;
+        frame->size = 144 * bitrate / frame->rate + padding;
+    } else {
+        frame->samples = 576;
+        frame->size = 72 * bitrate / frame->rate + padding;
+    }
+
+    bool crc = !(p[1] & 1);
+    size_t sideInfo = 0;
+    if (frame->layer == 3) {
+        sideInfo = lsf ? (frame->channels == 1 ? 9 : 17) : (frame->channels == 1 ? 17 : 32);
+    }
+    frame->side_info = 4 + (crc ? 2 : 0) + sideInfo;
+    return frame->size > frame->side_info;
+}
+
+static bool same_stream(Mp3Frame const & a, Mp3Frame const & b) {
+    return a.version == b.version && a.layer == b.layer && a.rate == b.rate && a.channels == b.channels;
+}
+
+static bool starts_with(uint8_t const * p, size_t left, char const * tag) {
+    size_t len = strlen(tag);
+    return left >= len && memcmp(p, tag, len) == 0;
+}
+
+/* What may follow the last frame without the decoder producing samples */
+static bool is_trailer(uint8_t const * p, size_t left) {
+    return left == 0 || starts_with(p, left, "TAG") || starts_with(p, left, "APETAGEX")
+            || starts_with(p, left, "LYRICSBEGIN");
+}
+
+static int plan_chunks(MappedFile const & file, double chunkSeconds, std::vector<DecodeChunk> * chunks) {
+    chunks->clear();
+    if (!file.ok()) {
+        return RESULT_ERROR;
+    }
+    uint8_t const * data = file.data();
+    size_t size = file.size();
+
+    /* Skip an ID3v2 tag (and its footer), then any zero padding */
+    size_t pos = 0;
+    if (size >= ID3V2_HEADER_SIZE && memcmp(data, "ID3", 3) == 0) {
+        uint8_t const * h = data + 3;
+        if ((h[3] | h[4] | h[5] | h[6]) & 0x80) {
+            return RESULT_ERROR;
+        }
+        size_t tagSize = ((size_t) h[3] << 21) | ((size_t) h[4] << 14) | ((size_t) h[5] << 7) | h[6];
+        pos = ID3V2_HEADER_SIZE + tagSize + ((h[2] & 0x10) ? ID3V2_HEADER_SIZE : 0);
+    }
+    while (pos < size && data[pos] == 0) {
+        pos++;
+    }
+
+    /* Walk the frames from header to header */
+    std::vector<size_t> offsets;
+    Mp3Frame first = {}, frame;
+    size_t smallestData = SIZE_MAX;
+    while (pos + 4 <= size && parse_header(data + pos, &frame)) {
+        if (offsets.empty()) {
+            first = frame;
+        } else if (!same_stream(first, frame)) {
+            return RESULT_ERROR;
+        }
+        if (pos + frame.size > size) {
+            /* Truncated last frame */
+            return RESULT_ERROR;
+        }
+        offsets.push_back(pos);
+        smallestData = std::min(smallestData, frame.size - frame.side_info);
+        pos += frame.size;
+    }
+    if (offsets.empty() || !is_trailer(data + pos, size - pos)) {
+        return RESULT_ERROR;
+    }
+
+    /* Enough frames ahead of a chunk for the reservoir of its first frame,
+     * even if every frame before it is as small as the smallest one. Layers
+     * I and II have no reservoir */
+    size_t leadIn = OVERLAP_FRAMES;
+    if (first.layer == 3) {
+        leadIn += (MAX_RESERVOIR_BYTES + smallestData - 1) / smallestData;
+    }
+    size_t framesPerChunk = std::max((size_t) 1, (size_t) (chunkSeconds * first.rate / first.samples));
+    size_t frameSamples = (size_t) first.samples * first.channels;
+
+    size_t count = offsets.size();
+    size_t a = 0;
+    while (a < count) {
+        size_t b = std::min(count, a + framesPerChunk);
+        if (count - b < framesPerChunk / 2) {
+            /* No short tail chunk */
+            b = count;
+        }
+        DecodeChunk chunk;
+        size_t from = a > leadIn ? offsets[a - leadIn] : 0;
+        size_t to = b == count ? size : offsets[b];
+        chunk.ranges.push_back({from, to - from});
+        if (a > 0) {
+            chunk.samples = (b - a) * frameSamples;
+            chunk.lead_in = true;
+        }
+        chunks->push_back(chunk);
+        a = b;
+    }
+    return RESULT_SUCCESS;
+}
+
+int mp3_convert_parallel(char const * inPath, char const * outPath, double chunkSeconds,
+                         unsigned threads, RenderReport * report, DecodeObserver const & observer,
+                         unsigned precision) {
+    MappedFile file(inPath);
+    std::vector<DecodeChunk> chunks;
+    if (plan_chunks(file, chunkSeconds, &chunks) != RESULT_SUCCESS || chunks.size() < 2) {
+        return RESULT_ERROR;
+    }
+    return parallel_decode_file("mp3-parallel", inPath, outPath, file, "mp3", chunks,
+                                std::min(threads, (unsigned) chunks.size()), report, observer, precision);
+}
@@ -0,0 +1,26 @@
+#ifndef SOXTEST_MP3_PARALLEL_H
+#define SOXTEST_MP3_PARALLEL_H
+
+#include "parallel-decode.h"
+
+/* Parallel decoding of MPEG audio (Layer I, II or III) files, see
+ * parallel-decode.h.
+ *
+ * The stream is split at frame boundaries into chunks of about
+ * chunkSeconds. Every chunk after the first starts enough frames early for
+ * the bit reservoir (main_data_begin reaches back up to 511 bytes) and the
+ * IMDCT/synthesis overlap to be rebuilt, and keeps only the samples of its
+ * own frames. The first chunk starts at the top of the file
+ * and the last one runs to its end, tags included, so the decoder sees the
+ * same bytes around them as a serial decode does.
+ *
+ * Fails for streams whose frames cannot all be found from their headers:
+ * free-format bitrates, a change of layer, rate or channel count, or junk
+ * before the first frame or after the last one (other than ID3/APE/Lyrics
+ * tags). Those are left to the serial decoder. observer and precision
+ * are those of parallel_decode_file() */
+int mp3_convert_parallel(char const * inPath, char const * outPath, double chunkSeconds,
+                         unsigned threads, RenderReport * report, DecodeObserver const & observer = nullptr,
+                         unsigned precision = 0);
+
+#endif //SOXTEST_MP3_PARALLEL_H
@@ -0,0 +1,280 @@
+#include "multi-export.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include "mapped-io.h"
+#include "native-log.h"
+#include "render-jobs.h"
+#include "sox.h"
+#include "sox-ops.h"
+
+/* Blocks an encoder may lag behind the reader */
+#define EXPORT_QUEUE_BLOCKS 8
+
+typedef std::chrono::steady_clock Clock;
+typedef std::shared_ptr<std::vector<sox_sample_t> const> Block;
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/* One output and its encoder thread; queue and flags guarded by mutex */
+struct Encoder {
+    std::string path;
+    sox_format_t * out = NULL;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Block> queue;
+    bool done = false;     /* no more blocks coming */
+    bool failed = false;
+
+    double encode_ms = 0;
+    uint64_t blocks = 0;
+    uint64_t samples = 0;
+    std::string error;
+};
+
+static void encode(Encoder * encoder) {
+    for (;;) {
+        Block block;
+        {
+            std::unique_lock<std::mutex> lock(encoder->mutex);
+            encoder->changed.wait(lock, [&] { return !encoder->queue.empty() || encoder->done; });
+            if (encoder->queue.empty()) {
+                return;
+            }
+            block = encoder->queue.front();
+            encoder->queue.pop_front();
+            encoder->changed.notify_all();
+        }
+
+        Clock::time_point start = Clock::now();
+        size_t written = sox_write(encoder->out, block->data(), block->size());
+        encoder->encode_ms += ms_since(start);
+        if (written != block->size()) {
+            std::lock_guard<std::mutex> lock(encoder->mutex);
+            encoder->failed = true;
+            encoder->error = encoder->out->sox_errno ? encoder->out->sox_errstr : "write failed";
+            encoder->queue.clear();
+            encoder->changed.notify_all();
+            return;
+        }
+        encoder->blocks++;
+        encoder->samples += written;
+    }
+}
+
+/* Queues the block for the encoder, waiting while it is too far behind;
+ * false once the encoder has failed */
+static bool hand_over(Encoder * encoder, Block const & block) {
+    std::unique_lock<std::mutex> lock(encoder->mutex);
+    encoder->changed.wait(lock, [&] {
+        return encoder->failed || encoder->queue.size() < EXPORT_QUEUE_BLOCKS;
+    });
+    if (encoder->failed) {
+        return false;
+    }
+    encoder->queue.push_back(block);
+    encoder->changed.notify_all();
+    return true;
+}
+
+/* What an export reads: the file being decoded, with the signal of the
+ * outputs */
+struct ExportInput {
+    char const * name = NULL;
+    sox_signalinfo_t signal = {};
+    sox_format_t * in = NULL;
+    uint64_t in_bytes = 0;
+};
+
+static size_t read_input(ExportInput * input, sox_sample_t * samples, size_t count) {
+    return sox_read(input->in, samples, count);
+}
+
+static void report_input_progress(ExportInput const * input) {
+    if (input->in_bytes > 0) {
+        job_report_progress((double) input->in->tell_off / input->in_bytes);
+    }
+}
+
+static int fail_export(RenderReport * report, std::string const & error) {
+    LOG_E("export failed: %s", error.c_str());
+    report->result = RESULT_ERROR;
+    report->error = error;
+    return RESULT_ERROR;
+}
+
+static int export_input(ExportInput * input, std::vector<std::string> const & outPaths,
+                        std::vector<std::string> const & tags, RenderReport * report) {
+    Clock::time_point start = Clock::now();
+
+    /* As in sox_render(), the outputs take the input's signal; each output
+     * copies the comments */
+    sox_oob_t oob;
+    memset(&oob, 0, sizeof(oob));
+    for (std::string const & tag : tags) {
+        sox_append_comment(&oob.comments, tag.c_str());
+    }
+    std::vector<std::unique_ptr<Encoder>> encoders;
+    std::string error;
+    for (std::string const & path : outPaths) {
+        std::unique_ptr<Encoder> encoder(new Encoder());
+        encoder->path = path;
+        encoder->out = sox_open_write(path.c_str(), &input->signal, NULL, NULL, &oob, NULL);
+        if (!encoder->out) {
+            error = "cannot open output: " + path;
+            break;
+        }
+        encoders.push_back(std::move(encoder));
+    }
+    sox_delete_comments(&oob.comments);
+    if (!error.empty()) {
+        for (auto & encoder : encoders) {
+            sox_close(encoder->out);
+            remove(encoder->path.c_str());
+        }
+        return fail_export(report, error);
+    }
+
+    std::vector<std::thread> threads;
+    for (auto & encoder : encoders) {
+        threads.emplace_back(encode, encoder.get());
+    }
+
+    /* The block size of the "input" effect of a chain */
+    size_t blockSamples = sox_globals.bufsiz - sox_globals.bufsiz % input->signal.channels;
+    Clock::time_point flow_start = Clock::now();
+    size_t alive = encoders.size();
+    while (alive > 0) {
+        std::vector<sox_sample_t> samples(blockSamples);
+        Clock::time_point read_start = Clock::now();
+        size_t got = read_input(input, samples.data(), blockSamples);
+        report->read_wait_ms += ms_since(read_start);
+        if (got == 0) {
+            break;
+        }
+        samples.resize(got);
+        Block block = std::make_shared<std::vector<sox_sample_t> const>(std::move(samples));
+        alive = 0;
+        for (auto & encoder : encoders) {
+            alive += hand_over(encoder.get(), block) ? 1 : 0;
+        }
+        report_input_progress(input);
+        job_yield();
+        if (job_cancelled()) {
+            break;
+        }
+    }
+    for (auto & encoder : encoders) {
+        std::lock_guard<std::mutex> lock(encoder->mutex);
+        encoder->done = true;
+        encoder->changed.notify_all();
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    report->flow_ms = ms_since(flow_start);
+
+    report->in_rate = input->signal.rate;
+    report->out_rate = input->signal.rate;
+    report->channels = input->signal.channels;
+    report->threads = encoders.size();
+    report->input_bytes = input->in->tell_off;
+    bool readFailed = (input->in && input->in->sox_errno != 0) || job_cancelled();
+    if (job_cancelled()) {
+        error = "cancelled";
+    } else if (readFailed) {
+        error = std::string("cannot read input: ") + input->in->sox_errstr;
+    }
+
+    for (auto & encoder : encoders) {
+        StageReport stage;
+        stage.name = encoder->out->filetype;
+        stage.flows = 1;
+        stage.flow_ms = encoder->encode_ms;
+        stage.flow_calls = encoder->blocks;
+        stage.samples_in = encoder->samples;
+        stage.samples_out = encoder->samples;
+        report->stages.push_back(stage);
+        report->write_wait_ms = std::max(report->write_wait_ms, encoder->encode_ms);
+
+        sox_close(encoder->out);
+        if (encoder->failed || readFailed) {
+            if (encoder->failed) {
+                error = encoder->path + ": " + encoder->error;
+            }
+            remove(encoder->path.c_str());
+            continue;
+        }
+        struct stat out_stat;
+        if (stat(encoder->path.c_str(), &out_stat) == 0) {
+            report->output_bytes += out_stat.st_size;
+        }
+    }
+    report->total_ms += ms_since(start);
+
+    if (!error.empty()) {
+        return fail_export(report, error);
+    }
+    report->result = RESULT_SUCCESS;
+    LOG_E("Export done: %s; %zu outputs", input->name, outPaths.size());
+    return RESULT_SUCCESS;
+}
+
+/* Fills in the report header; false if there is nothing to export to */
+static bool start_export(char const * inName, std::vector<std::string> const & outPaths, RenderReport * report) {
+    *report = RenderReport();
+    report->operation = "export";
+    report->in_path = inName;
+    for (std::string const & path : outPaths) {
+        report->out_path += (report->out_path.empty() ? "" : ";") + path;
+    }
+    if (outPaths.empty()) {
+        fail_export(report, "no outputs");
+        return false;
+    }
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        fail_export(report, "sox_init failed");
+        return false;
+    }
+    return true;
+}
+
+int sox_export(char const * inPath, std::vector<std::string> const & outPaths,
+               std::vector<std::string> const & tags, RenderReport * report, unsigned precision) {
+    RenderReport local_report;
+    Clock::time_point start = Clock::now();
+    if (!report) {
+        report = &local_report;
+    }
+    if (!start_export(inPath, outPaths, report)) {
+        return RESULT_ERROR;
+    }
+    MappedInput mapped;
+    ExportInput input;
+    input.name = inPath;
+    input.in = mapped.open(inPath);
+    if (!input.in) {
+        return fail_export(report, std::string("cannot open input: ") + inPath);
+    }
+    input.signal = input.in->signal;
+    if (precision > 0) {
+        input.signal.precision = precision;
+    }
+    struct stat in_stat;
+    input.in_bytes = input.in->seekable && stat(inPath, &in_stat) == 0 ? (uint64_t) in_stat.st_size : 0;
+    report->total_ms = ms_since(start);
+    int result = export_input(&input, outPaths, tags, report);
+    sox_close(input.in);
+    return result;
+}
@@ -0,0 +1,32 @@
+#ifndef SOXTEST_MULTI_EXPORT_H
+#define SOXTEST_MULTI_EXPORT_H
+
+#include <string>
+#include <vector>
+#include "render-report.h"
+#include "sox-ops.h"
+
+/* Export of one input to several formats in a single pass.
+ *
+ * The input is decoded once, in blocks the size the "input" effect of a
+ * libSoX chain would read, and every block is handed to one encoder thread
+ * per output through a short bounded queue. So the encoders run side by
+ * side, the reader waits only for the slowest one, and each output gets the
+ * same writes as a separate sox_convert() to it would make. An output
+ * whose encoder fails is removed and the export fails, but the other
+ * outputs are still completed; a read error of the input removes them all.
+ *
+ * Tags are libSoX comments, "Key=value", and are written by the encoders
+ * themselves: as ID3v2 frames through LAME for MP3 (Title, Artist, Album,
+ * Year, Comment, Tracknumber, Genre and Discnumber are mapped; LAME pads
+ * the tag as libSoX asks it to) and as Vorbis comments for FLAC and OGG, so
+ * no output has to be rewritten to tag it.
+ *
+ * The report has one stage per output, named after its file type, with the
+ * time spent encoding it. The outputs are written at precision bits, 0 for
+ * the input's, e.g. a 32-bit session stage at the bits of its source */
+int sox_export(char const * inPath, std::vector<std::string> const & outPaths,
+               std::vector<std::string> const & tags, RenderReport * report = NULL,
+               unsigned precision = 0);
+
+#endif //SOXTEST_MULTI_EXPORT_H
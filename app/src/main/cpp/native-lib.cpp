@@ -1,20 +1,35 @@
 #include <jni.h>
 #include <string>
+#include <vector>
+#include <cstdio>
 #include <cstring>
-#include <android/log.h>
-#include "sox.h"
-
-#define APPNAME "SoxTest"
-
-#define TMP_PATH "/sdcard/Android/data/jatx.soxtest/files"
-
-#define RESULT_SUCCESS 0
-#define RESULT_ERROR -1
-
-int sox_convert(char* inPathCStr, char* outPathCStr);
-int sox_tempo(char* inPathCStr, char* outPathCStr, char* tempoCStr);
-int sox_pitch(char* inPathCStr, char* outPathCStr, char* pitchCStr);
-int sox_reverse(char* inPathCStr, char* outPathCStr);
+#include "audio-probe.h"
+#include "checkpoint.h"
+#include "memory-budget.h"
+#include "project-session.h"
+#include "rate-plans.h"
+#include "render-cache.h"
+#include "render-jobs.h"
+#include "sox-ops.h"
+#include "sox-tuning.h"
+
+/* initNativeJNI: no tuning saved for this device yet */
+#define RESULT_NOT_CALIBRATED 1
+
+/* Renders of the app can be resumed after the process is killed */
+#define APP_CHECKPOINT_SECONDS 30
+
+static std::vector<std::string> string_list(JNIEnv* env, jobjectArray strings) {
+    std::vector<std::string> list;
+    for (jsize i = 0; i < env->GetArrayLength(strings); i++) {
+        jstring string = (jstring) env->GetObjectArrayElement(strings, i);
+        const char* stringCStr = env->GetStringUTFChars(string, NULL);
+        list.push_back(stringCStr);
+        env->ReleaseStringUTFChars(string, stringCStr);
+        env->DeleteLocalRef(string);
+    }
+    return list;
+}
 
 extern "C" JNIEXPORT jstring JNICALL
 Java_jatx_soxtest_MainActivity_stringFromJNI(
@@ -25,419 +40,392 @@ Java_jatx_soxtest_MainActivity_stringFromJNI(
 }
 
 extern "C" JNIEXPORT int JNICALL
-Java_jatx_soxtest_MainActivity_convertAudioFileJNI(
+Java_jatx_soxtest_MainActivity_initNativeJNI(
         JNIEnv* env,
         jobject /* this */,
-        jstring inPath,
-        jstring outPath) {
-    char* inPathCStr;
-    char* outPathCStr;
+        jstring tuningPath,
+        jstring ratePlansPath,
+        jstring deviceId
+        ) {
+    const char* tuningPathCStr;
+    const char* ratePlansPathCStr;
+    const char* deviceIdCStr;
+    SoxTuning tuning;
     int result;
-    inPathCStr = (char*) env->GetStringUTFChars(inPath, NULL);
-    outPathCStr = (char*) env->GetStringUTFChars(outPath, NULL);
-    result = sox_convert(inPathCStr, outPathCStr);
-    env->ReleaseStringUTFChars(inPath, inPathCStr);
-    env->ReleaseStringUTFChars(outPath, outPathCStr);
+    tuningPathCStr = env->GetStringUTFChars(tuningPath, NULL);
+    ratePlansPathCStr = env->GetStringUTFChars(ratePlansPath, NULL);
+    deviceIdCStr = env->GetStringUTFChars(deviceId, NULL);
+    if (tuning_load(tuningPathCStr, deviceIdCStr, &tuning) == RESULT_SUCCESS) {
+        tuning_set(tuning);
+        result = RESULT_SUCCESS;
+    } else {
+        /* Plans measured on another device (or build) are stale too */
+        remove(ratePlansPathCStr);
+        result = RESULT_NOT_CALIBRATED;
+    }
+    if (rate_plans_init(ratePlansPathCStr) != RESULT_SUCCESS) {
+        /* Plans of an older build are tuned again with the rest */
+        result = RESULT_NOT_CALIBRATED;
+    }
+    checkpoint_set_interval(APP_CHECKPOINT_SECONDS);
+    env->ReleaseStringUTFChars(tuningPath, tuningPathCStr);
+    env->ReleaseStringUTFChars(ratePlansPath, ratePlansPathCStr);
+    env->ReleaseStringUTFChars(deviceId, deviceIdCStr);
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
     return result;
 }
 
-extern "C" JNIEXPORT int JNICALL
-Java_jatx_soxtest_MainActivity_applyTempoJNI(
+extern "C" JNIEXPORT jstring JNICALL
+Java_jatx_soxtest_MainActivity_calibrateNativeJNI(
         JNIEnv* env,
         jobject /* this */,
-        jstring inPath,
-        jstring outPath,
-        jstring tempo
+        jstring workDir,
+        jstring tuningPath,
+        jstring deviceId
         ) {
-    char* inPathCStr;
-    char* outPathCStr;
-    char* tempoCStr;
-    int result;
-    inPathCStr = (char*) env->GetStringUTFChars(inPath, NULL);
-    outPathCStr = (char*) env->GetStringUTFChars(outPath, NULL);
-    tempoCStr = (char*) env->GetStringUTFChars(tempo, NULL);
-    result = sox_tempo(inPathCStr, outPathCStr, tempoCStr);
-    env->ReleaseStringUTFChars(inPath, inPathCStr);
-    env->ReleaseStringUTFChars(outPath, outPathCStr);
-    env->ReleaseStringUTFChars(tempo, tempoCStr);
-    return result;
+    const char* workDirCStr;
+    const char* tuningPathCStr;
+    const char* deviceIdCStr;
+    SoxTuning best;
+    std::vector<TuningSample> sweep;
+    std::string json;
+    workDirCStr = env->GetStringUTFChars(workDir, NULL);
+    tuningPathCStr = env->GetStringUTFChars(tuningPath, NULL);
+    deviceIdCStr = env->GetStringUTFChars(deviceId, NULL);
+    if (tuning_calibrate(workDirCStr, &best, &sweep) == RESULT_SUCCESS) {
+        tuning_save(tuningPathCStr, deviceIdCStr, best);
+        json = tuning_sweep_to_json(sweep, best);
+    }
+    env->ReleaseStringUTFChars(workDir, workDirCStr);
+    env->ReleaseStringUTFChars(tuningPath, tuningPathCStr);
+    env->ReleaseStringUTFChars(deviceId, deviceIdCStr);
+    return env->NewStringUTF(json.c_str());
 }
 
-extern "C" JNIEXPORT int JNICALL
-Java_jatx_soxtest_MainActivity_applyPitchJNI(
-        JNIEnv* env,
+extern "C" JNIEXPORT void JNICALL
+Java_jatx_soxtest_MainActivity_setMemoryBudgetJNI(
+        JNIEnv* /* env */,
         jobject /* this */,
-        jstring inPath,
-        jstring outPath,
-        jstring pitch
+        jlong bytes
         ) {
-    char* inPathCStr;
-    char* outPathCStr;
-    char* pitchCStr;
-    int result;
-    inPathCStr = (char*) env->GetStringUTFChars(inPath, NULL);
-    outPathCStr = (char*) env->GetStringUTFChars(outPath, NULL);
-    pitchCStr = (char*) env->GetStringUTFChars(pitch, NULL);
-    result = sox_pitch(inPathCStr, outPathCStr, pitchCStr);
-    env->ReleaseStringUTFChars(inPath, inPathCStr);
-    env->ReleaseStringUTFChars(outPath, outPathCStr);
-    env->ReleaseStringUTFChars(pitch, pitchCStr);
-    return result;
+    memory_budget_set(bytes > 0 ? (uint64_t) bytes : 0);
 }
 
-extern "C" JNIEXPORT int JNICALL
-Java_jatx_soxtest_MainActivity_applyReverseJNI(
+extern "C" JNIEXPORT void JNICALL
+Java_jatx_soxtest_MainActivity_initRenderCacheJNI(
         JNIEnv* env,
         jobject /* this */,
-        jstring inPath,
-        jstring outPath
+        jstring cacheDir,
+        jlong quotaBytes
         ) {
-    char* inPathCStr;
-    char* outPathCStr;
-    int result;
-    inPathCStr = (char*) env->GetStringUTFChars(inPath, NULL);
-    outPathCStr = (char*) env->GetStringUTFChars(outPath, NULL);
-    result = sox_reverse(inPathCStr, outPathCStr);
-    env->ReleaseStringUTFChars(inPath, inPathCStr);
-    env->ReleaseStringUTFChars(outPath, outPathCStr);
-    return result;
+    const char* cacheDirCStr;
+    cacheDirCStr = env->GetStringUTFChars(cacheDir, NULL);
+    render_cache_init(cacheDirCStr, quotaBytes > 0 ? (uint64_t) quotaBytes : 0);
+    env->ReleaseStringUTFChars(cacheDir, cacheDirCStr);
 }
 
-int sox_convert(char* inPathCStr, char* outPathCStr) {
-    static sox_format_t * in, * out; /* input and output files */
-    sox_effects_chain_t * chain;
-    sox_effect_t * e;
-    sox_signalinfo_t interm_signal;
-    char * args[10];
-
-    /* All libSoX applications must start by initialising the SoX library    */
-    if(sox_init() != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-
-    /* Open the input file (with default parameters) */
-    in = sox_open_read(inPathCStr, NULL, NULL, NULL);
-    if (!in) {
-        return RESULT_ERROR;
-    }
-
-    interm_signal = in->signal;
-
-    /* Open the output file; we must specify the output signal characteristics.
-    * Since we are using only simple effects, they are the same as the input
-    * file characteristics */
-    out = sox_open_write(outPathCStr, &interm_signal, NULL, NULL, NULL, NULL);
-    if (!out) {
-        return RESULT_ERROR;
-    }
-
-    /* Create an effects chain; some effects need to know about the input
-    * or output file encoding so we provide that information here */
-    chain = sox_create_effects_chain(&in->encoding, &out->encoding);
-
-    /* The first effect in the effect chain must be something that can source
-    * samples; in this case, we use the built-in handler that inputs
-    * data from an audio file */
-    e = sox_create_effect(sox_find_effect("input"));
-    args[0] = (char *)in;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* This becomes the first `effect' in the chain */
-    if(sox_add_effect(chain, e, &interm_signal, &in->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* The last effect in the effect chain must be something that only consumes
-    * samples; in this case, we use the built-in handler that outputs
-    * data to an audio file */
-    e = sox_create_effect(sox_find_effect("output"));
-    args[0] = (char *)out;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* Flow samples through the effects processing chain until EOF is reached */
-    sox_flow_effects(chain, NULL, NULL);
-
-    /* All done; tidy up: */
-    sox_delete_effects_chain(chain);
-    sox_close(out);
-    sox_close(in);
-    sox_quit();
-
-    __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Convert done: %s; %s", inPathCStr, outPathCStr);
-
-    return RESULT_SUCCESS;
+extern "C" JNIEXPORT jstring JNICALL
+Java_jatx_soxtest_MainActivity_probeAudioFileJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jstring path
+        ) {
+    const char* pathCStr;
+    AudioProbe probe;
+    pathCStr = env->GetStringUTFChars(path, NULL);
+    audio_probe(pathCStr, &probe);
+    env->ReleaseStringUTFChars(path, pathCStr);
+    return env->NewStringUTF(probe_to_json(probe).c_str());
 }
 
-int sox_tempo(char* inPathCStr, char* outPathCStr, char* tempoCStr) {
-    static sox_format_t * in, * out; /* input and output files */
-    sox_effects_chain_t * chain;
-    sox_effect_t * e;
-    sox_signalinfo_t interm_signal;
-    char * args[10];
-
-    /* All libSoX applications must start by initialising the SoX library    */
-    if(sox_init() != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-
-    /* Open the input file (with default parameters) */
-    in = sox_open_read(inPathCStr, NULL, NULL, NULL);
-    if (!in) {
-        return RESULT_ERROR;
-    }
-
-    interm_signal = in->signal;
-
-    /* Open the output file; we must specify the output signal characteristics.
-    * Since we are using only simple effects, they are the same as the input
-    * file characteristics */
-    out = sox_open_write(outPathCStr, &interm_signal, NULL, NULL, NULL, NULL);
-    if (!out) {
-        return RESULT_ERROR;
-    }
-
-    /* Create an effects chain; some effects need to know about the input
-    * or output file encoding so we provide that information here */
-    chain = sox_create_effects_chain(&in->encoding, &out->encoding);
-
-    /* The first effect in the effect chain must be something that can source
-    * samples; in this case, we use the built-in handler that inputs
-    * data from an audio file */
-    e = sox_create_effect(sox_find_effect("input"));
-    args[0] = (char *)in;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* This becomes the first `effect' in the chain */
-    if(sox_add_effect(chain, e, &interm_signal, &in->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
+/* Render jobs (see render-jobs.h), reported to the RenderJobs object on
+ * the native callback thread */
+static JavaVM* java_vm = NULL;
+static jobject jobs_listener = NULL;
+static jmethodID on_job_progress = NULL;
+static jmethodID on_job_done = NULL;
+
+extern "C" JNIEXPORT jint JNICALL
+JNI_OnLoad(JavaVM* vm, void* /* reserved */) {
+    java_vm = vm;
+    return JNI_VERSION_1_6;
+}
 
-    /* Create the `tempo' effect, and initialise it with the desired parameters: */
-    e = sox_create_effect(sox_find_effect("tempo"));
-    args[0] = tempoCStr;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* Add the effect to the end of the effects processing chain: */
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* The last effect in the effect chain must be something that only consumes
-    * samples; in this case, we use the built-in handler that outputs
-    * data to an audio file */
-    e = sox_create_effect(sox_find_effect("output"));
-    args[0] = (char *)out;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
+/* The callback thread lives as long as the process, so it is attached once
+ * and never detached */
+static JNIEnv* callback_env() {
+    JNIEnv* env = NULL;
+    if (java_vm->GetEnv((void**) &env, JNI_VERSION_1_6) != JNI_OK
+            && java_vm->AttachCurrentThread(&env, NULL) != JNI_OK) {
+        return NULL;
     }
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* Flow samples through the effects processing chain until EOF is reached */
-    sox_flow_effects(chain, NULL, NULL);
-
-    /* All done; tidy up: */
-    sox_delete_effects_chain(chain);
-    sox_close(out);
-    sox_close(in);
-    sox_quit();
-
-    __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Tempo done: %s", tempoCStr);
-
-    return RESULT_SUCCESS;
+    return env;
 }
 
-int sox_pitch(char* inPathCStr, char* outPathCStr, char* pitchCStr) {
-    static sox_format_t * in, * out; /* input and output files */
-    sox_effects_chain_t * chain;
-    sox_effect_t * e;
-    sox_signalinfo_t interm_signal;
-    char * args[10];
-
-    /* All libSoX applications must start by initialising the SoX library    */
-    if(sox_init() != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
+static std::string status_to_json(JobStatus const & status) {
+    std::string out = "{";
+    json_field(out, "id", (uint64_t) status.id);
+    json_field(out, "state", (int) status.state);
+    json_field(out, "priority", (int) status.priority);
+    json_field(out, "progress", status.progress);
+    json_field(out, "queued_ms", status.queued_ms);
+    json_field(out, "run_ms", status.run_ms);
+    json_field(out, "preempted_ms", status.preempted_ms);
+    json_field(out, "preemptions", status.preemptions);
+    json_field(out, "superseded_by", (uint64_t) status.superseded_by);
+    out += "}";
+    return out;
+}
 
-    /* Open the input file (with default parameters) */
-    in = sox_open_read(inPathCStr, NULL, NULL, NULL);
-    if (!in) {
-        return RESULT_ERROR;
-    }
+static JobCallbacks listener_callbacks() {
+    JobCallbacks callbacks;
+    callbacks.on_progress = [](uint64_t id, double progress) {
+        JNIEnv* env = callback_env();
+        if (env && jobs_listener) {
+            env->CallVoidMethod(jobs_listener, on_job_progress, (jlong) id, (jdouble) progress);
+            if (env->ExceptionCheck()) env->ExceptionClear();
+        }
+    };
+    callbacks.on_done = [](JobStatus const & status) {
+        JNIEnv* env = callback_env();
+        if (env && jobs_listener) {
+            jstring reportJson = env->NewStringUTF(report_to_json(status.report).c_str());
+            env->CallVoidMethod(jobs_listener, on_job_done, (jlong) status.id, (jint) status.state, reportJson);
+            if (env->ExceptionCheck()) env->ExceptionClear();
+            env->DeleteLocalRef(reportJson);
+        }
+    };
+    return callbacks;
+}
 
-    interm_signal = in->signal;
+static std::string string_of(JNIEnv* env, jstring string) {
+    const char* stringCStr = env->GetStringUTFChars(string, NULL);
+    std::string result = stringCStr;
+    env->ReleaseStringUTFChars(string, stringCStr);
+    return result;
+}
 
-    /* Open the output file; we must specify the output signal characteristics.
-    * Since we are using only simple effects, they are the same as the input
-    * file characteristics */
-    out = sox_open_write(outPathCStr, &interm_signal, NULL, NULL, NULL, NULL);
-    if (!out) {
-        return RESULT_ERROR;
-    }
+static JobPriority job_priority_of(jint priority) {
+    return priority >= 0 && priority < JOB_PRIORITIES ? (JobPriority) priority : JOB_BACKGROUND;
+}
 
-    /* Create an effects chain; some effects need to know about the input
-    * or output file encoding so we provide that information here */
-    chain = sox_create_effects_chain(&in->encoding, &out->encoding);
+extern "C" JNIEXPORT void JNICALL
+Java_jatx_soxtest_RenderJobs_initJNI(
+        JNIEnv* env,
+        jobject thiz
+        ) {
+    if (jobs_listener) {
+        return;
+    }
+    jclass listenerClass = env->GetObjectClass(thiz);
+    on_job_progress = env->GetMethodID(listenerClass, "onJobProgress", "(JD)V");
+    on_job_done = env->GetMethodID(listenerClass, "onJobDone", "(JILjava/lang/String;)V");
+    env->DeleteLocalRef(listenerClass);
+    jobs_listener = env->NewGlobalRef(thiz);
+}
 
-    /* The first effect in the effect chain must be something that can source
-    * samples; in this case, we use the built-in handler that inputs
-    * data from an audio file */
-    e = sox_create_effect(sox_find_effect("input"));
-    args[0] = (char *)in;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* This becomes the first `effect' in the chain */
-    if(sox_add_effect(chain, e, &interm_signal, &in->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
+extern "C" JNIEXPORT jboolean JNICALL
+Java_jatx_soxtest_RenderJobs_cancelJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong id
+        ) {
+    return job_cancel((uint64_t) id) == RESULT_SUCCESS ? JNI_TRUE : JNI_FALSE;
+}
 
-    /* Create the `tempo' effect, and initialise it with the desired parameters: */
-    e = sox_create_effect(sox_find_effect("pitch"));
-    args[0] = pitchCStr;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* Add the effect to the end of the effects processing chain: */
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
+extern "C" JNIEXPORT jstring JNICALL
+Java_jatx_soxtest_RenderJobs_statusJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong id
+        ) {
+    JobStatus status;
+    if (job_status((uint64_t) id, &status) != RESULT_SUCCESS) {
+        return env->NewStringUTF("{}");
     }
-    free(e);
+    return env->NewStringUTF(status_to_json(status).c_str());
+}
 
-    e = sox_create_effect(sox_find_effect("rate"));
-    args[0] = "-m";
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* The last effect in the effect chain must be something that only consumes
-    * samples; in this case, we use the built-in handler that outputs
-    * data to an audio file */
-    e = sox_create_effect(sox_find_effect("output"));
-    args[0] = (char *)out;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
+extern "C" JNIEXPORT jint JNICALL
+Java_jatx_soxtest_RenderJobs_awaitJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong id,
+        jlong timeoutMs
+        ) {
+    JobStatus status;
+    if (job_await((uint64_t) id, (double) timeoutMs, &status) != RESULT_SUCCESS) {
         return RESULT_ERROR;
     }
-    free(e);
-
-    /* Flow samples through the effects processing chain until EOF is reached */
-    sox_flow_effects(chain, NULL, NULL);
-
-    /* All done; tidy up: */
-    sox_delete_effects_chain(chain);
-    sox_close(out);
-    sox_close(in);
-    sox_quit();
-
-    __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Pitch done: %s", pitchCStr);
-
-    return RESULT_SUCCESS;
+    return status.state == JOB_SUCCEEDED ? RESULT_SUCCESS : RESULT_ERROR;
 }
 
-int sox_reverse(char* inPathCStr, char* outPathCStr) {
-    static sox_format_t * in, * out; /* input and output files */
-    sox_effects_chain_t * chain;
-    sox_effect_t * e;
-    sox_signalinfo_t interm_signal;
-    char * args[10];
-
-    sox_globals.tmp_path = TMP_PATH;
+/* Project sessions (see project-session.h), held by the ProjectSession
+ * class by handle; the renders run as jobs reported to RenderJobs */
+extern "C" JNIEXPORT jlong JNICALL
+Java_jatx_soxtest_ProjectSession_createJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jstring dir
+        ) {
+    return (jlong) session_create(string_of(env, dir));
+}
 
-    /* All libSoX applications must start by initialising the SoX library    */
-    if(sox_init() != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
+extern "C" JNIEXPORT void JNICALL
+Java_jatx_soxtest_ProjectSession_closeJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong handle
+        ) {
+    session_close((uint64_t) handle);
+}
 
-    /* Open the input file (with default parameters) */
-    in = sox_open_read(inPathCStr, NULL, NULL, NULL);
-    if (!in) {
-        return RESULT_ERROR;
-    }
+extern "C" JNIEXPORT jlong JNICALL
+Java_jatx_soxtest_ProjectSession_submitLoadJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle,
+        jstring path,
+        jint priority,
+        jboolean trimSilence
+        ) {
+    std::string in = string_of(env, path);
+    bool trim = trimSilence;
+    JobWork work = [handle, in, trim](RenderReport* report) {
+        return session_load((uint64_t) handle, in.c_str(), report, trim);
+    };
+    return (jlong) job_submit("load", job_priority_of(priority), work, listener_callbacks());
+}
 
-    interm_signal = in->signal;
+extern "C" JNIEXPORT jlong JNICALL
+Java_jatx_soxtest_ProjectSession_submitApplyJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong handle,
+        jint base,
+        jint type,
+        jdouble value,
+        jboolean draft,
+        jint priority
+        ) {
+    SessionEffect effect;
+    effect.type = (SessionEffectType) type;
+    effect.value = value;
+    effect.draft = draft;
+    JobWork work = [handle, base, effect](RenderReport* report) {
+        return session_apply((uint64_t) handle, (size_t) base, effect, report);
+    };
+    /* A newer effect on the same stage supersedes this one */
+    std::string key = "session " + std::to_string(handle) + " stage " + std::to_string(base);
+    return (jlong) job_submit_latest(key.c_str(), "apply", job_priority_of(priority), work,
+                                     listener_callbacks());
+}
 
-    /* Open the output file; we must specify the output signal characteristics.
-    * Since we are using only simple effects, they are the same as the input
-    * file characteristics */
-    out = sox_open_write(outPathCStr, &interm_signal, NULL, NULL, NULL, NULL);
-    if (!out) {
-        return RESULT_ERROR;
-    }
+extern "C" JNIEXPORT jboolean JNICALL
+Java_jatx_soxtest_ProjectSession_undoJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong handle
+        ) {
+    return session_undo((uint64_t) handle) == RESULT_SUCCESS ? JNI_TRUE : JNI_FALSE;
+}
 
-    /* Create an effects chain; some effects need to know about the input
-    * or output file encoding so we provide that information here */
-    chain = sox_create_effects_chain(&in->encoding, &out->encoding);
+extern "C" JNIEXPORT jlong JNICALL
+Java_jatx_soxtest_ProjectSession_submitPreviewJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle,
+        jstring path,
+        jint priority
+        ) {
+    std::string out = string_of(env, path);
+    JobWork work = [handle, out](RenderReport* report) {
+        return session_preview((uint64_t) handle, out.c_str(), report);
+    };
+    return (jlong) job_submit("preview", job_priority_of(priority), work, listener_callbacks());
+}
 
-    /* The first effect in the effect chain must be something that can source
-    * samples; in this case, we use the built-in handler that inputs
-    * data from an audio file */
-    e = sox_create_effect(sox_find_effect("input"));
-    args[0] = (char *)in;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* This becomes the first `effect' in the chain */
-    if(sox_add_effect(chain, e, &interm_signal, &in->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
+extern "C" JNIEXPORT jlong JNICALL
+Java_jatx_soxtest_ProjectSession_submitExportJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle,
+        jobjectArray outPaths,
+        jobjectArray tags,
+        jint priority
+        ) {
+    std::vector<std::string> outPathList = string_list(env, outPaths);
+    std::vector<std::string> tagList = string_list(env, tags);
+    JobWork work = [handle, outPathList, tagList](RenderReport* report) {
+        return session_export((uint64_t) handle, outPathList, tagList, report);
+    };
+    return (jlong) job_submit("export", job_priority_of(priority), work, listener_callbacks());
+}
 
-    /* Create the `reverse' effect, and initialise it with the desired parameters: */
-    e = sox_create_effect(sox_find_effect("reverse"));
-    if(sox_effect_options(e, 0, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    /* Add the effect to the end of the effects processing chain: */
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
-
-    /* The last effect in the effect chain must be something that only consumes
-    * samples; in this case, we use the built-in handler that outputs
-    * data to an audio file */
-    e = sox_create_effect(sox_find_effect("output"));
-    args[0] = (char *)out;
-    if(sox_effect_options(e, 1, args) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    if(sox_add_effect(chain, e, &interm_signal, &out->signal) != SOX_SUCCESS) {
-        return RESULT_ERROR;
-    }
-    free(e);
+extern "C" JNIEXPORT jint JNICALL
+Java_jatx_soxtest_ProjectSession_effectCountJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong handle
+        ) {
+    return (jint) session_effect_count((uint64_t) handle);
+}
 
-    /* Flow samples through the effects processing chain until EOF is reached */
-    sox_flow_effects(chain, NULL, NULL);
+extern "C" JNIEXPORT jstring JNICALL
+Java_jatx_soxtest_ProjectSession_describeJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle
+        ) {
+    return env->NewStringUTF(session_to_json((uint64_t) handle).c_str());
+}
 
-    /* All done; tidy up: */
-    sox_delete_effects_chain(chain);
-    sox_close(out);
-    sox_close(in);
-    sox_quit();
+extern "C" JNIEXPORT void JNICALL
+Java_jatx_soxtest_ProjectSession_setSpectrogramsJNI(
+        JNIEnv* /* env */,
+        jobject /* this */,
+        jlong handle,
+        jboolean enabled
+        ) {
+    session_set_spectrograms((uint64_t) handle, enabled);
+}
 
-    __android_log_print(ANDROID_LOG_ERROR, APPNAME, "Reverse done");
+extern "C" JNIEXPORT jstring JNICALL
+Java_jatx_soxtest_ProjectSession_spectrogramInfoJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle,
+        jint stage
+        ) {
+    return env->NewStringUTF(session_spectrogram_json((uint64_t) handle, (size_t) stage).c_str());
+}
 
-    return RESULT_SUCCESS;
-}
\ No newline at end of file
+/* The tiles from first on, a byte[] each (see SpectrogramTile); null on
+ * failure. Called off the UI thread, as missing tiles are computed here */
+extern "C" JNIEXPORT jobjectArray JNICALL
+Java_jatx_soxtest_ProjectSession_spectrogramTilesJNI(
+        JNIEnv* env,
+        jobject /* this */,
+        jlong handle,
+        jint stage,
+        jint level,
+        jlong first,
+        jint count
+        ) {
+    std::vector<SpectrogramTile> tiles;
+    if (stage < 0 || level < 0 || first < 0 || count < 0
+            || session_spectrogram((uint64_t) handle, (size_t) stage, (unsigned) level, (uint64_t) first,
+                                   (uint64_t) count, &tiles) != RESULT_SUCCESS) {
+        return NULL;
+    }
+    jobjectArray array = env->NewObjectArray((jsize) tiles.size(), env->FindClass("[B"), NULL);
+    for (size_t i = 0; i < tiles.size(); i++) {
+        jbyteArray values = env->NewByteArray((jsize) tiles[i].values.size());
+        env->SetByteArrayRegion(values, 0, (jsize) tiles[i].values.size(), (jbyte const *) tiles[i].values.data());
+        env->SetObjectArrayElement(array, (jsize) i, values);
+        env->DeleteLocalRef(values);
+    }
+    return array;
+}
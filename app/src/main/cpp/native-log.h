@@ -0,0 +1,18 @@
+#ifndef SOXTEST_NATIVE_LOG_H
+#define SOXTEST_NATIVE_LOG_H
+
+#define APPNAME "SoxTest"
+
+/* The native code is also built for the host (see soxtest-cli.cpp), where
+ * there is no logcat; messages go to stderr instead */
+#ifdef __ANDROID__
+#include <android/log.h>
+#define LOG_E(...) __android_log_print(ANDROID_LOG_ERROR, APPNAME, __VA_ARGS__)
+#define LOG_I(...) __android_log_print(ANDROID_LOG_INFO, APPNAME, __VA_ARGS__)
+#else
+#include <cstdio>
+#define LOG_E(...) (fprintf(stderr, APPNAME ": " __VA_ARGS__), fputc('\n', stderr))
+#define LOG_I(...) LOG_E(__VA_ARGS__)
+#endif
+
+#endif //SOXTEST_NATIVE_LOG_H
@@ -0,0 +1,261 @@
+#include "parallel-decode.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include "native-log.h"
+#include "render-jobs.h"
+#include "sox-ops.h"
+
+#define MAX_DECODE_THREADS 8
+#define READ_BLOCK_SAMPLES 65536
+/* Decoded chunks waiting for the writer, beyond one per worker */
+#define EXTRA_CHUNKS_IN_FLIGHT 2
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+unsigned parallel_decode_threads() {
+    unsigned cores = std::thread::hardware_concurrency();
+    return std::max(1u, std::min(cores, (unsigned) MAX_DECODE_THREADS));
+}
+
+struct DecodedChunk {
+    std::vector<sox_sample_t> samples;
+    sox_signalinfo_t signal = {};
+    uint64_t decoded = 0;  /* samples including any lead-in */
+    bool done = false;
+    bool ok = false;
+};
+
+/* Shared by the workers and the writer; guarded by mutex */
+struct DecodeQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next = 0;       /* next chunk to be claimed by a worker */
+    size_t written = 0;    /* chunks written so far */
+    size_t window = 0;     /* chunks allowed to be decoded ahead of the writer */
+    bool failed = false;
+    double decode_ms = 0;  /* summed over the workers */
+    uint64_t decoded = 0;
+    std::vector<DecodedChunk> results;
+};
+
+static bool decode_chunk(MappedFile const & file, char const * filetype, DecodeChunk const & chunk,
+                         std::vector<uint8_t> & scratch, DecodedChunk * decoded) {
+    void * data;
+    size_t size;
+    if (!chunk.prefix && chunk.ranges.size() == 1) {
+        data = (void *) (file.data() + chunk.ranges[0].offset);
+        size = chunk.ranges[0].size;
+    } else {
+        scratch.clear();
+        if (chunk.prefix) {
+            scratch.insert(scratch.end(), chunk.prefix->begin(), chunk.prefix->end());
+        }
+        for (ByteRange const & range : chunk.ranges) {
+            scratch.insert(scratch.end(), file.data() + range.offset,
+                           file.data() + range.offset + range.size);
+        }
+        data = scratch.data();
+        size = scratch.size();
+    }
+
+    sox_format_t * in = sox_open_mem_read(data, size, NULL, NULL, filetype);
+    if (!in) {
+        return false;
+    }
+    decoded->signal = in->signal;
+    std::vector<sox_sample_t> & samples = decoded->samples;
+    size_t got;
+    do {
+        size_t used = samples.size();
+        samples.resize(used + READ_BLOCK_SAMPLES);
+        got = sox_read(in, samples.data() + used, READ_BLOCK_SAMPLES);
+        samples.resize(used + got);
+    } while (got > 0);
+    sox_close(in);
+    decoded->decoded = samples.size();
+
+    if (chunk.samples > 0) {
+        if (samples.size() < chunk.samples || (!chunk.lead_in && samples.size() != chunk.samples)) {
+            LOG_E("parallel decode: chunk came out with %zu samples instead of %zu",
+                  samples.size(), (size_t) chunk.samples);
+            return false;
+        }
+        samples.erase(samples.begin(), samples.end() - (ptrdiff_t) chunk.samples);
+    }
+    return true;
+}
+
+static void decode_worker(MappedFile const & file, char const * filetype,
+                          std::vector<DecodeChunk> const & chunks, DecodeQueue * queue) {
+    std::vector<uint8_t> scratch;
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    for (;;) {
+        queue->changed.wait(lock, [&] {
+            return queue->failed || queue->next >= chunks.size()
+                    || queue->next < queue->written + queue->window;
+        });
+        if (queue->failed || queue->next >= chunks.size()) {
+            return;
+        }
+        size_t i = queue->next++;
+        lock.unlock();
+
+        DecodedChunk decoded;
+        Clock::time_point start = Clock::now();
+        decoded.ok = decode_chunk(file, filetype, chunks[i], scratch, &decoded);
+        decoded.done = true;
+        double ms = ms_since(start);
+
+        lock.lock();
+        queue->decode_ms += ms;
+        queue->decoded += decoded.decoded;
+        if (!decoded.ok) {
+            queue->failed = true;
+        }
+        queue->results[i] = std::move(decoded);
+        queue->changed.notify_all();
+    }
+}
+
+/* Writes the chunks in order as they come in; runs on the calling thread */
+static bool write_chunks(DecodeQueue * queue, size_t count, sox_format_t * out,
+                         DecodeObserver const & observer, double * writeMs) {
+    for (size_t i = 0; i < count; i++) {
+        std::vector<sox_sample_t> samples;
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->changed.wait(lock, [&] { return queue->failed || queue->results[i].done; });
+            if (queue->failed) {
+                return false;
+            }
+            DecodedChunk & decoded = queue->results[i];
+            if (decoded.signal.rate != out->signal.rate || decoded.signal.channels != out->signal.channels) {
+                LOG_E("parallel decode: chunk %zu changes the signal", i);
+                queue->failed = true;
+                queue->changed.notify_all();
+                return false;
+            }
+            samples.swap(decoded.samples);
+        }
+
+        Clock::time_point start = Clock::now();
+        if (observer) {
+            observer(samples.data(), samples.size());
+        }
+        bool written = sox_write(out, samples.data(), samples.size()) == samples.size();
+        *writeMs += ms_since(start);
+
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            if (!written) {
+                queue->failed = true;
+                queue->changed.notify_all();
+                return false;
+            }
+            queue->written = i + 1;
+            queue->changed.notify_all();
+        }
+
+        /* Outside the lock: a preempted job must not hold up the workers,
+         * which go on decoding up to the window meanwhile */
+        job_report_progress((double) (i + 1) / count);
+        job_yield();
+        if (job_cancelled()) {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->failed = true;
+            queue->changed.notify_all();
+            return false;
+        }
+    }
+    return true;
+}
+
+int parallel_decode_file(char const * stageName, char const * inPath, char const * outPath,
+                         MappedFile const & file, char const * filetype,
+                         std::vector<DecodeChunk> const & chunks, unsigned threads,
+                         RenderReport * report, DecodeObserver const & observer, unsigned precision) {
+    Clock::time_point start = Clock::now();
+    *report = RenderReport();
+    report->operation = "convert";
+    report->in_path = inPath;
+    report->out_path = outPath;
+
+    if (!file.ok() || chunks.empty() || threads < 1 || sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    /* The output gets exactly what a serial conversion would open it with */
+    sox_format_t * whole = sox_open_read(inPath, NULL, NULL, filetype);
+    if (!whole) {
+        return RESULT_ERROR;
+    }
+    sox_signalinfo_t signal = whole->signal;
+    sox_close(whole);
+    if (precision > 0) {
+        signal.precision = precision;
+    }
+
+    sox_format_t * out = sox_open_write(outPath, &signal, NULL, NULL, NULL, NULL);
+    if (!out) {
+        return RESULT_ERROR;
+    }
+
+    DecodeQueue queue;
+    queue.window = threads + EXTRA_CHUNKS_IN_FLIGHT;
+    queue.results.resize(chunks.size());
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; t++) {
+        workers.emplace_back(decode_worker, std::cref(file), filetype, std::cref(chunks), &queue);
+    }
+
+    Clock::time_point flow_start = Clock::now();
+    bool ok = write_chunks(&queue, chunks.size(), out, observer, &report->write_wait_ms);
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.failed = queue.failed || !ok;
+        queue.changed.notify_all();
+    }
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+    report->flow_ms = ms_since(flow_start);
+
+    StageReport stage;
+    stage.name = stageName;
+    stage.flows = threads;
+    stage.flow_ms = queue.decode_ms;
+    stage.flow_calls = chunks.size();
+    stage.samples_in = queue.decoded;
+    stage.samples_out = out->olength;
+    report->stages.push_back(stage);
+
+    report->in_rate = signal.rate;
+    report->out_rate = out->signal.rate;
+    report->channels = signal.channels;
+    report->threads = threads;
+    report->input_bytes = file.size();
+    sox_close(out);
+
+    if (!ok) {
+        remove(outPath);
+        return RESULT_ERROR;
+    }
+    struct stat out_stat;
+    if (stat(outPath, &out_stat) == 0) {
+        report->output_bytes = out_stat.st_size;
+    }
+    report->total_ms = ms_since(start);
+    report->result = RESULT_SUCCESS;
+    return RESULT_SUCCESS;
+}
@@ -0,0 +1,61 @@
+#ifndef SOXTEST_PARALLEL_DECODE_H
+#define SOXTEST_PARALLEL_DECODE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "mapped-io.h"
+#include "render-report.h"
+#include "sox.h"
+
+/* Decoding of one compressed file on several threads.
+ *
+ * A format module (mp3-parallel.h, flac-parallel.h) splits the file into
+ * chunks that libSoX can decode on their own from memory
+ * (sox_open_mem_read()). The chunks are decoded on a pool of worker
+ * threads and their samples are written to the output in file order, so
+ * the writer sees the same sample sequence as a serial decode of the whole
+ * file. A chunk that needs decoder state from before its first frame
+ * starts a few frames early and drops the samples of that lead-in */
+
+struct ByteRange {
+    size_t offset;
+    size_t size;
+};
+
+struct DecodeChunk {
+    /* Bytes put in front of the ranges, e.g. a trimmed stream header; owned
+     * by the format module for the length of the decode */
+    std::vector<uint8_t> const * prefix = NULL;
+    /* Concatenated into the in-memory file handed to libSoX; a single range
+     * without prefix is decoded in place from the mapping */
+    std::vector<ByteRange> ranges;
+    /* Samples (all channels) of the chunk's own frames; 0 if not known */
+    uint64_t samples = 0;
+    /* The ranges start ahead of the chunk's own frames: only the last
+     * `samples' samples out of the decoder belong to it */
+    bool lead_in = false;
+};
+
+/* Called on the writing thread with every block of samples, in order,
+ * before it is written */
+typedef std::function<void(sox_sample_t const * samples, size_t count)> DecodeObserver;
+
+/* Worker threads for a parallel decode on this device; 1 means don't */
+unsigned parallel_decode_threads();
+
+/* Decodes the chunks of file (of the given libSoX file type) with threads
+ * workers and writes outPath with the signal libSoX reports for the whole
+ * file, as sox_convert() would. Fails, leaving no output, when a chunk does
+ * not decode or comes out with a different number of samples than it
+ * should, in which case the caller falls back to the serial decoder. The
+ * report gets one stage named stageName with the summed decode time of the
+ * workers. A precision other than 0 overrides the bits of the output */
+int parallel_decode_file(char const * stageName, char const * inPath, char const * outPath,
+                         MappedFile const & file, char const * filetype,
+                         std::vector<DecodeChunk> const & chunks, unsigned threads,
+                         RenderReport * report, DecodeObserver const & observer = nullptr,
+                         unsigned precision = 0);
+
+#endif //SOXTEST_PARALLEL_DECODE_H
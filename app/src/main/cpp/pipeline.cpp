@@ -0,0 +1,348 @@
+#include "pipeline.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include "rate-plans.h"
+#include "spectrogram.h"
+
+std::string pipeline_format(double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.10g", value);
+    return buf;
+}
+
+EffectSpec pipeline_rate_spec(RateOptions const & options) {
+    EffectSpec spec = {"rate", {std::string("-") + (char) options.quality}};
+    if (options.quality == RATE_QUICK || options.quality == RATE_LOW) {
+        return spec;
+    }
+    if (options.phase == RATE_PHASE_INTERMEDIATE) {
+        spec.args.push_back("-I");
+    } else if (options.phase == RATE_PHASE_MINIMUM) {
+        spec.args.push_back("-M");
+    }
+    if (options.bandwidth > 0) {
+        spec.args.push_back("-b");
+        spec.args.push_back(pipeline_format(options.bandwidth));
+    }
+    if (options.allow_aliasing) {
+        spec.args.push_back("-a");
+    }
+    return spec;
+}
+
+char pipeline_rate_quality(EffectSpec const & spec) {
+    for (std::string const & arg : spec.args) {
+        if (arg.size() == 2 && arg[0] == '-' && strchr("qlmhv", arg[1])) {
+            return arg[1];
+        }
+    }
+    return 'h';
+}
+
+EffectSpec pipeline_wsola_spec(char const * name, double value, bool draft) {
+    if (draft) {
+        return {name, {"-q", pipeline_format(value), DRAFT_SEGMENT_MS, DRAFT_SEARCH_MS, DRAFT_OVERLAP_MS}};
+    }
+    return {name, {pipeline_format(value)}};
+}
+
+double pipeline_now_ms() {
+    return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int pipeline_open(PipelineIo * io, char const * operation, char const * inPath, char const * outPath,
+                  RenderReport * report, RenderOptions const & options, std::vector<EffectSpec> const & effects) {
+    *report = RenderReport();
+    report->operation = operation;
+    report->in_path = inPath;
+    report->out_path = outPath;
+    io->start_ms = pipeline_now_ms();
+    io->options = &options;
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        report->result = RESULT_ERROR;
+        report->error = "sox_init failed";
+        return RESULT_ERROR;
+    }
+
+    io->in = io->mapped_in.open(inPath, options.in_signal, options.in_type);
+    if (!io->in) {
+        report->result = RESULT_ERROR;
+        report->error = std::string("cannot open input: ") + inPath;
+        return RESULT_ERROR;
+    }
+
+    /* As sox_render() opens it, so that the job is the same */
+    sox_signalinfo_t out_signal = io->in->signal;
+    if (options.out_rate > 0) {
+        out_signal.rate = options.out_rate;
+    }
+    if (options.max_out_rate > 0 && out_signal.rate > options.max_out_rate) {
+        out_signal.rate = options.max_out_rate;
+    }
+    if (options.precision > 0) {
+        out_signal.precision = options.precision;
+    }
+    io->checkpointed = checkpoint_run_begin(&io->run, outPath);
+    uint64_t bound = options.map_output ? sox_output_samples_bound(io->in->signal, out_signal, effects) : 0;
+    io->out = io->mapped_out.open(io->checkpointed ? io->run.part_path.c_str() : outPath, &out_signal,
+                                  io->checkpointed ? "wav" : options.out_type,
+                                  bound > 0 ? mapped_wav_bound(out_signal, bound) : 0);
+    if (!io->out) {
+        sox_close(io->in);
+        if (io->checkpointed) {
+            checkpoint_run_end(&io->run, RESULT_ERROR);
+        }
+        report->result = RESULT_ERROR;
+        report->error = std::string("cannot open output: ") + outPath;
+        return RESULT_ERROR;
+    }
+    io->job = checkpoint_job(operation, inPath, out_signal);
+
+    uint64_t length = io->in->signal.length;
+    unsigned channels = io->in->signal.channels;
+    io->total_frames = channels && length != SOX_UNKNOWN_LEN ? length / channels : 0;
+    memory_watch_start(&io->memory, options.memory_budget ? options.memory_budget : memory_budget_get());
+
+    report->in_rate = io->in->signal.rate;
+    report->out_rate = io->out->signal.rate;
+    report->channels = io->in->signal.channels;
+    return RESULT_SUCCESS;
+}
+
+int pipeline_begin(PipelineIo * io, sox_signalinfo_t const & signal) {
+    if (signal.rate != io->out->signal.rate || signal.channels != io->out->signal.channels) {
+        /* e.g. a `pitch' with no `rate' after it */
+        return RESULT_UNSUPPORTED;
+    }
+    if (io->checkpointed
+            && checkpoint_run_resume(&io->run, io->job, io->out, &io->mapped_out, &io->sink) != RESULT_SUCCESS) {
+        io->error = "cannot resume from checkpoint";
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+int pipeline_write(PipelineIo * io, sox_sample_t const * buf, size_t samples) {
+    double start = pipeline_now_ms();
+    int result = io->checkpointed ? checkpoint_sink_write(&io->sink, buf, samples)
+            : sox_write(io->out, buf, samples) == samples ? RESULT_SUCCESS : RESULT_ERROR;
+    io->write_ms += pipeline_now_ms() - start;
+    io->samples_out += samples;
+    return result;
+}
+
+int pipeline_close(PipelineIo * io, int result, RenderReport * report) {
+    report->input_bytes = io->in->tell_off;
+    if (io->mapped_out.close(io->out) != RESULT_SUCCESS && result == RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+        io->error = "cannot close output";
+    }
+    sox_close(io->in);
+
+    if (result != RESULT_SUCCESS && result != RESULT_UNSUPPORTED && io->mapped_out.full() && !job_cancelled()) {
+        /* The output outgrew its bound; sox_render() goes on from the checkpoint */
+        LOG_I("%s: output outgrew its mapping", report->operation.c_str());
+        result = RESULT_UNSUPPORTED;
+    }
+    if (result == RESULT_UNSUPPORTED) {
+        if (!io->checkpointed) {
+            remove(report->out_path.c_str());
+        } else if (!io->sink.out) {
+            /* Never resumed: the part set aside is still the one to go on from */
+            remove(io->run.part_path.c_str());
+            checkpoint_run_end(&io->run, RESULT_ERROR);
+        }
+        return result;
+    }
+    if (io->checkpointed && checkpoint_run_end(&io->run, result) != RESULT_SUCCESS && result == RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+        io->error = "cannot rename output: " + io->run.part_path;
+    }
+
+    StageReport input, output;
+    input.name = "input";
+    input.flows = 1;
+    input.drain_ms = io->read_ms;
+    input.samples_out = io->frames * report->channels;
+    output.name = "output";
+    output.flows = 1;
+    output.flow_ms = io->write_ms;
+    output.samples_in = io->samples_out;
+    report->stages = {input};
+    report->flow_ms = io->read_ms + io->write_ms;
+    for (StageReport const & stage : io->stages) {
+        report->stages.push_back(stage);
+        report->flow_ms += stage.flow_ms + stage.drain_ms;
+        report->clips += stage.clips;
+    }
+    report->stages.push_back(output);
+    report->read_wait_ms = io->read_ms;
+    report->write_wait_ms = io->write_ms;
+    report->resumed_samples = io->run.resumed;
+    report->peak_rss_bytes = io->memory.peak;
+    report->rss_growth_bytes = io->memory.peak - io->memory.baseline;
+    if (io->measuring && result == RESULT_SUCCESS) {
+        loudness_meter_finish(io->loudness, &report->loudness);
+    }
+    if (io->scanning && result == RESULT_SUCCESS) {
+        silence_scanner_finish(io->silence, &report->silence);
+    }
+
+    struct stat out_stat;
+    if (stat(report->out_path.c_str(), &out_stat) == 0) {
+        report->output_bytes = out_stat.st_size;
+    }
+    report->total_ms = pipeline_now_ms() - io->start_ms;
+    report->result = result;
+    if (result != RESULT_SUCCESS) {
+        report->error = job_cancelled() ? "cancelled" : io->memory.exceeded ? "memory budget exceeded"
+                : !io->error.empty() ? io->error : "write failed";
+        LOG_E("%s failed: %s", report->operation.c_str(), report->error.c_str());
+    }
+    return result;
+}
+
+/* The effect of spec, its options given, or the tap it names */
+static sox_effect_t * create_effect(EffectSpec const & spec, PipelineIo * io) {
+    if (spec.name == LOUDNESS_EFFECT) {
+        io->measuring = true;
+        return loudness_tap_create(&io->loudness);
+    }
+    if (spec.name == SPECTROGRAM_EFFECT) {
+        return io->options->spectrogram ? spectrogram_tap_create(io->options->spectrogram) : NULL;
+    }
+    if (spec.name == SILENCE_EFFECT) {
+        io->scanning = true;
+        return silence_tap_create(&io->silence, io->options->silence);
+    }
+
+    sox_effect_handler_t const * handler = sox_find_effect(spec.name.c_str());
+    sox_effect_t * e = handler ? sox_create_effect(handler) : NULL;
+    if (!e) {
+        return NULL;
+    }
+    char * args[10];
+    int argc = 0;
+    for (; argc < (int) spec.args.size() && argc < 10; argc++) {
+        args[argc] = (char *) spec.args[argc].c_str();
+    }
+    if (sox_effect_options(e, argc, args) != SOX_SUCCESS) {
+        free(e->priv);
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+static void * copy_priv(sox_effect_t const & effect) {
+    void * priv = malloc(effect.handler.priv_size ? effect.handler.priv_size : 1);
+    memcpy(priv, effect.priv, effect.handler.priv_size);
+    return priv;
+}
+
+int PipelineEffect::start(EffectSpec const & spec, PipelineIo * io, sox_signalinfo_t * signal) {
+    /* The DFT size is fixed when the effect starts */
+    size_t log2DftSize = spec.name == "rate"
+            ? rate_plan_get(signal->rate, io->out->signal.rate, pipeline_rate_quality(spec)) : 0;
+    ScopedDftSize dftSize(log2DftSize);
+    checkpoint_job_add(&io->job, spec, log2DftSize);
+    report_.name = spec.name;
+
+    sox_effect_t * e = create_effect(spec, io);
+    if (!e) {
+        io->error = "cannot add effect: " + spec.name;
+        return RESULT_ERROR;
+    }
+    sox_effect_t effect = *e;
+    free(e);
+
+    /* What sox_add_effect() sets up before and after the start */
+    unsigned flags = effect.handler.flags;
+    effect.global_info = sox_get_effects_globals();
+    effect.in_signal = *signal;
+    effect.out_signal = io->out->signal;
+    effect.in_encoding = &io->in->encoding;
+    effect.out_encoding = &io->out->encoding;
+    if (!(flags & SOX_EFF_CHAN)) {
+        effect.out_signal.channels = signal->channels;
+    }
+    if (!(flags & SOX_EFF_RATE)) {
+        effect.out_signal.rate = signal->rate;
+    }
+    if (!(flags & SOX_EFF_PREC)) {
+        effect.out_signal.precision = flags & SOX_EFF_MODIFY ? signal->precision : SOX_SAMPLE_PRECISION;
+    }
+    if (!(flags & SOX_EFF_GAIN)) {
+        effect.out_signal.mult = signal->mult;
+    }
+    effect.flows = flags & SOX_EFF_MCHAN ? 1 : signal->channels;
+    effect.clips = 0;
+    effect.imin = 0;
+
+    /* The other flows start from the state before the first one started */
+    sox_effect_t eff0 = effect;
+    eff0.priv = copy_priv(effect);
+    eff0.in_signal.mult = NULL;
+    int started = effect.handler.start(&effect);
+    if (started != SOX_SUCCESS) {
+        effect.handler.kill(&effect);
+        free(effect.priv);
+        free(eff0.priv);
+        if (started != SOX_EFF_NULL) {
+            io->error = "cannot start effect: " + spec.name;
+            return RESULT_ERROR;
+        }
+        return RESULT_SUCCESS;
+    }
+
+    if (!(flags & SOX_EFF_LENGTH)) {
+        effect.out_signal.length = signal->length;
+        if (effect.out_signal.length != SOX_UNKNOWN_LEN && (flags & SOX_EFF_RATE)) {
+            effect.out_signal.length = effect.out_signal.length / signal->rate * effect.out_signal.rate + .5;
+        }
+    }
+    *signal = effect.out_signal;
+    report_.flows = effect.flows;
+
+    flows_.reserve(effect.flows);
+    flows_.push_back(effect);
+    int result = RESULT_SUCCESS;
+    for (size_t f = 1; f < effect.flows && result == RESULT_SUCCESS; f++) {
+        flows_.push_back(eff0);
+        flows_.back().flow = f;
+        flows_.back().priv = copy_priv(eff0);
+        if (flows_.back().handler.start(&flows_.back()) != SOX_SUCCESS) {
+            io->error = "cannot start effect: " + spec.name;
+            result = RESULT_ERROR;
+        }
+    }
+    free(eff0.priv);
+    return result;
+}
+
+StageReport PipelineEffect::report() const {
+    StageReport report = report_;
+    for (sox_effect_t const & flow : flows_) {
+        report.clips += flow.clips;
+    }
+    return report;
+}
+
+PipelineEffect::~PipelineEffect() {
+    if (flows_.empty()) {
+        return;
+    }
+    for (sox_effect_t & flow : flows_) {
+        flow.handler.stop(&flow);
+    }
+    /* Once per effect, not per flow */
+    flows_[0].handler.kill(&flows_[0]);
+    for (sox_effect_t & flow : flows_) {
+        free(flow.priv);
+    }
+}
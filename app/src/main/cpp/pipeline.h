@@ -0,0 +1,567 @@
+#ifndef SOXTEST_PIPELINE_H
+#define SOXTEST_PIPELINE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "checkpoint.h"
+#include "job-arena.h"
+#include "loudness.h"
+#include "mapped-io.h"
+#include "memory-budget.h"
+#include "native-log.h"
+#include "render-jobs.h"
+#include "silence.h"
+#include "sox-ops.h"
+
+/* Typed effects and compile-time pipelines of them.
+ *
+ * Every effect the app runs often is a struct that knows its libSoX effect
+ * and options, so callers of sox_render need no string handling:
+ *
+ *   sox_render("pitch", in, out, {Pitch{300}.spec(), Rate{}.spec()}, report);
+ *
+ * They also run as a pipeline, with taps (LOUDNESS_EFFECT,
+ * SPECTROGRAM_EFFECT, SILENCE_EFFECT) after the last of them:
+ *
+ *   run_pipeline("gain", in, out, report, RenderOptions(), {}, Gain{-3}, Fade{2, 5});
+ *   run_pipeline("pitch", in, out, report, options, {Loudness().spec()}, Pitch{300}, Rate{});
+ *
+ * For a mono or stereo input the whole chain is one fused loop with the
+ * channel count and block size as template parameters. The sample-wise
+ * stages (Gain, Fade) are inlined, rounding as their libSoX effects do;
+ * the others (Tempo, Pitch, Rate) and the taps have their libSoX handlers
+ * called directly, started and flowed as a chain would (one flow per
+ * channel unless the effect takes them all), with the deinterleaving
+ * unrolled for the channel count and no buffers between the stages beyond
+ * one block each. The output is the same sample for sample, and a
+ * checkpointed output resumes as one of sox_render does, from the same
+ * job. Anything the fused loop cannot handle falls back to sox_render */
+
+std::string pipeline_format(double value);
+
+/* WSOLA settings of draft tempo/pitch stages: quick search over shorter
+ * segment, search and overlap windows (ms) than the defaults of 82/14.68/12 */
+#define DRAFT_SEGMENT_MS "60"
+#define DRAFT_SEARCH_MS "6"
+#define DRAFT_OVERLAP_MS "8"
+
+/* Options of `tempo' and `pitch'; both take [-q] value [segment [search [overlap]]] */
+EffectSpec pipeline_wsola_spec(char const * name, double value, bool draft);
+
+struct Tempo {
+    double factor;
+    bool draft = false;
+
+    static constexpr bool sample_wise = false;
+    EffectSpec spec() const { return pipeline_wsola_spec("tempo", factor, draft); }
+};
+
+struct Pitch {
+    double cents;
+    bool draft = false;
+
+    static constexpr bool sample_wise = false;
+    EffectSpec spec() const { return pipeline_wsola_spec("pitch", cents, draft); }
+};
+
+EffectSpec pipeline_rate_spec(RateOptions const & options);
+/* Quality option of a `rate' spec (-q, -l, -m, -h or -v); libSoX
+ * defaults to high */
+char pipeline_rate_quality(EffectSpec const & spec);
+
+/* Converts to the output file's rate */
+struct Rate {
+    RateOptions options;
+
+    static constexpr bool sample_wise = false;
+    EffectSpec spec() const { return pipeline_rate_spec(options); }
+};
+
+/* Measures the loudness at its place into report->loudness (loudness.h) */
+struct Loudness {
+    EffectSpec spec() const { return {LOUDNESS_EFFECT, {}}; }
+};
+
+struct Gain {
+    double db;
+
+    static constexpr bool sample_wise = true;
+    static constexpr bool needs_length = false;
+    EffectSpec spec() const { return {"gain", {pipeline_format(db)}}; }
+
+    void prepare(double /* rate */, uint64_t /* frames */) {
+        /* dB_to_linear() of libSoX's `gain' */
+        factor = std::exp(db * M_LN10 * 0.05);
+    }
+    template<unsigned Channels>
+    void process(sox_sample_t * buf, size_t frames, uint64_t /* first */, uint64_t * clips) const {
+        for (size_t i = 0; i < frames * Channels; i++) {
+            double value = buf[i] * factor;
+            buf[i] = SOX_ROUND_CLIP_COUNT(value, *clips);
+        }
+    }
+
+    double factor = 1;
+};
+
+/* Linear fade in from the start and fade out to the end of the audio */
+struct Fade {
+    double in_seconds;
+    double out_seconds;
+
+    static constexpr bool sample_wise = true;
+    static constexpr bool needs_length = true;
+    EffectSpec spec() const {
+        EffectSpec spec = {"fade", {"t", pipeline_format(in_seconds)}};
+        if (out_seconds > 0) {
+            spec.args.push_back("0");
+            spec.args.push_back(pipeline_format(out_seconds));
+        }
+        return spec;
+    }
+
+    /* As libSoX's `fade' does: lengths rounded to frames, the fade in
+     * before the fade out where they overlap, and the products truncated */
+    void prepare(double rate, uint64_t frames) {
+        in_frames = (uint64_t) (in_seconds * rate + 0.5);
+        out_frames = std::min(frames, (uint64_t) (out_seconds * rate + 0.5));
+        total_frames = frames;
+    }
+    double gain_at(uint64_t frame) const {
+        if (frame < in_frames) {
+            return (double) frame / in_frames;
+        }
+        if (frame + out_frames >= total_frames && out_frames > 0) {
+            return (double) (total_frames - frame) / out_frames;
+        }
+        return 1;
+    }
+    template<unsigned Channels>
+    void process(sox_sample_t * buf, size_t frames, uint64_t first, uint64_t * /* clips */) const {
+        if (first >= in_frames && first + frames + out_frames <= total_frames) {
+            return;
+        }
+        for (size_t i = 0; i < frames; i++) {
+            double gain = gain_at(first + i);
+            for (unsigned c = 0; c < Channels; c++) {
+                buf[i * Channels + c] = (sox_sample_t) (buf[i * Channels + c] * gain);
+            }
+        }
+    }
+
+    uint64_t in_frames = 0;
+    uint64_t out_frames = 0;
+    uint64_t total_frames = 0;
+};
+
+#define PIPELINE_BLOCK_FRAMES 4096
+
+/* Returned by the fused path when the input is outside its specialisations */
+#define RESULT_UNSUPPORTED 1
+
+/* Files, taps and report bookkeeping of a fused pipeline */
+struct PipelineIo {
+    MappedInput mapped_in;
+    MappedOutput mapped_out;
+    sox_format_t * in = NULL;
+    sox_format_t * out = NULL;
+    RenderOptions const * options = NULL;
+    std::string job;          /* signature of the render, see checkpoint.h */
+    bool checkpointed = false;
+    CheckpointRun run;
+    CheckpointSink sink;
+    LoudnessMeter loudness;   /* of a LOUDNESS_EFFECT tap */
+    bool measuring = false;
+    SilenceScanner silence;   /* of a SILENCE_EFFECT tap */
+    bool scanning = false;
+    MemoryWatch memory;
+    double start_ms = 0;
+    uint64_t total_frames = 0;  /* of the input, 0 if unknown */
+    uint64_t frames = 0;
+    uint64_t samples_out = 0;
+    double read_ms = 0;
+    double write_ms = 0;
+    std::vector<StageReport> stages;  /* between input and output */
+    std::string error;
+};
+
+/* Opens the input and the output (or its checkpoint part) with the signal
+ * sox_render would give it; effects are the whole chain, for the bound of
+ * a mapped output */
+int pipeline_open(PipelineIo * io, char const * operation, char const * inPath, char const * outPath,
+                  RenderReport * report, RenderOptions const & options, std::vector<EffectSpec> const & effects);
+/* Once the effects are started and have brought the input to signal:
+ * resumes a checkpointed output */
+int pipeline_begin(PipelineIo * io, sox_signalinfo_t const & signal);
+/* Writes through the checkpoint sink of a checkpointed output */
+int pipeline_write(PipelineIo * io, sox_sample_t const * buf, size_t samples);
+int pipeline_close(PipelineIo * io, int result, RenderReport * report);
+double pipeline_now_ms();
+
+/* A libSoX effect without a chain: started as sox_add_effect() does, with
+ * a flow per channel unless the effect takes them all (SOX_EFF_MCHAN), and
+ * stopped and killed as sox_delete_effect() does */
+class PipelineEffect {
+public:
+    PipelineEffect() = default;
+    PipelineEffect(PipelineEffect const &) = delete;
+    PipelineEffect & operator=(PipelineEffect const &) = delete;
+    ~PipelineEffect();
+
+    /* Creates the effect or tap of spec and starts it on *signal, which
+     * becomes its output signal. An effect that would do nothing
+     * (SOX_EFF_NULL) stays inactive, as libSoX leaves it out of a chain */
+    int start(EffectSpec const & spec, PipelineIo * io, sox_signalinfo_t * signal);
+    bool active() const { return !flows_.empty(); }
+    StageReport report() const;
+
+protected:
+    std::vector<sox_effect_t> flows_;
+    StageReport report_;
+};
+
+/* Drives the flows of an effect a block at a time: push() hands each
+ * output block to next as it comes, as sox_flow_effects() passes it down
+ * the chain */
+template<unsigned Channels, size_t BlockFrames>
+class PipelineHandler : public PipelineEffect {
+public:
+    int start(EffectSpec const & spec, PipelineIo * io, JobArena * arena, sox_signalinfo_t * signal) {
+        int result = PipelineEffect::start(spec, io, signal);
+        if (result != RESULT_SUCCESS || !active()) {
+            return result;
+        }
+        out_ = arena->allocate_array<sox_sample_t>(BlockFrames * Channels);
+        if (flows_.size() > 1) {
+            for (unsigned c = 0; c < Channels; c++) {
+                channel_in_[c] = arena->allocate_array<sox_sample_t>(BlockFrames);
+                channel_out_[c] = arena->allocate_array<sox_sample_t>(BlockFrames);
+            }
+        }
+        return RESULT_SUCCESS;
+    }
+
+    template<class Next>
+    int push(sox_sample_t * in, size_t frames, Next const & next) {
+        if (!active()) {
+            return next(in, frames);
+        }
+        report_.samples_in += frames * Channels;
+        while (frames > 0) {
+            size_t inFrames = std::min(frames, BlockFrames);
+            size_t outFrames = BlockFrames;
+            double start = pipeline_now_ms();
+            int status = flow(in, &inFrames, &outFrames);
+            report_.flow_ms += pipeline_now_ms() - start;
+            report_.flow_calls++;
+            if (status != SOX_SUCCESS || (inFrames == 0 && outFrames == 0)) {
+                return RESULT_ERROR;
+            }
+            in += inFrames * Channels;
+            frames -= inFrames;
+            report_.samples_out += outFrames * Channels;
+            if (outFrames > 0 && next(out_, outFrames) != RESULT_SUCCESS) {
+                return RESULT_ERROR;
+            }
+        }
+        return RESULT_SUCCESS;
+    }
+
+    template<class Next>
+    int drain(Next const & next) {
+        if (!active()) {
+            return RESULT_SUCCESS;
+        }
+        for (;;) {
+            size_t outFrames = BlockFrames;
+            double start = pipeline_now_ms();
+            int status = drain(&outFrames);
+            report_.drain_ms += pipeline_now_ms() - start;
+            report_.drain_calls++;
+            report_.samples_out += outFrames * Channels;
+            if (outFrames > 0 && next(out_, outFrames) != RESULT_SUCCESS) {
+                return RESULT_ERROR;
+            }
+            if (outFrames == 0 || status != SOX_SUCCESS) {
+                return RESULT_SUCCESS;
+            }
+        }
+    }
+
+private:
+    int flow(sox_sample_t const * in, size_t * inFrames, size_t * outFrames) {
+        if (flows_.size() == 1) {
+            size_t isamp = *inFrames * Channels, osamp = *outFrames * Channels;
+            int status = flows_[0].handler.flow(&flows_[0], in, out_, &isamp, &osamp);
+            *inFrames = isamp / Channels;
+            *outFrames = osamp / Channels;
+            return status;
+        }
+        for (size_t i = 0; i < *inFrames; i++) {
+            for (unsigned c = 0; c < Channels; c++) {
+                channel_in_[c][i] = in[i * Channels + c];
+            }
+        }
+        int status = SOX_SUCCESS;
+        size_t idone = 0, odone = 0;
+        for (unsigned c = 0; c < Channels; c++) {
+            size_t isamp = *inFrames, osamp = *outFrames;
+            if (flows_[c].handler.flow(&flows_[c], channel_in_[c], channel_out_[c], &isamp, &osamp) != SOX_SUCCESS) {
+                status = SOX_EOF;
+            }
+            if (c > 0 && (isamp != idone || osamp != odone)) {
+                LOG_E("%s flowed asymmetrically", report_.name.c_str());
+                status = SOX_EOF;
+            }
+            idone = isamp;
+            odone = osamp;
+        }
+        interleave(odone);
+        *inFrames = idone;
+        *outFrames = odone;
+        return status;
+    }
+
+    int drain(size_t * outFrames) {
+        if (flows_.size() == 1) {
+            size_t osamp = *outFrames * Channels;
+            int status = flows_[0].handler.drain(&flows_[0], out_, &osamp);
+            *outFrames = osamp / Channels;
+            return status;
+        }
+        int status = SOX_SUCCESS;
+        size_t odone = 0;
+        for (unsigned c = 0; c < Channels; c++) {
+            size_t osamp = *outFrames;
+            if (flows_[c].handler.drain(&flows_[c], channel_out_[c], &osamp) != SOX_SUCCESS) {
+                status = SOX_EOF;
+            }
+            if (c > 0 && osamp != odone) {
+                LOG_E("%s drained asymmetrically", report_.name.c_str());
+                status = SOX_EOF;
+            }
+            odone = osamp;
+        }
+        interleave(odone);
+        *outFrames = odone;
+        return status;
+    }
+
+    void interleave(size_t frames) {
+        for (size_t i = 0; i < frames; i++) {
+            for (unsigned c = 0; c < Channels; c++) {
+                out_[i * Channels + c] = channel_out_[c][i];
+            }
+        }
+    }
+
+    sox_sample_t * out_ = NULL;
+    sox_sample_t * channel_in_[Channels] = {};
+    sox_sample_t * channel_out_[Channels] = {};
+};
+
+/* A typed stage of the fused loop: run through its libSoX handler... */
+template<class Stage, unsigned Channels, size_t BlockFrames, bool SampleWise = Stage::sample_wise>
+class PipelineStep : public PipelineHandler<Channels, BlockFrames> {
+public:
+    explicit PipelineStep(Stage const & stage) : stage_(stage) {}
+
+    int start(PipelineIo * io, JobArena * arena, sox_signalinfo_t * signal) {
+        return PipelineHandler<Channels, BlockFrames>::start(stage_.spec(), io, arena, signal);
+    }
+
+private:
+    Stage stage_;
+};
+
+/* ...or, for a sample-wise one, inlined on the block in place */
+template<class Stage, unsigned Channels, size_t BlockFrames>
+class PipelineStep<Stage, Channels, BlockFrames, true> {
+public:
+    explicit PipelineStep(Stage const & stage) : stage_(stage) {}
+
+    int start(PipelineIo * io, JobArena * /* arena */, sox_signalinfo_t * signal) {
+        EffectSpec spec = stage_.spec();
+        checkpoint_job_add(&io->job, spec, 0);
+        report_.name = spec.name;
+        report_.flows = 1;
+        uint64_t frames = signal->length != SOX_UNKNOWN_LEN ? signal->length / Channels : 0;
+        if (Stage::needs_length && frames == 0) {
+            return RESULT_UNSUPPORTED;
+        }
+        stage_.prepare(signal->rate, frames);
+        return RESULT_SUCCESS;
+    }
+
+    template<class Next>
+    int push(sox_sample_t * buf, size_t frames, Next const & next) {
+        double start = pipeline_now_ms();
+        stage_.template process<Channels>(buf, frames, frame_, &report_.clips);
+        report_.flow_ms += pipeline_now_ms() - start;
+        report_.flow_calls++;
+        report_.samples_in += frames * Channels;
+        report_.samples_out += frames * Channels;
+        frame_ += frames;
+        return next(buf, frames);
+    }
+
+    template<class Next>
+    int drain(Next const & /* next */) { return RESULT_SUCCESS; }
+
+    bool active() const { return true; }
+    StageReport report() const { return report_; }
+
+private:
+    Stage stage_;
+    uint64_t frame_ = 0;
+    StageReport report_;
+};
+
+template<unsigned Channels, size_t BlockFrames>
+using PipelineTaps = std::vector<std::unique_ptr<PipelineHandler<Channels, BlockFrames>>>;
+
+/* Hands a block to tap t and what comes out of it down to the output */
+template<unsigned Channels, size_t BlockFrames>
+int pipeline_push_taps(PipelineIo * io, PipelineTaps<Channels, BlockFrames> & taps, size_t t,
+                       sox_sample_t * buf, size_t frames) {
+    if (t == taps.size()) {
+        return pipeline_write(io, buf, frames * Channels);
+    }
+    return taps[t]->push(buf, frames, [&](sox_sample_t * out, size_t outFrames) {
+        return pipeline_push_taps<Channels, BlockFrames>(io, taps, t + 1, out, outFrames);
+    });
+}
+
+/* Hands a block to step I and what comes out of it down the pipeline */
+template<unsigned Channels, size_t BlockFrames, size_t I, class Steps>
+int pipeline_push(PipelineIo * io, Steps & steps, PipelineTaps<Channels, BlockFrames> & taps,
+                  sox_sample_t * buf, size_t frames) {
+    if constexpr (I == std::tuple_size<Steps>::value) {
+        return pipeline_push_taps<Channels, BlockFrames>(io, taps, 0, buf, frames);
+    } else {
+        return std::get<I>(steps).push(buf, frames, [&](sox_sample_t * out, size_t outFrames) {
+            return pipeline_push<Channels, BlockFrames, I + 1>(io, steps, taps, out, outFrames);
+        });
+    }
+}
+
+/* Drains the steps from I on, then the taps, each through the rest */
+template<unsigned Channels, size_t BlockFrames, size_t I, class Steps>
+int pipeline_drain(PipelineIo * io, Steps & steps, PipelineTaps<Channels, BlockFrames> & taps) {
+    if constexpr (I == std::tuple_size<Steps>::value) {
+        for (size_t t = 0; t < taps.size(); t++) {
+            int result = taps[t]->drain([&](sox_sample_t * out, size_t outFrames) {
+                return pipeline_push_taps<Channels, BlockFrames>(io, taps, t + 1, out, outFrames);
+            });
+            if (result != RESULT_SUCCESS) {
+                return result;
+            }
+        }
+        return RESULT_SUCCESS;
+    } else {
+        int result = std::get<I>(steps).drain([&](sox_sample_t * out, size_t outFrames) {
+            return pipeline_push<Channels, BlockFrames, I + 1>(io, steps, taps, out, outFrames);
+        });
+        return result == RESULT_SUCCESS ? pipeline_drain<Channels, BlockFrames, I + 1>(io, steps, taps) : result;
+    }
+}
+
+template<unsigned Channels, size_t BlockFrames, class... Stages>
+int pipeline_fused_loop(PipelineIo * io, JobArena * arena, std::vector<EffectSpec> const & tapSpecs,
+                        Stages const &... stages) {
+    std::tuple<PipelineStep<Stages, Channels, BlockFrames>...> steps(stages...);
+    PipelineTaps<Channels, BlockFrames> taps;
+
+    /* Started in chain order, each on the signal of the one before */
+    sox_signalinfo_t signal = io->in->signal;
+    int result = RESULT_SUCCESS;
+    std::apply([&](auto &... step) {
+        ((result = result == RESULT_SUCCESS ? step.start(io, arena, &signal) : result), ...);
+    }, steps);
+    for (size_t t = 0; t < tapSpecs.size() && result == RESULT_SUCCESS; t++) {
+        taps.emplace_back(new PipelineHandler<Channels, BlockFrames>());
+        result = taps.back()->start(tapSpecs[t], io, arena, &signal);
+    }
+    if (result == RESULT_SUCCESS) {
+        result = pipeline_begin(io, signal);
+    }
+
+    sox_sample_t * buf = arena->allocate_array<sox_sample_t>(BlockFrames * Channels);
+    while (result == RESULT_SUCCESS) {
+        double start = pipeline_now_ms();
+        size_t samples = sox_read(io->in, buf, BlockFrames * Channels);
+        io->read_ms += pipeline_now_ms() - start;
+        if (samples == 0) {
+            result = pipeline_drain<Channels, BlockFrames, 0>(io, steps, taps);
+            break;
+        }
+
+        size_t frames = samples / Channels;
+        io->frames += frames;
+        result = pipeline_push<Channels, BlockFrames, 0>(io, steps, taps, buf, frames);
+
+        /* The block boundary, as flow_callback() is for a libSoX chain */
+        job_yield();
+        if (io->total_frames > 0) {
+            job_report_progress((double) io->frames / io->total_frames);
+        }
+        if (!memory_watch_check(&io->memory) || job_cancelled()) {
+            result = RESULT_ERROR;
+        }
+    }
+
+    std::apply([&](auto &... step) {
+        ((step.active() ? io->stages.push_back(step.report()) : void()), ...);
+    }, steps);
+    for (auto const & tap : taps) {
+        if (tap->active()) {
+            io->stages.push_back(tap->report());
+        }
+    }
+    return result;
+}
+
+template<class... Stages>
+int pipeline_run_fused(char const * operation, char const * inPath, char const * outPath,
+                       RenderReport * report, RenderOptions const & options,
+                       std::vector<EffectSpec> const & taps, Stages const &... stages) {
+    RenderReport localReport;
+    PipelineIo io;
+    JobArena arena;
+    if (!report) {
+        report = &localReport;
+    }
+    std::vector<EffectSpec> chain = {stages.spec()...};
+    chain.insert(chain.end(), taps.begin(), taps.end());
+    if (pipeline_open(&io, operation, inPath, outPath, report, options, chain) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    unsigned channels = io.in->signal.channels;
+    int result = channels == 1 ? pipeline_fused_loop<1, PIPELINE_BLOCK_FRAMES>(&io, &arena, taps, stages...)
+            : channels == 2 ? pipeline_fused_loop<2, PIPELINE_BLOCK_FRAMES>(&io, &arena, taps, stages...)
+            : RESULT_UNSUPPORTED;
+    return pipeline_close(&io, result, report);
+}
+
+/* Stages: Gain, Fade, Tempo, Pitch, Rate; taps: specs of LOUDNESS_EFFECT,
+ * SPECTROGRAM_EFFECT (into options.spectrogram) or SILENCE_EFFECT */
+template<class... Stages>
+int run_pipeline(char const * operation, char const * inPath, char const * outPath, RenderReport * report,
+                 RenderOptions const & options, std::vector<EffectSpec> const & taps, Stages const &... stages) {
+    int result = pipeline_run_fused(operation, inPath, outPath, report, options, taps, stages...);
+    if (result != RESULT_UNSUPPORTED) {
+        return result;
+    }
+    std::vector<EffectSpec> chain = {stages.spec()...};
+    chain.insert(chain.end(), taps.begin(), taps.end());
+    return sox_render(operation, inPath, outPath, chain, report, options);
+}
+
+#endif //SOXTEST_PIPELINE_H
@@ -0,0 +1,728 @@
+#include "project-session.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped-io.h"
+#include "multi-export.h"
+#include "native-log.h"
+#include "pipeline.h"
+#include "parallel-decode.h"
+#include "render-cache.h"
+#include "spectrogram.h"
+
+/* Bits of the stage files: every sample as the effects made it */
+#define STAGE_PRECISION 32
+
+struct Stage {
+    uint64_t id = 0;          /* new for every render of the stage */
+    SessionEffect effect;     /* that made it; none for the source */
+    std::string file;         /* the audio, see stage_file_locked() */
+    LoudnessReport loudness;  /* measured while it was rendered */
+    std::string chain;        /* the effects up to it, see describe_effect() */
+    std::shared_ptr<Spectrogram> spectrogram;   /* tiles of the file */
+};
+
+struct Session {
+    std::mutex mutex;
+    std::string dir;
+    std::string source_path;
+    std::string source_digest;  /* empty if the source could not be hashed */
+    unsigned precision = 0;     /* of the source: the preview's and the export's */
+    std::vector<Stage> stages;
+    uint64_t last_stage_id = 0;
+    bool spectrograms = false;  /* computed while stages render */
+    /* Files renders are writing or reading outside the lock, once per
+     * holder; they stay on disk until released, see StageFiles */
+    std::multiset<std::string> busy;
+
+    ~Session();
+};
+
+/* Numbers the stage files of the process that have no key */
+static std::atomic<uint64_t> last_stage_file(0);
+
+Session::~Session() {
+    for (Stage const & stage : stages) {
+        remove(stage.file.c_str());
+    }
+}
+
+static std::mutex sessions_mutex;
+static std::map<uint64_t, std::shared_ptr<Session>> sessions;
+static uint64_t last_session = 0;
+
+static std::shared_ptr<Session> find_session(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    auto it = sessions.find(handle);
+    return it == sessions.end() ? std::shared_ptr<Session>() : it->second;
+}
+
+static char const * effect_name(SessionEffectType type) {
+    switch (type) {
+        case SESSION_TEMPO: return "tempo";
+        case SESSION_PITCH: return "pitch";
+        case SESSION_REVERSE: return "reverse";
+        case SESSION_NORMALIZE: return "normalize";
+    }
+    return "unknown";
+}
+
+static int fail(RenderReport * report, char const * operation, std::string const & error) {
+    LOG_E("%s failed: %s", operation, error.c_str());
+    report->operation = operation;
+    report->result = RESULT_ERROR;
+    report->error = error;
+    return RESULT_ERROR;
+}
+
+/* The chain of stage below with effect added; the key of the stage's
+ * statistics along with the source's digest. The options of each `rate'
+ * the effect runs (quality, phase, bandwidth) are part of it, as the
+ * default quality follows the tuning */
+static std::string describe_effect(std::string const & below, SessionEffect const & effect) {
+    std::string chain = below + "|" + effect_name(effect.type);
+    if (effect.type != SESSION_REVERSE) {
+        chain += " " + pipeline_format(effect.value);
+    }
+    std::vector<EffectSpec> specs;
+    RenderOptions options;
+    if (effect.type != SESSION_NORMALIZE
+            && sox_effect_chain(effect_name(effect.type), effect.value, effect.draft ? RENDER_DRAFT : RENDER_FULL,
+                                &specs, &options) == RESULT_SUCCESS) {
+        for (EffectSpec const & spec : specs) {
+            if (spec.name != "rate") {
+                continue;
+            }
+            chain += " rate";
+            for (std::string const & arg : spec.args) {
+                chain += " " + arg;
+            }
+        }
+    }
+    return effect.draft ? chain + " draft" : chain;
+}
+
+static std::string stats_key(std::string const & digest, std::string const & chain) {
+    return digest.empty() ? "" : render_cache_chain_key(digest, "session|" + chain);
+}
+
+static bool stage_has_file_locked(Session const * session, std::string const & file) {
+    for (Stage const & stage : session->stages) {
+        if (stage.file == file) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Removes file unless a stage has it or a render holds it; the callers
+ * hold the session's lock */
+static void remove_unused_locked(Session const * session, std::string const & file) {
+    if (!file.empty() && session->busy.count(file) == 0 && !stage_has_file_locked(session, file)) {
+        remove(file.c_str());
+    }
+}
+
+/* The stage files a call holds while it renders or reads them outside the
+ * session's lock; released when it goes. Declare it ahead of the lock
+ * guards, so that it goes after them */
+class StageFiles {
+public:
+    explicit StageFiles(Session * session) : session_(session) {}
+    StageFiles(StageFiles const &) = delete;
+    StageFiles & operator=(StageFiles const &) = delete;
+
+    ~StageFiles() {
+        std::lock_guard<std::mutex> lock(session_->mutex);
+        for (std::string const & file : files_) {
+            session_->busy.erase(session_->busy.find(file));
+            remove_unused_locked(session_, file);
+        }
+    }
+
+    /* Under the session's lock */
+    void hold_locked(std::string const & file) {
+        session_->busy.insert(file);
+        files_.push_back(file);
+    }
+
+private:
+    Session * session_;
+    std::vector<std::string> files_;
+};
+
+/* The file of a new stage of key, held by files. It is named after the
+ * key, so a render of the stage again, in this process or after a
+ * restart, writes the same file and finds the checkpoints of a render cut
+ * short. A file of a stage of the session is complete: *done tells the
+ * stage's statistics and there is nothing to render. A stage with no key,
+ * or whose file another render is writing, gets a file of its own */
+static std::string stage_file_locked(Session * session, StageFiles * files, std::string const & key,
+                                     bool * done, LoudnessReport * loudness) {
+    *done = false;
+    std::string file = session->dir + "/" + key + ".wav";
+    for (Stage const & stage : session->stages) {
+        if (!key.empty() && stage.file == file) {
+            *done = true;
+            *loudness = stage.loudness;
+        }
+    }
+    if (key.empty() || (!*done && session->busy.count(file) > 0)) {
+        file = session->dir + "/stage-" + std::to_string(getpid()) + "-" + std::to_string(++last_stage_file)
+                + ".wav";
+    }
+    files->hold_locked(file);
+    return file;
+}
+
+static void reuse_report(char const * operation, std::string const & file, LoudnessReport const & loudness,
+                         RenderReport * report) {
+    *report = RenderReport();
+    report->operation = operation;
+    report->out_path = file;
+    report->cache_hit = true;
+    report->loudness = loudness;
+    struct stat file_stat;
+    if (stat(file.c_str(), &file_stat) == 0) {
+        report->output_bytes = file_stat.st_size;
+    }
+    report->result = RESULT_SUCCESS;
+}
+
+/* Links the stage of key in from the render cache to file, where a
+ * session put it when it rendered the stage before, with its statistics.
+ * False on a miss */
+static bool cached_stage(std::string const & key, char const * operation, std::string const & file,
+                         RenderReport * report) {
+    LoudnessReport loudness;
+    if (key.empty() || !render_cache_get_loudness(key, &loudness)) {
+        return false;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (render_cache_fetch(key, file.c_str()) != RESULT_SUCCESS) {
+        return false;
+    }
+    reuse_report(operation, file, loudness, report);
+    report->total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    LOG_I("session: %s served from the render cache", operation);
+    return true;
+}
+
+/* Drops the stages from size on, with their files; the callers hold the
+ * session's lock */
+static void truncate_stages_locked(Session * session, size_t size) {
+    std::vector<std::string> dropped;
+    for (size_t i = size; i < session->stages.size(); i++) {
+        dropped.push_back(session->stages[i].file);
+    }
+    session->stages.resize(std::min(size, session->stages.size()));
+    for (std::string const & file : dropped) {
+        remove_unused_locked(session, file);
+    }
+}
+
+/* Precision of the audio of path, from its header; 0 if it cannot be read */
+static unsigned file_precision(char const * path) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return 0;
+    }
+    sox_format_t * in = sox_open_read(path, NULL, NULL, NULL);
+    if (!in) {
+        return 0;
+    }
+    unsigned precision = in->signal.precision;
+    sox_close(in);
+    return precision;
+}
+
+/* Renders effect from the stage file in, whose statistics are inLoudness,
+ * to out, and leaves the statistics of the output in report->loudness:
+ * from the cache under key if they are there, from a tap in the chain
+ * otherwise. A normalise is a gain from inLoudness and moves the
+ * statistics by it. A spectrogram, if any, is filled by a tap at the end
+ * of the chain. The output goes to the render cache under key */
+static int render_stage(std::string const & in, LoudnessReport const & inLoudness, SessionEffect const & effect,
+                        std::string const & key, std::string const & out, RenderReport * report,
+                        Spectrogram * spectrogram = NULL) {
+    std::vector<EffectSpec> chain, taps;
+    RenderOptions options;
+    RenderMode mode = effect.draft ? RENDER_DRAFT : RENDER_FULL;
+    std::string operation = std::string(effect_name(effect.type)) + (effect.draft ? "-draft" : "");
+    LoudnessReport loudness;
+    bool known = false;
+    double gainDb = 0;
+    if (effect.type == SESSION_NORMALIZE) {
+        if (!inLoudness.measured) {
+            return fail(report, operation.c_str(), "no statistics of the stage below");
+        }
+        gainDb = loudness_gain_db(inLoudness, effect.value);
+        loudness = loudness_after_gain(inLoudness, gainDb);
+        known = true;
+    } else if (sox_effect_chain(effect_name(effect.type), effect.value, mode, &chain, &options) != RESULT_SUCCESS) {
+        return fail(report, operation.c_str(), "unknown effect");
+    } else {
+        known = !key.empty() && render_cache_get_loudness(key, &loudness);
+        if (!known) {
+            taps.push_back(Loudness().spec());
+        }
+    }
+    if (spectrogram) {
+        taps.push_back({SPECTROGRAM_EFFECT, {}});
+        options.spectrogram = spectrogram;
+    }
+    options.precision = STAGE_PRECISION;
+    /* A file left by a render without checkpoints may be linked to a
+     * read-only cache entry */
+    remove(out.c_str());
+    int result = effect.type == SESSION_NORMALIZE
+            ? run_pipeline(operation.c_str(), in.c_str(), out.c_str(), report, options, taps, Gain{gainDb})
+            : sox_render_effect(effect_name(effect.type), effect.value, mode, in.c_str(), out.c_str(), taps,
+                                report, options);
+    if (result != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    if (known) {
+        report->loudness = loudness;
+    } else {
+        render_cache_put_loudness(key, report->loudness);
+    }
+    if (!key.empty()) {
+        render_cache_store(key, out.c_str());
+    }
+    if (effect.type == SESSION_NORMALIZE) {
+        LOG_I("session: normalised to %g LUFS with %+.2f dB", loudness.integrated_lufs, gainDb);
+    }
+    return RESULT_SUCCESS;
+}
+
+uint64_t session_create(std::string const & dir) {
+    std::shared_ptr<Session> session = std::make_shared<Session>();
+    session->dir = dir;
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    sessions[++last_session] = session;
+    return last_session;
+}
+
+int session_close(uint64_t handle) {
+    std::lock_guard<std::mutex> lock(sessions_mutex);
+    /* A render still running keeps its session until it is done */
+    return sessions.erase(handle) > 0 ? RESULT_SUCCESS : RESULT_ERROR;
+}
+
+int session_load(uint64_t handle, char const * path, RenderReport * report, bool trimSilence) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(report, "import", "no session");
+    }
+    /* Hashed once per file (render-cache.h); a trimmed source is other
+     * audio to the effects */
+    std::string digest = render_cache_digest(path);
+    std::string chain = trimSilence ? "source|trim" : "source";
+    std::string key = stats_key(digest, chain);
+    unsigned precision = file_precision(path);
+    if (precision == 0) {
+        return fail(report, "import", std::string("cannot open input: ") + path);
+    }
+
+    StageFiles files(session.get());
+    std::string file;
+    bool done;
+    LoudnessReport loudness;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        file = stage_file_locked(session.get(), &files, key, &done, &loudness);
+    }
+    if (done) {
+        reuse_report("import", file, loudness, report);
+    } else if (!cached_stage(key, "import", file, report)) {
+        DecodeOptions options;
+        options.measure_loudness = true;
+        options.scan_silence = true;
+        options.trim_silence = trimSilence;
+        remove(file.c_str());
+        if (sox_import(path, file.c_str(), report, options, STAGE_PRECISION) != RESULT_SUCCESS) {
+            return RESULT_ERROR;
+        }
+        render_cache_put_loudness(key, report->loudness);
+        if (!key.empty()) {
+            render_cache_store(key, file.c_str());
+        }
+    }
+    report->in_path = path;
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->source_path = path;
+    session->source_digest = digest;
+    session->precision = precision;
+    Stage stage;
+    stage.id = ++session->last_stage_id;
+    stage.file = file;
+    stage.loudness = report->loudness;
+    stage.chain = chain;
+    stage.spectrogram = spectrogram_create();
+    std::vector<Stage> old;
+    old.swap(session->stages);
+    session->stages.push_back(stage);
+    for (Stage const & dropped : old) {
+        remove_unused_locked(session.get(), dropped.file);
+    }
+    return RESULT_SUCCESS;
+}
+
+int session_apply(uint64_t handle, size_t base, SessionEffect const & requested, RenderReport * report) {
+    /* A gain has no draft of its own */
+    SessionEffect effect = requested;
+    effect.draft = effect.draft && effect.type != SESSION_NORMALIZE;
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(report, effect_name(effect.type), "no session");
+    }
+    StageFiles files(session.get());
+    uint64_t baseId;
+    std::string in, out, chain, key;
+    LoudnessReport baseLoudness, loudness;
+    bool done;
+    std::shared_ptr<Spectrogram> spectrogram = spectrogram_create();
+    bool tap;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (base >= session->stages.size()) {
+            return fail(report, effect_name(effect.type), "no stage " + std::to_string(base));
+        }
+        Stage const & below = session->stages[base];
+        baseId = below.id;
+        baseLoudness = below.loudness;
+        in = below.file;
+        files.hold_locked(in);
+        chain = describe_effect(below.chain, effect);
+        key = stats_key(session->source_digest, chain);
+        out = stage_file_locked(session.get(), &files, key, &done, &loudness);
+        tap = session->spectrograms;
+    }
+    if (done) {
+        reuse_report(effect_name(effect.type), out, loudness, report);
+    } else if (!cached_stage(key, effect_name(effect.type), out, report)
+            && render_stage(in, baseLoudness, effect, key, out, report,
+                            tap ? spectrogram.get() : NULL) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (base >= session->stages.size() || session->stages[base].id != baseId) {
+        return fail(report, effect_name(effect.type), "stage replaced while rendering");
+    }
+    Stage stage;
+    stage.id = ++session->last_stage_id;
+    stage.effect = effect;
+    stage.file = out;
+    stage.loudness = report->loudness;
+    stage.chain = chain;
+    stage.spectrogram = spectrogram;
+    truncate_stages_locked(session.get(), base + 1);
+    session->stages.push_back(stage);
+    return RESULT_SUCCESS;
+}
+
+int session_undo(uint64_t handle) {
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return RESULT_ERROR;
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->stages.size() < 2) {
+        return RESULT_ERROR;
+    }
+    truncate_stages_locked(session.get(), session->stages.size() - 1);
+    return RESULT_SUCCESS;
+}
+
+int session_render_full(uint64_t handle, RenderReport * report) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(report, "render-full", "no session");
+    }
+    StageFiles files(session.get());
+    size_t first = 0;
+    std::vector<Stage> stages;
+    std::string below;
+    LoudnessReport loudness;
+    std::string chain, digest;
+    bool tap;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        for (size_t i = 1; i < session->stages.size() && first == 0; i++) {
+            first = session->stages[i].effect.draft ? i : 0;
+        }
+        if (first == 0) {
+            report->operation = "render-full";
+            report->result = RESULT_SUCCESS;
+            return RESULT_SUCCESS;
+        }
+        stages.assign(session->stages.begin() + first, session->stages.end());
+        below = session->stages[first - 1].file;
+        files.hold_locked(below);
+        loudness = session->stages[first - 1].loudness;
+        chain = session->stages[first - 1].chain;
+        digest = session->source_digest;
+        tap = session->spectrograms;
+    }
+
+    /* Every stage above the first draft one has a new input, rendered
+     * from the file of the stage below unless the render cache holds it.
+     * Each stage is normalised from the statistics of the one below,
+     * measured on the way */
+    std::vector<Stage> rendered;
+    for (Stage const & stage : stages) {
+        Stage full;
+        full.effect = stage.effect;
+        full.effect.draft = false;
+        chain = describe_effect(chain, full.effect);
+        std::string key = stats_key(digest, chain);
+        std::shared_ptr<Spectrogram> spectrogram = spectrogram_create();
+        std::string file;
+        bool done;
+        LoudnessReport known;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            file = stage_file_locked(session.get(), &files, key, &done, &known);
+        }
+        if (done) {
+            reuse_report(effect_name(full.effect.type), file, known, report);
+        } else if (!cached_stage(key, effect_name(full.effect.type), file, report)
+                && render_stage(below, loudness, full.effect, key, file, report,
+                                tap ? spectrogram.get() : NULL) != RESULT_SUCCESS) {
+            return RESULT_ERROR;
+        }
+        below = file;
+        loudness = report->loudness;
+        full.file = file;
+        full.loudness = loudness;
+        full.chain = chain;
+        full.spectrogram = spectrogram;
+        rendered.push_back(full);
+    }
+
+    std::lock_guard<std::mutex> lock(session->mutex);
+    bool changed = session->stages.size() != first + stages.size();
+    for (size_t i = 0; i < stages.size() && !changed; i++) {
+        changed = session->stages[first + i].id != stages[i].id;
+    }
+    if (changed) {
+        return fail(report, "render-full", "stages changed while rendering");
+    }
+    for (size_t i = 0; i < stages.size(); i++) {
+        Stage & stage = session->stages[first + i];
+        std::string old = stage.file;
+        stage = rendered[i];
+        stage.id = ++session->last_stage_id;
+        remove_unused_locked(session.get(), old);
+    }
+    return RESULT_SUCCESS;
+}
+
+/* The file of the top stage, held by files, with the precision of the
+ * source and the loudness of the stage, measured when it was rendered;
+ * empty on failure */
+static std::string top_file(Session * session, StageFiles * files, RenderReport * report,
+                            unsigned * precision, LoudnessReport * loudness = NULL) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (session->stages.empty()) {
+        fail(report, "stage", "nothing loaded");
+        return "";
+    }
+    Stage const & top = session->stages.back();
+    *precision = session->precision;
+    if (loudness) {
+        *loudness = top.loudness;
+    }
+    files->hold_locked(top.file);
+    return top.file;
+}
+
+int session_preview(uint64_t handle, char const * path, RenderReport * report) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(report, "preview", "no session");
+    }
+    StageFiles files(session.get());
+    RenderOptions options;
+    std::string file = top_file(session.get(), &files, report, &options.precision);
+    if (file.empty()) {
+        return RESULT_ERROR;
+    }
+    return sox_render("preview", file.c_str(), path, {}, report, options);
+}
+
+int session_export(uint64_t handle, std::vector<std::string> const & outPaths,
+                   std::vector<std::string> const & tags, RenderReport * report) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(report, "export", "no session");
+    }
+    if (session_render_full(handle, report) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    StageFiles files(session.get());
+    unsigned precision;
+    LoudnessReport loudness;
+    std::string file = top_file(session.get(), &files, report, &precision, &loudness);
+    if (file.empty()) {
+        return RESULT_ERROR;
+    }
+    int result = sox_export(file.c_str(), outPaths, tags, report, precision);
+    report->loudness = loudness;
+    return result;
+}
+
+void session_set_spectrograms(uint64_t handle, bool enabled) {
+    std::shared_ptr<Session> session = find_session(handle);
+    if (session) {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->spectrograms = enabled;
+    }
+}
+
+/* The spectrogram of stage index with its file, held by files */
+static std::shared_ptr<Spectrogram> stage_spectrogram(Session * session, StageFiles * files, size_t index,
+                                                      std::string * file, RenderReport * report) {
+    std::lock_guard<std::mutex> lock(session->mutex);
+    if (index >= session->stages.size()) {
+        fail(report, "spectrogram", "no stage " + std::to_string(index));
+        return std::shared_ptr<Spectrogram>();
+    }
+    *file = session->stages[index].file;
+    files->hold_locked(*file);
+    return session->stages[index].spectrogram;
+}
+
+/* Fetches tiles, mapping the stage's file only if some are missing or the
+ * frames and rate are still unknown */
+static int fetch_tiles(Spectrogram * spectrogram, std::string const & file, unsigned level, uint64_t first,
+                       uint64_t count, std::vector<SpectrogramTile> * tiles) {
+    if (spectrogram_frames(spectrogram) > 0 && spectrogram_cached(spectrogram, level, first, count)) {
+        return spectrogram_fetch(spectrogram, NULL, level, first, count, parallel_decode_threads(), tiles);
+    }
+    MappedAudio audio(file.c_str());
+    if (!audio.ok()) {
+        return RESULT_ERROR;
+    }
+    return spectrogram_fetch(spectrogram, &audio.view(), level, first, count, parallel_decode_threads(), tiles);
+}
+
+int session_spectrogram(uint64_t handle, size_t stage, unsigned level, uint64_t first, uint64_t count,
+                        std::vector<SpectrogramTile> * tiles) {
+    RenderReport report;
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return fail(&report, "spectrogram", "no session");
+    }
+    StageFiles files(session.get());
+    std::string file;
+    std::shared_ptr<Spectrogram> spectrogram = stage_spectrogram(session.get(), &files, stage, &file, &report);
+    if (!spectrogram) {
+        return RESULT_ERROR;
+    }
+    return fetch_tiles(spectrogram.get(), file, level, first, count, tiles);
+}
+
+std::string session_spectrogram_json(uint64_t handle, size_t stage) {
+    RenderReport report;
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return "{}";
+    }
+    StageFiles files(session.get());
+    std::string file;
+    std::shared_ptr<Spectrogram> spectrogram = stage_spectrogram(session.get(), &files, stage, &file, &report);
+    std::vector<SpectrogramTile> none;
+    if (!spectrogram || fetch_tiles(spectrogram.get(), file, 0, 0, 0, &none) != RESULT_SUCCESS) {
+        return "{}";
+    }
+    SpectrogramOptions options = spectrogram_options(spectrogram.get());
+    std::string out = "{";
+    json_field(out, "stage", (uint64_t) stage);
+    json_field(out, "frames", spectrogram_frames(spectrogram.get()));
+    json_field(out, "rate", spectrogram_rate(spectrogram.get()));
+    json_field(out, "bins", (uint64_t) options.fft_size / 2);
+    json_field(out, "hop", (uint64_t) options.hop);
+    json_field(out, "floor_db", options.floor_db);
+    json_field(out, "tile_columns", (uint64_t) SPECTROGRAM_TILE_COLUMNS);
+    out += ",\"tiles\":[";
+    for (unsigned level = 0; level < options.levels; level++) {
+        out += (level > 0 ? "," : "") + std::to_string(spectrogram_tile_count(spectrogram.get(), level));
+    }
+    out += "]}";
+    return out;
+}
+
+
+size_t session_effect_count(uint64_t handle) {
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    return session->stages.empty() ? 0 : session->stages.size() - 1;
+}
+
+std::string session_to_json(uint64_t handle) {
+    std::shared_ptr<Session> session = find_session(handle);
+    if (!session) {
+        return "{}";
+    }
+    std::lock_guard<std::mutex> lock(session->mutex);
+    std::string out = "{";
+    json_field(out, "source", session->source_path);
+    json_field(out, "dir", session->dir);
+    uint64_t total = 0;
+    out += ",\"stages\":[";
+    for (size_t i = 0; i < session->stages.size(); i++) {
+        Stage const & stage = session->stages[i];
+        struct stat file_stat;
+        uint64_t bytes = stat(stage.file.c_str(), &file_stat) == 0 ? (uint64_t) file_stat.st_size : 0;
+        out += i > 0 ? ",{" : "{";
+        json_field(out, "id", stage.id);
+        json_field(out, "effect", std::string(i == 0 ? "source" : effect_name(stage.effect.type)));
+        json_field(out, "value", stage.effect.value);
+        json_field(out, "draft", stage.effect.draft);
+        json_field(out, "file", stage.file);
+        json_field(out, "bytes", bytes);
+        if (stage.loudness.measured) {
+            json_field(out, "integrated_lufs", stage.loudness.integrated_lufs);
+            json_field(out, "true_peak_dbtp", stage.loudness.true_peak_dbtp);
+        }
+        out += "}";
+        total += bytes;
+    }
+    out += "]";
+    json_field(out, "bytes_on_disk", total);
+    out += "}";
+    return out;
+}
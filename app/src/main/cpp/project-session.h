@@ -0,0 +1,118 @@
+#ifndef SOXTEST_PROJECT_SESSION_H
+#define SOXTEST_PROJECT_SESSION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "render-report.h"
+#include "sox-ops.h"
+#include "spectrogram.h"
+
+/* A project held by the native side.
+ *
+ * A session owns the source, the ordered effect list and the rendered
+ * stage after each effect: stage 0 is the source, stage i the output of
+ * effect i. Every stage is a WAV in the session's directory with all 32
+ * bits of the samples, named after its statistics' key (the source's
+ * digest and the chain up to the stage). The source is imported with
+ * sox_import(), on all cores for MP3 and FLAC; edits render file to file
+ * from the stage they build on through the fused pipeline (pipeline.h;
+ * sox_render() for a reverse), undo drops the top
+ * stage, and the preview and the export read the top stage. No stage is
+ * held in the memory of the process: the files are read through mappings
+ * (mapped-io.h) and every render is held to the memory budget
+ * (memory-budget.h).
+ *
+ * The renders write checkpoints (checkpoint.h) when an interval is set.
+ * As a stage goes to the same file whenever its chain is rendered again,
+ * a render cut short by the death of the process resumes when the
+ * restored project renders the stage.
+ *
+ * Every stage is measured on its way to disk by a loudness tap
+ * (loudness.h); the export report carries the loudness of the top stage.
+ * The statistics are remembered in the render cache (render-cache.h) under
+ * the stage's key, so a stage rendered again is not measured again,
+ * across sessions too. A normalise effect takes the statistics of the
+ * stage below, which are known by the time it is applied, and is a plain
+ * gain: normalising costs no analysis pass.
+ *
+ * Every stage goes to the render cache as it is committed, and a stage
+ * the render cache holds is linked in instead of rendered, the source too
+ * instead of decoded, so that restoring a project costs neither a decode
+ * nor a render of what a session did before.
+ *
+ * Every stage has a spectrogram (spectrogram.h) whose tiles are computed
+ * from a mapping of its file when they are first asked for, or, with
+ * spectrograms on, by a tap while the stage renders, so a view of the new
+ * stage finds them ready.
+ *
+ * Sessions are reached by handle (see the JNI in native-lib.cpp); the
+ * calls may come from several job threads at once. Renders run outside
+ * the session's lock and commit their stage only if the stage they built
+ * on is still there; the files they read stay until they are done */
+
+enum SessionEffectType {
+    SESSION_TEMPO,      /* value: factor */
+    SESSION_PITCH,      /* value: cents */
+    SESSION_REVERSE,
+    SESSION_NORMALIZE   /* value: target integrated loudness, LUFS */
+};
+
+struct SessionEffect {
+    SessionEffectType type = SESSION_TEMPO;
+    double value = 0;
+    bool draft = false;
+};
+
+/* dir holds the stage files; the session removes its own when they are
+ * dropped and on close */
+uint64_t session_create(std::string const & dir);
+/* RESULT_ERROR for an unknown handle; renders still running finish first */
+int session_close(uint64_t session);
+
+/* Imports the source, or links it in from the render cache (see above);
+ * drops any effects. The silent regions of an imported source come back
+ * in report->silence; with trimSilence its leading and trailing silence
+ * never make it into the source stage (see sox_import()), so no effect
+ * processes them */
+int session_load(uint64_t session, char const * path, RenderReport * report = NULL, bool trimSilence = false);
+
+/* Renders the effect on top of stage base (the number of effects it
+ * follows) and makes it effect base + 1, dropping the effects above base:
+ * an apply to the top stage adds an effect, an apply to a lower one
+ * replaces what came after it. Fails if stage base was replaced or undone
+ * meanwhile */
+int session_apply(uint64_t session, size_t base, SessionEffect const & effect, RenderReport * report = NULL);
+
+/* Drops the last effect; RESULT_ERROR if there is none */
+int session_undo(uint64_t session);
+
+/* Renders the stages from the first draft effect up again at full quality */
+int session_render_full(uint64_t session, RenderReport * report = NULL);
+
+/* Writes the top stage to a file for the player */
+int session_preview(uint64_t session, char const * path, RenderReport * report = NULL);
+
+/* Exports the top stage (at full quality) to all the outputs in one pass,
+ * see sox_export() */
+int session_export(uint64_t session, std::vector<std::string> const & outPaths,
+                   std::vector<std::string> const & tags, RenderReport * report = NULL);
+
+/* Taps filling the spectrograms of the stages rendered from now on */
+void session_set_spectrograms(uint64_t session, bool enabled);
+
+/* Tiles first to first + count - 1 of level of stage's spectrogram; only
+ * missing ones map the stage's file, see spectrogram_fetch() */
+int session_spectrogram(uint64_t session, size_t stage, unsigned level, uint64_t first, uint64_t count,
+                        std::vector<SpectrogramTile> * tiles);
+
+/* Geometry of stage's spectrogram: frames, rate, bins, hop, floor_db,
+ * tile_columns and the tile count of every level; "{}" on failure */
+std::string session_spectrogram_json(uint64_t session, size_t stage);
+
+size_t session_effect_count(uint64_t session);
+
+/* Source, effects and stages with their files; "{}" for an unknown handle */
+std::string session_to_json(uint64_t session);
+
+#endif //SOXTEST_PROJECT_SESSION_H
@@ -0,0 +1,203 @@
+#include "rate-plans.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include "native-log.h"
+#include "sox.h"
+#include "sox-ops.h"
+#include "test-signal.h"
+
+/* Candidate values of sox_globals.log2_dft_min_size; libSoX's default is 10 */
+static const size_t dft_candidates[] = {9, 10, 11, 12, 13};
+
+/* Qualities with a plan; `-q' interpolates without a DFT */
+static const char plan_qualities[] = {RATE_LOW, RATE_MEDIUM, RATE_HIGH, RATE_VERY_HIGH};
+
+/* Conversions of up to an octave either way have a plan */
+#define PLAN_MAX_HALF_OCTAVES 2
+
+#define PLAN_TUNING_RATE 44100.0
+#define PLAN_TUNING_SECONDS 2
+
+/* Quality and ratio to the nearest half octave */
+typedef std::pair<char, long> PlanKey;
+
+static std::mutex plans_mutex;
+static std::map<PlanKey, size_t> plans;
+static std::string plans_path;
+
+/* Set by ScopedRatePlan, -1 when unset */
+static thread_local long plan_override = -1;
+
+/* Held shared by ScopedDftSize guards without a size, exclusively by those
+ * with one and by rate_plans_set_default_dft() */
+static std::shared_mutex dft_mutex;
+
+/* Numbers the scratch files of the tuning renders */
+static std::atomic<unsigned> scratch_counter(0);
+
+static PlanKey make_key(double inRate, double outRate, char quality) {
+    return PlanKey(quality, std::lround(2 * std::log2(outRate / inRate)));
+}
+
+static bool plan_quality(char quality) {
+    return memchr(plan_qualities, quality, sizeof(plan_qualities)) != NULL;
+}
+
+int rate_plans_init(char const * confPath) {
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    plans_path = confPath;
+    plans.clear();
+
+    FILE * f = fopen(confPath, "r");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+    char quality;
+    long halfOctaves;
+    size_t log2DftSize;
+    while (fscanf(f, " %c %ld %zu", &quality, &halfOctaves, &log2DftSize) == 3) {
+        /* Plans of an older layout are dropped with the rest of the file */
+        if (!plan_quality(quality) || std::labs(halfOctaves) > PLAN_MAX_HALF_OCTAVES) {
+            plans.clear();
+            break;
+        }
+        plans[PlanKey(quality, halfOctaves)] = log2DftSize;
+    }
+    fclose(f);
+    return plans.empty() ? RESULT_ERROR : RESULT_SUCCESS;
+}
+
+/* Times a short resample of the reference signal at each candidate size */
+static size_t tune_plan(std::string const & in, std::string const & out, double outRate, char quality) {
+    char outRateStr[32];
+    char qualityStr[3] = {'-', quality, 0};
+    snprintf(outRateStr, sizeof(outRateStr), "%.2f", outRate);
+
+    size_t best = 0;
+    double bestMs = 0;
+    for (size_t log2DftSize : dft_candidates) {
+        ScopedRatePlan plan(log2DftSize);
+        RenderReport report;
+        if (sox_render("rate-plan", in.c_str(), out.c_str(),
+                       {{"rate", {qualityStr, outRateStr}}}, &report) != RESULT_SUCCESS) {
+            continue;
+        }
+        double ms = report.stages.size() > 1 ? report.stages[1].flow_ms + report.stages[1].drain_ms : 0;
+        if (best == 0 || ms < bestMs) {
+            best = log2DftSize;
+            bestMs = ms;
+        }
+    }
+    LOG_I("rate plan %.2f -> %.2f -%c: log2 dft %zu (%.1f ms)",
+          PLAN_TUNING_RATE, outRate, quality, best, bestMs);
+    return best;
+}
+
+/* Replaces the file with the plans, so that it never holds half of them */
+static int save_plans(std::string const & path, std::map<PlanKey, size_t> const & tuned) {
+    std::string tmpPath = path + ".tmp";
+    FILE * f = fopen(tmpPath.c_str(), "w");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+    for (auto const & plan : tuned) {
+        fprintf(f, "%c %ld %zu\n", plan.first.first, plan.first.second, plan.second);
+    }
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+int rate_plans_calibrate(char const * workDir) {
+    std::string scratch = std::string(workDir) + "/rate-plan-" + std::to_string(getpid()) + "-"
+            + std::to_string(scratch_counter++);
+    std::string in = scratch + "-in.wav";
+    std::string out = scratch + "-out.wav";
+    if (write_test_signal(in.c_str(), PLAN_TUNING_RATE, 2, PLAN_TUNING_SECONDS) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::map<PlanKey, size_t> tuned;
+    for (char quality : plan_qualities) {
+        for (long halfOctaves = -PLAN_MAX_HALF_OCTAVES; halfOctaves <= PLAN_MAX_HALF_OCTAVES; halfOctaves++) {
+            /* An equal rate makes `rate' a no-op; the half octave around it
+             * is mostly 44.1 <-> 48 kHz */
+            double outRate = halfOctaves == 0 ? 48000.0 : PLAN_TUNING_RATE * std::exp2(halfOctaves / 2.0);
+            size_t log2DftSize = tune_plan(in, out, outRate, quality);
+            if (log2DftSize) {
+                tuned[PlanKey(quality, halfOctaves)] = log2DftSize;
+            }
+        }
+    }
+    remove(in.c_str());
+    remove(out.c_str());
+
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    plans = tuned;
+    if (!plans_path.empty() && save_plans(plans_path, plans) != RESULT_SUCCESS) {
+        LOG_E("rate plans: cannot save %s", plans_path.c_str());
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+size_t rate_plan_get(double inRate, double outRate, char quality) {
+    if (plan_override >= 0) {
+        return (size_t) plan_override;
+    }
+    if (inRate <= 0 || outRate <= 0) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    auto it = plans.find(make_key(inRate, outRate, quality));
+    return it != plans.end() ? it->second : 0;
+}
+
+ScopedRatePlan::ScopedRatePlan(size_t log2DftSize) : previous(plan_override) {
+    plan_override = (long) log2DftSize;
+}
+
+ScopedRatePlan::~ScopedRatePlan() {
+    plan_override = previous;
+}
+
+ScopedDftSize::ScopedDftSize(size_t log2DftSize) : size(log2DftSize), previous(0) {
+    if (size) {
+        dft_mutex.lock();
+        previous = sox_globals.log2_dft_min_size;
+        sox_globals.log2_dft_min_size = size;
+    } else {
+        dft_mutex.lock_shared();
+    }
+}
+
+ScopedDftSize::~ScopedDftSize() {
+    if (size) {
+        sox_globals.log2_dft_min_size = previous;
+        dft_mutex.unlock();
+    } else {
+        dft_mutex.unlock_shared();
+    }
+}
+
+void rate_plans_set_default_dft(size_t log2DftSize) {
+    std::lock_guard<std::shared_mutex> lock(dft_mutex);
+    sox_globals.log2_dft_min_size = log2DftSize;
+}
+
+size_t rate_plans_default_dft() {
+    std::shared_lock<std::shared_mutex> lock(dft_mutex);
+    return sox_globals.log2_dft_min_size;
+}
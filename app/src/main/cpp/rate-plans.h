@@ -0,0 +1,56 @@
+#ifndef SOXTEST_RATE_PLANS_H
+#define SOXTEST_RATE_PLANS_H
+
+#include <cstddef>
+
+/* Cache of DFT sizes for the `rate' effect. libSoX designs the polyphase
+ * filters privately in the effect's start(), but its DFT tables are
+ * process-wide and survive between jobs as long as libSoX stays initialised
+ * (see sox_runtime_init), and the DFT size they are built for is
+ * sox_globals.log2_dft_min_size. A plan is the size measured fastest for a
+ * canonical conversion: the quality and the ratio to the nearest half
+ * octave, so that every pitch of a range shares one. Plans are tuned by
+ * rate_plans_calibrate(), never inside a render, and persisted across
+ * restarts */
+
+/* Loads the persisted plans from confPath, which rate_plans_calibrate()
+ * rewrites; RESULT_ERROR if there are none to load */
+int rate_plans_init(char const * confPath);
+
+/* Tunes the plans of all canonical conversions with scratch files in
+ * workDir and replaces the persisted ones; run with the calibration */
+int rate_plans_calibrate(char const * workDir);
+
+/* Returns the log2 DFT size for the conversion; 0 means keep the global
+ * default */
+size_t rate_plan_get(double inRate, double outRate, char quality);
+
+/* Makes rate_plan_get() return log2DftSize on this thread while the guard
+ * lives; 0 lets the global DFT size apply (used while calibrating it) */
+class ScopedRatePlan {
+public:
+    explicit ScopedRatePlan(size_t log2DftSize);
+    ~ScopedRatePlan();
+private:
+    long previous;
+};
+
+/* Effects started while the guard lives get log2DftSize, or the global
+ * default with 0. libSoX only takes the size from sox_globals, so a guard
+ * with a size sets it there and excludes every other guard until it is
+ * gone, and guards without one share the default; every sox_add_effect()
+ * of a job runs under one */
+class ScopedDftSize {
+public:
+    explicit ScopedDftSize(size_t log2DftSize);
+    ~ScopedDftSize();
+private:
+    size_t size;
+    size_t previous;
+};
+
+/* Sets the global default of the DFT size, waiting for the guards to go */
+void rate_plans_set_default_dft(size_t log2DftSize);
+size_t rate_plans_default_dft();
+
+#endif //SOXTEST_RATE_PLANS_H
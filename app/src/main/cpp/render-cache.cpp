@@ -0,0 +1,449 @@
+#include "render-cache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <tuple>
+#include <unistd.h>
+#include <vector>
+#include "md5.h"
+#include "native-log.h"
+#include "sox.h"
+#include "sox-ops.h"
+
+#define INDEX_NAME "index"
+#define LOUDNESS_NAME "loudness"
+/* Statistics are a few dozen bytes each; the least recently used go first */
+#define LOUDNESS_MAX_ENTRIES 4096
+/* Bumped whenever the render code changes its output for the same chain */
+#define RENDER_CACHE_VERSION 1
+#define COPY_BLOCK_BYTES (1 << 20)
+/* In the index, the digest of an entry nobody hashed yet */
+#define UNKNOWN_DIGEST "-"
+
+struct CacheEntry {
+    uint64_t bytes = 0;
+    uint64_t last_used = 0;   /* tick of the last store or fetch */
+    std::string digest;       /* of the content, for later renders of it;
+                               * empty until one hashes it */
+};
+
+/* A file's content is taken to be unchanged while these are */
+typedef std::tuple<dev_t, ino_t, off_t, int64_t> FileIdentity;
+
+static std::mutex cache_mutex;
+static std::string cache_dir;
+static uint64_t cache_quota = 0;
+static uint64_t cache_tick = 0;
+static std::map<std::string, CacheEntry> entries;
+static std::map<FileIdentity, std::string> digests;
+
+struct LoudnessEntry {
+    LoudnessReport loudness;
+    uint64_t last_used = 0;
+};
+
+static std::map<std::string, LoudnessEntry> loudness_entries;
+
+static std::string to_hex(uint8_t const * bytes, size_t size) {
+    static char const digits[] = "0123456789abcdef";
+    std::string hex;
+    for (size_t i = 0; i < size; i++) {
+        hex += digits[bytes[i] >> 4];
+        hex += digits[bytes[i] & 15];
+    }
+    return hex;
+}
+
+static bool identity_of(char const * path, FileIdentity * identity) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    *identity = FileIdentity(st.st_dev, st.st_ino, st.st_size,
+                             (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec);
+    return true;
+}
+
+static std::string entry_path(std::string const & key) {
+    return cache_dir + "/" + key;
+}
+
+static int hash_file(char const * path, std::string * hex) {
+    FILE * f = fopen(path, "rb");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+    Md5 md5;
+    std::vector<char> buf(COPY_BLOCK_BYTES);
+    size_t got;
+    while ((got = fread(buf.data(), 1, buf.size(), f)) > 0) {
+        md5.update(buf.data(), got);
+    }
+    bool failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        return RESULT_ERROR;
+    }
+    uint8_t digest[16];
+    md5.finish(digest);
+    *hex = to_hex(digest, sizeof(digest));
+    return RESULT_SUCCESS;
+}
+
+static int copy_file(char const * from, char const * to) {
+    FILE * in = fopen(from, "rb");
+    FILE * out = in ? fopen(to, "wb") : NULL;
+    bool ok = in && out;
+    std::vector<char> buf(COPY_BLOCK_BYTES);
+    size_t got;
+    while (ok && (got = fread(buf.data(), 1, buf.size(), in)) > 0) {
+        ok = fwrite(buf.data(), 1, got, out) == got;
+    }
+    ok = ok && !ferror(in);
+    if (in) fclose(in);
+    if (out && fclose(out) != 0) {
+        ok = false;
+    }
+    if (!ok && out) {
+        remove(to);
+    }
+    return ok ? RESULT_SUCCESS : RESULT_ERROR;
+}
+
+/* Links from to to, or copies it where links are not supported */
+static int link_or_copy(char const * from, char const * to) {
+    return link(from, to) == 0 ? RESULT_SUCCESS : copy_file(from, to);
+}
+
+/* Content digest of the file, hashed only if its identity is new */
+static std::string file_digest(char const * path) {
+    FileIdentity identity;
+    if (!identity_of(path, &identity)) {
+        return "";
+    }
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = digests.find(identity);
+        if (it != digests.end()) {
+            return it->second;
+        }
+    }
+    std::string digest;
+    if (hash_file(path, &digest) != RESULT_SUCCESS) {
+        return "";
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    digests[identity] = digest;
+    return digest;
+}
+
+/* The callers hold cache_mutex */
+static void save_index_locked() {
+    std::string path = cache_dir + "/" INDEX_NAME;
+    std::string tmpPath = path + ".tmp";
+    FILE * f = fopen(tmpPath.c_str(), "w");
+    if (!f) {
+        return;
+    }
+    for (auto const & entry : entries) {
+        std::string const & digest = entry.second.digest;
+        fprintf(f, "%s %llu %llu %s\n", entry.first.c_str(), (unsigned long long) entry.second.bytes,
+                (unsigned long long) entry.second.last_used, digest.empty() ? UNKNOWN_DIGEST : digest.c_str());
+    }
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+    }
+}
+
+/* One line per entry: key, last use, frames and the statistics */
+static void save_loudness_locked() {
+    if (cache_dir.empty()) {
+        return;
+    }
+    std::string path = cache_dir + "/" LOUDNESS_NAME;
+    std::string tmpPath = path + ".tmp";
+    FILE * f = fopen(tmpPath.c_str(), "w");
+    if (!f) {
+        return;
+    }
+    for (auto const & entry : loudness_entries) {
+        LoudnessReport const & l = entry.second.loudness;
+        fprintf(f, "%s %llu %llu %.17g %.17g %.17g %.17g %.17g %.17g\n", entry.first.c_str(),
+                (unsigned long long) entry.second.last_used, (unsigned long long) l.frames,
+                l.integrated_lufs, l.range_lu, l.momentary_max_lufs, l.short_term_max_lufs,
+                l.true_peak_dbtp, l.sample_peak_dbfs);
+    }
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+    }
+}
+
+static void load_loudness_locked() {
+    FILE * f = fopen((cache_dir + "/" LOUDNESS_NAME).c_str(), "r");
+    if (!f) {
+        return;
+    }
+    char key[65];
+    unsigned long long lastUsed, frames;
+    LoudnessReport l;
+    while (fscanf(f, "%64s %llu %llu %lf %lf %lf %lf %lf %lf", key, &lastUsed, &frames, &l.integrated_lufs,
+                  &l.range_lu, &l.momentary_max_lufs, &l.short_term_max_lufs, &l.true_peak_dbtp,
+                  &l.sample_peak_dbfs) == 9) {
+        l.measured = true;
+        l.frames = frames;
+        LoudnessEntry & entry = loudness_entries[key];
+        entry.loudness = l;
+        entry.last_used = lastUsed;
+        cache_tick = std::max(cache_tick, (uint64_t) lastUsed);
+    }
+    fclose(f);
+}
+
+static void evict_locked(std::string const & keep) {
+    uint64_t total = 0;
+    for (auto const & entry : entries) {
+        total += entry.second.bytes;
+    }
+    while (total > cache_quota) {
+        auto oldest = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (it->first != keep && (oldest == entries.end() || it->second.last_used < oldest->second.last_used)) {
+                oldest = it;
+            }
+        }
+        if (oldest == entries.end()) {
+            break;
+        }
+        remove(entry_path(oldest->first).c_str());
+        total -= oldest->second.bytes;
+        entries.erase(oldest);
+    }
+}
+
+void render_cache_init(char const * dir, uint64_t quotaBytes) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache_dir = dir ? dir : "";
+    cache_quota = quotaBytes;
+    cache_tick = 0;
+    entries.clear();
+    loudness_entries.clear();
+    if (cache_dir.empty()) {
+        return;
+    }
+    mkdir(cache_dir.c_str(), 0700);
+    load_loudness_locked();
+
+    FILE * f = fopen((cache_dir + "/" INDEX_NAME).c_str(), "r");
+    if (f) {
+        char key[65], digest[33];
+        unsigned long long bytes, lastUsed;
+        while (fscanf(f, "%64s %llu %llu %32s", key, &bytes, &lastUsed, digest) == 4) {
+            std::string path = entry_path(key);
+            FileIdentity identity;
+            if (!identity_of(path.c_str(), &identity) || (uint64_t) std::get<2>(identity) != bytes) {
+                continue;
+            }
+            CacheEntry & entry = entries[key];
+            entry.bytes = bytes;
+            entry.last_used = lastUsed;
+            if (strcmp(digest, UNKNOWN_DIGEST) != 0) {
+                entry.digest = digest;
+                digests[identity] = digest;
+            }
+            cache_tick = std::max(cache_tick, (uint64_t) lastUsed);
+        }
+        fclose(f);
+    }
+
+    /* Files of entries that did not make it into the index */
+    DIR * d = opendir(cache_dir.c_str());
+    if (d) {
+        while (dirent * e = readdir(d)) {
+            std::string name = e->d_name;
+            if (name != "." && name != ".." && name != INDEX_NAME && name != LOUDNESS_NAME
+                    && entries.find(name) == entries.end()) {
+                remove(entry_path(name).c_str());
+            }
+        }
+        closedir(d);
+    }
+
+    evict_locked("");
+    save_index_locked();
+    LOG_I("render cache: %zu entries in %s", entries.size(), cache_dir.c_str());
+}
+
+bool render_cache_enabled() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return !cache_dir.empty();
+}
+
+std::string render_cache_digest(char const * path) {
+    return file_digest(path);
+}
+
+std::string render_cache_chain_key(std::string const & digest, std::string const & chain) {
+    std::string text = digest + "|" + chain + "|" + sox_version() + "|" + std::to_string(RENDER_CACHE_VERSION);
+    Md5 md5;
+    md5.update(text.data(), text.size());
+    uint8_t key[16];
+    md5.finish(key);
+    return to_hex(key, sizeof(key));
+}
+
+std::string render_cache_key(char const * inPath, std::string const & chain) {
+    std::string digest = file_digest(inPath);
+    return digest.empty() ? "" : render_cache_chain_key(digest, chain);
+}
+
+int render_cache_fetch(std::string const & key, char const * outPath) {
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (cache_dir.empty() || entries.find(key) == entries.end()) {
+            return RESULT_ERROR;
+        }
+        path = entry_path(key);
+    }
+
+    remove(outPath);
+    if (link_or_copy(path.c_str(), outPath) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    FileIdentity identity;
+    bool known = identity_of(outPath, &identity);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        it->second.last_used = ++cache_tick;
+        if (known && !it->second.digest.empty()) {
+            digests[identity] = it->second.digest;
+        }
+        save_index_locked();
+    }
+    return RESULT_SUCCESS;
+}
+
+int render_cache_store(std::string const & key, char const * outPath) {
+    if (!render_cache_enabled()) {
+        return RESULT_ERROR;
+    }
+    /* Hashed before only if it was the input of a cached render */
+    FileIdentity outIdentity;
+    if (!identity_of(outPath, &outIdentity)) {
+        return RESULT_ERROR;
+    }
+    uint64_t bytes = (uint64_t) std::get<2>(outIdentity);
+    std::string digest;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto known = digests.find(outIdentity);
+        if (known != digests.end()) {
+            digest = known->second;
+        }
+    }
+    std::string path, tmpPath;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (bytes > cache_quota) {
+            return RESULT_ERROR;
+        }
+        path = entry_path(key);
+        tmpPath = path + ".tmp";
+    }
+
+    remove(tmpPath.c_str());
+    if (link_or_copy(outPath, tmpPath.c_str()) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    chmod(tmpPath.c_str(), 0444);
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return RESULT_ERROR;
+    }
+
+    FileIdentity identity;
+    bool known = identity_of(path.c_str(), &identity);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    CacheEntry & entry = entries[key];
+    entry.bytes = bytes;
+    entry.last_used = ++cache_tick;
+    entry.digest = digest;
+    if (known && !digest.empty()) {
+        digests[identity] = digest;
+    }
+    evict_locked(key);
+    save_index_locked();
+    return RESULT_SUCCESS;
+}
+
+uint64_t render_cache_bytes() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    uint64_t total = 0;
+    for (auto const & entry : entries) {
+        total += entry.second.bytes;
+    }
+    return total;
+}
+
+bool render_cache_get_loudness(std::string const & key, LoudnessReport * loudness) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = loudness_entries.find(key);
+    if (it == loudness_entries.end()) {
+        return false;
+    }
+    /* Not worth a write of the file; the order of use is kept in memory */
+    it->second.last_used = ++cache_tick;
+    *loudness = it->second.loudness;
+    return true;
+}
+
+void render_cache_put_loudness(std::string const & key, LoudnessReport const & loudness) {
+    if (!loudness.measured || key.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    LoudnessEntry & entry = loudness_entries[key];
+    entry.loudness = loudness;
+    entry.last_used = ++cache_tick;
+    while (loudness_entries.size() > LOUDNESS_MAX_ENTRIES) {
+        auto oldest = loudness_entries.begin();
+        for (auto it = loudness_entries.begin(); it != loudness_entries.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used) {
+                oldest = it;
+            }
+        }
+        loudness_entries.erase(oldest);
+    }
+    save_loudness_locked();
+}
+
+/* Of the same width as the content keys, for the statistics file */
+static std::string identity_key(char const * path) {
+    FileIdentity identity;
+    if (!identity_of(path, &identity)) {
+        return "";
+    }
+    std::string text = "file|" + std::to_string(std::get<0>(identity)) + "|" + std::to_string(std::get<1>(identity))
+            + "|" + std::to_string(std::get<2>(identity)) + "|" + std::to_string(std::get<3>(identity));
+    Md5 md5;
+    md5.update(text.data(), text.size());
+    uint8_t key[16];
+    md5.finish(key);
+    return to_hex(key, sizeof(key));
+}
+
+bool render_cache_get_file_loudness(char const * path, LoudnessReport * loudness) {
+    std::string key = identity_key(path);
+    return !key.empty() && render_cache_get_loudness(key, loudness);
+}
+
+void render_cache_put_file_loudness(char const * path, LoudnessReport const & loudness) {
+    render_cache_put_loudness(identity_key(path), loudness);
+}
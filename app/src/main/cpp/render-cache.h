@@ -0,0 +1,67 @@
+#ifndef SOXTEST_RENDER_CACHE_H
+#define SOXTEST_RENDER_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include "loudness.h"
+
+/* Persistent cache of render outputs.
+ *
+ * An entry is keyed by the MD5 of the input's content, the canonical
+ * description of the chain (operation, effects and their options, output
+ * type; see sox-ops.cpp) and the libSoX version, so the same chain applied
+ * to the same audio is found again whatever the file is called and across
+ * restarts. The DFT sizes of the device tuning are not part of the key:
+ * they trade speed only and move samples by rounding at most.
+ *
+ * Entries are files named after their key in the cache directory, listed
+ * in an index with their size, last use and, once known, content digest.
+ * Outputs are hard-linked in and out of the cache where the filesystem
+ * allows (and made read-only, so an in-place rewrite cannot corrupt them),
+ * copied otherwise. The least recently used entries are evicted to stay
+ * under the quota. A store does not hash the output, whose key already
+ * says what it is: its digest is taken when a later render looks it up as
+ * its input. Content digests are remembered per inode, so no file is
+ * hashed twice.
+ *
+ * The cache also remembers the loudness statistics of audio it has seen
+ * (loudness.h), keyed like the outputs by a content digest and the chain
+ * that led from it; normalisation looks them up instead of analysing the
+ * audio again. They are kept in memory and, while the cache is enabled,
+ * in a file of their own in its directory; they take no part in the quota */
+
+/* Enables the cache in dir (created if missing) with a size quota in
+ * bytes; an empty dir disables it. Loads the index and drops entries
+ * whose files have gone */
+void render_cache_init(char const * dir, uint64_t quotaBytes);
+bool render_cache_enabled();
+
+/* Content digest of the file; empty if it is unreadable */
+std::string render_cache_digest(char const * path);
+
+/* Key of rendering the audio of digest through chain */
+std::string render_cache_chain_key(std::string const & digest, std::string const & chain);
+
+/* Key of rendering inPath through chain; empty if the input is unreadable */
+std::string render_cache_key(char const * inPath, std::string const & chain);
+
+/* Puts the cached output for key at outPath; RESULT_ERROR on a miss */
+int render_cache_fetch(std::string const & key, char const * outPath);
+
+/* Adds outPath, just rendered, as the output for key; not hashed */
+int render_cache_store(std::string const & key, char const * outPath);
+
+/* Loudness statistics of the audio of key; false on a miss */
+bool render_cache_get_loudness(std::string const & key, LoudnessReport * loudness);
+void render_cache_put_loudness(std::string const & key, LoudnessReport const & loudness);
+
+/* Statistics of the file at path as the render that wrote it measured
+ * them; kept under the file's identity (device, inode, size and
+ * modification time), so that no one hashes it to find them */
+bool render_cache_get_file_loudness(char const * path, LoudnessReport * loudness);
+void render_cache_put_file_loudness(char const * path, LoudnessReport const & loudness);
+
+/* Total size of the entries */
+uint64_t render_cache_bytes();
+
+#endif //SOXTEST_RENDER_CACHE_H
@@ -0,0 +1,492 @@
+#include "render-jobs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "native-log.h"
+#include "sox-ops.h"
+
+/* Renders are multithreaded themselves, so one flows at a time and the
+ * classes take turns on it */
+#define JOB_SLOTS 1
+/* Jobs given a thread of their own, most of them waiting for the slot;
+ * the rest wait in the queues */
+#define JOB_THREADS 4
+/* Threads beyond JOB_THREADS that only interactive jobs start, so that a
+ * preview waits for the slot, not for a thread, while the others are busy
+ * with exports; further previews wait in the queue of their class, which
+ * the threads take first */
+#define JOB_INTERACTIVE_THREADS 2
+/* A job keeps the slot at least this long before it yields */
+#define JOB_QUANTUM_MS 10
+/* Submissions of one key closer than this are a burst */
+#define JOB_DEBOUNCE_MS 150
+/* Finished jobs remembered for job_status() */
+#define JOB_HISTORY 64
+#define PROGRESS_STEP 0.01
+
+/* CPU shares of the classes while they compete for the slot */
+static const double class_shares[JOB_PRIORITIES] = {0.70, 0.25, 0.05};
+
+typedef std::chrono::steady_clock Clock;
+
+struct Job {
+    uint64_t id = 0;
+    std::string name;
+    JobWork work;
+    JobCallbacks callbacks;
+    JobPriority priority = JOB_EXPORT;
+    std::string key;                    /* job_submit_latest() */
+    Clock::time_point not_before;       /* end of the debounce window */
+    std::atomic<bool> cancel_requested{false};
+
+    /* Guarded by jobs_mutex */
+    JobState state = JOB_QUEUED;
+    bool has_thread = false;
+    bool has_slot = false;
+    Clock::time_point charged;          /* slot time is charged to the class up to here */
+    Clock::time_point granted;          /* the slot was last granted */
+    Clock::time_point preempted;        /* the slot was last given back */
+    double preempted_ms = 0;
+    int preemptions = 0;
+    uint64_t superseded_by = 0;
+    double progress = 0;
+    double posted_progress = 0;
+    Clock::time_point submitted;
+    Clock::time_point started;
+    Clock::time_point finished;
+    RenderReport report;
+};
+
+static std::mutex jobs_mutex;
+static std::condition_variable jobs_changed;
+static std::map<uint64_t, std::shared_ptr<Job>> jobs;
+static std::deque<uint64_t> history;
+static uint64_t last_id = 0;
+
+/* The scheduler, guarded by jobs_mutex: jobs without a thread wait in the
+ * queue of their class, jobs with one in waiting until they get the slot.
+ * A class is charged the slot time of its jobs divided by its share; the
+ * waiting job of the class charged least goes next. A class that becomes
+ * active again starts from the floor (the least charge of the active
+ * classes), so idle time is not saved up for a burst later */
+static std::deque<std::shared_ptr<Job>> queues[JOB_PRIORITIES];
+static std::deque<std::shared_ptr<Job>> waiting;
+static double class_charge[JOB_PRIORITIES];
+static int class_active[JOB_PRIORITIES];
+static double charge_floor = 0;
+static int slots_busy = 0;
+static int threads_busy = 0;
+
+/* Last submission of each key, for the debounce */
+static std::map<std::string, Clock::time_point> key_submitted;
+
+/* The callback thread waits on these for the life of the process; they
+ * are never destroyed, as destroying a condition variable with a waiter
+ * blocks the exit */
+static std::mutex & events_mutex = *new std::mutex;
+static std::condition_variable & events_changed = *new std::condition_variable;
+static std::deque<std::function<void()>> & events = *new std::deque<std::function<void()>>;
+
+static std::once_flag event_thread_started;
+static thread_local Job * current_job = NULL;
+
+static double ms_between(Clock::time_point from, Clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static bool finished(JobState state) {
+    return state == JOB_SUCCEEDED || state == JOB_FAILED || state == JOB_CANCELLED;
+}
+
+static void post_event(std::function<void()> const & event) {
+    std::lock_guard<std::mutex> lock(events_mutex);
+    events.push_back(event);
+    events_changed.notify_one();
+}
+
+static void event_loop() {
+    for (;;) {
+        std::function<void()> event;
+        {
+            std::unique_lock<std::mutex> lock(events_mutex);
+            events_changed.wait(lock, [] { return !events.empty(); });
+            event = events.front();
+            events.pop_front();
+        }
+        event();
+    }
+}
+
+/* The callers hold jobs_mutex */
+static JobStatus status_locked(Job const & job) {
+    JobStatus status;
+    status.id = job.id;
+    status.state = job.state;
+    status.priority = job.priority;
+    status.progress = job.progress;
+    status.preempted_ms = job.preempted_ms;
+    status.preemptions = job.preemptions;
+    status.superseded_by = job.superseded_by;
+    Clock::time_point now = Clock::now();
+    if (job.state == JOB_QUEUED) {
+        status.queued_ms = ms_between(job.submitted, now);
+    } else {
+        status.queued_ms = ms_between(job.submitted, job.started);
+        status.run_ms = ms_between(job.started, finished(job.state) ? job.finished : now);
+    }
+    status.report = job.report;
+    return status;
+}
+
+/* Marks the job finished and queues its done callback; the callers hold jobs_mutex */
+static void finish_locked(std::shared_ptr<Job> const & job, JobState state) {
+    job->state = state;
+    job->finished = Clock::now();
+    if (job->started == Clock::time_point()) {
+        job->started = job->finished;
+    }
+    if (state == JOB_SUCCEEDED) {
+        job->progress = 1;
+    }
+    history.push_back(job->id);
+    while (history.size() > JOB_HISTORY) {
+        jobs.erase(history.front());
+        history.pop_front();
+    }
+    jobs_changed.notify_all();
+
+    JobStatus status = status_locked(*job);
+    std::function<void(JobStatus const &)> onDone = job->callbacks.on_done;
+    if (onDone) {
+        post_event([onDone, status] { onDone(status); });
+    }
+}
+
+/* True if class a goes before class b */
+static bool class_before(int a, int b) {
+    return class_charge[a] < class_charge[b] || (class_charge[a] == class_charge[b] && a < b);
+}
+
+/* Charges the slot time of the job since the last charge to its class */
+static void charge_locked(Job * job, Clock::time_point now) {
+    class_charge[job->priority] += ms_between(job->charged, now) / class_shares[job->priority];
+    job->charged = now;
+    double least = -1;
+    for (int c = 0; c < JOB_PRIORITIES; c++) {
+        if (class_active[c] > 0 && (least < 0 || class_charge[c] < least)) {
+            least = class_charge[c];
+        }
+    }
+    charge_floor = std::max(charge_floor, least);
+}
+
+/* Hands the free slots to the waiting jobs of the classes charged least */
+static void schedule_locked() {
+    while (slots_busy < JOB_SLOTS && !waiting.empty()) {
+        auto next = waiting.begin();
+        for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+            if (class_before((*it)->priority, (*next)->priority)
+                    || ((*it)->priority == (*next)->priority && (*it)->id < (*next)->id)) {
+                next = it;
+            }
+        }
+        std::shared_ptr<Job> job = *next;
+        waiting.erase(next);
+        Clock::time_point now = Clock::now();
+        job->has_slot = true;
+        job->charged = now;
+        job->granted = now;
+        if (job->state == JOB_RUNNING) {
+            job->preempted_ms += ms_between(job->preempted, now);
+        }
+        slots_busy++;
+    }
+    jobs_changed.notify_all();
+}
+
+static void drop_waiting_locked(Job * job) {
+    for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+        if (it->get() == job) {
+            waiting.erase(it);
+            return;
+        }
+    }
+}
+
+static char const * cancel_error(Job const & job) {
+    return job.superseded_by ? "superseded" : "cancelled";
+}
+
+/* Asks the job to stop; one without a thread yet is dropped from its queue
+ * and finished here, the others stop at their next block */
+static void cancel_locked(std::shared_ptr<Job> const & job) {
+    job->cancel_requested = true;
+    if (!job->has_thread) {
+        std::deque<std::shared_ptr<Job>> & queue = queues[job->priority];
+        for (auto q = queue.begin(); q != queue.end(); ++q) {
+            if (*q == job) {
+                queue.erase(q);
+                break;
+            }
+        }
+        job->report.operation = job->name;
+        job->report.result = RESULT_ERROR;
+        job->report.error = cancel_error(*job);
+        finish_locked(job, JOB_CANCELLED);
+    } else {
+        /* Wakes the job if it waits for the slot or its debounce */
+        jobs_changed.notify_all();
+    }
+}
+
+/* Waits in line for the slot; false if the job was cancelled meanwhile */
+static bool acquire_slot_locked(std::unique_lock<std::mutex> & lock, std::shared_ptr<Job> const & job) {
+    waiting.push_back(job);
+    schedule_locked();
+    jobs_changed.wait(lock, [&] { return job->has_slot || job->cancel_requested; });
+    if (!job->has_slot) {
+        drop_waiting_locked(job.get());
+        return false;
+    }
+    return true;
+}
+
+static void release_slot_locked(Job * job) {
+    if (!job->has_slot) {
+        return;
+    }
+    charge_locked(job, Clock::now());
+    job->has_slot = false;
+    slots_busy--;
+    schedule_locked();
+}
+
+static void run_job(std::shared_ptr<Job> const & job) {
+    {
+        std::unique_lock<std::mutex> lock(jobs_mutex);
+        jobs_changed.wait_until(lock, job->not_before, [&] { return job->cancel_requested.load(); });
+        int & active = class_active[job->priority];
+        if (active++ == 0) {
+            class_charge[job->priority] = std::max(class_charge[job->priority], charge_floor);
+        }
+        if (job->cancel_requested || !acquire_slot_locked(lock, job)) {
+            active--;
+            job->report.operation = job->name;
+            job->report.result = RESULT_ERROR;
+            job->report.error = cancel_error(*job);
+            finish_locked(job, JOB_CANCELLED);
+            return;
+        }
+        job->state = JOB_RUNNING;
+        job->started = Clock::now();
+    }
+
+    RenderReport report;
+    current_job = job.get();
+    int result = job->work(&report);
+    current_job = NULL;
+    if (report.operation.empty()) {
+        report.operation = job->name;
+    }
+    report_set_last(report);
+
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    release_slot_locked(job.get());
+    class_active[job->priority]--;
+    if (result != RESULT_SUCCESS && job->cancel_requested) {
+        report.error = cancel_error(*job);
+    }
+    job->report = report;
+    finish_locked(job, result == RESULT_SUCCESS ? JOB_SUCCEEDED
+                       : job->cancel_requested ? JOB_CANCELLED : JOB_FAILED);
+    LOG_I("job %llu (%s, %s): queued %.1f ms, ran %.1f ms, preempted %d times for %.1f ms",
+          (unsigned long long) job->id, job->name.c_str(), job_priority_name(job->priority),
+          ms_between(job->submitted, job->started), ms_between(job->started, job->finished),
+          job->preemptions, job->preempted_ms);
+}
+
+/* Runs the job, then the queued ones, most urgent class first */
+static void job_thread(std::shared_ptr<Job> job) {
+    while (job) {
+        run_job(job);
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        job.reset();
+        for (int c = 0; c < JOB_PRIORITIES && !job; c++) {
+            if (!queues[c].empty()) {
+                job = queues[c].front();
+                queues[c].pop_front();
+                job->has_thread = true;
+            }
+        }
+        if (!job) {
+            threads_busy--;
+        }
+    }
+}
+
+static void start_event_thread() {
+    std::thread(event_loop).detach();
+}
+
+static uint64_t submit(char const * key, char const * name, JobPriority priority, JobWork const & work,
+                       JobCallbacks const & callbacks) {
+    std::call_once(event_thread_started, start_event_thread);
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->name = name;
+    job->priority = priority;
+    job->key = key ? key : "";
+    job->work = work;
+    job->callbacks = callbacks;
+    job->submitted = Clock::now();
+
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    job->id = ++last_id;
+    if (!job->key.empty()) {
+        std::vector<std::shared_ptr<Job>> older;
+        for (auto const & entry : jobs) {
+            if (entry.second->key == job->key && !finished(entry.second->state)) {
+                older.push_back(entry.second);
+            }
+        }
+        for (std::shared_ptr<Job> const & other : older) {
+            other->superseded_by = job->id;
+            cancel_locked(other);
+            LOG_I("job %llu (%s): superseded by %llu", (unsigned long long) other->id, other->name.c_str(),
+                  (unsigned long long) job->id);
+        }
+        auto last = key_submitted.find(job->key);
+        if (last != key_submitted.end() && ms_between(last->second, job->submitted) < JOB_DEBOUNCE_MS) {
+            job->not_before = job->submitted + std::chrono::milliseconds(JOB_DEBOUNCE_MS);
+        }
+        for (auto it = key_submitted.begin(); it != key_submitted.end();) {
+            it = ms_between(it->second, job->submitted) >= JOB_DEBOUNCE_MS ? key_submitted.erase(it) : ++it;
+        }
+        key_submitted[job->key] = job->submitted;
+    }
+    jobs[job->id] = job;
+    int threads = priority == JOB_INTERACTIVE ? JOB_THREADS + JOB_INTERACTIVE_THREADS : JOB_THREADS;
+    if (threads_busy < threads) {
+        threads_busy++;
+        job->has_thread = true;
+        std::thread(job_thread, job).detach();
+    } else {
+        queues[priority].push_back(job);
+    }
+    return job->id;
+}
+
+uint64_t job_submit(char const * name, JobPriority priority, JobWork const & work, JobCallbacks const & callbacks) {
+    return submit(NULL, name, priority, work, callbacks);
+}
+
+uint64_t job_submit_latest(char const * key, char const * name, JobPriority priority, JobWork const & work,
+                           JobCallbacks const & callbacks) {
+    return submit(key, name, priority, work, callbacks);
+}
+
+int job_status(uint64_t id, JobStatus * status) {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) {
+        return RESULT_ERROR;
+    }
+    *status = status_locked(*it->second);
+    return RESULT_SUCCESS;
+}
+
+int job_await(uint64_t id, double timeoutMs, JobStatus * status) {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) {
+        return RESULT_ERROR;
+    }
+    std::shared_ptr<Job> job = it->second;
+    auto done = [&] { return finished(job->state); };
+    if (timeoutMs < 0) {
+        jobs_changed.wait(lock, done);
+    } else {
+        jobs_changed.wait_for(lock, std::chrono::duration<double, std::milli>(timeoutMs), done);
+    }
+    if (status) {
+        *status = status_locked(*job);
+    }
+    return finished(job->state) ? RESULT_SUCCESS : RESULT_ERROR;
+}
+
+int job_cancel(uint64_t id) {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end() || finished(it->second->state)) {
+        return RESULT_ERROR;
+    }
+    std::shared_ptr<Job> job = it->second;
+    cancel_locked(job);
+    LOG_I("job %llu (%s): cancel requested", (unsigned long long) id, job->name.c_str());
+    return RESULT_SUCCESS;
+}
+
+void job_report_progress(double fraction) {
+    Job * job = current_job;
+    if (!job) {
+        return;
+    }
+    fraction = fraction < 0 ? 0 : fraction > 1 ? 1 : fraction;
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    job->progress = fraction;
+    if (fraction - job->posted_progress < PROGRESS_STEP || !job->callbacks.on_progress) {
+        return;
+    }
+    job->posted_progress = fraction;
+    uint64_t id = job->id;
+    std::function<void(uint64_t, double)> onProgress = job->callbacks.on_progress;
+    post_event([onProgress, id, fraction] { onProgress(id, fraction); });
+}
+
+bool job_cancelled() {
+    return current_job && current_job->cancel_requested;
+}
+
+void job_yield() {
+    Job * job = current_job;
+    if (!job) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    Clock::time_point now = Clock::now();
+    if (!job->has_slot || ms_between(job->granted, now) < JOB_QUANTUM_MS) {
+        return;
+    }
+    charge_locked(job, now);
+    bool overtaken = false;
+    for (std::shared_ptr<Job> const & other : waiting) {
+        overtaken = overtaken || class_before(other->priority, job->priority);
+    }
+    if (!overtaken) {
+        return;
+    }
+    std::shared_ptr<Job> self = jobs[job->id];
+    job->has_slot = false;
+    job->preempted = now;
+    job->preemptions++;
+    slots_busy--;
+    /* Back in line; a cancel lets the job go on without the slot to stop at once */
+    acquire_slot_locked(lock, self);
+}
+
+char const * job_priority_name(JobPriority priority) {
+    switch (priority) {
+        case JOB_INTERACTIVE: return "interactive";
+        case JOB_EXPORT: return "export";
+        case JOB_BACKGROUND: return "background";
+    }
+    return "unknown";
+}
@@ -0,0 +1,97 @@
+#ifndef SOXTEST_RENDER_JOBS_H
+#define SOXTEST_RENDER_JOBS_H
+
+#include <cstdint>
+#include <functional>
+#include "render-report.h"
+
+/* Asynchronous render jobs.
+ *
+ * job_submit() queues a render and returns its id at once; job threads run
+ * the jobs as the scheduler below lets them, and a single callback thread delivers
+ * their progress and completion, so neither the submitter nor a worker
+ * ever waits on the receiver of a callback (on Android, the JVM).
+ *
+ * A job reaches the render code through its thread: sox_render() and the
+ * parallel decode and export paths report progress with
+ * job_report_progress() and stop at the next block once job_cancelled()
+ * turns true. Outside a job both are no-ops.
+ *
+ * Jobs belong to a priority class, and the classes share a single render
+ * slot in proportion to their CPU shares (a weighted fair queue over the
+ * classes, first come first served within one). The render code offers the
+ * slot back at every block with job_yield(): a job whose class has used
+ * more than its share steps aside there for a waiting job of another class,
+ * so a preview that arrives during a long export starts after one block
+ * instead of after the export */
+
+enum JobPriority {
+    JOB_INTERACTIVE,    /* previews the user waits for */
+    JOB_EXPORT,         /* user exports and full-quality renders */
+    JOB_BACKGROUND      /* batch renders, cache warm-up */
+};
+#define JOB_PRIORITIES 3
+
+enum JobState {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_SUCCEEDED,
+    JOB_FAILED,
+    JOB_CANCELLED
+};
+
+struct JobStatus {
+    uint64_t id = 0;
+    JobState state = JOB_QUEUED;
+    JobPriority priority = JOB_EXPORT;
+    double progress = 0;      /* 0..1 */
+    double queued_ms = 0;     /* from submission to the start of the run */
+    double run_ms = 0;        /* from the start of the run to its end, preempted time included */
+    double preempted_ms = 0;  /* waiting for the slot after a job_yield() */
+    int preemptions = 0;
+    uint64_t superseded_by = 0;   /* the newer job of the same key that cancelled this one */
+    RenderReport report;      /* once finished */
+};
+
+/* Runs the render and fills the report; returns RESULT_SUCCESS or RESULT_ERROR */
+typedef std::function<int(RenderReport * report)> JobWork;
+
+/* Called on the callback thread, in order for each job: progress at most
+ * every percent, then done exactly once */
+struct JobCallbacks {
+    std::function<void(uint64_t id, double progress)> on_progress;
+    std::function<void(JobStatus const & status)> on_done;
+};
+
+uint64_t job_submit(char const * name, JobPriority priority, JobWork const & work,
+                    JobCallbacks const & callbacks = JobCallbacks());
+
+/* Submits a job that supersedes the unfinished jobs of the same key (a
+ * project stage, so that only the latest parameters of a stage render):
+ * queued ones are dropped and running ones stop at their next block, all
+ * finishing as JOB_CANCELLED with the error "superseded". A job that
+ * follows another of its key within the debounce window waits out the
+ * window before it starts, so a burst of changes renders only its last */
+uint64_t job_submit_latest(char const * key, char const * name, JobPriority priority, JobWork const & work,
+                           JobCallbacks const & callbacks = JobCallbacks());
+
+/* RESULT_ERROR for an unknown id; finished jobs are remembered for a while */
+int job_status(uint64_t id, JobStatus * status);
+
+/* Waits up to timeoutMs (forever if negative) for the job to finish;
+ * RESULT_SUCCESS once it has, RESULT_ERROR on a timeout or an unknown id */
+int job_await(uint64_t id, double timeoutMs, JobStatus * status = NULL);
+
+/* A queued job is dropped, a running one stops at its next block; both
+ * finish as JOB_CANCELLED. RESULT_ERROR if the job has already finished */
+int job_cancel(uint64_t id);
+
+/* For the render code, on the thread of the job */
+void job_report_progress(double fraction);
+bool job_cancelled();
+/* Called at block boundaries; may block while jobs of other classes run */
+void job_yield();
+
+char const * job_priority_name(JobPriority priority);
+
+#endif //SOXTEST_RENDER_JOBS_H
@@ -0,0 +1,345 @@
+#include "render-report.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+
+/* One probe per flow of every effect in an attached chain. libSoX calls
+ * handler.flow/drain with a pointer into chain->effects, so that pointer is
+ * the key under which the wrappers find the original handler and counters.
+ * With use_threads the flows of one effect run concurrently, so each probe
+ * gets its own cache line */
+struct alignas(64) EffectProbe {
+    sox_effect_handler_flow flow;
+    sox_effect_handler_drain drain;
+    size_t stage;
+    double flow_ms;
+    double drain_ms;
+    uint64_t flow_calls;
+    uint64_t drain_calls;
+    uint64_t samples_in;
+    uint64_t samples_out;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+/* Open-addressed table of the live probes (effp -> probe). It is fixed in
+ * size so that attaching a chain allocates nothing but the probe array from
+ * the job's arena; a chain has a handful of effects times their flows */
+#define PROBE_SLOTS 1024
+#define PROBE_TOMBSTONE ((sox_effect_t const *) 1)
+
+struct ProbeSlot {
+    sox_effect_t const * effp;
+    EffectProbe * probe;
+};
+
+static std::shared_mutex probes_mutex;
+static ProbeSlot probes[PROBE_SLOTS];
+static size_t live_probes = 0;
+
+static std::mutex last_mutex;
+static std::string last_json = "{}";
+
+static size_t probe_hash(sox_effect_t const * effp) {
+    return ((uintptr_t) effp >> 4) * 0x9E3779B1u % PROBE_SLOTS;
+}
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+/* Caller holds probes_mutex */
+static ProbeSlot * find_slot(sox_effect_t const * effp) {
+    for (size_t i = probe_hash(effp), n = 0; n < PROBE_SLOTS; i = (i + 1) % PROBE_SLOTS, n++) {
+        if (probes[i].effp == effp) {
+            return &probes[i];
+        }
+        if (!probes[i].effp) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Caller holds probes_mutex exclusively */
+static bool insert_probe(sox_effect_t const * effp, EffectProbe * probe) {
+    if (live_probes == 0) {
+        /* Nothing live: drop the tombstones of earlier chains */
+        memset(probes, 0, sizeof(probes));
+    }
+    for (size_t i = probe_hash(effp), n = 0; n < PROBE_SLOTS; i = (i + 1) % PROBE_SLOTS, n++) {
+        if (!probes[i].effp || probes[i].effp == PROBE_TOMBSTONE) {
+            probes[i].effp = effp;
+            probes[i].probe = probe;
+            live_probes++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static EffectProbe * find_probe(sox_effect_t const * effp) {
+    std::shared_lock<std::shared_mutex> lock(probes_mutex);
+    ProbeSlot * slot = find_slot(effp);
+    return slot ? slot->probe : NULL;
+}
+
+static int LSX_API probe_flow(sox_effect_t * effp, sox_sample_t const * ibuf,
+        sox_sample_t * obuf, size_t * isamp, size_t * osamp) {
+    EffectProbe * probe = find_probe(effp);
+    Clock::time_point start = Clock::now();
+    int result = probe->flow(effp, ibuf, obuf, isamp, osamp);
+    probe->flow_ms += ms_since(start);
+    probe->flow_calls++;
+    probe->samples_in += *isamp;
+    probe->samples_out += *osamp;
+    return result;
+}
+
+static int LSX_API probe_drain(sox_effect_t * effp, sox_sample_t * obuf, size_t * osamp) {
+    EffectProbe * probe = find_probe(effp);
+    Clock::time_point start = Clock::now();
+    int result = probe->drain(effp, obuf, osamp);
+    probe->drain_ms += ms_since(start);
+    probe->drain_calls++;
+    probe->samples_out += *osamp;
+    return result;
+}
+
+void report_attach_chain(RenderReport * report, sox_effects_chain_t * chain, JobArena * arena) {
+    size_t count = 0;
+    for (size_t i = 0; i < chain->length; i++) {
+        count += chain->effects[i][0].flows;
+    }
+
+    EffectProbe * table = arena->allocate_array<EffectProbe>(count);
+    std::unique_lock<std::shared_mutex> lock(probes_mutex);
+
+    report->stages.clear();
+    report->stages.reserve(chain->length);
+    size_t n = 0;
+    for (size_t i = 0; i < chain->length; i++) {
+        StageReport stage;
+        stage.name = chain->effects[i][0].handler.name;
+        stage.flows = chain->effects[i][0].flows;
+        report->stages.push_back(stage);
+
+        for (size_t f = 0; f < stage.flows; f++, n++) {
+            sox_effect_t * effp = &chain->effects[i][f];
+            EffectProbe * probe = &table[n];
+            probe->stage = i;
+            probe->flow = effp->handler.flow;
+            probe->drain = effp->handler.drain;
+            if (!insert_probe(effp, probe)) {
+                /* Table full: this flow simply goes unmeasured */
+                continue;
+            }
+            if (probe->flow) {
+                effp->handler.flow = probe_flow;
+            }
+            if (probe->drain) {
+                effp->handler.drain = probe_drain;
+            }
+        }
+    }
+}
+
+void report_detach_chain(RenderReport * report, sox_effects_chain_t * chain) {
+    std::unique_lock<std::shared_mutex> lock(probes_mutex);
+
+    for (size_t i = 0; i < chain->length && i < report->stages.size(); i++) {
+        StageReport & stage = report->stages[i];
+        for (size_t f = 0; f < chain->effects[i][0].flows; f++) {
+            sox_effect_t * effp = &chain->effects[i][f];
+            ProbeSlot * slot = find_slot(effp);
+            if (!slot) {
+                continue;
+            }
+            EffectProbe * probe = slot->probe;
+            stage.flow_ms += probe->flow_ms;
+            stage.drain_ms += probe->drain_ms;
+            stage.flow_calls += probe->flow_calls;
+            stage.drain_calls += probe->drain_calls;
+            stage.samples_in += probe->samples_in;
+            stage.samples_out += probe->samples_out;
+            stage.clips += effp->clips;
+
+            /* Stopping the effect later must see the real handler */
+            effp->handler.flow = probe->flow;
+            effp->handler.drain = probe->drain;
+            slot->effp = PROBE_TOMBSTONE;
+            live_probes--;
+        }
+    }
+
+    if (!report->stages.empty()) {
+        report->read_wait_ms = report->stages.front().drain_ms;
+        report->write_wait_ms = report->stages.back().flow_ms;
+    }
+    report->clips = sox_effects_clips(chain);
+}
+
+void json_string(std::string & out, std::string const & value) {
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if ((unsigned char) c < 0x20) {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+static void json_key(std::string & out, char const * key) {
+    if (out.back() != '{') {
+        out += ',';
+    }
+    out += '"';
+    out += key;
+    out += "\":";
+}
+
+void json_field(std::string & out, char const * key, std::string const & value) {
+    json_key(out, key);
+    json_string(out, value);
+}
+
+void json_field(std::string & out, char const * key, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", value);
+    json_key(out, key);
+    out += buf;
+}
+
+void json_field(std::string & out, char const * key, uint64_t value) {
+    json_key(out, key);
+    out += std::to_string(value);
+}
+
+void json_field(std::string & out, char const * key, int value) {
+    json_key(out, key);
+    out += std::to_string(value);
+}
+
+void json_field(std::string & out, char const * key, bool value) {
+    json_key(out, key);
+    out += value ? "true" : "false";
+}
+
+std::string report_to_json(RenderReport const & report) {
+    std::string out = "{";
+    json_field(out, "operation", report.operation);
+    json_field(out, "in_path", report.in_path);
+    json_field(out, "out_path", report.out_path);
+    json_field(out, "result", report.result);
+    json_field(out, "error", report.error);
+    json_field(out, "in_rate", report.in_rate);
+    json_field(out, "out_rate", report.out_rate);
+    json_field(out, "channels", (uint64_t) report.channels);
+    json_field(out, "threads", (uint64_t) report.threads);
+    json_field(out, "total_ms", report.total_ms);
+    json_field(out, "flow_ms", report.flow_ms);
+    json_field(out, "input_bytes", report.input_bytes);
+    json_field(out, "output_bytes", report.output_bytes);
+    json_field(out, "read_wait_ms", report.read_wait_ms);
+    json_field(out, "write_wait_ms", report.write_wait_ms);
+    json_field(out, "clips", report.clips);
+    json_field(out, "resumed_samples", report.resumed_samples);
+    json_field(out, "peak_rss_bytes", report.peak_rss_bytes);
+    json_field(out, "rss_growth_bytes", report.rss_growth_bytes);
+    json_field(out, "cache_hit", report.cache_hit);
+    if (report.loudness.measured) {
+        LoudnessReport const & loudness = report.loudness;
+        json_key(out, "loudness");
+        out += '{';
+        json_field(out, "frames", loudness.frames);
+        json_field(out, "integrated_lufs", loudness.integrated_lufs);
+        json_field(out, "range_lu", loudness.range_lu);
+        json_field(out, "momentary_max_lufs", loudness.momentary_max_lufs);
+        json_field(out, "short_term_max_lufs", loudness.short_term_max_lufs);
+        json_field(out, "true_peak_dbtp", loudness.true_peak_dbtp);
+        json_field(out, "sample_peak_dbfs", loudness.sample_peak_dbfs);
+        out += '}';
+    }
+    if (report.silence.scanned) {
+        SilenceReport const & silence = report.silence;
+        json_key(out, "silence");
+        out += '{';
+        json_field(out, "threshold_db", silence.threshold_db);
+        json_field(out, "frames", silence.frames);
+        json_field(out, "lead_frames", silence.lead_frames);
+        json_field(out, "trail_frames", silence.trail_frames);
+        json_field(out, "trimmed", silence.trimmed);
+        json_key(out, "regions");
+        out += '[';
+        for (size_t i = 0; i < silence.regions.size(); i++) {
+            out += i > 0 ? ",{" : "{";
+            json_field(out, "start", silence.regions[i].start);
+            json_field(out, "frames", silence.regions[i].frames);
+            out += '}';
+        }
+        out += ']';
+        out += '}';
+    }
+
+    json_key(out, "stages");
+    out += '[';
+    for (size_t i = 0; i < report.stages.size(); i++) {
+        StageReport const & stage = report.stages[i];
+        if (i > 0) {
+            out += ',';
+        }
+        out += '{';
+        json_field(out, "name", stage.name);
+        json_field(out, "flows", (uint64_t) stage.flows);
+        json_field(out, "flow_ms", stage.flow_ms);
+        json_field(out, "drain_ms", stage.drain_ms);
+        json_field(out, "flow_calls", stage.flow_calls);
+        json_field(out, "drain_calls", stage.drain_calls);
+        json_field(out, "samples_in", stage.samples_in);
+        json_field(out, "samples_out", stage.samples_out);
+        json_field(out, "clips", stage.clips);
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
+
+int report_write_json(RenderReport const & report, char const * path) {
+    FILE * f = fopen(path, "w");
+    if (!f) {
+        return -1;
+    }
+    std::string json = report_to_json(report);
+    size_t written = fwrite(json.data(), 1, json.size(), f);
+    fputc('\n', f);
+    if (fclose(f) != 0 || written != json.size()) {
+        return -1;
+    }
+    return 0;
+}
+
+void report_set_last(RenderReport const & report) {
+    std::string json = report_to_json(report);
+    std::lock_guard<std::mutex> lock(last_mutex);
+    last_json = json;
+}
+
+std::string report_last_json() {
+    std::lock_guard<std::mutex> lock(last_mutex);
+    return last_json;
+}
@@ -0,0 +1,82 @@
+#ifndef SOXTEST_RENDER_REPORT_H
+#define SOXTEST_RENDER_REPORT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "job-arena.h"
+#include "loudness.h"
+#include "silence.h"
+#include "sox.h"
+
+/* Telemetry of one effect of the chain, summed over all of its flows
+ * (one flow per channel unless the effect is SOX_EFF_MCHAN) */
+struct StageReport {
+    std::string name;
+    size_t flows = 0;
+    double flow_ms = 0;       /* time spent inside the effect's flow()  */
+    double drain_ms = 0;      /* time spent inside the effect's drain() */
+    uint64_t flow_calls = 0;  /* buffers handed to flow()               */
+    uint64_t drain_calls = 0;
+    uint64_t samples_in = 0;
+    uint64_t samples_out = 0;
+    uint64_t clips = 0;
+};
+
+/* Structured result of one render; filled by sox_render() */
+struct RenderReport {
+    std::string operation;
+    std::string in_path;
+    std::string out_path;
+    int result = 0;
+    std::string error;
+
+    double in_rate = 0;
+    double out_rate = 0;
+    unsigned channels = 0;
+    unsigned threads = 0;     /* parallel flow threads, 0 if disabled   */
+
+    double total_ms = 0;      /* wall time from open to close           */
+    double flow_ms = 0;       /* wall time inside sox_flow_effects      */
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    double read_wait_ms = 0;  /* decode + read: drain() of "input"      */
+    double write_wait_ms = 0; /* encode + write: flow() of "output"     */
+    uint64_t clips = 0;       /* sox_effects_clips() of the chain       */
+    uint64_t resumed_samples = 0; /* output taken over from a checkpoint */
+    uint64_t peak_rss_bytes = 0;   /* process RSS, sampled while flowing  */
+    uint64_t rss_growth_bytes = 0; /* peak over the RSS at the start      */
+    bool cache_hit = false;   /* output taken from the render cache     */
+    LoudnessReport loudness;  /* of a loudness tap in the chain         */
+    SilenceReport silence;    /* of a silence tap, see silence.h        */
+
+    std::vector<StageReport> stages;
+};
+
+/* Wraps flow()/drain() of every effect already added to the chain with
+ * timing probes that accumulate into the report. Must be called after the
+ * last sox_add_effect() and paired with report_detach_chain(); the probes
+ * live in the job's arena */
+void report_attach_chain(RenderReport * report, sox_effects_chain_t * chain, JobArena * arena);
+
+/* Copies the per-stage counters and clip counts into the report and
+ * forgets the chain; call before sox_delete_effects_chain() */
+void report_detach_chain(RenderReport * report, sox_effects_chain_t * chain);
+
+std::string report_to_json(RenderReport const & report);
+
+/* Writers of the JSON objects handed to the app; a field is appended to an
+ * object already opened in out */
+void json_string(std::string & out, std::string const & value);
+void json_field(std::string & out, char const * key, std::string const & value);
+void json_field(std::string & out, char const * key, double value);
+void json_field(std::string & out, char const * key, uint64_t value);
+void json_field(std::string & out, char const * key, int value);
+void json_field(std::string & out, char const * key, bool value);
+int report_write_json(RenderReport const & report, char const * path);
+
+/* Last report produced in this process, for the JNI layer */
+void report_set_last(RenderReport const & report);
+std::string report_last_json();
+
+#endif //SOXTEST_RENDER_REPORT_H
@@ -0,0 +1,152 @@
+#include "silence.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "simd.h"
+#include "sox-ops.h"
+
+static void reset_window(SilenceScanner * scanner) {
+    scanner->window_pos = 0;
+    scanner->window_max = INT32_MIN;
+    scanner->window_min = INT32_MAX;
+}
+
+int silence_scanner_init(SilenceScanner * scanner, double rate, unsigned channels, SilenceOptions const & options) {
+    *scanner = SilenceScanner();
+    if (rate <= 0 || channels == 0) {
+        return RESULT_ERROR;
+    }
+    scanner->channels = channels;
+    scanner->window_frames = std::max<uint64_t>(1, (uint64_t) std::llround(rate * SILENCE_WINDOW_SECONDS));
+    scanner->pad_frames = (uint64_t) std::llround(rate * options.pad_seconds);
+    scanner->min_frames = (uint64_t) std::llround(rate * options.min_seconds);
+    scanner->threshold = (int64_t) (std::pow(10.0, options.threshold_db / 20) * SOX_SAMPLE_MAX);
+    scanner->threshold_db = options.threshold_db;
+    reset_window(scanner);
+    return RESULT_SUCCESS;
+}
+
+/* Lowest and highest sample, four lanes at a time; the peak is taken from
+ * both, as -SOX_SAMPLE_MIN does not fit a sample */
+static void sample_range(sox_sample_t const * samples, size_t count, int32_t * lo, int32_t * hi) {
+    i32x4 lows = i32x4_splat(*lo), highs = i32x4_splat(*hi);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        i32x4 v = i32x4_load(samples + i);
+        lows = i32x4_min(lows, v);
+        highs = i32x4_max(highs, v);
+    }
+    *lo = i32x4_hmin(lows);
+    *hi = i32x4_hmax(highs);
+    for (; i < count; i++) {
+        *lo = std::min(*lo, samples[i]);
+        *hi = std::max(*hi, samples[i]);
+    }
+}
+
+static void end_window(SilenceScanner * s) {
+    uint64_t start = s->frames - s->window_pos;
+    int64_t peak = std::max((int64_t) s->window_max, -(int64_t) s->window_min);
+    if (peak < s->threshold) {
+        if (!s->in_run) {
+            s->in_run = true;
+            s->run_start = start;
+        }
+    } else {
+        uint64_t length = start - s->run_start;
+        if (s->in_run && length > 0 && (s->run_start == 0 || length >= s->min_frames)) {
+            s->regions.push_back({s->run_start, length});
+        }
+        s->in_run = false;
+        if (!s->heard) {
+            s->heard = true;
+            s->first_heard = start;
+        }
+        s->last_heard_end = s->frames;
+    }
+    reset_window(s);
+}
+
+void silence_scanner_add(SilenceScanner * scanner, sox_sample_t const * samples, size_t count) {
+    size_t frames = count / scanner->channels;
+    while (frames > 0) {
+        size_t n = (size_t) std::min<uint64_t>(frames, scanner->window_frames - scanner->window_pos);
+        sample_range(samples, n * scanner->channels, &scanner->window_min, &scanner->window_max);
+        samples += n * scanner->channels;
+        frames -= n;
+        scanner->frames += n;
+        scanner->window_pos += n;
+        if (scanner->window_pos == scanner->window_frames) {
+            end_window(scanner);
+        }
+    }
+}
+
+uint64_t silence_scanner_lead(SilenceScanner const & scanner) {
+    uint64_t silent = scanner.heard ? scanner.first_heard : scanner.frames - scanner.window_pos;
+    return silent > scanner.pad_frames ? silent - scanner.pad_frames : 0;
+}
+
+void silence_scanner_finish(SilenceScanner const & scanner, SilenceReport * report) {
+    SilenceScanner s = scanner;
+    if (s.window_pos > 0) {
+        end_window(&s);
+    }
+    if (s.in_run && s.frames > s.run_start) {
+        s.regions.push_back({s.run_start, s.frames - s.run_start});
+    }
+    *report = SilenceReport();
+    report->scanned = s.channels > 0;
+    report->threshold_db = s.threshold_db;
+    report->frames = s.frames;
+    report->regions = s.regions;
+    if (s.heard) {
+        report->lead_frames = silence_scanner_lead(s);
+        uint64_t trail = s.frames - s.last_heard_end;
+        report->trail_frames = trail > s.pad_frames ? trail - s.pad_frames : 0;
+    } else {
+        /* Silent throughout: what was dropped while scanning, never all */
+        report->lead_frames = silence_scanner_lead(scanner);
+    }
+}
+
+struct SilenceTap {
+    SilenceScanner * scanner;
+    SilenceOptions options;
+};
+
+static int LSX_API tap_start(sox_effect_t * effp) {
+    SilenceTap * tap = (SilenceTap *) effp->priv;
+    return silence_scanner_init(tap->scanner, effp->in_signal.rate, effp->in_signal.channels, tap->options)
+            == RESULT_SUCCESS ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int LSX_API tap_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * obuf,
+                            size_t * isamp, size_t * osamp) {
+    SilenceScanner * scanner = ((SilenceTap *) effp->priv)->scanner;
+    size_t len = std::min(*isamp, *osamp);
+    len -= len % scanner->channels;
+    std::copy(ibuf, ibuf + len, obuf);
+    silence_scanner_add(scanner, ibuf, len);
+    *isamp = *osamp = len;
+    return SOX_SUCCESS;
+}
+
+static sox_effect_handler_t const * tap_handler() {
+    static sox_effect_handler_t handler = {
+            SILENCE_EFFECT, NULL, SOX_EFF_MCHAN | SOX_EFF_MODIFY, NULL, tap_start, tap_flow, NULL, NULL, NULL,
+            sizeof(SilenceTap)
+    };
+    return &handler;
+}
+
+sox_effect_t * silence_tap_create(SilenceScanner * scanner, SilenceOptions const & options) {
+    sox_effect_t * e = sox_create_effect(tap_handler());
+    if (e) {
+        SilenceTap * tap = (SilenceTap *) e->priv;
+        tap->scanner = scanner;
+        tap->options = options;
+    }
+    return e;
+}
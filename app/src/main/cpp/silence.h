@@ -0,0 +1,89 @@
+#ifndef SOXTEST_SILENCE_H
+#define SOXTEST_SILENCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "sox.h"
+
+/* Silent regions found while an import decodes.
+ *
+ * The scanner cuts the signal into windows of SILENCE_WINDOW_SECONDS and
+ * takes the peak of each over all channels, four samples at a time
+ * (simd.h); a window is silent when its peak stays under the threshold.
+ * Runs of silent windows of at least min_seconds are reported as regions,
+ * the leading and trailing runs whatever their length.
+ *
+ * The leading and trailing silence is what an import may trim, less a pad
+ * kept on either side so no onset or decay is cut. lead_frames is then
+ * where a `trim' of the audio would start: as with sox_trim_get_start(),
+ * the samples before it are never handed on, so no effect processes them
+ * (see sox_decode_buffer()). The peak is a level, not an energy: a click
+ * in a quiet window keeps the window.
+ *
+ * A tap (SILENCE_EFFECT in an EffectSpec list) scans a render's signal at
+ * its place in the chain into report->silence, see sox_render() */
+
+#define SILENCE_EFFECT "silence-scan"
+#define SILENCE_WINDOW_SECONDS 0.01
+
+struct SilenceOptions {
+    double threshold_db = -60;   /* dBFS; windows peaking under it are silent */
+    double min_seconds = 0.5;    /* shortest region reported inside the audio */
+    double pad_seconds = 0.05;   /* of silence kept next to the audio at a trim */
+};
+
+/* In frames from the start of the decoded audio */
+struct SilenceRegion {
+    uint64_t start = 0;
+    uint64_t frames = 0;
+};
+
+struct SilenceReport {
+    bool scanned = false;
+    double threshold_db = 0;
+    uint64_t frames = 0;              /* scanned */
+    std::vector<SilenceRegion> regions;
+    /* Trimmable, pad excluded; of audio that is silent throughout, all
+     * but the pad is lead */
+    uint64_t lead_frames = 0;
+    uint64_t trail_frames = 0;
+    bool trimmed = false;             /* lead and trail were dropped */
+};
+
+/* State of one scan; set up with silence_scanner_init() */
+struct SilenceScanner {
+    unsigned channels = 0;
+    uint64_t window_frames = 0;
+    uint64_t pad_frames = 0;
+    uint64_t min_frames = 0;
+    int64_t threshold = 0;            /* peak, in sample units */
+    double threshold_db = 0;
+
+    uint64_t frames = 0;
+    uint64_t window_pos = 0;          /* frames into the current window */
+    int32_t window_max = 0;
+    int32_t window_min = 0;
+    bool heard = false;               /* a window that was not silent */
+    uint64_t first_heard = 0;         /* start of the first such window */
+    uint64_t last_heard_end = 0;      /* end of the last one */
+    uint64_t run_start = 0;           /* of the current silent run */
+    bool in_run = true;
+    std::vector<SilenceRegion> regions;
+};
+
+int silence_scanner_init(SilenceScanner * scanner, double rate, unsigned channels,
+                         SilenceOptions const & options = SilenceOptions());
+/* Interleaved samples, whole frames */
+void silence_scanner_add(SilenceScanner * scanner, sox_sample_t const * samples, size_t count);
+/* Frames from the start that are silent for sure, pad excluded: what a
+ * trim may drop while the scan is still going */
+uint64_t silence_scanner_lead(SilenceScanner const & scanner);
+void silence_scanner_finish(SilenceScanner const & scanner, SilenceReport * report);
+
+/* The tap; initialises the scanner with options for the signal at its
+ * place in the chain. The scanner is owned by the caller for the length
+ * of the flow */
+sox_effect_t * silence_tap_create(SilenceScanner * scanner, SilenceOptions const & options);
+
+#endif //SOXTEST_SILENCE_H
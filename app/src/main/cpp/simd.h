@@ -0,0 +1,101 @@
+#ifndef SOXTEST_SIMD_H
+#define SOXTEST_SIMD_H
+
+#include <cstdint>
+#include <cstring>
+
+/* Short vectors through the GCC/Clang vector extensions: the compiler
+ * lowers them to NEON on ARM and SSE on x86 and to scalar code elsewhere,
+ * so the DSP loops need no per-architecture intrinsics. Arithmetic and
+ * comparisons work lane-wise; a comparison yields an all-ones/all-zeros
+ * mask of the matching integer vector */
+
+typedef float f32x4 __attribute__((vector_size(16)));
+typedef int32_t i32x4 __attribute__((vector_size(16)));
+typedef double f64x2 __attribute__((vector_size(16)));
+typedef int64_t i64x2 __attribute__((vector_size(16)));
+
+static inline f32x4 f32x4_splat(float x) {
+    return f32x4{x, x, x, x};
+}
+
+static inline f32x4 f32x4_load(float const * p) {
+    f32x4 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void f32x4_store(float * p, f32x4 v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline f32x4 f32x4_abs(f32x4 v) {
+    return (f32x4) ((i32x4) v & 0x7fffffff);
+}
+
+static inline f32x4 f32x4_max(f32x4 a, f32x4 b) {
+    i32x4 greater = a > b;
+    return (f32x4) ((greater & (i32x4) a) | (~greater & (i32x4) b));
+}
+
+static inline float f32x4_hmax(f32x4 v) {
+    float a = v[0] > v[1] ? v[0] : v[1];
+    float b = v[2] > v[3] ? v[2] : v[3];
+    return a > b ? a : b;
+}
+
+static inline float f32x4_hsum(f32x4 v) {
+    return (v[0] + v[1]) + (v[2] + v[3]);
+}
+
+static inline i32x4 i32x4_splat(int32_t x) {
+    return i32x4{x, x, x, x};
+}
+
+static inline i32x4 i32x4_load(int32_t const * p) {
+    i32x4 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline i32x4 i32x4_max(i32x4 a, i32x4 b) {
+    i32x4 greater = a > b;
+    return (greater & a) | (~greater & b);
+}
+
+static inline i32x4 i32x4_min(i32x4 a, i32x4 b) {
+    i32x4 less = a < b;
+    return (less & a) | (~less & b);
+}
+
+static inline int32_t i32x4_hmax(i32x4 v) {
+    int32_t a = v[0] > v[1] ? v[0] : v[1];
+    int32_t b = v[2] > v[3] ? v[2] : v[3];
+    return a > b ? a : b;
+}
+
+static inline int32_t i32x4_hmin(i32x4 v) {
+    int32_t a = v[0] < v[1] ? v[0] : v[1];
+    int32_t b = v[2] < v[3] ? v[2] : v[3];
+    return a < b ? a : b;
+}
+
+/* log2 to within 2e-4 for normal x > 0, from the exponent and a quartic
+ * in the mantissa; 0 gives -127 */
+static inline f32x4 f32x4_log2(f32x4 x) {
+    i32x4 bits = (i32x4) x;
+    f32x4 exponent = __builtin_convertvector(((bits >> 23) & 255) - 127, f32x4);
+    f32x4 m = (f32x4) ((bits & 0x7fffff) | 0x3f800000);
+    f32x4 p = f32x4_splat(-0.078440676f);
+    p = p * m + 0.62603218f;
+    p = p * m - 2.0783352f;
+    p = p * m + 4.0292114f;
+    p = p * m - 2.4983531f;
+    return exponent + p;
+}
+
+static inline f64x2 f64x2_splat(double x) {
+    return f64x2{x, x};
+}
+
+#endif //SOXTEST_SIMD_H
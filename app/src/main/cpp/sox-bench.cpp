@@ -0,0 +1,1884 @@
+#include "sox-bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <fcntl.h>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "audio-probe.h"
+#include "checkpoint.h"
+#include "flac-parallel.h"
+#include "job-arena.h"
+#include "loudness.h"
+#include "mapped-io.h"
+#include "memory-budget.h"
+#include "mp3-parallel.h"
+#include "multi-export.h"
+#include "parallel-decode.h"
+#include "pipeline.h"
+#include "project-session.h"
+#include "render-cache.h"
+#include "render-jobs.h"
+#include "sox-ops.h"
+#include "sox-tuning.h"
+#include "spectrogram.h"
+#include "test-signal.h"
+
+#define BENCH_SECONDS 20
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+/* The CLI counts heap allocations by interposing the allocator entry points
+ * over glibc's own implementations */
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t count, size_t size);
+extern "C" void * __libc_realloc(void * ptr, size_t size);
+extern "C" void * __libc_memalign(size_t align, size_t size);
+
+static std::atomic<uint64_t> heap_allocations(0);
+
+extern "C" void * malloc(size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t count, size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void * realloc(void * ptr, size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void * aligned_alloc(size_t align, size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(align, size);
+}
+
+#define HEAP_COUNTED 1
+#else
+#define HEAP_COUNTED 0
+#endif
+
+#define TONE_BLOCK_FRAMES 4096
+
+/* Least-squares fit of a DC term plus a sine/cosine pair per tone to every
+ * block of the first channel of path. Returns the ratio of fitted to
+ * residual energy in dB: how much of the output is still the expected
+ * tones, rather than noise, aliases, imaging and splicing artefacts. The
+ * first and last blocks are skipped for the filters' edge effects */
+static double tone_snr_db(std::string const & path, std::vector<double> const & freqs) {
+    sox_format_t * in = sox_open_read(path.c_str(), NULL, NULL, NULL);
+    if (!in) {
+        return NAN;
+    }
+    unsigned channels = in->signal.channels;
+    double rate = in->signal.rate;
+    size_t n = 1 + 2 * freqs.size();
+
+    std::vector<sox_sample_t> buf(TONE_BLOCK_FRAMES * channels);
+    std::vector<double> y(TONE_BLOCK_FRAMES), basis(n * TONE_BLOCK_FRAMES), ata(n * n), aty(n);
+    std::vector<std::vector<double>> blocks;
+    size_t got;
+    while ((got = sox_read(in, buf.data(), buf.size())) == buf.size()) {
+        std::vector<double> block(TONE_BLOCK_FRAMES);
+        for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+            block[i] = buf[i * channels] / (SOX_SAMPLE_MAX + 1.0);
+        }
+        blocks.push_back(std::move(block));
+    }
+    sox_close(in);
+
+    double signalEnergy = 0, residualEnergy = 0;
+    for (size_t b = 1; b + 1 < blocks.size(); b++) {
+        std::vector<double> const & block = blocks[b];
+        for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+            double t = (double) (b * TONE_BLOCK_FRAMES + i) / rate;
+            basis[i] = 1;
+            for (size_t f = 0; f < freqs.size(); f++) {
+                basis[(1 + 2 * f) * TONE_BLOCK_FRAMES + i] = std::cos(2 * M_PI * freqs[f] * t);
+                basis[(2 + 2 * f) * TONE_BLOCK_FRAMES + i] = std::sin(2 * M_PI * freqs[f] * t);
+            }
+        }
+        /* Normal equations, solved by Gaussian elimination */
+        for (size_t r = 0; r < n; r++) {
+            aty[r] = 0;
+            for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+                aty[r] += basis[r * TONE_BLOCK_FRAMES + i] * block[i];
+            }
+            for (size_t c = 0; c < n; c++) {
+                double sum = 0;
+                for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+                    sum += basis[r * TONE_BLOCK_FRAMES + i] * basis[c * TONE_BLOCK_FRAMES + i];
+                }
+                ata[r * n + c] = sum;
+            }
+        }
+        for (size_t k = 0; k < n; k++) {
+            size_t pivot = k;
+            for (size_t r = k + 1; r < n; r++) {
+                if (std::fabs(ata[r * n + k]) > std::fabs(ata[pivot * n + k])) {
+                    pivot = r;
+                }
+            }
+            for (size_t c = 0; c < n; c++) {
+                std::swap(ata[k * n + c], ata[pivot * n + c]);
+            }
+            std::swap(aty[k], aty[pivot]);
+            for (size_t r = k + 1; r < n; r++) {
+                double m = ata[r * n + k] / ata[k * n + k];
+                for (size_t c = k; c < n; c++) {
+                    ata[r * n + c] -= m * ata[k * n + c];
+                }
+                aty[r] -= m * aty[k];
+            }
+        }
+        for (size_t k = n; k-- > 0; ) {
+            for (size_t c = k + 1; c < n; c++) {
+                aty[k] -= ata[k * n + c] * aty[c];
+            }
+            aty[k] /= ata[k * n + k];
+        }
+
+        for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+            double fitted = 0;
+            for (size_t r = 0; r < n; r++) {
+                fitted += aty[r] * basis[r * TONE_BLOCK_FRAMES + i];
+            }
+            signalEnergy += fitted * fitted;
+            residualEnergy += (block[i] - fitted) * (block[i] - fitted);
+        }
+    }
+    if (signalEnergy == 0) {
+        return NAN;
+    }
+    return 10 * std::log10(signalEnergy / std::max(residualEnergy, 1e-30));
+}
+
+/* Level in dB relative to full scale of the first channel of path, edge
+ * blocks skipped as in tone_snr_db() */
+static double level_db(std::string const & path) {
+    sox_format_t * in = sox_open_read(path.c_str(), NULL, NULL, NULL);
+    if (!in) {
+        return NAN;
+    }
+    unsigned channels = in->signal.channels;
+    std::vector<sox_sample_t> buf(TONE_BLOCK_FRAMES * channels);
+    std::vector<double> blockEnergy;
+    while (sox_read(in, buf.data(), buf.size()) == buf.size()) {
+        double energy = 0;
+        for (size_t i = 0; i < TONE_BLOCK_FRAMES; i++) {
+            double value = buf[i * channels] / (SOX_SAMPLE_MAX + 1.0);
+            energy += value * value;
+        }
+        blockEnergy.push_back(energy);
+    }
+    sox_close(in);
+
+    double energy = 0;
+    size_t frames = 0;
+    for (size_t b = 1; b + 1 < blockEnergy.size(); b++) {
+        energy += blockEnergy[b];
+        frames += TONE_BLOCK_FRAMES;
+    }
+    if (frames == 0) {
+        return NAN;
+    }
+    return 10 * std::log10(std::max(energy / frames, 1e-30));
+}
+
+#define ALLOC_BENCH_JOBS 200
+#define ALLOC_BENCH_SECONDS 1
+
+static bool files_identical(std::string const & a, std::string const & b) {
+    FILE * fa = fopen(a.c_str(), "rb");
+    FILE * fb = fopen(b.c_str(), "rb");
+    bool identical = fa && fb;
+    std::vector<char> bufa(65536), bufb(65536);
+    while (identical) {
+        size_t na = fread(bufa.data(), 1, bufa.size(), fa);
+        size_t nb = fread(bufb.data(), 1, bufb.size(), fb);
+        identical = na == nb && std::equal(bufa.begin(), bufa.begin() + na, bufb.begin());
+        if (na == 0) {
+            break;
+        }
+    }
+    if (fa) fclose(fa);
+    if (fb) fclose(fb);
+    return identical;
+}
+
+/* Whether both files decode to the same samples; for OGG, whose stream
+ * serial number libSoX picks at random */
+static bool decoded_identical(std::string const & a, std::string const & b) {
+    sox_format_t * fa = sox_open_read(a.c_str(), NULL, NULL, NULL);
+    sox_format_t * fb = fa ? sox_open_read(b.c_str(), NULL, NULL, NULL) : NULL;
+    bool identical = fa && fb && fa->signal.channels == fb->signal.channels;
+    std::vector<sox_sample_t> bufa(65536), bufb(65536);
+    while (identical) {
+        size_t na = sox_read(fa, bufa.data(), bufa.size());
+        size_t nb = sox_read(fb, bufb.data(), bufb.size());
+        identical = na == nb && std::equal(bufa.begin(), bufa.begin() + na, bufb.begin());
+        if (na == 0) {
+            break;
+        }
+    }
+    if (fa) sox_close(fa);
+    if (fb) sox_close(fb);
+    return identical;
+}
+
+int bench_threads(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    if (!tuning_threads_supported()) {
+        fprintf(out, "this libSoX build has no parallel flows\n");
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-threads-in.wav";
+    std::string outSingle = dir + "/bench-threads-single.wav";
+    std::string outParallel = dir + "/bench-threads-parallel.wav";
+    std::vector<EffectSpec> chain = {
+            {"tempo", {"1.25"}},
+            {"pitch", {"300"}},
+            {"rate", {"-m", "44100"}}
+    };
+    SoxTuning previous = tuning_get();
+    SoxTuning single = previous;
+    SoxTuning parallel = previous;
+    single.threads = 0;
+    parallel.threads = std::max(2u, std::thread::hardware_concurrency());
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%8s %8s %12s %12s %8s %10s\n",
+            "channels", "threads", "single_ms", "parallel_ms", "speedup", "identical");
+    for (unsigned channels : {1u, 2u, 6u}) {
+        RenderReport singleReport, parallelReport;
+        if (write_test_signal(in.c_str(), 44100, channels, BENCH_SECONDS) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        tuning_set(single);
+        int singleResult = sox_render("bench-single", in.c_str(), outSingle.c_str(), chain, &singleReport);
+        tuning_set(parallel);
+        int parallelResult = sox_render("bench-parallel", in.c_str(), outParallel.c_str(), chain, &parallelReport);
+        if (singleResult != RESULT_SUCCESS || parallelResult != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        bool identical = files_identical(outSingle, outParallel);
+        fprintf(out, "%8u %8u %12.1f %12.1f %7.2fx %10s\n",
+                channels, parallel.threads, singleReport.flow_ms, parallelReport.flow_ms,
+                singleReport.flow_ms / parallelReport.flow_ms, identical ? "yes" : "NO");
+        if (!identical) {
+            result = RESULT_ERROR;
+        }
+    }
+
+    tuning_set(previous);
+    remove(in.c_str());
+    remove(outSingle.c_str());
+    remove(outParallel.c_str());
+    return result;
+}
+
+int bench_pipelines(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-pipelines-in.wav";
+    std::string outGeneric = dir + "/bench-pipelines-generic.wav";
+    std::string outTyped = dir + "/bench-pipelines-typed.wav";
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-22s %8s %12s %12s %8s %10s\n",
+            "chain", "channels", "generic_ms", "pipeline_ms", "speedup", "identical");
+    for (unsigned channels : {1u, 2u}) {
+        if (write_test_signal(in.c_str(), 44100, channels, BENCH_SECONDS * 3) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        /* The libSoX chain against the fused loop, sample for sample */
+        auto row = [&](char const * name, std::vector<EffectSpec> const & chain, auto run) {
+            RenderReport generic, typed;
+            bool identical = sox_render("bench-generic", in.c_str(), outGeneric.c_str(), chain, &generic)
+                    == RESULT_SUCCESS
+                    && run(&typed) == RESULT_SUCCESS
+                    && decoded_identical(outGeneric, outTyped);
+            if (!identical) {
+                result = RESULT_ERROR;
+            }
+            fprintf(out, "%-22s %8u %12.1f %12.1f %7.2fx %10s\n", name, channels, generic.total_ms,
+                    typed.total_ms, generic.total_ms / typed.total_ms, identical ? "yes" : "NO");
+        };
+        /* Loud enough for the gain to clip, so the rounding of both is compared */
+        row("decode->gain/fade->enc", {Gain{10}.spec(), Fade{2, 5}.spec()}, [&](RenderReport * r) {
+            return run_pipeline("bench-pipeline", in.c_str(), outTyped.c_str(), r, RenderOptions(), {},
+                                Gain{10}, Fade{2, 5});
+        });
+        row("decode->tempo->enc", {Tempo{1.25}.spec()}, [&](RenderReport * r) {
+            return run_pipeline("bench-pipeline", in.c_str(), outTyped.c_str(), r, RenderOptions(), {},
+                                Tempo{1.25});
+        });
+        row("decode->pitch/rate->enc", {Pitch{300}.spec(), Rate{}.spec()}, [&](RenderReport * r) {
+            return run_pipeline("bench-pipeline", in.c_str(), outTyped.c_str(), r, RenderOptions(), {},
+                                Pitch{300}, Rate{});
+        });
+    }
+
+    remove(in.c_str());
+    remove(outGeneric.c_str());
+    remove(outTyped.c_str());
+    return result;
+}
+
+struct AllocationRun {
+    double ms = 0;
+    uint64_t allocations = 0;
+    size_t heap_bytes = 0;
+    size_t free_bytes = 0;
+};
+
+static int run_job_batch(std::string const & in, std::string const & outPath, AllocationRun * run) {
+    int result = RESULT_SUCCESS;
+#if HEAP_COUNTED
+    uint64_t allocationsBefore = heap_allocations.load();
+#endif
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < ALLOC_BENCH_JOBS && result == RESULT_SUCCESS; i++) {
+        /* Alternate a libSoX chain and a fused pipeline, as an editing
+         * session does */
+        if (i % 2 == 0) {
+            result = sox_render("tempo", in.c_str(), outPath.c_str(), {Tempo{1.1}.spec()}, NULL);
+        } else {
+            result = run_pipeline("gain", in.c_str(), outPath.c_str(), NULL, RenderOptions(), {},
+                                  Gain{-3}, Fade{0.2, 0.2});
+        }
+    }
+
+    run->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+#if HEAP_COUNTED
+    run->allocations = heap_allocations.load() - allocationsBefore;
+    struct mallinfo2 info = mallinfo2();
+    run->heap_bytes = info.arena;
+    run->free_bytes = info.fordblks;
+#endif
+    return result;
+}
+
+int bench_allocations(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-allocations-in.wav";
+    std::string outPath = dir + "/bench-allocations-out.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, ALLOC_BENCH_SECONDS) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    /* Heap figures are process-wide, so the run without arenas goes first
+     * and the arena run can only look better by not growing the heap */
+    AllocationRun runs[2];
+    JobArena::set_enabled(false);
+    int result = run_job_batch(in, outPath, &runs[0]);
+    JobArena::set_enabled(true);
+    if (result == RESULT_SUCCESS) {
+        result = run_job_batch(in, outPath, &runs[1]);
+    }
+
+    fprintf(out, "%-8s %6s %10s %12s %12s %12s %10s\n", "arenas", "jobs", "ms/job",
+            "allocs/job", "heap_bytes", "free_bytes", "free_pct");
+    char const * names[] = {"off", "on"};
+    for (int i = 0; i < 2; i++) {
+        AllocationRun const & r = runs[i];
+        fprintf(out, "%-8s %6d %10.2f %12.1f %12zu %12zu %9.1f%%\n", names[i], ALLOC_BENCH_JOBS,
+                r.ms / ALLOC_BENCH_JOBS, (double) r.allocations / ALLOC_BENCH_JOBS,
+                r.heap_bytes, r.free_bytes, r.heap_bytes ? 100.0 * r.free_bytes / r.heap_bytes : 0);
+    }
+    if (!HEAP_COUNTED) {
+        fprintf(out, "(allocation counts need glibc)\n");
+    }
+
+    remove(in.c_str());
+    remove(outPath.c_str());
+    return result;
+}
+
+int bench_draft(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-draft-in.wav";
+    std::string outPath = dir + "/bench-draft-out.wav";
+    std::vector<double> tones = {440, 1000, 3150};
+    if (write_test_tones(in.c_str(), 44100, 2, BENCH_SECONDS, tones) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    struct Case {
+        char const * name;
+        bool pitch;
+        char const * value;
+    };
+    Case cases[] = {{"tempo 1.25", false, "1.25"}, {"pitch 300", true, "300"}};
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-12s %6s %10s %10s %8s %8s %12s\n", "chain", "mode", "ms", "x_realtime",
+            "speedup", "out_rate", "tone_snr_db");
+    for (Case const & c : cases) {
+        /* Pitch moves the tones; tempo keeps them */
+        std::vector<double> expected = tones;
+        if (c.pitch) {
+            for (double & freq : expected) {
+                freq *= std::pow(2.0, atof(c.value) / 1200);
+            }
+        }
+        double fullMs = 0;
+        for (RenderMode mode : {RENDER_FULL, RENDER_DRAFT}) {
+            RenderReport report;
+            int r = c.pitch
+                    ? sox_pitch((char *) in.c_str(), (char *) outPath.c_str(), (char *) c.value, &report, mode)
+                    : sox_tempo((char *) in.c_str(), (char *) outPath.c_str(), (char *) c.value, &report, mode);
+            if (r != RESULT_SUCCESS) {
+                result = RESULT_ERROR;
+                continue;
+            }
+            if (mode == RENDER_FULL) {
+                fullMs = report.total_ms;
+            }
+            fprintf(out, "%-12s %6s %10.1f %10.1f %7.2fx %8.0f %12.1f\n", c.name,
+                    mode == RENDER_FULL ? "full" : "draft", report.total_ms,
+                    BENCH_SECONDS * 1000.0 / report.total_ms, fullMs / report.total_ms,
+                    report.out_rate, tone_snr_db(outPath, expected));
+        }
+    }
+
+    remove(in.c_str());
+    remove(outPath.c_str());
+    return result;
+}
+
+#define RATE_BENCH_TONE_SECONDS 10
+/* Above the Nyquist frequency of 22050 Hz, so it folds to 7050 Hz */
+#define RATE_BENCH_ALIAS_HZ 15000.0
+
+int bench_rate(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string music = dir + "/bench-rate-music.wav";
+    std::string tones = dir + "/bench-rate-tones.wav";
+    std::string alias = dir + "/bench-rate-alias.wav";
+    std::string outPath = dir + "/bench-rate-out.wav";
+    std::vector<double> toneFreqs = {1000, 5000, 15000};
+    if (write_test_signal(music.c_str(), 44100, 2, BENCH_SECONDS) != RESULT_SUCCESS
+            || write_test_tones(tones.c_str(), 44100, 1, RATE_BENCH_TONE_SECONDS, toneFreqs) != RESULT_SUCCESS
+            || write_test_tones(alias.c_str(), 44100, 1, RATE_BENCH_TONE_SECONDS, {RATE_BENCH_ALIAS_HZ})
+                    != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    double aliasInputDb = level_db(alias);
+
+    std::vector<RateOptions> tiers;
+    for (RateQuality quality : {RATE_QUICK, RATE_LOW, RATE_MEDIUM, RATE_HIGH, RATE_VERY_HIGH}) {
+        RateOptions options;
+        options.quality = quality;
+        tiers.push_back(options);
+    }
+    for (RateQuality quality : {RATE_MEDIUM, RATE_HIGH, RATE_VERY_HIGH}) {
+        RateOptions options;
+        options.quality = quality;
+        options.phase = RATE_PHASE_MINIMUM;
+        tiers.push_back(options);
+    }
+    RateOptions wide;
+    wide.quality = RATE_HIGH;
+    wide.bandwidth = 99;
+    tiers.push_back(wide);
+
+    int result = RESULT_SUCCESS;
+    fprintf(out, "%-14s %10s %10s %10s %12s %12s\n", "rate", "ms", "x_realtime", "msamples/s",
+            "tone_snr_db", "alias_db");
+    for (RateOptions const & tier : tiers) {
+        std::string name;
+        for (std::string const & arg : Rate{tier}.spec().args) {
+            name += (name.empty() ? "" : " ") + arg;
+        }
+
+        /* Throughput on music, 44.1 -> 48 kHz */
+        RenderReport report;
+        if (sox_resample(music.c_str(), outPath.c_str(), 48000, &tier, &report) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            continue;
+        }
+        double ms = report.total_ms;
+
+        /* Pass band: how cleanly the tones survive 44.1 -> 48 kHz */
+        double snr = NAN;
+        if (sox_resample(tones.c_str(), outPath.c_str(), 48000, &tier, NULL) == RESULT_SUCCESS) {
+            snr = tone_snr_db(outPath, toneFreqs);
+        }
+
+        /* Stop band: what is left of a tone above the new Nyquist frequency
+         * after 44.1 -> 22.05 kHz */
+        double aliasDb = NAN;
+        if (sox_resample(alias.c_str(), outPath.c_str(), 22050, &tier, NULL) == RESULT_SUCCESS) {
+            aliasDb = level_db(outPath) - aliasInputDb;
+        }
+
+        fprintf(out, "%-14s %10.1f %10.1f %10.2f %12.1f %12.1f\n", name.c_str(), ms,
+                BENCH_SECONDS * 1000.0 / ms, BENCH_SECONDS * 44100.0 * 2 / ms / 1000, snr, aliasDb);
+    }
+
+    remove(music.c_str());
+    remove(tones.c_str());
+    remove(alias.c_str());
+    remove(outPath.c_str());
+    return result;
+}
+
+/* Starts op in a child process, SIGKILLs it once its first checkpoint is
+ * down and returns the committed output samples (0 on failure) */
+template<class Op>
+static uint64_t render_and_kill(std::string const & outPath, Op op) {
+    std::string checkpointPath = outPath + ".ckpt";
+    remove(checkpointPath.c_str());
+    pid_t pid = fork();
+    if (pid == 0) {
+        op();
+        _exit(0);
+    }
+    if (pid < 0) {
+        return 0;
+    }
+
+    Checkpoint checkpoint;
+    for (int i = 0; i < 60000; i++) {
+        if (checkpoint_load(checkpointPath, &checkpoint) == RESULT_SUCCESS && checkpoint.out_samples > 0) {
+            break;
+        }
+        usleep(1000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    /* The child may have moved on by one more checkpoint */
+    if (checkpoint_load(checkpointPath, &checkpoint) != RESULT_SUCCESS) {
+        return 0;
+    }
+    return checkpoint.out_samples;
+}
+
+int bench_checkpoint(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-checkpoint-in.wav";
+    std::string outWhole = dir + "/bench-checkpoint-whole.wav";
+    std::string outResumed = dir + "/bench-checkpoint-resumed.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    double interval = checkpoint_interval();
+    checkpoint_set_interval(1);
+
+    struct Case {
+        char const * name;
+        char const * tempo;  /* NULL for a plain conversion */
+    };
+    Case cases[] = {{"convert (seek)", NULL}, {"tempo (replay)", "1.25"}};
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-16s %10s %14s %10s %10s\n", "render", "whole_ms", "killed_at", "resume_ms", "identical");
+    for (Case const & c : cases) {
+        auto render = [&](std::string const & outPath, RenderReport * report) {
+            return c.tempo
+                    ? sox_tempo((char *) in.c_str(), (char *) outPath.c_str(), (char *) c.tempo, report)
+                    : sox_convert((char *) in.c_str(), (char *) outPath.c_str(), report);
+        };
+
+        RenderReport whole, resumed;
+        int r = render(outWhole, &whole);
+        uint64_t killedAt = render_and_kill(outResumed, [&]() { render(outResumed, NULL); });
+        if (r == RESULT_SUCCESS) {
+            r = render(outResumed, &resumed);
+        }
+        bool identical = r == RESULT_SUCCESS && killedAt > 0 && resumed.resumed_samples == killedAt
+                && files_identical(outWhole, outResumed);
+        if (!identical) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-16s %10.1f %14llu %10.1f %10s\n", c.name, whole.total_ms,
+                (unsigned long long) killedAt, resumed.total_ms, identical ? "yes" : "NO");
+        remove(outResumed.c_str());
+    }
+
+    checkpoint_set_interval(interval);
+    remove(in.c_str());
+    remove(outWhole.c_str());
+    return result;
+}
+
+/* Growth of the RSS a longer render may show over a shorter one */
+#define MEMORY_FLAT_TOLERANCE (2 * 1024 * 1024)
+
+int bench_memory(char const * /* workDir */, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    /* Hours of pink noise from `synth' into the null file type: no disk
+     * space needed, and only the chain's own memory is measured */
+    sox_signalinfo_t signal = {44100, 2, 16, 0, NULL};
+    RenderOptions options;
+    options.in_type = "null";
+    options.out_type = "null";
+    options.in_signal = &signal;
+
+    struct Case {
+        char const * name;
+        std::vector<EffectSpec> effects;
+    };
+    Case cases[] = {
+            {"tempo 1.25", {Tempo{1.25}.spec()}},
+            {"pitch 300", {Pitch{300}.spec(), Rate{}.spec()}},
+            {"gain/fade", {Gain{-3}.spec(), Fade{5, 0}.spec()}},
+    };
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-12s %6s %10s %14s %14s\n", "chain", "hours", "ms", "peak_rss_kb", "growth_kb");
+    for (Case const & c : cases) {
+        uint64_t firstGrowth = 0;
+        for (int hours : {1, 2, 4}) {
+            std::vector<EffectSpec> effects = {{"synth", {std::to_string(hours * 3600), "pinknoise"}}};
+            effects.insert(effects.end(), c.effects.begin(), c.effects.end());
+
+            RenderReport report;
+            if (sox_render("memory", "", "", effects, &report, options) != RESULT_SUCCESS) {
+                result = RESULT_ERROR;
+                break;
+            }
+            if (hours == 1) {
+                firstGrowth = report.rss_growth_bytes;
+            }
+            bool flat = report.rss_growth_bytes <= firstGrowth + MEMORY_FLAT_TOLERANCE;
+            if (!flat) {
+                result = RESULT_ERROR;
+            }
+            fprintf(out, "%-12s %6d %10.1f %14llu %14llu%s\n", c.name, hours, report.total_ms,
+                    (unsigned long long) report.peak_rss_bytes / 1024,
+                    (unsigned long long) report.rss_growth_bytes / 1024, flat ? "" : "  GROWS");
+        }
+    }
+    return result;
+}
+
+/* Seconds of audio per chunk in the decode benchmarks, as in sox_convert() */
+#define MP3_BENCH_CHUNK_SECONDS 8
+#define FLAC_BENCH_CHUNK_SECONDS 4
+
+typedef int (*ParallelConvert)(char const * inPath, char const * outPath, double chunkSeconds,
+                               unsigned threads, RenderReport * report, DecodeObserver const & observer,
+                               unsigned precision);
+
+struct DecodeBenchCase {
+    char const * name;
+    double rate;
+    unsigned channels;
+};
+
+/* Encodes a test signal per case to the compressed extension, then decodes
+ * it serially and in parallel with 1, 2, 4 and all threads */
+static int bench_parallel_decode(char const * workDir, char const * extension,
+                                 std::vector<DecodeBenchCase> const & cases, ParallelConvert convert,
+                                 double chunkSeconds, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string wav = dir + "/bench-decode-in.wav";
+    std::string encoded = dir + "/bench-decode-in" + extension;
+    std::string outSerial = dir + "/bench-decode-serial.wav";
+    std::string outParallel = dir + "/bench-decode-parallel.wav";
+    unsigned cores = parallel_decode_threads();
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-14s %8s %8s %12s %12s %8s %10s\n",
+            "stream", "chunks", "threads", "serial_ms", "parallel_ms", "speedup", "identical");
+    for (DecodeBenchCase const & c : cases) {
+        RenderReport serial;
+        if (write_test_signal(wav.c_str(), c.rate, c.channels, BENCH_SECONDS * 6) != RESULT_SUCCESS
+                || sox_render("bench-encode", wav.c_str(), encoded.c_str(), {}, NULL) != RESULT_SUCCESS
+                || sox_render("convert", encoded.c_str(), outSerial.c_str(), {}, &serial) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            break;
+        }
+
+        std::vector<unsigned> threadCounts = {1, 2, 4};
+        if (cores > 4) {
+            threadCounts.push_back(cores);
+        }
+        for (unsigned threads : threadCounts) {
+            RenderReport parallel;
+            int r = convert(encoded.c_str(), outParallel.c_str(), chunkSeconds, threads, &parallel, nullptr, 0);
+            bool identical = r == RESULT_SUCCESS && files_identical(outSerial, outParallel);
+            if (!identical) {
+                result = RESULT_ERROR;
+            }
+            uint64_t chunks = parallel.stages.empty() ? 0 : parallel.stages[0].flow_calls;
+            fprintf(out, "%-14s %8llu %8u %12.1f %12.1f %7.2fx %10s\n", c.name, (unsigned long long) chunks,
+                    threads, serial.total_ms, parallel.total_ms, serial.total_ms / parallel.total_ms,
+                    identical ? "yes" : "NO");
+            remove(outParallel.c_str());
+        }
+    }
+
+    remove(wav.c_str());
+    remove(encoded.c_str());
+    remove(outSerial.c_str());
+    return result;
+}
+
+int bench_mp3(char const * workDir, FILE * out) {
+    /* MPEG-1 and MPEG-2 Layer III: 1152 and 576 samples per frame */
+    return bench_parallel_decode(workDir, ".mp3", {{"44.1k stereo", 44100, 2}, {"22.05k mono", 22050, 1}},
+                                 mp3_convert_parallel, MP3_BENCH_CHUNK_SECONDS, out);
+}
+
+int bench_flac(char const * workDir, FILE * out) {
+    return bench_parallel_decode(workDir, ".flac", {{"44.1k stereo", 44100, 2}, {"96k stereo", 96000, 2}},
+                                 flac_convert_parallel, FLAC_BENCH_CHUNK_SECONDS, out);
+}
+
+int bench_cache(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string cacheDir = dir + "/bench-cache";
+    std::string in = dir + "/bench-cache-in.wav";
+    std::string inCopy = dir + "/bench-cache-in-copy.wav";
+    std::string outFirst = dir + "/bench-cache-first.wav";
+    std::string outSecond = dir + "/bench-cache-second.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS
+            || write_test_signal(inCopy.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    render_cache_init(cacheDir.c_str(), UINT64_MAX);
+    int result = RESULT_SUCCESS;
+
+    auto tempo = [](std::string const & from, std::string const & to, RenderReport * report) {
+        return sox_tempo((char *) from.c_str(), (char *) to.c_str(), (char *) "1.25", report);
+    };
+    auto check = [&](char const * name, RenderReport const & report, bool hit, std::string const & reference) {
+        bool ok = report.result == RESULT_SUCCESS && report.cache_hit == hit
+                && (reference.empty() || files_identical(reference, report.out_path));
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-34s %10.1f %6s %6s\n", name, report.total_ms, report.cache_hit ? "hit" : "miss",
+                ok ? "ok" : "FAIL");
+    };
+
+    fprintf(out, "%-34s %10s %6s %6s\n", "render", "total_ms", "cache", "check");
+    RenderReport report;
+    tempo(in, outFirst, &report);
+    check("tempo, first time", report, false, "");
+    tempo(in, outSecond, &report);
+    check("tempo again", report, true, outFirst);
+    tempo(inCopy, outSecond, &report);
+    check("tempo of a copy of the input", report, true, outFirst);
+    sox_reverse((char *) outSecond.c_str(), (char *) outFirst.c_str(), &report);
+    check("reverse of the tempo output", report, false, "");
+
+    /* As after a restart of the app */
+    render_cache_init(cacheDir.c_str(), UINT64_MAX);
+    tempo(in, outSecond, &report);
+    check("tempo after reloading the index", report, true, "");
+    sox_reverse((char *) outSecond.c_str(), (char *) inCopy.c_str(), &report);
+    check("reverse after reloading", report, true, outFirst);
+
+    /* A quota of one and a half outputs keeps only the latest */
+    uint64_t quota = render_cache_bytes() * 3 / 4;
+    render_cache_init(cacheDir.c_str(), quota);
+    sox_gain_fade(in.c_str(), outFirst.c_str(), -1, 0, 0, &report);
+    check("gain -1 under a small quota", report, false, "");
+    sox_gain_fade(in.c_str(), outFirst.c_str(), -2, 0, 0, &report);
+    check("gain -2 evicts gain -1", report, false, "");
+    sox_gain_fade(in.c_str(), outSecond.c_str(), -2, 0, 0, &report);
+    check("gain -2 again", report, true, outFirst);
+    sox_gain_fade(in.c_str(), outSecond.c_str(), -1, 0, 0, &report);
+    check("gain -1 again", report, false, "");
+    if (render_cache_bytes() > quota) {
+        fprintf(out, "cache holds %llu bytes over a quota of %llu\n",
+                (unsigned long long) render_cache_bytes(), (unsigned long long) quota);
+        result = RESULT_ERROR;
+    }
+
+    render_cache_init(cacheDir.c_str(), 0);
+    render_cache_init("", 0);
+    remove((cacheDir + "/index").c_str());
+    rmdir(cacheDir.c_str());
+    remove(in.c_str());
+    remove(inCopy.c_str());
+    remove(outFirst.c_str());
+    remove(outSecond.c_str());
+    return result;
+}
+
+int bench_export(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-export-in.wav";
+    std::vector<std::string> extensions = {".mp3", ".flac", ".ogg"};
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    int result = RESULT_SUCCESS;
+
+    std::vector<std::string> tags = {"Title=Bench", "Artist=SoxTest", "Album=Export", "Year=2024"};
+
+    /* One export per format, as the save buttons make */
+    fprintf(out, "%-24s %12s %10s\n", "export", "total_ms", "identical");
+    double separateMs = 0, slowestMs = 0;
+    std::vector<std::string> separate, tee;
+    for (std::string const & extension : extensions) {
+        separate.push_back(dir + "/bench-export-separate" + extension);
+        tee.push_back(dir + "/bench-export-tee" + extension);
+        RenderReport report;
+        if (sox_export(in.c_str(), {separate.back()}, tags, &report) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-24s %12.1f %10s\n", ("separate " + extension.substr(1)).c_str(), report.total_ms, "");
+        separateMs += report.total_ms;
+        slowestMs = std::max(slowestMs, report.total_ms);
+    }
+
+    RenderReport report;
+    bool identical = sox_export(in.c_str(), tee, tags, &report) == RESULT_SUCCESS;
+    for (size_t i = 0; identical && i < extensions.size(); i++) {
+        identical = extensions[i] == ".ogg" ? decoded_identical(separate[i], tee[i])
+                                            : files_identical(separate[i], tee[i]);
+    }
+    if (!identical) {
+        result = RESULT_ERROR;
+    }
+    fprintf(out, "%-24s %12.1f\n", "separate, all formats", separateMs);
+    fprintf(out, "%-24s %12.1f %10s\n", "single decode, tee", report.total_ms, identical ? "yes" : "NO");
+    fprintf(out, "tee takes %.2fx the slowest encoder alone, %.2fx the separate conversions\n",
+            report.total_ms / slowestMs, report.total_ms / separateMs);
+    for (StageReport const & stage : report.stages) {
+        fprintf(out, "  encode %-8s %10.1f ms\n", stage.name.c_str(), stage.flow_ms);
+    }
+
+    /* The tags come back from the Vorbis comments; libSoX reads no ID3 */
+    for (size_t i = 0; i < extensions.size(); i++) {
+        if (extensions[i] == ".mp3") {
+            continue;
+        }
+        sox_format_t * f = sox_open_read(tee[i].c_str(), NULL, NULL, NULL);
+        char const * title = f ? sox_find_comment(f->oob.comments, "Title") : NULL;
+        bool tagged = title && strcmp(title, "Bench") == 0;
+        if (!tagged) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "tags in %-6s %s\n", extensions[i].substr(1).c_str(), tagged ? "ok" : "MISSING");
+        if (f) sox_close(f);
+    }
+
+    remove(in.c_str());
+    for (size_t i = 0; i < extensions.size(); i++) {
+        remove(separate[i].c_str());
+        remove(tee[i].c_str());
+    }
+    return result;
+}
+
+#define PROBE_RUNS 20
+#define PROBE_BATCH_COPIES 16
+
+/* Decodes the whole file: what finding the length would cost without a
+ * header to read it from */
+static double full_read_ms(std::string const & path, uint64_t * samples) {
+    auto start = std::chrono::steady_clock::now();
+    sox_format_t * in = sox_open_read(path.c_str(), NULL, NULL, NULL);
+    *samples = 0;
+    if (!in) {
+        return NAN;
+    }
+    std::vector<sox_sample_t> buf(65536 - 65536 % in->signal.channels);
+    size_t got;
+    while ((got = sox_read(in, buf.data(), buf.size())) > 0) {
+        *samples += got;
+    }
+    *samples /= in->signal.channels;
+    sox_close(in);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int bench_probe(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string wav = dir + "/bench-probe-in.wav";
+    std::string batchDir = dir + "/bench-probe";
+    std::vector<std::string> extensions = {".wav", ".mp3", ".flac", ".ogg"};
+    std::vector<std::string> tags = {"Title=Probe", "Artist=SoxTest", "Album=Bench", "Year=2024"};
+    if (write_test_signal(wav.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    mkdir(batchDir.c_str(), 0700);
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-6s %10s %12s %12s %8s %8s\n", "format", "probe_ms", "full_read_ms", "speedup", "length", "tags");
+    std::vector<std::string> files;
+    for (std::string const & extension : extensions) {
+        std::string path = batchDir + "/probe" + extension;
+        if (sox_export(wav.c_str(), {path}, tags, NULL) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            continue;
+        }
+        files.push_back(path);
+
+        AudioProbe probe;
+        double probeMs = 0;
+        for (int i = 0; i < PROBE_RUNS; i++) {
+            audio_probe(path.c_str(), &probe);
+            probeMs += probe.probe_ms;
+        }
+        probeMs /= PROBE_RUNS;
+        uint64_t decoded;
+        double readMs = full_read_ms(path, &decoded);
+
+        /* MP3 lengths count whole frames, the encoder's padding included */
+        uint64_t slack = extension == ".mp3" ? 2 * 1152 : 0;
+        bool lengthOk = probe.result == RESULT_SUCCESS
+                && std::max(probe.samples, decoded) - std::min(probe.samples, decoded) <= slack;
+        /* libSoX's WAV writer stores no comments */
+        bool tagsOk = extension == ".wav" || (probe.title == "Probe" && probe.artist == "SoxTest"
+                && probe.album == "Bench" && probe.year == "2024");
+        if (!lengthOk || !tagsOk) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-6s %10.3f %12.1f %11.0fx %8s %8s\n", extension.substr(1).c_str(), probeMs, readMs,
+                readMs / probeMs, lengthOk ? "ok" : "WRONG", tagsOk ? "ok" : "MISSING");
+    }
+
+    /* A folder scan: hard links of the files above */
+    std::vector<std::string> links;
+    for (int copy = 0; copy < PROBE_BATCH_COPIES; copy++) {
+        for (std::string const & file : files) {
+            std::string link = file.substr(0, file.rfind('.')) + "-" + std::to_string(copy) + file.substr(file.rfind('.'));
+            if (::link(file.c_str(), link.c_str()) == 0) {
+                links.push_back(link);
+            }
+        }
+    }
+    std::vector<std::string> scanned = audio_probe_list_dir(batchDir.c_str());
+    for (unsigned threads : {1u, parallel_decode_threads()}) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<AudioProbe> probes = audio_probe_batch(scanned, threads);
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        size_t failed = std::count_if(probes.begin(), probes.end(),
+                                      [](AudioProbe const & p) { return p.result != RESULT_SUCCESS; });
+        if (failed > 0) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "folder of %zu files, %u threads: %.1f ms (%.3f ms per file), %zu failed\n",
+                probes.size(), threads, ms, ms / std::max<size_t>(1, probes.size()), failed);
+    }
+
+    for (std::string const & path : links) {
+        remove(path.c_str());
+    }
+    for (std::string const & path : files) {
+        remove(path.c_str());
+    }
+    rmdir(batchDir.c_str());
+    remove(wav.c_str());
+    return result;
+}
+
+int bench_jobs(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string in = dir + "/bench-jobs-in.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    auto tempoJob = [&](std::string const & outPath) {
+        return [in, outPath](RenderReport * report) {
+            return sox_tempo((char *) in.c_str(), (char *) outPath.c_str(), (char *) "1.25", report);
+        };
+    };
+    int result = RESULT_SUCCESS;
+    auto check = [&](char const * name, bool ok, JobStatus const & status) {
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-34s %10.1f %10.1f %6s\n", name, status.queued_ms, status.run_ms, ok ? "ok" : "FAIL");
+    };
+    fprintf(out, "%-34s %10s %10s %6s\n", "job", "queued_ms", "run_ms", "check");
+
+    /* Progress arrives in order, on the callback thread, ahead of done */
+    std::mutex mutex;
+    std::vector<double> progress;
+    bool doneAfterProgress = false;
+    JobCallbacks callbacks;
+    callbacks.on_progress = [&](uint64_t, double fraction) {
+        std::lock_guard<std::mutex> lock(mutex);
+        progress.push_back(fraction);
+    };
+    callbacks.on_done = [&](JobStatus const &) {
+        std::lock_guard<std::mutex> lock(mutex);
+        doneAfterProgress = !progress.empty();
+    };
+    std::string outFirst = dir + "/bench-jobs-first.wav";
+    JobStatus status;
+    job_await(job_submit("tempo", JOB_EXPORT, tempoJob(outFirst), callbacks), -1, &status);
+    /* on_done may still be on its way */
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool ordered = std::is_sorted(progress.begin(), progress.end());
+        check("run with progress", status.state == JOB_SUCCEEDED && progress.size() >= 10 && ordered
+                && doneAfterProgress, status);
+        fprintf(out, "  %zu progress callbacks\n", progress.size());
+    }
+
+    /* Await with a timeout returns while the job is still going */
+    std::string outSecond = dir + "/bench-jobs-second.wav";
+    uint64_t running = job_submit("tempo", JOB_EXPORT, tempoJob(outSecond));
+    bool timedOut = job_await(running, 1, &status) == RESULT_ERROR && status.state != JOB_SUCCEEDED;
+    check("await with a 1 ms timeout", timedOut, status);
+
+    /* A running job stops at its next block */
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto cancelStart = std::chrono::steady_clock::now();
+    job_cancel(running);
+    job_await(running, -1, &status);
+    double cancelMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cancelStart).count();
+    check("cancel while running", status.state == JOB_CANCELLED, status);
+    fprintf(out, "  stopped %.1f ms after the cancel\n", cancelMs);
+
+    /* With the slot busy, a queued job is dropped without running */
+    std::vector<uint64_t> ids;
+    for (int i = 0; i < 3; i++) {
+        ids.push_back(job_submit("tempo", JOB_EXPORT, tempoJob(dir + "/bench-jobs-busy-" + std::to_string(i) + ".wav")));
+    }
+    job_cancel(ids.back());
+    job_await(ids.back(), -1, &status);
+    check("cancel while queued", status.state == JOB_CANCELLED && status.run_ms == 0, status);
+    for (uint64_t id : ids) {
+        job_await(id, -1, &status);
+    }
+    check("jobs next to a cancelled one", status.state == JOB_CANCELLED
+            && job_status(ids[0], &status) == RESULT_SUCCESS && status.state == JOB_SUCCEEDED, status);
+
+    /* A burst of renders of one stage: the first starts at once and is
+     * superseded while running, the middle one is dropped in its debounce
+     * window, and only the last renders to the end */
+    std::vector<uint64_t> burst;
+    for (int i = 0; i < 3; i++) {
+        burst.push_back(job_submit_latest(in.c_str(), "tempo", JOB_INTERACTIVE,
+                                          tempoJob(dir + "/bench-jobs-burst-" + std::to_string(i) + ".wav")));
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    }
+    JobStatus first, middle;
+    job_await(burst[0], -1, &first);
+    job_await(burst[1], -1, &middle);
+    job_await(burst[2], -1, &status);
+    check("superseded while running", first.state == JOB_CANCELLED && first.superseded_by == burst[1]
+            && first.report.error == "superseded", first);
+    check("superseded in the debounce window", middle.state == JOB_CANCELLED && middle.run_ms == 0
+            && middle.superseded_by == burst[2], middle);
+    check("latest of the burst", status.state == JOB_SUCCEEDED, status);
+
+    remove(in.c_str());
+    remove(outFirst.c_str());
+    remove(outSecond.c_str());
+    for (int i = 0; i < 3; i++) {
+        remove((dir + "/bench-jobs-busy-" + std::to_string(i) + ".wav").c_str());
+        remove((dir + "/bench-jobs-burst-" + std::to_string(i) + ".wav").c_str());
+    }
+    return result;
+}
+
+int bench_priority(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string longIn = dir + "/bench-priority-long.wav";
+    std::string shortIn = dir + "/bench-priority-short.wav";
+    if (write_test_signal(longIn.c_str(), 44100, 2, BENCH_SECONDS * 6) != RESULT_SUCCESS
+            || write_test_signal(shortIn.c_str(), 44100, 2, BENCH_SECONDS / 4) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    auto tempoJob = [](std::string const & inPath, std::string const & outPath) {
+        return [inPath, outPath](RenderReport * report) {
+            return sox_tempo((char *) inPath.c_str(), (char *) outPath.c_str(), (char *) "1.25", report);
+        };
+    };
+    auto latency = [](JobStatus const & status) {
+        return status.queued_ms + status.run_ms;
+    };
+    fprintf(out, "%-34s %10s %10s %12s %6s\n", "job", "queued_ms", "run_ms", "preempted_ms", "yields");
+    auto row = [&](char const * name, JobStatus const & status) {
+        fprintf(out, "%-34s %10.1f %10.1f %12.1f %6d\n", name, status.queued_ms, status.run_ms,
+                status.preempted_ms, status.preemptions);
+    };
+
+    /* The preview alone */
+    std::string previewOut = dir + "/bench-priority-preview.wav";
+    JobStatus alone;
+    job_await(job_submit("preview", JOB_INTERACTIVE, tempoJob(shortIn, previewOut)), -1, &alone);
+    row("preview, idle", alone);
+
+    /* The same preview behind long exports and background renders */
+    std::vector<uint64_t> load;
+    for (int i = 0; i < 4; i++) {
+        JobPriority priority = i % 2 == 0 ? JOB_EXPORT : JOB_BACKGROUND;
+        std::string loadOut = dir + "/bench-priority-load-" + std::to_string(i) + ".wav";
+        load.push_back(job_submit(job_priority_name(priority), priority, tempoJob(longIn, loadOut)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    JobStatus loaded;
+    job_await(job_submit("preview", JOB_INTERACTIVE, tempoJob(shortIn, previewOut)), -1, &loaded);
+    row("preview, under load", loaded);
+
+    /* Export and background share the slot 5:1 while both run */
+    JobStatus exportStatus, backgroundStatus;
+    job_status(load[0], &exportStatus);
+    job_status(load[1], &backgroundStatus);
+    double before[2] = {exportStatus.progress, backgroundStatus.progress};
+    std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+    job_status(load[0], &exportStatus);
+    job_status(load[1], &backgroundStatus);
+    double exportShare = exportStatus.progress - before[0];
+    double backgroundShare = backgroundStatus.progress - before[1];
+
+    for (uint64_t id : load) {
+        job_cancel(id);
+    }
+    for (size_t i = 0; i < load.size(); i++) {
+        JobStatus status;
+        job_await(load[i], -1, &status);
+        row(i % 2 == 0 ? "export (cancelled)" : "background (cancelled)", status);
+        remove((dir + "/bench-priority-load-" + std::to_string(i) + ".wav").c_str());
+    }
+
+    /* The interactive target: the preview starts within a couple of quanta
+     * and takes at most twice as long as on an idle scheduler */
+    bool startsSoon = loaded.queued_ms <= 50;
+    bool fastEnough = latency(loaded) <= 2 * latency(alone) + 50;
+    bool shared = exportShare > 2 * backgroundShare;
+    fprintf(out, "preview latency %.1f ms idle, %.1f ms under load (%.2fx): %s\n", latency(alone),
+            latency(loaded), latency(loaded) / latency(alone), startsSoon && fastEnough ? "ok" : "FAIL");
+    fprintf(out, "progress in 2 s: export %.3f, background %.3f: %s\n", exportShare, backgroundShare,
+            shared ? "ok" : "FAIL");
+
+    remove(longIn.c_str());
+    remove(shortIn.c_str());
+    remove(previewOut.c_str());
+    return startsSoon && fastEnough && shared && alone.state == JOB_SUCCEEDED
+           && loaded.state == JOB_SUCCEEDED ? RESULT_SUCCESS : RESULT_ERROR;
+}
+
+#define MAPPED_RUNS 3
+
+/* Drops the file's pages from the page cache, so that the next read comes
+ * from flash */
+static void drop_cached_pages(std::string const & path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+/* Reads the whole file; the sum of its samples tells the data apart */
+static double mapped_read_ms(std::string const & path, uint64_t * checksum) {
+    auto start = std::chrono::steady_clock::now();
+    MappedInput mapped;
+    sox_format_t * in = mapped.open(path.c_str());
+    *checksum = 0;
+    if (!in) {
+        return NAN;
+    }
+    std::vector<sox_sample_t> buf(65536 - 65536 % in->signal.channels);
+    size_t got;
+    while ((got = sox_read(in, buf.data(), buf.size())) > 0) {
+        for (size_t i = 0; i < got; i++) {
+            *checksum = *checksum * 31 + (uint32_t) buf[i];
+        }
+    }
+    sox_close(in);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double mapped_write_ms(std::string const & path, AudioBuffer const & buffer) {
+    auto start = std::chrono::steady_clock::now();
+    if (sox_write_buffer(buffer, path.c_str(), NULL) != RESULT_SUCCESS) {
+        return NAN;
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int bench_mapped(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string wav = dir + "/bench-mapped-in.wav";
+    if (write_test_signal(wav.c_str(), 44100, 2, BENCH_SECONDS * 15) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    struct stat in_stat;
+    stat(wav.c_str(), &in_stat);
+    double megabytes = in_stat.st_size / 1048576.0;
+    AudioBuffer buffer;
+    if (sox_decode_buffer(wav.c_str(), &buffer, NULL) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    bool enabled = mapped_io_enabled();
+    int result = RESULT_SUCCESS;
+
+    fprintf(out, "%-6s %-6s %10s %10s %10s %10s %8s\n", "io", "cache", "read_ms", "read_MB/s",
+            "write_ms", "write_MB/s", "data");
+    uint64_t reference = 0;
+    std::string written[2];
+    for (int mode = 0; mode < 2; mode++) {
+        mapped_io_set_enabled(mode == 1);
+        char const * io = mode == 1 ? "mapped" : "stdio";
+        written[mode] = dir + "/bench-mapped-out-" + io + ".wav";
+        for (bool cold : {true, false}) {
+            double readMs = 0, writeMs = 0;
+            bool same = true;
+            for (int run = 0; run < MAPPED_RUNS; run++) {
+                if (cold) {
+                    drop_cached_pages(wav);
+                }
+                uint64_t checksum;
+                readMs += mapped_read_ms(wav, &checksum);
+                if (reference == 0) {
+                    reference = checksum;
+                }
+                same = same && checksum == reference;
+                writeMs += mapped_write_ms(written[mode], buffer);
+            }
+            readMs /= MAPPED_RUNS;
+            writeMs /= MAPPED_RUNS;
+            if (!same || std::isnan(readMs) || std::isnan(writeMs)) {
+                result = RESULT_ERROR;
+            }
+            fprintf(out, "%-6s %-6s %10.1f %10.1f %10.1f %10.1f %8s\n", io, cold ? "cold" : "warm", readMs,
+                    megabytes * 1000 / readMs, writeMs, megabytes * 1000 / writeMs, same ? "ok" : "DIFFERS");
+        }
+    }
+    bool writesSame = files_identical(written[0], written[1]);
+
+    /* A render reading and writing intermediates */
+    std::string rendered[2];
+    double renderMs[2];
+    for (int mode = 0; mode < 2; mode++) {
+        mapped_io_set_enabled(mode == 1);
+        rendered[mode] = dir + "/bench-mapped-tempo-" + std::to_string(mode) + ".wav";
+        drop_cached_pages(wav);
+        RenderReport report;
+        if (sox_render("tempo", wav.c_str(), rendered[mode].c_str(), {{"tempo", {"1.25"}}}, &report)
+                != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+        }
+        renderMs[mode] = report.total_ms;
+    }
+    mapped_io_set_enabled(enabled);
+    bool rendersSame = files_identical(rendered[0], rendered[1]);
+    if (!writesSame || !rendersSame) {
+        result = RESULT_ERROR;
+    }
+    fprintf(out, "written WAVs: %s\n", writesSame ? "identical" : "DIFFER");
+    fprintf(out, "tempo render, cold input: stdio %.1f ms, mapped %.1f ms, outputs %s\n",
+            renderMs[0], renderMs[1], rendersSame ? "identical" : "DIFFER");
+
+    for (int mode = 0; mode < 2; mode++) {
+        remove(written[mode].c_str());
+        remove(rendered[mode].c_str());
+    }
+    remove(wav.c_str());
+    return result;
+}
+
+/* A stereo sine segment of a reference case */
+struct ToneSegment {
+    double freq;
+    double dbfs;
+    double seconds;
+};
+
+struct LoudnessCase {
+    char const * name;
+    double rate;
+    std::vector<ToneSegment> segments;
+    double phase;         /* radians, of the sine at the first sample */
+    double integrated;    /* expected values; NAN where the case sets none */
+    double range;
+    double true_peak;
+    double tolerance;
+};
+
+static LoudnessReport measure_tones(LoudnessCase const & c) {
+    LoudnessMeter meter;
+    loudness_meter_init(&meter, c.rate, 2);
+    std::vector<sox_sample_t> block(2 * 4096);
+    uint64_t frame = 0;
+    for (ToneSegment const & segment : c.segments) {
+        double amplitude = std::pow(10.0, segment.dbfs / 20) * SOX_SAMPLE_MAX;
+        uint64_t end = frame + (uint64_t) (segment.seconds * c.rate);
+        while (frame < end) {
+            size_t frames = (size_t) std::min<uint64_t>(4096, end - frame);
+            for (size_t i = 0; i < frames; i++, frame++) {
+                double value = amplitude * std::sin(2 * M_PI * segment.freq * frame / c.rate + c.phase);
+                block[2 * i] = block[2 * i + 1] = (sox_sample_t) value;
+            }
+            loudness_meter_add(&meter, block.data(), 2 * frames);
+        }
+    }
+    LoudnessReport report;
+    loudness_meter_finish(meter, &report);
+    return report;
+}
+
+static bool within(double value, double expected, double tolerance) {
+    return std::isnan(expected) || std::fabs(value - expected) <= tolerance;
+}
+
+int bench_loudness(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    std::vector<LoudnessCase> cases = {
+            {"3341-1 1k -23 dBFS", 48000, {{1000, -23, 20}}, 0, -23, NAN, NAN, 0.1},
+            {"3341-2 1k -33 dBFS", 48000, {{1000, -33, 20}}, 0, -33, NAN, NAN, 0.1},
+            {"3341-3 -36/-23/-36", 48000, {{1000, -36, 10}, {1000, -23, 60}, {1000, -36, 10}}, 0, -23, NAN, NAN, 0.1},
+            {"3341-4 -72/-36/-23/-36/-72", 48000,
+             {{1000, -72, 10}, {1000, -36, 10}, {1000, -23, 60}, {1000, -36, 10}, {1000, -72, 10}},
+             0, -23, NAN, NAN, 0.1},
+            {"3342-1 -20/-30", 48000, {{1000, -20, 20}, {1000, -30, 20}}, 0, NAN, 10, NAN, 1},
+            {"3342-2 -20/-15", 48000, {{1000, -20, 20}, {1000, -15, 20}}, 0, NAN, 5, NAN, 1},
+            {"3342-3 -40/-20", 48000, {{1000, -40, 20}, {1000, -20, 20}}, 0, NAN, 20, NAN, 1},
+            {"1k -23 dBFS at 44.1 kHz", 44100, {{1000, -23, 20}}, 0, -23, NAN, NAN, 0.1},
+            {"true peak fs/4 at 45 deg", 48000, {{12000, -6, 10}}, M_PI / 4, NAN, NAN, -6, 0.5},
+            {"true peak fs/4 at 45 deg 44.1", 44100, {{11025, -6, 10}}, M_PI / 4, NAN, NAN, -6, 0.5},
+    };
+    int result = RESULT_SUCCESS;
+    fprintf(out, "%-32s %9s %7s %9s %9s %8s\n", "case", "I_LUFS", "LRA_LU", "TP_dBTP", "SP_dBFS", "check");
+    for (LoudnessCase const & c : cases) {
+        LoudnessReport r = measure_tones(c);
+        bool ok = within(r.integrated_lufs, c.integrated, c.tolerance) && within(r.range_lu, c.range, c.tolerance)
+                && within(r.true_peak_dbtp, c.true_peak, c.tolerance);
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-32s %9.2f %7.2f %9.2f %9.2f %8s\n", c.name, r.integrated_lufs, r.range_lu,
+                r.true_peak_dbtp, r.sample_peak_dbfs, ok ? "ok" : "WRONG");
+    }
+
+    /* The tap in a render: the measurement against the cost of a pass */
+    std::string dir = workDir;
+    std::string in = dir + "/bench-loudness-in.wav";
+    std::string outPath = dir + "/bench-loudness-out.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 3) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    RenderReport plain, tapped, measured;
+    std::vector<EffectSpec> chain = {Tempo{1.25}.spec()};
+    std::vector<EffectSpec> tappedChain = {Tempo{1.25}.spec(), Loudness().spec()};
+    if (sox_render("tempo", in.c_str(), outPath.c_str(), chain, &plain) != RESULT_SUCCESS
+            || sox_render("tempo", in.c_str(), outPath.c_str(), tappedChain, &tapped) != RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+    }
+    /* A separate pass over the rendered file, as before the tap */
+    RenderOptions nowhere;
+    nowhere.out_type = "null";
+    if (sox_render("loudness", outPath.c_str(), "-", {Loudness().spec()}, &measured, nowhere) != RESULT_SUCCESS
+            || std::fabs(measured.loudness.integrated_lufs - tapped.loudness.integrated_lufs) > 0.05) {
+        result = RESULT_ERROR;
+    }
+    fprintf(out, "tempo render %.1f ms, with the tap %.1f ms (%s); separate pass %.1f ms (%s)\n",
+            plain.total_ms, tapped.total_ms, tapped.loudness.measured ? "measured" : "NOT MEASURED",
+            measured.total_ms, std::fabs(measured.loudness.integrated_lufs - tapped.loudness.integrated_lufs)
+                    <= 0.05 ? "same loudness" : "DIFFERENT LOUDNESS");
+    remove(in.c_str());
+    remove(outPath.c_str());
+    return result;
+}
+
+#define NORMALIZE_TOLERANCE_LU 0.1
+
+int bench_normalize(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    std::string dir = workDir;
+    std::string cacheDir = dir + "/bench-normalize-cache";
+    std::string in = dir + "/bench-normalize-in.wav";
+    std::string rendered = dir + "/bench-normalize-tempo.wav";
+    std::string outPath = dir + "/bench-normalize-out.wav";
+    if (write_test_signal(in.c_str(), 44100, 2, BENCH_SECONDS * 3) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    render_cache_init(cacheDir.c_str(), UINT64_MAX);
+    int result = RESULT_SUCCESS;
+
+    /* The output is measured again and must be where the report says */
+    auto check = [&](char const * name, double ms, RenderReport const & report) {
+        RenderReport measured;
+        bool ok = report.result == RESULT_SUCCESS
+                && sox_analyse_loudness(outPath.c_str(), &measured) == RESULT_SUCCESS
+                && std::fabs(measured.loudness.integrated_lufs - report.loudness.integrated_lufs)
+                        <= NORMALIZE_TOLERANCE_LU
+                && measured.loudness.true_peak_dbtp <= LOUDNESS_MAX_TRUE_PEAK + NORMALIZE_TOLERANCE_LU;
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-40s %10.1f %9.2f %9.2f %6s\n", name, ms, measured.loudness.integrated_lufs,
+                measured.loudness.true_peak_dbtp, ok ? "ok" : "WRONG");
+    };
+    auto timed = [](std::function<int()> const & work, double * ms) {
+        auto start = std::chrono::steady_clock::now();
+        int r = work();
+        *ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return r;
+    };
+
+    fprintf(out, "%-40s %10s %9s %9s %6s\n", "normalisation", "ms", "I_LUFS", "TP_dBTP", "check");
+    /* A file no render wrote and no analysis measured has no statistics */
+    RenderReport report;
+    double ms;
+    bool refused = sox_normalize(in.c_str(), outPath.c_str(), -23, &report) != RESULT_SUCCESS;
+    if (!refused) {
+        result = RESULT_ERROR;
+    }
+    fprintf(out, "%-40s %10s %9s %9s %6s\n", "unmeasured file", "-", "-", "-", refused ? "ok" : "WRONG");
+
+    /* The tempo render measures its output; the gain alone follows, and
+     * the targets differ, so the second is no render cache hit */
+    RenderReport tempoRender;
+    if (sox_tempo((char *) in.c_str(), (char *) rendered.c_str(), (char *) "1.25", &tempoRender) != RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+    }
+    timed([&] { return sox_normalize(rendered.c_str(), outPath.c_str(), -23, &report); }, &ms);
+    check("rendered file, -23 LUFS, gain only", ms, report);
+    timed([&] { return sox_normalize(rendered.c_str(), outPath.c_str(), -26, &report); }, &ms);
+    check("rendered file, -26 LUFS, gain only", ms, report);
+
+    /* A session: the tempo stage is measured on its way to disk, and a
+     * second session on the same source finds its statistics cached */
+    for (int run = 0; run < 2; run++) {
+        uint64_t session = session_create(dir);
+        SessionEffect tempo;
+        tempo.value = 1.25;
+        SessionEffect normalize;
+        normalize.type = SESSION_NORMALIZE;
+        normalize.value = -20;
+        RenderReport tempoReport, normalizeReport, exported;
+        if (session_load(session, in.c_str()) != RESULT_SUCCESS
+                || session_apply(session, 0, tempo, &tempoReport) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+        }
+        timed([&] { return session_apply(session, 1, normalize, &normalizeReport); }, &ms);
+        session_export(session, {outPath}, {}, &exported);
+        fprintf(out, "session %d: tempo %.1f ms\n", run + 1, tempoReport.total_ms);
+        check(run == 0 ? "session, -20 LUFS, measured below" : "session, -20 LUFS, cached below", ms, exported);
+        session_close(session);
+    }
+
+    render_cache_init(cacheDir.c_str(), 0);
+    render_cache_init("", 0);
+    remove((cacheDir + "/index").c_str());
+    remove((cacheDir + "/loudness").c_str());
+    rmdir(cacheDir.c_str());
+    remove(in.c_str());
+    remove(rendered.c_str());
+    remove(outPath.c_str());
+    return result;
+}
+
+#define SILENCE_HEAD_SECONDS 8
+#define SILENCE_GAP_SECONDS 1
+#define SILENCE_TAIL_SECONDS 12
+#define SILENCE_SCAN_RUNS 20
+
+/* The peak of every window the plain way, as the scanner did before */
+static uint64_t scalar_silent_windows(AudioBuffer const & buffer, uint64_t windowFrames, int64_t threshold) {
+    unsigned channels = buffer.signal.channels;
+    uint64_t silent = 0;
+    for (size_t i = 0; i < buffer.samples.size(); i += windowFrames * channels) {
+        size_t end = std::min(buffer.samples.size(), (size_t) (i + windowFrames * channels));
+        int64_t peak = 0;
+        for (size_t j = i; j < end; j++) {
+            peak = std::max(peak, std::abs((int64_t) buffer.samples[j]));
+        }
+        silent += peak < threshold;
+    }
+    return silent;
+}
+
+static bool near_frames(uint64_t frames, double seconds, double rate) {
+    return std::fabs(frames / rate - seconds) <= SILENCE_WINDOW_SECONDS;
+}
+
+int bench_silence(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    std::string dir = workDir;
+    std::string music = dir + "/bench-silence-music.wav";
+    std::string in = dir + "/bench-silence-in.wav";
+    double rate = 44100;
+    AudioBuffer audio;
+    if (write_test_signal(music.c_str(), rate, 2, BENCH_SECONDS) != RESULT_SUCCESS
+            || sox_decode_buffer(music.c_str(), &audio) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    remove(music.c_str());
+
+    /* Head, the first half, a gap, the second half, tail */
+    AudioBuffer padded;
+    padded.signal = audio.signal;
+    size_t half = audio.samples.size() / 2;
+    padded.samples.assign((size_t) (SILENCE_HEAD_SECONDS * rate * 2), 0);
+    padded.samples.insert(padded.samples.end(), audio.samples.begin(), audio.samples.begin() + half);
+    padded.samples.insert(padded.samples.end(), (size_t) (SILENCE_GAP_SECONDS * rate * 2), 0);
+    padded.samples.insert(padded.samples.end(), audio.samples.begin() + half, audio.samples.end());
+    padded.samples.insert(padded.samples.end(), (size_t) (SILENCE_TAIL_SECONDS * rate * 2), 0);
+    padded.signal.length = padded.samples.size();
+    if (sox_write_buffer(padded, in.c_str()) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    int result = RESULT_SUCCESS;
+
+    /* The scan alone, from memory */
+    SilenceOptions options;
+    SilenceScanner scanner;
+    SilenceReport silence;
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < SILENCE_SCAN_RUNS; run++) {
+        silence_scanner_init(&scanner, rate, 2, options);
+        silence_scanner_add(&scanner, padded.samples.data(), padded.samples.size());
+        silence_scanner_finish(scanner, &silence);
+    }
+    double vectorMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+            / SILENCE_SCAN_RUNS;
+    start = std::chrono::steady_clock::now();
+    uint64_t scalarSilent = 0;
+    for (int run = 0; run < SILENCE_SCAN_RUNS; run++) {
+        scalarSilent += scalar_silent_windows(padded, scanner.window_frames, scanner.threshold);
+    }
+    double scalarMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+            / SILENCE_SCAN_RUNS;
+    double megabytes = padded.samples.size() * sizeof(sox_sample_t) / 1e6;
+    fprintf(out, "scan of %.0f s: %.2f ms (%.0f MB/s), scalar %.2f ms (%.0f MB/s)\n",
+            padded.samples.size() / 2 / rate, vectorMs, megabytes * 1000 / vectorMs, scalarMs,
+            megabytes * 1000 / scalarMs);
+
+    double pad = options.pad_seconds;
+    bool regionsOk = silence.regions.size() == 3
+            && near_frames(silence.regions[1].start, SILENCE_HEAD_SECONDS + BENCH_SECONDS / 2.0, rate)
+            && near_frames(silence.regions[1].frames, SILENCE_GAP_SECONDS, rate)
+            && near_frames(silence.lead_frames, SILENCE_HEAD_SECONDS - pad, rate)
+            && near_frames(silence.trail_frames, SILENCE_TAIL_SECONDS - pad, rate)
+            && scalarSilent > 0;
+    if (!regionsOk) {
+        result = RESULT_ERROR;
+    }
+    for (SilenceRegion const & region : silence.regions) {
+        fprintf(out, "  silent %8.2f s +%6.2f s\n", region.start / rate, region.frames / rate);
+    }
+    fprintf(out, "lead %.2f s, trail %.2f s: %s\n", silence.lead_frames / rate, silence.trail_frames / rate,
+            regionsOk ? "ok" : "WRONG");
+
+    /* Imports: the scan rides on the decode; trimmed, the tempo stage has
+     * the head and tail less to render */
+    fprintf(out, "%-10s %10s %10s %10s %8s\n", "import", "decode_ms", "tempo_ms", "frames", "check");
+    char const * names[] = {"plain", "scanned", "trimmed"};
+    for (int mode = 0; mode < 3; mode++) {
+        DecodeOptions decode;
+        decode.scan_silence = mode >= 1;
+        decode.trim_silence = mode == 2;
+        AudioBuffer buffer, rendered;
+        RenderReport decoded, tempo;
+        if (sox_decode_buffer(in.c_str(), &buffer, &decoded, decode) != RESULT_SUCCESS
+                || sox_render_buffer("tempo", buffer, {Tempo{1.25}.spec()}, &rendered, &tempo) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+        }
+        uint64_t frames = buffer.samples.size() / 2;
+        uint64_t expected = padded.samples.size() / 2
+                - (mode == 2 ? silence.lead_frames + silence.trail_frames : 0);
+        bool ok = frames == expected && (mode == 0 || decoded.silence.regions.size() == silence.regions.size());
+        if (mode == 2) {
+            /* Nothing of the audio is lost */
+            ok = ok && std::equal(buffer.samples.begin(), buffer.samples.end(),
+                                  padded.samples.begin() + silence.lead_frames * 2);
+        }
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-10s %10.1f %10.1f %10llu %8s\n", names[mode], decoded.total_ms, tempo.total_ms,
+                (unsigned long long) frames, ok ? "ok" : "WRONG");
+    }
+    remove(in.c_str());
+    return result;
+}
+
+#define SPECTROGRAM_PAN_STEPS 16
+#define SPECTROGRAM_VIEW_TILES 4
+
+/* A column the plain way: one window at a time through a complex FFT in
+ * double precision, mapped to bytes as spectrogram.cpp does. twiddles holds
+ * e^(-2 pi i k / n) for k < n / 2, as cosines then sines */
+static void scalar_spectrogram_column(std::vector<double> const & window, std::vector<double> const & twiddles,
+                                      double floorDb, uint8_t * out) {
+    size_t n = window.size();
+    std::vector<double> re(n), im(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        re[i] = window[i] * (0.5 - 0.5 * std::cos(2 * M_PI * i / n));
+    }
+    for (size_t i = 1, j = 0; i < n; i++) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            std::swap(re[i], re[j]);
+        }
+    }
+    for (size_t half = 1; half < n; half <<= 1) {
+        for (size_t start = 0; start < n; start += 2 * half) {
+            for (size_t k = 0; k < half; k++) {
+                double c = twiddles[k * (n / 2 / half)], s = twiddles[n / 2 + k * (n / 2 / half)];
+                size_t a = start + k, b = a + half;
+                double tr = re[b] * c - im[b] * s, ti = re[b] * s + im[b] * c;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+    double refDb = 20 * std::log10(n / 4.0);
+    for (size_t k = 0; k < n / 2; k++) {
+        double db = 10 * std::log10(re[k] * re[k] + im[k] * im[k] + 1e-30) - refDb;
+        out[k] = (uint8_t) std::min(255.0, std::max(0.0, (db - floorDb) * 255 / -floorDb + 0.5));
+    }
+}
+
+/* The largest difference of two sets of tiles; 256 if they differ in shape */
+static int tiles_difference(std::vector<SpectrogramTile> const & a, std::vector<SpectrogramTile> const & b) {
+    if (a.size() != b.size()) {
+        return 256;
+    }
+    int difference = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].index != b[i].index || a[i].values.size() != b[i].values.size()) {
+            return 256;
+        }
+        for (size_t j = 0; j < a[i].values.size(); j++) {
+            difference = std::max(difference, std::abs(a[i].values[j] - b[i].values[j]));
+        }
+    }
+    return difference;
+}
+
+int bench_spectrogram(char const * workDir, FILE * out) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    std::string music = std::string(workDir) + "/bench-spectrogram.wav";
+    AudioBuffer audio;
+    if (write_test_signal(music.c_str(), 44100, 2, BENCH_SECONDS) != RESULT_SUCCESS
+            || sox_decode_buffer(music.c_str(), &audio) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    remove(music.c_str());
+    AudioView audioView = audio_view(audio);
+    int result = RESULT_SUCCESS;
+    auto since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    /* Level 0 on one worker, against the scalar FFT of the same columns */
+    SpectrogramOptions options;
+    std::shared_ptr<Spectrogram> spectrogram = spectrogram_create(options);
+    options = spectrogram_options(spectrogram.get());
+    uint64_t frames = audio.samples.size() / 2;
+    std::vector<SpectrogramTile> tiles;
+    auto start = std::chrono::steady_clock::now();
+    if (spectrogram_fetch(spectrogram.get(), &audioView, 0, 0, UINT64_MAX, 1, &tiles) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    double vectorMs = since(start);
+    uint64_t columns = 0;
+    for (SpectrogramTile const & tile : tiles) {
+        columns += tile.columns;
+    }
+    start = std::chrono::steady_clock::now();
+    std::vector<double> window(options.fft_size), twiddles(options.fft_size);
+    for (size_t k = 0; k < options.fft_size / 2; k++) {
+        twiddles[k] = std::cos(2 * M_PI * k / options.fft_size);
+        twiddles[options.fft_size / 2 + k] = -std::sin(2 * M_PI * k / options.fft_size);
+    }
+    std::vector<uint8_t> column(options.fft_size / 2);
+    int difference = 0;
+    for (uint64_t c = 0; c < columns; c++) {
+        for (size_t i = 0; i < window.size(); i++) {
+            uint64_t frame = c * options.hop + i;
+            window[i] = frame < frames
+                    ? ((double) audio.samples[frame * 2] + audio.samples[frame * 2 + 1]) / (2 * 2147483648.0) : 0;
+        }
+        scalar_spectrogram_column(window, twiddles, options.floor_db, column.data());
+        SpectrogramTile const & tile = tiles[c / SPECTROGRAM_TILE_COLUMNS];
+        uint8_t const * values = tile.values.data() + (c % SPECTROGRAM_TILE_COLUMNS) * tile.bins;
+        for (size_t k = 0; k < column.size(); k++) {
+            difference = std::max(difference, std::abs(column[k] - values[k]));
+        }
+    }
+    double scalarMs = since(start);
+    /* A byte is 0.47 dB; float rounding may tip one over */
+    bool valuesOk = difference <= 1 && columns == (frames + options.hop - 1) / options.hop;
+    if (!valuesOk) {
+        result = RESULT_ERROR;
+    }
+    fprintf(out, "%llu columns of %u bins: vector %.1f ms (%.1f us/column), scalar %.1f ms (%.1f us/column), "
+                 "max difference %d: %s\n",
+            (unsigned long long) columns, options.fft_size / 2, vectorMs, vectorMs * 1000 / columns, scalarMs,
+            scalarMs * 1000 / columns, difference, valuesOk ? "ok" : "WRONG");
+
+    /* Every level cold on all workers, then again from the cache */
+    unsigned threads = parallel_decode_threads();
+    fprintf(out, "%-6s %6s %12s %12s %12s\n", "level", "tiles", "cold_1_ms", "cold_n_ms", "cached_ms");
+    std::shared_ptr<Spectrogram> parallel = spectrogram_create(options);
+    for (unsigned level = 0; level < options.levels; level++) {
+        std::shared_ptr<Spectrogram> single = spectrogram_create(options);
+        std::vector<SpectrogramTile> one, many, cached;
+        start = std::chrono::steady_clock::now();
+        spectrogram_fetch(single.get(), &audioView, level, 0, UINT64_MAX, 1, &one);
+        double oneMs = since(start);
+        start = std::chrono::steady_clock::now();
+        spectrogram_fetch(parallel.get(), &audioView, level, 0, UINT64_MAX, threads, &many);
+        double manyMs = since(start);
+        start = std::chrono::steady_clock::now();
+        int fetched = spectrogram_fetch(parallel.get(), NULL, level, 0, UINT64_MAX, threads, &cached);
+        double cachedMs = since(start);
+        if (fetched != RESULT_SUCCESS || tiles_difference(one, many) != 0 || tiles_difference(many, cached) != 0) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-6u %6zu %12.2f %12.2f %12.3f\n", level, many.size(), oneMs, manyMs, cachedMs);
+    }
+
+    /* A view of a few tiles panning right a tile at a time and back: one
+     * tile to compute per step on the way out, none on the way back */
+    std::shared_ptr<Spectrogram> panned = spectrogram_create(options);
+    uint64_t tileCount = (columns + SPECTROGRAM_TILE_COLUMNS - 1) / SPECTROGRAM_TILE_COLUMNS;
+    uint64_t steps = std::min<uint64_t>(SPECTROGRAM_PAN_STEPS, tileCount > SPECTROGRAM_VIEW_TILES
+            ? tileCount - SPECTROGRAM_VIEW_TILES : 0);
+    std::vector<SpectrogramTile> view;
+    spectrogram_fetch(panned.get(), &audioView, 0, 0, SPECTROGRAM_VIEW_TILES, threads, &view);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t step = 1; step <= steps; step++) {
+        spectrogram_fetch(panned.get(), &audioView, 0, step, SPECTROGRAM_VIEW_TILES, threads, &view);
+    }
+    double outMs = since(start);
+    start = std::chrono::steady_clock::now();
+    for (uint64_t step = steps; step-- > 0;) {
+        if (!spectrogram_cached(panned.get(), 0, step, SPECTROGRAM_VIEW_TILES)
+                || spectrogram_fetch(panned.get(), NULL, 0, step, SPECTROGRAM_VIEW_TILES, threads, &view)
+                        != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+        }
+    }
+    double backMs = since(start);
+    if (steps > 0) {
+        fprintf(out, "pan of %u tiles over %llu steps: out %.2f ms/step, back %.3f ms/step\n",
+                SPECTROGRAM_VIEW_TILES, (unsigned long long) steps, outMs / steps, backMs / steps);
+    }
+
+    /* The tap in a tempo render: its tiles are the output's */
+    fprintf(out, "%-22s %10s %8s\n", "tempo render", "ms", "check");
+    for (int tapped = 0; tapped < 2; tapped++) {
+        std::shared_ptr<Spectrogram> tap = spectrogram_create(options);
+        std::vector<EffectSpec> chain = {Tempo{1.25}.spec()};
+        RenderOptions renderOptions;
+        if (tapped) {
+            chain.push_back({SPECTROGRAM_EFFECT, {}});
+            renderOptions.spectrogram = tap.get();
+        }
+        AudioBuffer rendered;
+        RenderReport report;
+        bool ok = sox_render_buffer("tempo", audio, chain, &rendered, &report, renderOptions) == RESULT_SUCCESS;
+        if (ok && tapped) {
+            std::shared_ptr<Spectrogram> computed = spectrogram_create(options);
+            AudioView renderedView = audio_view(rendered);
+            for (unsigned level = 0; level < options.levels && ok; level++) {
+                std::vector<SpectrogramTile> fromTap, fromOutput;
+                ok = spectrogram_cached(tap.get(), level, 0, UINT64_MAX)
+                        && spectrogram_fetch(tap.get(), NULL, level, 0, UINT64_MAX, 1, &fromTap) == RESULT_SUCCESS
+                        && spectrogram_fetch(computed.get(), &renderedView, level, 0, UINT64_MAX, threads,
+                                             &fromOutput) == RESULT_SUCCESS
+                        && !fromTap.empty() && tiles_difference(fromTap, fromOutput) == 0;
+            }
+        }
+        if (!ok) {
+            result = RESULT_ERROR;
+        }
+        fprintf(out, "%-22s %10.1f %8s\n", tapped ? "with spectrogram tap" : "plain", report.total_ms,
+                ok ? "ok" : "WRONG");
+    }
+    return result;
+}
@@ -0,0 +1,101 @@
+#ifndef SOXTEST_SOX_BENCH_H
+#define SOXTEST_SOX_BENCH_H
+
+#include <cstdio>
+
+/* Benchmarks of the native render paths. Each writes its scratch files to
+ * workDir, prints a table to out and returns RESULT_ERROR when a render
+ * fails or a correctness check does not hold */
+
+/* Single-threaded vs parallel flows on mono, stereo and 5.1 input; the
+ * outputs of both modes must be identical */
+int bench_threads(char const * workDir, FILE * out);
+
+/* libSoX chains (gain/fade, tempo, pitch/rate) vs the fused pipeline of
+ * pipeline.h, which must match them sample for sample */
+int bench_pipelines(char const * workDir, FILE * out);
+
+/* A batch of short renders with and without job arenas: time, heap
+ * allocations per job and how much of the heap is left free (fragmented)
+ * afterwards. Allocations made inside libSoX are counted too */
+int bench_allocations(char const * workDir, FILE * out);
+
+/* Full vs draft tempo and pitch renders of steady tones: speed, multiple of
+ * realtime and a tone SNR as the quality given up by the draft */
+int bench_draft(char const * workDir, FILE * out);
+
+/* Matrix of the `rate' quality tiers, phase responses and bandwidths:
+ * throughput on music, tone SNR of 44.1 -> 48 kHz and the level of an
+ * aliased tone after 44.1 -> 22.05 kHz. Per-device defaults
+ * (rate_quality in the tuning file) are picked from this table */
+int bench_rate(char const * workDir, FILE * out);
+
+/* Kills a checkpointed conversion and tempo render in a child process,
+ * resumes them and checks the result against an uninterrupted render */
+int bench_checkpoint(char const * workDir, FILE * out);
+
+/* Renders of 1, 2 and 4 hours of synthetic input per chain; fails unless
+ * the RSS growth stays flat as the duration grows */
+int bench_memory(char const * workDir, FILE * out);
+
+/* Serial vs frame-parallel decoding of MPEG-1 and MPEG-2 Layer III files
+ * with 1, 2, 4 and all worker threads; the decoded WAVs must be identical */
+int bench_mp3(char const * workDir, FILE * out);
+
+/* The same for FLAC at 44.1 and 96 kHz; the parallel decodes also check
+ * the STREAMINFO MD5 */
+int bench_flac(char const * workDir, FILE * out);
+
+/* Misses, hits and evictions of the render cache, including hits on a
+ * renamed copy of the input and after reloading the index */
+int bench_cache(char const * workDir, FILE * out);
+
+/* Tagged MP3, FLAC and OGG exports of one input, made one at a time and
+ * in a single decode with the encoders side by side; the outputs of both
+ * must be the same and the FLAC and OGG ones must carry the tags */
+int bench_export(char const * workDir, FILE * out);
+
+/* Header probes of tagged WAV, MP3, FLAC and OGG files against decoding
+ * them in full, and a folder scan with one and all threads; the probed
+ * lengths and tags must match what was written */
+int bench_probe(char const * workDir, FILE * out);
+
+/* The asynchronous job API: progress and done callbacks, await with a
+ * timeout, cancelling running and queued jobs, and a burst of renders of
+ * one stage superseding each other */
+int bench_jobs(char const * workDir, FILE * out);
+
+/* The priority classes of the job scheduler: a short preview alone and
+ * behind long export and background jobs, its queueing delay against the
+ * interactive latency target, and the slot shares of export and background */
+int bench_priority(char const * workDir, FILE * out);
+
+/* Reads and writes of a WAV intermediate through stdio and through memory
+ * mappings (mapped-io.h), cold (pages dropped from the cache) and warm,
+ * and a tempo render both ways; the data and outputs must be identical */
+int bench_mapped(char const * workDir, FILE * out);
+
+/* The loudness meter against the EBU Tech 3341/3342 reference cases
+ * (integrated loudness, loudness range, true peak) on synthetic tones,
+ * and the cost of the tap in a tempo render */
+int bench_loudness(char const * workDir, FILE * out);
+
+/* Normalisation of a file with and without its statistics in the render
+ * cache (analysis and gain against the gain alone), and in a project
+ * session, where the stage below was measured as it was rendered. Checks
+ * the normalised loudness */
+int bench_normalize(char const * workDir, FILE * out);
+
+/* The silence scanner on a recording with silent head, gap and tail: its
+ * throughput against a scalar scan, the regions it finds, the cost of the
+ * scan in an import and the tempo render it saves when the import trims */
+int bench_silence(char const * workDir, FILE * out);
+
+/* Spectrogram tiles (spectrogram.h): the vectorised FFT against a scalar
+ * one, which also checks the values; the tiles of a level computed cold
+ * on one and on all workers, fetched again from the cache and panned over;
+ * and the cost of the tap in a tempo render, whose tiles must equal the
+ * ones computed from the output */
+int bench_spectrogram(char const * workDir, FILE * out);
+
+#endif //SOXTEST_SOX_BENCH_H
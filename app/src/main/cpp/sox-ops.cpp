@@ -0,0 +1,1124 @@
+#include "sox-ops.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "flac-parallel.h"
+#include "loudness.h"
+#include "mapped-io.h"
+#include "memory-budget.h"
+#include "mp3-parallel.h"
+#include "native-log.h"
+#include "parallel-decode.h"
+#include "pipeline.h"
+#include "rate-plans.h"
+#include "render-cache.h"
+#include "render-jobs.h"
+#include "sox-tuning.h"
+#include "spectrogram.h"
+
+#define TMP_PATH "/sdcard/Android/data/jatx.soxtest/files"
+
+/* Seconds of audio per chunk of a parallel decode */
+#define MP3_CHUNK_SECONDS 8
+#define FLAC_CHUNK_SECONDS 4
+
+typedef std::chrono::steady_clock Clock;
+
+static double ms_since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static std::mutex runtime_mutex;
+static bool runtime_initialised = false;
+
+int sox_runtime_init() {
+    std::lock_guard<std::mutex> lock(runtime_mutex);
+    if (runtime_initialised) {
+        return RESULT_SUCCESS;
+    }
+
+    sox_globals.tmp_path = (char *) TMP_PATH;
+
+    /* All libSoX applications must start by initialising the SoX library    */
+    if(sox_init() != SOX_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    tuning_set(tuning_get());
+    runtime_initialised = true;
+    return RESULT_SUCCESS;
+}
+
+static bool has_extension(char const * path, char const * extension) {
+    size_t len = strlen(path), extLen = strlen(extension);
+    return len > extLen && strcasecmp(path + len - extLen, extension) == 0;
+}
+
+static bool is_wav_path(char const * path) {
+    return has_extension(path, ".wav");
+}
+
+/* Seeking is exact (a sample is a sample) for these inputs */
+static bool seeks_exactly(sox_format_t const * in) {
+    return in->seekable && (strcmp(in->filetype, "wav") == 0 || strcmp(in->filetype, "flac") == 0);
+}
+
+/* Source effect of sox_render_buffer() */
+struct BufferSource {
+    AudioBuffer const * buffer = NULL;
+    size_t position = 0;
+};
+
+struct FlowState {
+    MemoryWatch memory;
+    sox_format_t * in = NULL;
+    uint64_t in_bytes = 0;    /* size of the input file, for the progress */
+    BufferSource const * source = NULL;   /* or the buffer read */
+};
+
+/* Called by sox_flow_effects() after every round of buffers, the block
+ * boundary where the job may be preempted */
+static int LSX_API flow_callback(sox_bool /* all_done */, void * client_data) {
+    FlowState * flow = (FlowState *) client_data;
+    job_yield();
+    if (flow->in_bytes > 0) {
+        job_report_progress((double) flow->in->tell_off / flow->in_bytes);
+    } else if (flow->source && !flow->source->buffer->samples.empty()) {
+        job_report_progress((double) flow->source->position / flow->source->buffer->samples.size());
+    }
+    return memory_watch_check(&flow->memory) && !job_cancelled() ? SOX_SUCCESS : SOX_EOF;
+}
+
+static std::string memory_error(MemoryWatch const & memory) {
+    char message[128];
+    snprintf(message, sizeof(message), "memory budget exceeded: grew by %.1f MB, budget %.1f MB",
+             (memory.peak - memory.baseline) / 1048576.0, memory.budget / 1048576.0);
+    return message;
+}
+
+static int fail(RenderReport * report, std::string const & error) {
+    LOG_E("%s failed: %s", report->operation.c_str(), error.c_str());
+    report->result = RESULT_ERROR;
+    report->error = error;
+    return RESULT_ERROR;
+}
+
+/* Creates the named effect, initialises it with the given options and adds
+ * it to the end of the effects processing chain */
+static int add_effect(sox_effects_chain_t * chain, char const * name, int argc, char * argv[],
+                      sox_signalinfo_t * interm_signal, sox_signalinfo_t const * out_signal) {
+    sox_effect_t * e = sox_create_effect(sox_find_effect(name));
+    if (!e) {
+        return RESULT_ERROR;
+    }
+    if (sox_effect_options(e, argc, argv) != SOX_SUCCESS) {
+        free(e);
+        return RESULT_ERROR;
+    }
+    int result = sox_add_effect(chain, e, interm_signal, out_signal);
+    free(e);
+    return result == SOX_SUCCESS ? RESULT_SUCCESS : RESULT_ERROR;
+}
+
+/* Adds the tap of a LOUDNESS_EFFECT spec, measuring into meter */
+static int add_loudness_tap(sox_effects_chain_t * chain, LoudnessMeter * meter,
+                            sox_signalinfo_t * interm_signal, sox_signalinfo_t const * out_signal) {
+    sox_effect_t * e = loudness_tap_create(meter);
+    int result = e && sox_add_effect(chain, e, interm_signal, out_signal) == SOX_SUCCESS
+            ? RESULT_SUCCESS : RESULT_ERROR;
+    free(e);
+    return result;
+}
+
+/* Adds the tap of a SPECTROGRAM_EFFECT spec, filling spectrogram */
+static int add_spectrogram_tap(sox_effects_chain_t * chain, Spectrogram * spectrogram,
+                               sox_signalinfo_t * interm_signal, sox_signalinfo_t const * out_signal) {
+    if (!spectrogram) {
+        LOG_E("%s in a chain without a spectrogram", SPECTROGRAM_EFFECT);
+        return RESULT_ERROR;
+    }
+    sox_effect_t * e = spectrogram_tap_create(spectrogram);
+    int result = e && sox_add_effect(chain, e, interm_signal, out_signal) == SOX_SUCCESS
+            ? RESULT_SUCCESS : RESULT_ERROR;
+    free(e);
+    return result;
+}
+
+/* Adds the tap of a SILENCE_EFFECT spec, scanning into scanner */
+static int add_silence_tap(sox_effects_chain_t * chain, SilenceScanner * scanner, SilenceOptions const & options,
+                           sox_signalinfo_t * interm_signal, sox_signalinfo_t const * out_signal) {
+    sox_effect_t * e = silence_tap_create(scanner, options);
+    int result = e && sox_add_effect(chain, e, interm_signal, out_signal) == SOX_SUCCESS
+            ? RESULT_SUCCESS : RESULT_ERROR;
+    free(e);
+    return result;
+}
+
+/* The factor of a `tempo' stage: its first argument that is not an option */
+static double tempo_factor(EffectSpec const & spec) {
+    for (std::string const & arg : spec.args) {
+        char * end;
+        double value = strtod(arg.c_str(), &end);
+        if (arg[0] != '-' && *end == 0) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+uint64_t sox_output_samples_bound(sox_signalinfo_t const & in, sox_signalinfo_t const & out,
+                                  std::vector<EffectSpec> const & effects) {
+    if (in.length == SOX_UNKNOWN_LEN || in.channels == 0 || in.rate <= 0) {
+        return 0;
+    }
+    double frames = (double) (in.length / in.channels) * out.rate / in.rate;
+    for (EffectSpec const & spec : effects) {
+        if (spec.name == "tempo") {
+            double factor = tempo_factor(spec);
+            if (factor <= 0) {
+                return 0;
+            }
+            frames /= factor;
+        } else if (spec.name != "pitch" && spec.name != "rate" && spec.name != "reverse"
+                && spec.name != "gain" && spec.name != "fade" && spec.name != LOUDNESS_EFFECT
+                && spec.name != SPECTROGRAM_EFFECT && spec.name != SILENCE_EFFECT) {
+            return 0;
+        }
+    }
+    /* Rounding and filter delays: a percent and a second of slack */
+    return (uint64_t) (frames * 1.01 + out.rate) * out.channels;
+}
+
+int sox_render(char const * operation, char const * inPathCStr, char const * outPathCStr,
+               std::vector<EffectSpec> const & effects, RenderReport * report,
+               RenderOptions const & options) {
+    sox_format_t * in, * out; /* input and output files */
+    sox_effects_chain_t * chain;
+    sox_signalinfo_t interm_signal;
+    MappedInput mapped_in;
+    MappedOutput mapped_out;
+    LoudnessMeter loudness;   /* of a LOUDNESS_EFFECT tap in the chain */
+    bool measuring = false;
+    SilenceScanner silence;   /* of a SILENCE_EFFECT tap */
+    bool scanning = false;
+    char * args[10];
+    RenderReport local_report;
+    JobArena arena;           /* scratch memory of this job */
+    Clock::time_point start = Clock::now();
+
+    if (!report) {
+        report = &local_report;
+    }
+    *report = RenderReport();
+    report->operation = operation;
+    report->in_path = inPathCStr;
+    report->out_path = outPathCStr;
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return fail(report, "sox_init failed");
+    }
+
+    /* Open the input file (with default parameters) */
+    in = mapped_in.open(inPathCStr, options.in_signal, options.in_type);
+    if (!in) {
+        return fail(report, std::string("cannot open input: ") + inPathCStr);
+    }
+
+    interm_signal = in->signal;
+    sox_signalinfo_t out_signal = in->signal;
+    /* A `rate' effect in the chain must bring the signal to the new rate */
+    if (options.out_rate > 0) {
+        out_signal.rate = options.out_rate;
+    }
+    if (options.max_out_rate > 0 && out_signal.rate > options.max_out_rate) {
+        out_signal.rate = options.max_out_rate;
+    }
+    if (options.precision > 0) {
+        out_signal.precision = options.precision;
+    }
+
+    /* Checkpointed renders write to <out>.part (see checkpoint.h) */
+    CheckpointRun run;
+    bool checkpointed = checkpoint_run_begin(&run, outPathCStr);
+
+    /* Open the output file; we must specify the output signal characteristics.
+    * Since we are using only simple effects, they are the same as the input
+    * file characteristics */
+    uint64_t out_bound = options.map_output ? sox_output_samples_bound(in->signal, out_signal, effects) : 0;
+    out = mapped_out.open(checkpointed ? run.part_path.c_str() : outPathCStr, &out_signal,
+                          checkpointed ? "wav" : options.out_type,
+                          out_bound > 0 ? mapped_wav_bound(out_signal, out_bound) : 0);
+    if (!out) {
+        sox_close(in);
+        return fail(report, std::string("cannot open output: ") + outPathCStr);
+    }
+
+    /* Everything the output samples depend on */
+    std::string job = checkpoint_job(operation, inPathCStr, out_signal);
+    struct stat in_stat = {};
+    stat(inPathCStr, &in_stat);
+
+    /* Create an effects chain; some effects need to know about the input
+    * or output file encoding so we provide that information here */
+    chain = sox_create_effects_chain(&in->encoding, &out->encoding);
+
+    /* The first effect in the effect chain must be something that can source
+    * samples; in this case, we use the built-in handler that inputs
+    * data from an audio file */
+    args[0] = (char *)in;
+    int result = add_effect(chain, "input", 1, args, &interm_signal, &in->signal);
+    std::string error = "cannot add effect: input";
+
+    /* The effects in between, each initialised with its own options */
+    for (size_t i = 0; i < effects.size() && result == RESULT_SUCCESS; i++) {
+        EffectSpec const & spec = effects[i];
+        int argc = 0;
+        for (; argc < (int) spec.args.size() && argc < 10; argc++) {
+            args[argc] = (char *) spec.args[argc].c_str();
+        }
+        /* The DFT size is fixed when the effect starts, i.e. on adding it */
+        size_t log2DftSize = spec.name == "rate"
+                ? rate_plan_get(interm_signal.rate, out->signal.rate, pipeline_rate_quality(spec)) : 0;
+        ScopedDftSize dftSize(log2DftSize);
+        checkpoint_job_add(&job, spec, log2DftSize);
+        if (spec.name == LOUDNESS_EFFECT) {
+            result = add_loudness_tap(chain, &loudness, &interm_signal, &out->signal);
+            measuring = true;
+        } else if (spec.name == SPECTROGRAM_EFFECT) {
+            result = add_spectrogram_tap(chain, options.spectrogram, &interm_signal, &out->signal);
+        } else if (spec.name == SILENCE_EFFECT) {
+            result = add_silence_tap(chain, &silence, options.silence, &interm_signal, &out->signal);
+            scanning = true;
+        } else {
+            result = add_effect(chain, spec.name.c_str(), argc, args, &interm_signal, &out->signal);
+        }
+        error = "cannot add effect: " + spec.name;
+    }
+
+    CheckpointSink sink;
+    if (checkpointed && result == RESULT_SUCCESS) {
+        /* A resume replays the chain up to the checkpoint */
+        if (checkpoint_run_resume(&run, job, out, &mapped_out, &sink) != RESULT_SUCCESS) {
+            result = RESULT_ERROR;
+            error = "cannot resume from checkpoint";
+        } else if (sink.skip > 0 && effects.empty() && out_signal.rate == in->signal.rate && seeks_exactly(in)
+                && sox_seek(in, sink.skip, SOX_SEEK_SET) == SOX_SUCCESS) {
+            /* Plain conversion: the input sample is the output sample */
+            sink.skip = 0;
+        }
+        report->resumed_samples = run.resumed;
+    }
+
+    /* The last effect in the effect chain must be something that only consumes
+    * samples; in this case, we use the built-in handler that outputs
+    * data to an audio file */
+    if (result == RESULT_SUCCESS && checkpointed) {
+        sox_effect_t * e = checkpoint_sink_create(&sink);
+        result = e && sox_add_effect(chain, e, &interm_signal, &out->signal) == SOX_SUCCESS
+                ? RESULT_SUCCESS : RESULT_ERROR;
+        free(e);
+        error = "cannot add effect: output";
+    } else if (result == RESULT_SUCCESS) {
+        args[0] = (char *)out;
+        result = add_effect(chain, "output", 1, args, &interm_signal, &out->signal);
+        error = "cannot add effect: output";
+    }
+
+    report->in_rate = in->signal.rate;
+    report->out_rate = out->signal.rate;
+    report->channels = in->signal.channels;
+    report->threads = sox_globals.use_threads ? tuning_get().threads : 0;
+
+    if (result == RESULT_SUCCESS) {
+        report_attach_chain(report, chain, &arena);
+
+        FlowState flow;
+        MemoryWatch & memory = flow.memory;
+        memory_watch_start(&memory, options.memory_budget ? options.memory_budget : memory_budget_get());
+        flow.in = in;
+        flow.in_bytes = in->seekable ? (uint64_t) in_stat.st_size : 0;
+
+        /* Flow samples through the effects processing chain until EOF is reached */
+        Clock::time_point flow_start = Clock::now();
+        if (sox_flow_effects(chain, flow_callback, &flow) != SOX_SUCCESS || memory.exceeded
+                || job_cancelled()) {
+            result = RESULT_ERROR;
+            error = out->sox_errno ? out->sox_errstr : "sox_flow_effects failed";
+        }
+        if (job_cancelled()) {
+            error = "cancelled";
+        } else if (memory.exceeded) {
+            error = memory_error(memory);
+        }
+        report->flow_ms = ms_since(flow_start);
+        if (measuring && result == RESULT_SUCCESS) {
+            loudness_meter_finish(loudness, &report->loudness);
+        }
+        if (scanning && result == RESULT_SUCCESS) {
+            silence_scanner_finish(silence, &report->silence);
+        }
+        report->peak_rss_bytes = memory.peak;
+        report->rss_growth_bytes = memory.peak - memory.baseline;
+
+        report_detach_chain(report, chain);
+    }
+    report->input_bytes = in->tell_off;
+
+    /* All done; tidy up: */
+    sox_delete_effects_chain(chain);
+    if (mapped_out.close(out) != RESULT_SUCCESS && result == RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+        error = std::string("cannot close output: ") + outPathCStr;
+    }
+    sox_close(in);
+
+    if (checkpointed && checkpoint_run_end(&run, result) != RESULT_SUCCESS && result == RESULT_SUCCESS) {
+        result = RESULT_ERROR;
+        error = std::string("cannot rename output: ") + run.part_path;
+    }
+
+    if (result != RESULT_SUCCESS && mapped_out.full() && !job_cancelled()) {
+        /* The output outgrew its bound; stdio has none */
+        LOG_I("%s: output outgrew its mapping, rendering again through stdio", operation);
+        RenderOptions unmapped = options;
+        unmapped.map_output = false;
+        return sox_render(operation, inPathCStr, outPathCStr, effects, report, unmapped);
+    }
+
+    struct stat out_stat;
+    if (stat(outPathCStr, &out_stat) == 0) {
+        report->output_bytes = out_stat.st_size;
+    }
+    report->total_ms = ms_since(start);
+
+    if (result != RESULT_SUCCESS) {
+        return fail(report, error);
+    }
+
+    report->result = RESULT_SUCCESS;
+    return RESULT_SUCCESS;
+}
+
+static int LSX_API buffer_source_drain(sox_effect_t * effp, sox_sample_t * obuf, size_t * osamp) {
+    BufferSource * source = *(BufferSource **) effp->priv;
+    std::vector<sox_sample_t> const & samples = source->buffer->samples;
+    size_t len = *osamp - *osamp % effp->out_signal.channels;
+    len = std::min(len, samples.size() - source->position);
+    memcpy(obuf, samples.data() + source->position, len * sizeof(sox_sample_t));
+    source->position += len;
+    *osamp = len;
+    return len > 0 ? SOX_SUCCESS : SOX_EOF;
+}
+
+static int LSX_API buffer_sink_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * /* obuf */,
+                                    size_t * isamp, size_t * osamp) {
+    AudioBuffer * sink = *(AudioBuffer **) effp->priv;
+    sink->samples.insert(sink->samples.end(), ibuf, ibuf + *isamp);
+    *osamp = 0;
+    return SOX_SUCCESS;
+}
+
+static sox_effect_t * buffer_effect_create(sox_effect_handler_t const * handler, void * state) {
+    sox_effect_t * e = sox_create_effect(handler);
+    if (e) {
+        *(void **) e->priv = state;
+    }
+    return e;
+}
+
+int sox_render_buffer(char const * operation, AudioBuffer const & in, std::vector<EffectSpec> const & effects,
+                      AudioBuffer * out, RenderReport * report, RenderOptions const & options) {
+    static sox_effect_handler_t const source_handler = {
+            "input", NULL, SOX_EFF_MCHAN, NULL, NULL, NULL, buffer_source_drain, NULL, NULL,
+            sizeof(BufferSource *)
+    };
+    static sox_effect_handler_t const sink_handler = {
+            "output", NULL, SOX_EFF_MCHAN, NULL, NULL, buffer_sink_flow, NULL, NULL, NULL,
+            sizeof(AudioBuffer *)
+    };
+    RenderReport local_report;
+    JobArena arena;
+    Clock::time_point start = Clock::now();
+    char * args[10];
+
+    if (!report) {
+        report = &local_report;
+    }
+    *report = RenderReport();
+    report->operation = operation;
+    report->in_path = "memory";
+    report->out_path = "memory";
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return fail(report, "sox_init failed");
+    }
+
+    sox_signalinfo_t in_signal = in.signal;
+    in_signal.length = in.samples.size();
+    sox_signalinfo_t interm_signal = in_signal;
+    out->signal = in_signal;
+    out->signal.length = SOX_UNKNOWN_LEN;
+    if (options.out_rate > 0) {
+        out->signal.rate = options.out_rate;
+    }
+    if (options.max_out_rate > 0 && out->signal.rate > options.max_out_rate) {
+        out->signal.rate = options.max_out_rate;
+    }
+    out->samples.clear();
+
+    /* As for a 32-bit raw file: the effects read the precision from the signal */
+    sox_encodinginfo_t encoding = {};
+    encoding.encoding = SOX_ENCODING_SIGN2;
+    encoding.bits_per_sample = 32;
+    sox_effects_chain_t * chain = sox_create_effects_chain(&encoding, &encoding);
+
+    LoudnessMeter loudness;
+    bool measuring = false;
+    BufferSource source;
+    source.buffer = &in;
+    sox_effect_t * e = buffer_effect_create(&source_handler, &source);
+    int result = e && sox_add_effect(chain, e, &interm_signal, &in_signal) == SOX_SUCCESS
+            ? RESULT_SUCCESS : RESULT_ERROR;
+    free(e);
+    std::string error = "cannot add effect: input";
+
+    for (size_t i = 0; i < effects.size() && result == RESULT_SUCCESS; i++) {
+        EffectSpec const & spec = effects[i];
+        int argc = 0;
+        for (; argc < (int) spec.args.size() && argc < 10; argc++) {
+            args[argc] = (char *) spec.args[argc].c_str();
+        }
+        ScopedDftSize dftSize(spec.name == "rate"
+                ? rate_plan_get(interm_signal.rate, out->signal.rate, pipeline_rate_quality(spec)) : 0);
+        if (spec.name == LOUDNESS_EFFECT) {
+            result = add_loudness_tap(chain, &loudness, &interm_signal, &out->signal);
+            measuring = true;
+        } else if (spec.name == SPECTROGRAM_EFFECT) {
+            result = add_spectrogram_tap(chain, options.spectrogram, &interm_signal, &out->signal);
+        } else {
+            result = add_effect(chain, spec.name.c_str(), argc, args, &interm_signal, &out->signal);
+        }
+        error = "cannot add effect: " + spec.name;
+    }
+    if (result == RESULT_SUCCESS) {
+        e = buffer_effect_create(&sink_handler, out);
+        result = e && sox_add_effect(chain, e, &interm_signal, &out->signal) == SOX_SUCCESS
+                ? RESULT_SUCCESS : RESULT_ERROR;
+        free(e);
+        error = "cannot add effect: output";
+    }
+
+    report->in_rate = in_signal.rate;
+    report->out_rate = out->signal.rate;
+    report->channels = in_signal.channels;
+    report->threads = sox_globals.use_threads ? tuning_get().threads : 0;
+
+    if (result == RESULT_SUCCESS) {
+        report_attach_chain(report, chain, &arena);
+        FlowState flow;
+        memory_watch_start(&flow.memory, options.memory_budget ? options.memory_budget : memory_budget_get());
+        flow.source = &source;
+        Clock::time_point flow_start = Clock::now();
+        if (sox_flow_effects(chain, flow_callback, &flow) != SOX_SUCCESS || flow.memory.exceeded
+                || job_cancelled()) {
+            result = RESULT_ERROR;
+            error = job_cancelled() ? "cancelled"
+                    : flow.memory.exceeded ? memory_error(flow.memory) : "sox_flow_effects failed";
+        }
+        report->flow_ms = ms_since(flow_start);
+        if (measuring && result == RESULT_SUCCESS) {
+            loudness_meter_finish(loudness, &report->loudness);
+        }
+        report_detach_chain(report, chain);
+    }
+    sox_delete_effects_chain(chain);
+
+    out->signal.length = out->samples.size();
+    report->input_bytes = in.samples.size() * sizeof(sox_sample_t);
+    report->output_bytes = out->samples.size() * sizeof(sox_sample_t);
+    report->total_ms = ms_since(start);
+    if (result != RESULT_SUCCESS) {
+        out->samples.clear();
+        return fail(report, error);
+    }
+    report->result = RESULT_SUCCESS;
+    return RESULT_SUCCESS;
+}
+
+int sox_decode_buffer(char const * inPathCStr, AudioBuffer * out, RenderReport * report,
+                      DecodeOptions const & options) {
+    RenderReport local_report;
+    Clock::time_point start = Clock::now();
+    if (!report) {
+        report = &local_report;
+    }
+    *report = RenderReport();
+    report->operation = "decode";
+    report->in_path = inPathCStr;
+    report->out_path = "memory";
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return fail(report, "sox_init failed");
+    }
+    /* A WAV is read from a mapping */
+    MappedInput mapped_in;
+    sox_format_t * in = mapped_in.open(inPathCStr);
+    if (!in) {
+        return fail(report, std::string("cannot open input: ") + inPathCStr);
+    }
+    out->signal = in->signal;
+    out->samples.clear();
+    if (in->signal.length != SOX_UNKNOWN_LEN) {
+        out->samples.reserve(in->signal.length);
+    }
+    struct stat in_stat;
+    uint64_t inBytes = in->seekable && stat(inPathCStr, &in_stat) == 0 ? (uint64_t) in_stat.st_size : 0;
+    size_t blockSamples = sox_globals.bufsiz - sox_globals.bufsiz % in->signal.channels;
+    LoudnessMeter loudness;
+    if (options.measure_loudness) {
+        loudness_meter_init(&loudness, in->signal.rate, in->signal.channels);
+    }
+    SilenceScanner silence;
+    bool scanning = options.scan_silence || options.trim_silence;
+    if (scanning) {
+        silence_scanner_init(&silence, in->signal.rate, in->signal.channels, options.silence);
+    }
+    bool leading = options.trim_silence;   /* no audio heard yet */
+    uint64_t dropped = 0;                  /* frames of leading silence */
+    MemoryWatch memory;
+    memory_watch_start(&memory, memory_budget_get());
+    for (;;) {
+        size_t size = out->samples.size();
+        out->samples.resize(size + blockSamples);
+        size_t got = sox_read(in, out->samples.data() + size, blockSamples);
+        out->samples.resize(size + got);
+        if (options.measure_loudness) {
+            loudness_meter_add(&loudness, out->samples.data() + size, got);
+        }
+        if (scanning) {
+            silence_scanner_add(&silence, out->samples.data() + size, got);
+        }
+        if (leading) {
+            /* Up to the block the audio starts in, the buffer holds a
+             * block or so, so the drops move next to nothing */
+            uint64_t lead = silence_scanner_lead(silence);
+            out->samples.erase(out->samples.begin(),
+                               out->samples.begin() + (size_t) ((lead - dropped) * in->signal.channels));
+            dropped = lead;
+            leading = !silence.heard;
+        }
+        if (got == 0 || job_cancelled() || !memory_watch_check(&memory)) {
+            break;
+        }
+        if (inBytes > 0) {
+            job_report_progress((double) in->tell_off / inBytes);
+        }
+        job_yield();
+    }
+    out->signal.length = out->samples.size();
+    report->in_rate = in->signal.rate;
+    report->out_rate = in->signal.rate;
+    report->channels = in->signal.channels;
+    report->input_bytes = in->tell_off;
+    report->output_bytes = out->samples.size() * sizeof(sox_sample_t);
+    std::string error = job_cancelled() ? "cancelled"
+            : memory.exceeded ? memory_error(memory)
+            : in->sox_errno ? std::string("cannot read input: ") + in->sox_errstr : "";
+    sox_close(in);
+    report->total_ms = ms_since(start);
+    if (!error.empty()) {
+        out->samples.clear();
+        return fail(report, error);
+    }
+    if (options.measure_loudness) {
+        loudness_meter_finish(loudness, &report->loudness);
+    }
+    if (scanning) {
+        silence_scanner_finish(silence, &report->silence);
+    }
+    if (options.trim_silence) {
+        SilenceReport const & trim = report->silence;
+        unsigned channels = out->signal.channels;
+        out->samples.erase(out->samples.begin(),
+                           out->samples.begin() + (size_t) ((trim.lead_frames - dropped) * channels));
+        out->samples.resize(out->samples.size() - (size_t) (trim.trail_frames * channels));
+        out->signal.length = out->samples.size();
+        report->output_bytes = out->samples.size() * sizeof(sox_sample_t);
+        report->silence.trimmed = true;
+        LOG_I("decode: trimmed %.2f s of leading and %.2f s of trailing silence",
+              trim.lead_frames / out->signal.rate, trim.trail_frames / out->signal.rate);
+    }
+    out->samples.shrink_to_fit();
+    report->result = RESULT_SUCCESS;
+    return RESULT_SUCCESS;
+}
+
+int sox_write_buffer(AudioBuffer const & in, char const * outPathCStr, RenderReport * report, unsigned precision) {
+    RenderReport local_report;
+    Clock::time_point start = Clock::now();
+    if (!report) {
+        report = &local_report;
+    }
+    *report = RenderReport();
+    report->operation = "write";
+    report->in_path = "memory";
+    report->out_path = outPathCStr;
+
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return fail(report, "sox_init failed");
+    }
+    sox_signalinfo_t signal = in.signal;
+    signal.length = in.samples.size();
+    if (precision) {
+        signal.precision = precision;
+    }
+    MappedOutput mapped;
+    sox_format_t * out = mapped.open(outPathCStr, &signal, NULL, mapped_wav_bound(signal, signal.length));
+    if (!out) {
+        return fail(report, std::string("cannot open output: ") + outPathCStr);
+    }
+    size_t written = sox_write(out, in.samples.data(), in.samples.size());
+    std::string error = written == in.samples.size() ? ""
+            : out->sox_errno ? out->sox_errstr : "write failed";
+    if (mapped.close(out) != RESULT_SUCCESS && error.empty()) {
+        error = std::string("cannot close output: ") + outPathCStr;
+    }
+    struct stat out_stat;
+    if (stat(outPathCStr, &out_stat) == 0) {
+        report->output_bytes = out_stat.st_size;
+    }
+    report->in_rate = signal.rate;
+    report->out_rate = signal.rate;
+    report->channels = signal.channels;
+    report->total_ms = ms_since(start);
+    if (!error.empty()) {
+        remove(outPathCStr);
+        return fail(report, error);
+    }
+    report->result = RESULT_SUCCESS;
+    return RESULT_SUCCESS;
+}
+
+/* Canonical description of a render for the cache key: everything the
+ * output depends on apart from the input's content */
+static std::string describe_chain(char const * operation, std::vector<EffectSpec> const & effects,
+                                  RenderOptions const & options) {
+    std::string chain = operation;
+    for (EffectSpec const & spec : effects) {
+        chain += "|" + spec.name;
+        for (std::string const & arg : spec.args) {
+            chain += " " + arg;
+        }
+    }
+    chain += "|out_rate " + pipeline_format(options.out_rate);
+    chain += "|max_out_rate " + pipeline_format(options.max_out_rate);
+    return chain;
+}
+
+/* Runs render() unless the render cache already has the output of the
+ * same chain applied to the same audio (see render-cache.h); WAV outputs
+ * only, the intermediates of a project. render() puts the taps at the end
+ * of its chain: the output is measured on its way to disk, and the
+ * statistics are kept for the file and for the key, which sox_normalize()
+ * of the output then finds */
+static int cached_render(char const * operation, char const * inPathCStr, char const * outPathCStr,
+                         std::vector<EffectSpec> const & effects, RenderOptions const & options,
+                         RenderReport * report,
+                         std::function<int(RenderReport *, std::vector<EffectSpec> const &)> const & render) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    std::string key;
+    if (render_cache_enabled() && is_wav_path(outPathCStr) && !options.in_type && !options.out_type) {
+        Clock::time_point start = Clock::now();
+        key = render_cache_key(inPathCStr, describe_chain(operation, effects, options));
+        if (!key.empty() && render_cache_fetch(key, outPathCStr) == RESULT_SUCCESS) {
+            *report = RenderReport();
+            report->operation = operation;
+            report->in_path = inPathCStr;
+            report->out_path = outPathCStr;
+            report->cache_hit = true;
+            struct stat out_stat;
+            if (stat(outPathCStr, &out_stat) == 0) {
+                report->output_bytes = out_stat.st_size;
+            }
+            report->total_ms = ms_since(start);
+            report->result = RESULT_SUCCESS;
+            if (render_cache_get_loudness(key, &report->loudness)) {
+                render_cache_put_file_loudness(outPathCStr, report->loudness);
+            }
+            LOG_I("%s: served from the render cache", operation);
+            return RESULT_SUCCESS;
+        }
+    }
+
+    if (!key.empty()) {
+        /* The old output may be linked to a read-only cache entry */
+        remove(outPathCStr);
+    }
+    int result = render(report, {Loudness().spec()});
+    if (result == RESULT_SUCCESS && !key.empty()) {
+        render_cache_store(key, outPathCStr);
+        render_cache_put_loudness(key, report->loudness);
+    }
+    if (result == RESULT_SUCCESS) {
+        render_cache_put_file_loudness(outPathCStr, report->loudness);
+    }
+    return result;
+}
+
+/* MP3 and FLAC imports are decoded on all cores when the stream can be
+ * split (see mp3-parallel.h and flac-parallel.h); anything else goes
+ * through the serial chain */
+static int convert_parallel(char const * inPathCStr, char const * outPathCStr, RenderReport * report,
+                            DecodeObserver const & observer = nullptr, unsigned precision = 0) {
+    unsigned threads = parallel_decode_threads();
+    if (threads < 2 || !is_wav_path(outPathCStr)) {
+        return RESULT_ERROR;
+    }
+    if (has_extension(inPathCStr, ".mp3")) {
+        return mp3_convert_parallel(inPathCStr, outPathCStr, MP3_CHUNK_SECONDS, threads, report,
+                                    observer, precision);
+    }
+    if (has_extension(inPathCStr, ".flac")) {
+        return flac_convert_parallel(inPathCStr, outPathCStr, FLAC_CHUNK_SECONDS, threads, report,
+                                     observer, precision);
+    }
+    return RESULT_ERROR;
+}
+
+int sox_convert(char* inPathCStr, char* outPathCStr, RenderReport * report) {
+    int result = cached_render("convert", inPathCStr, outPathCStr, {}, RenderOptions(), report,
+                               [&](RenderReport * r, std::vector<EffectSpec> const & /* taps */) {
+        /* An import measures as it decodes, on all cores where it can */
+        DecodeOptions options;
+        options.measure_loudness = true;
+        int converted = sox_import(inPathCStr, outPathCStr, r, options);
+        r->operation = "convert";
+        return converted;
+    });
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Convert done: %s; %s", inPathCStr, outPathCStr);
+    }
+    return result;
+}
+
+/* Decodes the import on all cores with the measurements of options taken
+ * by an observer of the samples, as the taps of the serial chain would */
+static int import_parallel(char const * inPathCStr, char const * outPathCStr, RenderReport * report,
+                           DecodeOptions const & options, unsigned precision) {
+    if (parallel_decode_threads() < 2
+            || !(has_extension(inPathCStr, ".mp3") || has_extension(inPathCStr, ".flac"))) {
+        return RESULT_ERROR;
+    }
+    sox_format_t * in = sox_open_read(inPathCStr, NULL, NULL, NULL);
+    if (!in) {
+        return RESULT_ERROR;
+    }
+    sox_signalinfo_t signal = in->signal;
+    sox_close(in);
+
+    LoudnessMeter loudness;
+    SilenceScanner silence;
+    bool scanning = options.scan_silence || options.trim_silence;
+    if ((options.measure_loudness && loudness_meter_init(&loudness, signal.rate, signal.channels) != RESULT_SUCCESS)
+            || (scanning && silence_scanner_init(&silence, signal.rate, signal.channels, options.silence)
+                    != RESULT_SUCCESS)) {
+        return RESULT_ERROR;
+    }
+    DecodeObserver observer = [&](sox_sample_t const * samples, size_t count) {
+        if (options.measure_loudness) {
+            loudness_meter_add(&loudness, samples, count);
+        }
+        if (scanning) {
+            silence_scanner_add(&silence, samples, count);
+        }
+    };
+    if (convert_parallel(inPathCStr, outPathCStr, report, observer, precision) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    if (options.measure_loudness) {
+        loudness_meter_finish(loudness, &report->loudness);
+    }
+    if (scanning) {
+        silence_scanner_finish(silence, &report->silence);
+    }
+    return RESULT_SUCCESS;
+}
+
+int sox_import(char const * inPathCStr, char const * outPathCStr, RenderReport * report,
+               DecodeOptions const & options, unsigned precision) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    /* A trim reads the decode from a WAV next to the output */
+    std::string decoded = options.trim_silence ? std::string(outPathCStr) + ".decoded.wav" : outPathCStr;
+    int result = import_parallel(inPathCStr, decoded.c_str(), report, options, precision);
+    if (result != RESULT_SUCCESS && !job_cancelled()) {
+        std::vector<EffectSpec> taps;
+        if (options.measure_loudness) {
+            taps.push_back({LOUDNESS_EFFECT, {}});
+        }
+        if (options.scan_silence || options.trim_silence) {
+            taps.push_back({SILENCE_EFFECT, {}});
+        }
+        RenderOptions render;
+        render.precision = precision;
+        render.silence = options.silence;
+        result = sox_render("import", inPathCStr, decoded.c_str(), taps, report, render);
+    }
+    if (result != RESULT_SUCCESS || !options.trim_silence) {
+        if (result == RESULT_SUCCESS && options.measure_loudness) {
+            render_cache_put_file_loudness(outPathCStr, report->loudness);
+        }
+        return result;
+    }
+
+    LoudnessReport loudness = report->loudness;
+    SilenceReport silence = report->silence;
+    if (silence.lead_frames == 0 && silence.trail_frames == 0) {
+        result = rename(decoded.c_str(), outPathCStr) == 0 ? RESULT_SUCCESS
+                : fail(report, std::string("cannot rename output: ") + decoded);
+        report->silence.trimmed = result == RESULT_SUCCESS;
+    } else {
+        /* From the first frame kept to the first one dropped at the end */
+        std::vector<EffectSpec> trim = {{"trim", {std::to_string(silence.lead_frames) + "s",
+                                                  "=" + std::to_string(silence.frames - silence.trail_frames) + "s"}}};
+        result = sox_render("trim", decoded.c_str(), outPathCStr, trim, report);
+        remove(decoded.c_str());
+        report->in_path = inPathCStr;
+        report->loudness = loudness;
+        report->silence = silence;
+        report->silence.trimmed = result == RESULT_SUCCESS;
+        if (result == RESULT_SUCCESS) {
+            LOG_I("import: trimmed %.2f s of leading and %.2f s of trailing silence",
+                  silence.lead_frames / report->out_rate, silence.trail_frames / report->out_rate);
+        }
+    }
+    /* Only silence was cut, which the gates of the measurement ignore */
+    if (result == RESULT_SUCCESS && options.measure_loudness) {
+        render_cache_put_file_loudness(outPathCStr, loudness);
+    }
+    return result;
+}
+
+RateOptions rate_options_default() {
+    RateOptions options;
+    if (strchr("qlmhv", tuning_get().rate_quality)) {
+        options.quality = (RateQuality) tuning_get().rate_quality;
+    }
+    return options;
+}
+
+/* Drafts first drop to DRAFT_MAX_RATE with the quick resampler, so every
+ * later stage has fewer samples to process, and are written at that rate */
+static RenderOptions draft_options() {
+    RenderOptions options;
+    options.max_out_rate = DRAFT_MAX_RATE;
+    return options;
+}
+
+int sox_effect_chain(char const * operation, double value, RenderMode mode,
+                     std::vector<EffectSpec> * chain, RenderOptions * options) {
+    bool draft = mode == RENDER_DRAFT;
+    *options = draft ? draft_options() : RenderOptions();
+    chain->clear();
+    if (draft && strcmp(operation, "reverse") != 0) {
+        chain->push_back(Rate{{RATE_QUICK}}.spec());
+    }
+    if (strcmp(operation, "tempo") == 0) {
+        chain->push_back(Tempo{value, draft}.spec());
+    } else if (strcmp(operation, "pitch") == 0) {
+        chain->push_back(Pitch{value, draft}.spec());
+        chain->push_back(Rate{draft ? RateOptions{RATE_QUICK} : rate_options_default()}.spec());
+    } else if (strcmp(operation, "reverse") == 0) {
+        *options = RenderOptions();
+        chain->push_back({"reverse", {}});
+    } else {
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+int sox_render_effect(char const * operation, double value, RenderMode mode, char const * inPathCStr,
+                      char const * outPathCStr, std::vector<EffectSpec> const & taps, RenderReport * report,
+                      RenderOptions const & options) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    bool draft = mode == RENDER_DRAFT;
+    std::string name = std::string(operation) + (draft ? "-draft" : "");
+    char const * op = name.c_str();
+    /* The chains of sox_effect_chain(), typed */
+    if (strcmp(operation, "tempo") == 0) {
+        return draft ? run_pipeline(op, inPathCStr, outPathCStr, report, options, taps,
+                                    Rate{{RATE_QUICK}}, Tempo{value, true})
+                     : run_pipeline(op, inPathCStr, outPathCStr, report, options, taps, Tempo{value});
+    }
+    if (strcmp(operation, "pitch") == 0) {
+        return draft ? run_pipeline(op, inPathCStr, outPathCStr, report, options, taps,
+                                    Rate{{RATE_QUICK}}, Pitch{value, true}, Rate{{RATE_QUICK}})
+                     : run_pipeline(op, inPathCStr, outPathCStr, report, options, taps,
+                                    Pitch{value}, Rate{rate_options_default()});
+    }
+    std::vector<EffectSpec> chain;
+    RenderOptions chainOptions;
+    if (sox_effect_chain(operation, value, mode, &chain, &chainOptions) != RESULT_SUCCESS) {
+        report->operation = name;
+        return fail(report, "unknown effect");
+    }
+    chain.insert(chain.end(), taps.begin(), taps.end());
+    return sox_render(op, inPathCStr, outPathCStr, chain, report, options);
+}
+
+int sox_tempo(char* inPathCStr, char* outPathCStr, char* tempoCStr, RenderReport * report,
+              RenderMode mode) {
+    std::vector<EffectSpec> chain;
+    RenderOptions options;
+    sox_effect_chain("tempo", atof(tempoCStr), mode, &chain, &options);
+    int result = cached_render(mode == RENDER_DRAFT ? "tempo-draft" : "tempo", inPathCStr, outPathCStr,
+                               chain, options, report, [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+        return sox_render_effect("tempo", atof(tempoCStr), mode, inPathCStr, outPathCStr, taps, r, options);
+    });
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Tempo done: %s", tempoCStr);
+    }
+    return result;
+}
+
+int sox_pitch(char* inPathCStr, char* outPathCStr, char* pitchCStr, RenderReport * report,
+              RenderMode mode, RateOptions const * rate) {
+    /* `pitch' changes the sample rate, so `rate' brings it back to the
+     * output file's rate */
+    int result;
+    if (mode == RENDER_DRAFT || !rate) {
+        std::vector<EffectSpec> chain;
+        RenderOptions options;
+        sox_effect_chain("pitch", atof(pitchCStr), mode, &chain, &options);
+        result = cached_render(mode == RENDER_DRAFT ? "pitch-draft" : "pitch", inPathCStr, outPathCStr,
+                               chain, options, report, [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+            return sox_render_effect("pitch", atof(pitchCStr), mode, inPathCStr, outPathCStr, taps, r, options);
+        });
+    } else {
+        Pitch pitch{atof(pitchCStr)};
+        Rate resample{*rate};
+        result = cached_render("pitch", inPathCStr, outPathCStr, {pitch.spec(), resample.spec()}, RenderOptions(),
+                               report, [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+            return run_pipeline("pitch", inPathCStr, outPathCStr, r, RenderOptions(), taps, pitch, resample);
+        });
+    }
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Pitch done: %s", pitchCStr);
+    }
+    return result;
+}
+
+int sox_resample(char const * inPathCStr, char const * outPathCStr, double outRate,
+                 RateOptions const * rate, RenderReport * report) {
+    RenderOptions options;
+    options.out_rate = outRate;
+    Rate resample{rate ? *rate : rate_options_default()};
+    int result = cached_render("resample", inPathCStr, outPathCStr, {resample.spec()}, options, report,
+                               [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+        return run_pipeline("resample", inPathCStr, outPathCStr, r, options, taps, resample);
+    });
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Resample done: %g", outRate);
+    }
+    return result;
+}
+
+int sox_reverse(char* inPathCStr, char* outPathCStr, RenderReport * report) {
+    /* `reverse' spools its input to a temporary file under TMP_PATH */
+    std::vector<EffectSpec> chain = {{"reverse", {}}};
+    int result = cached_render("reverse", inPathCStr, outPathCStr, chain, RenderOptions(), report,
+                               [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+        std::vector<EffectSpec> measured = chain;
+        measured.insert(measured.end(), taps.begin(), taps.end());
+        return sox_render("reverse", inPathCStr, outPathCStr, measured, r);
+    });
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Reverse done");
+    }
+    return result;
+}
+
+int sox_gain_fade(char const * inPathCStr, char const * outPathCStr, double gainDb,
+                  double fadeInSeconds, double fadeOutSeconds, RenderReport * report) {
+    Gain gain{gainDb};
+    Fade fade{fadeInSeconds, fadeOutSeconds};
+    bool fades = fadeInSeconds > 0 || fadeOutSeconds > 0;
+    std::vector<EffectSpec> chain = {gain.spec()};
+    if (fades) {
+        chain.push_back(fade.spec());
+    }
+    int result = cached_render("gain", inPathCStr, outPathCStr, chain, RenderOptions(), report,
+                               [&](RenderReport * r, std::vector<EffectSpec> const & taps) {
+        return fades ? run_pipeline("gain", inPathCStr, outPathCStr, r, RenderOptions(), taps, gain, fade)
+                     : run_pipeline("gain", inPathCStr, outPathCStr, r, RenderOptions(), taps, gain);
+    });
+    if (result == RESULT_SUCCESS) {
+        LOG_E("Gain done: %g", gainDb);
+    }
+    return result;
+}
+
+/* Statistics of a file as a whole, whatever chain made it */
+static std::string file_loudness_key(char const * path) {
+    std::string digest = render_cache_digest(path);
+    return digest.empty() ? "" : render_cache_chain_key(digest, LOUDNESS_EFFECT);
+}
+
+int sox_analyse_loudness(char const * inPathCStr, RenderReport * report) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    RenderOptions options;
+    options.out_type = "null";
+    if (sox_render("loudness", inPathCStr, "-", {{LOUDNESS_EFFECT, {}}}, report, options) != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+    render_cache_put_loudness(file_loudness_key(inPathCStr), report->loudness);
+    return RESULT_SUCCESS;
+}
+
+int sox_normalize(char const * inPathCStr, char const * outPathCStr, double targetLufs,
+                  RenderReport * report) {
+    RenderReport local_report;
+    if (!report) {
+        report = &local_report;
+    }
+    /* Measured by the render that wrote the file, or analysed as a whole */
+    LoudnessReport loudness;
+    if (!render_cache_get_file_loudness(inPathCStr, &loudness)
+            && !render_cache_get_loudness(file_loudness_key(inPathCStr), &loudness)) {
+        *report = RenderReport();
+        report->operation = "normalize";
+        report->in_path = inPathCStr;
+        report->out_path = outPathCStr;
+        return fail(report, std::string("no loudness statistics of ") + inPathCStr);
+    }
+    Gain gain{loudness_gain_db(loudness, targetLufs)};
+    int result = cached_render("normalize", inPathCStr, outPathCStr, {gain.spec()}, RenderOptions(), report,
+                               [&](RenderReport * r, std::vector<EffectSpec> const & /* taps: known */) {
+        return run_pipeline("normalize", inPathCStr, outPathCStr, r, RenderOptions(), {}, gain);
+    });
+    if (result == RESULT_SUCCESS) {
+        report->loudness = loudness_after_gain(loudness, gain.db);
+        render_cache_put_file_loudness(outPathCStr, report->loudness);
+        LOG_E("Normalize done: %+.2f dB", gain.db);
+    }
+    return result;
+}
@@ -0,0 +1,191 @@
+#ifndef SOXTEST_SOX_OPS_H
+#define SOXTEST_SOX_OPS_H
+
+#include <string>
+#include <vector>
+#include "render-report.h"
+
+#define RESULT_SUCCESS 0
+#define RESULT_ERROR -1
+
+/* Initialises libSoX once per process and applies the current tuning
+ * (see sox-tuning.h); called by every render */
+int sox_runtime_init();
+
+/* One effect between "input" and "output", with its command-line options */
+struct EffectSpec {
+    std::string name;
+    std::vector<std::string> args;
+};
+
+/* Full quality for renders that end up in an export; draft trades quality
+ * for speed and is meant for previews only */
+enum RenderMode {
+    RENDER_FULL,
+    RENDER_DRAFT
+};
+
+/* Draft renders run and write at no more than this rate */
+#define DRAFT_MAX_RATE 22050
+
+struct Spectrogram;
+
+struct RenderOptions {
+    double out_rate = 0;      /* output rate, 0 for the input's         */
+    double max_out_rate = 0;  /* cap on the output rate, 0 for none     */
+    /* File types overriding the extensions, e.g. "null" to render from a
+     * `synth' source or to nowhere; a null input needs in_signal */
+    char const * in_type = NULL;
+    char const * out_type = NULL;
+    sox_signalinfo_t const * in_signal = NULL;
+    uint64_t memory_budget = 0; /* bytes, 0 for memory_budget_get()    */
+    bool map_output = true;     /* false writes WAVs through stdio     */
+    unsigned precision = 0;     /* bits of the output, 0 for the input's */
+    SilenceOptions silence;     /* of a SILENCE_EFFECT in the chain    */
+    /* Filled by a SPECTROGRAM_EFFECT in the chain (see spectrogram.h);
+     * left alone when the render cache serves the output */
+    Spectrogram * spectrogram = NULL;
+};
+
+/* Quality tiers of the `rate' effect (its -q, -l, -m, -h and -v options) */
+enum RateQuality {
+    RATE_QUICK = 'q',
+    RATE_LOW = 'l',
+    RATE_MEDIUM = 'm',
+    RATE_HIGH = 'h',
+    RATE_VERY_HIGH = 'v'
+};
+
+enum RatePhase {
+    RATE_PHASE_LINEAR,        /* -L, libSoX's default */
+    RATE_PHASE_INTERMEDIATE,  /* -I */
+    RATE_PHASE_MINIMUM        /* -M */
+};
+
+/* Options of a `rate' stage. As in libSoX, phase, bandwidth and aliasing
+ * only apply to the medium, high and very high tiers */
+struct RateOptions {
+    RateQuality quality = RATE_MEDIUM;
+    RatePhase phase = RATE_PHASE_LINEAR;
+    double bandwidth = 0;         /* -b: % of Nyquist kept, 0 for the tier's default */
+    bool allow_aliasing = false;  /* -a */
+};
+
+/* Medium quality unless the device tuning says otherwise (see sox-tuning.h) */
+RateOptions rate_options_default();
+
+/* Bound on the samples (all channels) the effects make of an input with
+ * signal in at the rate and channels of out; 0 if the input's length is
+ * not known or an effect may lengthen it by more than can be told from its
+ * options. Pre-sizes mapped WAV outputs (see mapped-io.h) */
+uint64_t sox_output_samples_bound(sox_signalinfo_t const & in, sox_signalinfo_t const & out,
+                                  std::vector<EffectSpec> const & effects);
+
+/* Opens inPath, runs it through the effects and writes outPath with the
+ * input's signal characteristics (as changed by the effects). When report
+ * is given it receives the timing and throughput telemetry of the render.
+ * WAV inputs and outputs go through memory mappings (mapped-io.h).
+ * A LOUDNESS_EFFECT spec (one per chain) measures the loudness of the
+ * signal at its place into report->loudness, see loudness.h, and a
+ * SILENCE_EFFECT spec scans it into report->silence, see silence.h */
+int sox_render(char const * operation, char const * inPathCStr, char const * outPathCStr,
+               std::vector<EffectSpec> const & effects, RenderReport * report,
+               RenderOptions const & options = RenderOptions());
+
+/* Decoded audio held in memory: interleaved samples with the rate,
+ * channels and precision of signal (whose length is samples.size()) */
+struct AudioBuffer {
+    sox_signalinfo_t signal = {};
+    std::vector<sox_sample_t> samples;
+};
+
+/* Decoded audio wherever it is held, e.g. in an AudioBuffer or in a mapped
+ * WAV (MappedAudio, mapped-io.h): count interleaved samples */
+struct AudioView {
+    sox_signalinfo_t signal = {};
+    sox_sample_t const * samples = NULL;
+    size_t count = 0;
+};
+
+inline AudioView audio_view(AudioBuffer const & buffer) {
+    AudioView view;
+    view.signal = buffer.signal;
+    view.samples = buffer.samples.data();
+    view.count = buffer.samples.size();
+    return view;
+}
+
+/* sox_render() from and to memory: the chain reads in and appends to out
+ * through buffer effects in place of "input" and "output". The memory
+ * budget applies to the whole render, out included: a buffer render is
+ * for what fits in memory */
+int sox_render_buffer(char const * operation, AudioBuffer const & in, std::vector<EffectSpec> const & effects,
+                      AudioBuffer * out, RenderReport * report, RenderOptions const & options = RenderOptions());
+/* What an import does on the way in besides decoding */
+struct DecodeOptions {
+    bool measure_loudness = false;  /* into report->loudness            */
+    bool scan_silence = false;      /* into report->silence, silence.h  */
+    bool trim_silence = false;      /* drop the leading and trailing
+                                     * silence; scans too              */
+    SilenceOptions silence;
+};
+
+/* Decodes a file into memory and writes a buffer out in the format of the
+ * path's extension. A trimmed decode keeps nothing of the leading silence
+ * past the scan (it is dropped block by block, not copied out at the
+ * end), so the buffer and every effect after it start at the audio;
+ * loudness is measured on the whole decode. WAVs are read from a mapping
+ * and written to one (mapped-io.h); a decode is held to the memory budget
+ * as sox_render_buffer() is */
+int sox_decode_buffer(char const * inPathCStr, AudioBuffer * out, RenderReport * report = NULL,
+                      DecodeOptions const & options = DecodeOptions());
+/* Decodes an import to the WAV at outPathCStr with precision bits (0 for
+ * the input's), measuring on the way. MP3 and FLAC are decoded on all
+ * cores where the stream splits; anything else goes through sox_render()
+ * with its checkpoints. A trim is a second pass, over the decoded WAV,
+ * once the scan knows where the audio ends */
+int sox_import(char const * inPathCStr, char const * outPathCStr, RenderReport * report = NULL,
+               DecodeOptions const & options = DecodeOptions(), unsigned precision = 0);
+/* Writes the buffer at the precision of its signal, or at precision bits
+ * (32 keeps every sample as it is) */
+int sox_write_buffer(AudioBuffer const & in, char const * outPathCStr, RenderReport * report = NULL,
+                     unsigned precision = 0);
+
+/* The chain and options of sox_tempo(), sox_pitch() ("value" is the
+ * factor or the cents) and sox_reverse() */
+int sox_effect_chain(char const * operation, double value, RenderMode mode,
+                     std::vector<EffectSpec> * chain, RenderOptions * options);
+/* Renders that chain, with taps (e.g. LOUDNESS_EFFECT) after it, through
+ * the fused pipeline where there is one (see pipeline.h); options as from
+ * sox_effect_chain(), the report named "<operation>[-draft]" */
+int sox_render_effect(char const * operation, double value, RenderMode mode, char const * inPathCStr,
+                      char const * outPathCStr, std::vector<EffectSpec> const & taps, RenderReport * report,
+                      RenderOptions const & options);
+
+int sox_convert(char* inPathCStr, char* outPathCStr, RenderReport * report = NULL);
+int sox_tempo(char* inPathCStr, char* outPathCStr, char* tempoCStr, RenderReport * report = NULL,
+              RenderMode mode = RENDER_FULL);
+/* rate selects the `rate' stage bringing the pitched audio back to the
+ * file's rate; NULL for rate_options_default(). Drafts always use quick */
+int sox_pitch(char* inPathCStr, char* outPathCStr, char* pitchCStr, RenderReport * report = NULL,
+              RenderMode mode = RENDER_FULL, RateOptions const * rate = NULL);
+/* Converts to outRate with the given resampler options (NULL for default) */
+int sox_resample(char const * inPathCStr, char const * outPathCStr, double outRate,
+                 RateOptions const * rate = NULL, RenderReport * report = NULL);
+int sox_reverse(char* inPathCStr, char* outPathCStr, RenderReport * report = NULL);
+int sox_gain_fade(char const * inPathCStr, char const * outPathCStr, double gainDb,
+                  double fadeInSeconds, double fadeOutSeconds, RenderReport * report = NULL);
+
+/* Measures the loudness of the file into report->loudness, a pass to
+ * nowhere, and remembers it in the render cache under the file's digest */
+int sox_analyse_loudness(char const * inPathCStr, RenderReport * report = NULL);
+/* Brings the file to targetLufs with one gain, held back to keep the true
+ * peak under LOUDNESS_MAX_TRUE_PEAK (loudness.h), in a single fused gain
+ * pass. The statistics come from the render that wrote the file (every
+ * render above measures its output on the way) or from an earlier
+ * sox_analyse_loudness() of the same audio; a file with neither is an
+ * error, not a hidden second pass */
+int sox_normalize(char const * inPathCStr, char const * outPathCStr, double targetLufs,
+                  RenderReport * report = NULL);
+
+#endif //SOXTEST_SOX_OPS_H
@@ -0,0 +1,277 @@
+#include "sox-tuning.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include "native-log.h"
+#include "rate-plans.h"
+#include "sox.h"
+#include "sox-ops.h"
+#include "test-signal.h"
+
+/* Block sizes (bytes) tried for both sox_globals.bufsiz and input_bufsiz */
+static const size_t candidates[] = {4096, 8192, 16384, 32768};
+
+/* Values tried for sox_globals.log2_dft_min_size; libSoX's default is 10 */
+static const size_t dft_candidates[] = {9, 10, 11, 12, 13};
+
+#define CALIBRATION_SECONDS 5
+#define CALIBRATION_RUNS 2
+
+static std::mutex tuning_mutex;
+static SoxTuning current_tuning;
+static size_t default_bufsiz = 0;
+static size_t default_input_bufsiz = 0;
+static size_t default_log2_dft_min_size = 0;
+
+bool tuning_threads_supported() {
+    return (sox_version_info()->flags & sox_version_have_threads) != 0;
+}
+
+SoxTuning tuning_get() {
+    std::lock_guard<std::mutex> lock(tuning_mutex);
+    return current_tuning;
+}
+
+void tuning_set(SoxTuning const & tuning) {
+    std::lock_guard<std::mutex> lock(tuning_mutex);
+    if (default_bufsiz == 0) {
+        default_bufsiz = sox_globals.bufsiz;
+        default_input_bufsiz = sox_globals.input_bufsiz;
+        default_log2_dft_min_size = sox_globals.log2_dft_min_size;
+    }
+    current_tuning = tuning;
+    sox_globals.bufsiz = tuning.bufsiz ? tuning.bufsiz : default_bufsiz;
+    sox_globals.input_bufsiz = tuning.input_bufsiz ? tuning.input_bufsiz : default_input_bufsiz;
+    rate_plans_set_default_dft(tuning.log2_dft_min_size ?
+            tuning.log2_dft_min_size : default_log2_dft_min_size);
+    sox_globals.use_threads = tuning.threads > 0 ? sox_true : sox_false;
+    if (tuning.threads > 0) {
+        setenv("OMP_NUM_THREADS", std::to_string(tuning.threads).c_str(), 1);
+    }
+}
+
+int tuning_load(char const * path, std::string const & deviceId, SoxTuning * tuning) {
+    FILE * f = fopen(path, "r");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+
+    SoxTuning loaded;
+    bool sameDevice = false;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        char * value = strchr(line, '=');
+        if (!value) {
+            continue;
+        }
+        *value++ = 0;
+        if (strcmp(line, "device") == 0) {
+            sameDevice = deviceId == value;
+        } else if (strcmp(line, "bufsiz") == 0) {
+            loaded.bufsiz = strtoul(value, NULL, 10);
+        } else if (strcmp(line, "input_bufsiz") == 0) {
+            loaded.input_bufsiz = strtoul(value, NULL, 10);
+        } else if (strcmp(line, "threads") == 0) {
+            loaded.threads = strtoul(value, NULL, 10);
+        } else if (strcmp(line, "log2_dft_min_size") == 0) {
+            loaded.log2_dft_min_size = strtoul(value, NULL, 10);
+        } else if (strcmp(line, "rate_quality") == 0 && value[0] && strchr("qlmhv", value[0])) {
+            loaded.rate_quality = value[0];
+        }
+    }
+    fclose(f);
+
+    if (!sameDevice) {
+        return RESULT_ERROR;
+    }
+    *tuning = loaded;
+    return RESULT_SUCCESS;
+}
+
+int tuning_save(char const * path, std::string const & deviceId, SoxTuning const & tuning) {
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE * f = fopen(tmpPath.c_str(), "w");
+    if (!f) {
+        return RESULT_ERROR;
+    }
+    fprintf(f, "device=%s\n", deviceId.c_str());
+    fprintf(f, "bufsiz=%zu\n", tuning.bufsiz);
+    fprintf(f, "input_bufsiz=%zu\n", tuning.input_bufsiz);
+    fprintf(f, "threads=%u\n", tuning.threads);
+    fprintf(f, "log2_dft_min_size=%zu\n", tuning.log2_dft_min_size);
+    fprintf(f, "rate_quality=%c\n", tuning.rate_quality);
+    if (fclose(f) != 0 || rename(tmpPath.c_str(), path) != 0) {
+        remove(tmpPath.c_str());
+        return RESULT_ERROR;
+    }
+    return RESULT_SUCCESS;
+}
+
+/* Times one combination; each figure is the best of CALIBRATION_RUNS */
+static int measure(std::string const & dir, TuningSample * sample) {
+    std::string refWav = dir + "/calibrate-ref.wav";
+    std::string refFlac = dir + "/calibrate-ref.flac";
+    std::string outWav = dir + "/calibrate-out.wav";
+    std::string outFlac = dir + "/calibrate-out.flac";
+    RenderReport report;
+
+    sample->decode_ms = sample->effects_ms = sample->encode_ms = 1e12;
+    for (int run = 0; run < CALIBRATION_RUNS; run++) {
+        /* decode: FLAC in, the WAV writer is negligible */
+        if (sox_render("calibrate-decode", refFlac.c_str(), outWav.c_str(), {}, &report) != RESULT_SUCCESS) {
+            return RESULT_ERROR;
+        }
+        sample->decode_ms = std::min(sample->decode_ms, report.read_wait_ms);
+
+        if (sox_render("calibrate-effects", refWav.c_str(), outWav.c_str(), {
+                {"tempo", {"1.25"}},
+                {"pitch", {"200"}},
+                {"rate", {"-m", "44100"}}
+        }, &report) != RESULT_SUCCESS) {
+            return RESULT_ERROR;
+        }
+        /* Wall time, as bench_threads takes it: the stage times of
+         * parallel flows add up to CPU time, not to what the user waits */
+        sample->effects_ms = std::min(sample->effects_ms, report.flow_ms);
+
+        /* encode: FLAC out */
+        if (sox_render("calibrate-encode", refWav.c_str(), outFlac.c_str(), {}, &report) != RESULT_SUCCESS) {
+            return RESULT_ERROR;
+        }
+        sample->encode_ms = std::min(sample->encode_ms, report.write_wait_ms);
+    }
+    sample->total_ms = sample->decode_ms + sample->effects_ms + sample->encode_ms;
+
+    remove(outWav.c_str());
+    remove(outFlac.c_str());
+    return RESULT_SUCCESS;
+}
+
+int tuning_calibrate(char const * workDir, SoxTuning * best, std::vector<TuningSample> * sweep) {
+    if (sox_runtime_init() != RESULT_SUCCESS) {
+        return RESULT_ERROR;
+    }
+
+    std::string dir = workDir;
+    std::string refWav = dir + "/calibrate-ref.wav";
+    std::string refFlac = dir + "/calibrate-ref.flac";
+    SoxTuning previous = tuning_get();
+    ScopedRatePlan noPlan(0);
+
+    tuning_set(SoxTuning());
+    int result = write_test_signal(refWav.c_str(), 44100, 2, CALIBRATION_SECONDS);
+    if (result == RESULT_SUCCESS) {
+        result = sox_render("calibrate-prepare", refWav.c_str(), refFlac.c_str(), {}, NULL);
+    }
+
+    TuningSample fastest = {};
+    fastest.total_ms = -1;
+    sweep->clear();
+    for (size_t input_bufsiz : candidates) {
+        for (size_t bufsiz : candidates) {
+            if (result != RESULT_SUCCESS) {
+                break;
+            }
+            SoxTuning tuning;
+            tuning.bufsiz = bufsiz;
+            tuning.input_bufsiz = input_bufsiz;
+            tuning_set(tuning);
+
+            TuningSample sample = {};
+            sample.bufsiz = bufsiz;
+            sample.input_bufsiz = input_bufsiz;
+            result = measure(dir, &sample);
+            sweep->push_back(sample);
+
+            if (fastest.total_ms < 0 || sample.total_ms < fastest.total_ms) {
+                fastest = sample;
+            }
+        }
+    }
+
+    if (result != RESULT_SUCCESS) {
+        remove(refWav.c_str());
+        remove(refFlac.c_str());
+        LOG_E("calibration failed");
+        tuning_set(previous);
+        return RESULT_ERROR;
+    }
+
+    best->bufsiz = fastest.bufsiz;
+    best->input_bufsiz = fastest.input_bufsiz;
+    best->threads = 0;
+    best->log2_dft_min_size = 0;
+    best->rate_quality = previous.rate_quality;
+
+    for (size_t log2DftSize : dft_candidates) {
+        SoxTuning tuning = *best;
+        tuning.log2_dft_min_size = log2DftSize;
+        tuning_set(tuning);
+
+        TuningSample sample = {};
+        sample.bufsiz = tuning.bufsiz;
+        sample.input_bufsiz = tuning.input_bufsiz;
+        sample.log2_dft_min_size = log2DftSize;
+        if (measure(dir, &sample) == RESULT_SUCCESS) {
+            sweep->push_back(sample);
+            if (sample.total_ms < fastest.total_ms) {
+                fastest = sample;
+                best->log2_dft_min_size = log2DftSize;
+            }
+        }
+    }
+
+    unsigned cores = std::thread::hardware_concurrency();
+    if (tuning_threads_supported() && cores > 1) {
+        SoxTuning threaded = *best;
+        threaded.threads = cores;
+        tuning_set(threaded);
+
+        TuningSample sample = {};
+        sample.bufsiz = threaded.bufsiz;
+        sample.input_bufsiz = threaded.input_bufsiz;
+        sample.threads = threaded.threads;
+        sample.log2_dft_min_size = threaded.log2_dft_min_size;
+        if (measure(dir, &sample) == RESULT_SUCCESS) {
+            sweep->push_back(sample);
+            if (sample.effects_ms < fastest.effects_ms) {
+                best->threads = cores;
+            }
+        }
+    }
+    remove(refWav.c_str());
+    remove(refFlac.c_str());
+
+    tuning_set(*best);
+    /* At the calibrated block sizes, as the plans will run */
+    if (rate_plans_calibrate(workDir) != RESULT_SUCCESS) {
+        LOG_E("rate plans: calibration failed, keeping the global DFT size");
+    }
+    LOG_I("calibrated: bufsiz %zu, input_bufsiz %zu, threads %u, log2 dft %zu (%.1f ms)",
+          best->bufsiz, best->input_bufsiz, best->threads, best->log2_dft_min_size, fastest.total_ms);
+    return RESULT_SUCCESS;
+}
+
+std::string tuning_sweep_to_json(std::vector<TuningSample> const & sweep, SoxTuning const & best) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"bufsiz\":%zu,\"input_bufsiz\":%zu,\"threads\":%u,\"log2_dft_min_size\":%zu,\"sweep\":[",
+             best.bufsiz, best.input_bufsiz, best.threads, best.log2_dft_min_size);
+    std::string out = buf;
+    for (size_t i = 0; i < sweep.size(); i++) {
+        TuningSample const & s = sweep[i];
+        snprintf(buf, sizeof(buf),
+                 "%s{\"bufsiz\":%zu,\"input_bufsiz\":%zu,\"threads\":%u,\"log2_dft_min_size\":%zu,"
+                 "\"decode_ms\":%.3f,\"effects_ms\":%.3f,\"encode_ms\":%.3f,\"total_ms\":%.3f}",
+                 i > 0 ? "," : "", s.bufsiz, s.input_bufsiz, s.threads, s.log2_dft_min_size,
+                 s.decode_ms, s.effects_ms, s.encode_ms, s.total_ms);
+        out += buf;
+    }
+    out += "]}";
+    return out;
+}
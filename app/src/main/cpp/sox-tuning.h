@@ -0,0 +1,60 @@
+#ifndef SOXTEST_SOX_TUNING_H
+#define SOXTEST_SOX_TUNING_H
+
+#include <string>
+#include <vector>
+
+/* Per-device values for sox_globals; 0 keeps the library default */
+struct SoxTuning {
+    size_t bufsiz = 0;
+    size_t input_bufsiz = 0;
+    /* 0 runs every flow on the calling thread; N > 0 sets use_threads so
+     * that libSoX processes the channels of non-MCHAN effects in parallel
+     * on N threads */
+    unsigned threads = 0;
+    /* sox_globals.log2_dft_min_size, the smallest DFT libSoX's filters use;
+     * `rate' stages may override it per conversion (see rate-plans.h) */
+    size_t log2_dft_min_size = 0;
+    /* Default tier of the pitch and resample `rate' stages (a RateQuality
+     * letter); not calibrated but chosen from `soxtest-cli bench rate' */
+    char rate_quality = 'm';
+};
+
+/* One measured combination of the calibration sweep */
+struct TuningSample {
+    size_t bufsiz;
+    size_t input_bufsiz;
+    unsigned threads;
+    size_t log2_dft_min_size;
+    double decode_ms;
+    double effects_ms;      /* wall time of the effects render */
+    double encode_ms;
+    double total_ms;
+};
+
+/* True when this libSoX build can run flows in parallel */
+bool tuning_threads_supported();
+
+SoxTuning tuning_get();
+
+/* Stores the tuning and applies it to sox_globals. The thread count is
+ * read by the OpenMP runtime on libSoX's first parallel flow, so only the
+ * value set before that takes effect; use_threads can be toggled anytime */
+void tuning_set(SoxTuning const & tuning);
+
+/* Reads a tuning saved by tuning_save(); fails when the file is missing
+ * or was written for another device */
+int tuning_load(char const * path, std::string const & deviceId, SoxTuning * tuning);
+int tuning_save(char const * path, std::string const & deviceId, SoxTuning const & tuning);
+
+/* Benchmarks the candidate block sizes for decode, effects and encode on
+ * this CPU, using scratch files in workDir. On success the fastest
+ * combination is applied and returned in best; sweep receives all of the
+ * measurements. The DFT size is then swept with the chosen block sizes, and
+ * parallel flows are kept when they beat the single-threaded effects time
+ * on stereo input */
+int tuning_calibrate(char const * workDir, SoxTuning * best, std::vector<TuningSample> * sweep);
+
+std::string tuning_sweep_to_json(std::vector<TuningSample> const & sweep, SoxTuning const & best);
+
+#endif //SOXTEST_SOX_TUNING_H
@@ -0,0 +1,270 @@
+/* Host (Linux) front end for the native render code, used to profile the
+ * effect chains outside the app:
+ *
+ *   soxtest-cli convert <in> <out> [--report <file.json>]
+ *   soxtest-cli export <in> <out> [<out>...] [--tag <Key=value>]... [--report <file.json>]
+ *   soxtest-cli tempo <in> <out> <tempo> [--draft] [--report <file.json>]
+ *   soxtest-cli pitch <in> <out> <cents> [--draft] [--report <file.json>]
+ *   soxtest-cli reverse <in> <out> [--report <file.json>]
+ *   soxtest-cli resample <in> <out> <rate> [q|l|m|h|v] [--report <file.json>]
+ *   soxtest-cli gain <in> <out> <dB> [<fade in s> <fade out s>] [--report <file.json>]
+ *   soxtest-cli normalize <in> <out> <LUFS> [--report <file.json>]
+ *   soxtest-cli probe <file|dir>...
+ *   soxtest-cli loudness <in>
+ *   soxtest-cli silence <in> [--trim]
+ *   soxtest-cli autotune <workdir>
+ *   soxtest-cli bench threads|pipelines|allocations|draft|rate|checkpoint|memory|mp3|flac|cache|export|probe|jobs|priority|mapped|loudness|normalize|silence|spectrogram <workdir>
+ *
+ * Every render also takes --checkpoint <seconds>: WAV outputs are then
+ * written resumably, see checkpoint.h; --memory-budget <MB>, see
+ * memory-budget.h; and --cache <dir>, which serves and stores WAV outputs
+ * in a render cache there, see render-cache.h.
+ * Without --report the render report is printed to stdout as JSON.
+ * probe prints the header metadata of the files, and of the audio files in
+ * the directories, as a JSON array, see audio-probe.h.
+ * loudness measures the EBU R128 loudness of a file and prints the report;
+ * with --cache, a normalize of the file later finds the statistics there,
+ * as it finds those of a render's output under the same --cache. A
+ * normalize of a file with neither fails.
+ * silence decodes a file as an import does and prints the silent regions
+ * it found, see silence.h.
+ * autotune runs the block size calibration and prints the whole sweep;
+ * bench runs one of the benchmarks of sox-bench.h. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include "audio-probe.h"
+#include "checkpoint.h"
+#include "loudness.h"
+#include "memory-budget.h"
+#include "multi-export.h"
+#include "parallel-decode.h"
+#include "render-cache.h"
+#include "sox-bench.h"
+#include "sox-ops.h"
+#include "sox-tuning.h"
+
+#define CLI_CACHE_QUOTA (4ULL << 30)
+
+static int usage() {
+    fprintf(stderr,
+            "usage: soxtest-cli convert|reverse <in> <out> [--report <file.json>]\n"
+            "       soxtest-cli export <in> <out> [<out>...] [--tag <Key=value>]... [--report <file.json>]\n"
+            "       soxtest-cli tempo|pitch <in> <out> <value> [--draft] [--report <file.json>]\n"
+            "       soxtest-cli resample <in> <out> <rate> [q|l|m|h|v] [--report <file.json>]\n"
+            "       soxtest-cli gain <in> <out> <dB> [<fade in s> <fade out s>] [--report <file.json>]\n"
+            "       soxtest-cli normalize <in> <out> <LUFS> [--report <file.json>]\n"
+            "       soxtest-cli autotune <workdir>\n"
+            "       soxtest-cli probe <file|dir>...\n"
+            "       soxtest-cli loudness <in> [--cache <dir>]\n"
+            "       soxtest-cli silence <in> [--trim]\n"
+            "       soxtest-cli bench threads|pipelines|allocations|draft|rate|checkpoint|memory|mp3|flac|cache|export|probe|jobs|priority|mapped|loudness|normalize|silence|spectrogram <workdir>\n");
+    return 2;
+}
+
+static int autotune(char const * workDir) {
+    SoxTuning best;
+    std::vector<TuningSample> sweep;
+    int result = tuning_calibrate(workDir, &best, &sweep);
+
+    printf("%8s %12s %8s %8s %10s %10s %10s %10s\n", "bufsiz", "input_bufsiz", "threads",
+           "log2_dft", "decode_ms", "effects_ms", "encode_ms", "total_ms");
+    for (TuningSample const & s : sweep) {
+        bool chosen = s.bufsiz == best.bufsiz && s.input_bufsiz == best.input_bufsiz
+                && s.threads == best.threads && s.log2_dft_min_size == best.log2_dft_min_size;
+        printf("%8zu %12zu %8u %8zu %10.1f %10.1f %10.1f %10.1f%s\n",
+               s.bufsiz, s.input_bufsiz, s.threads, s.log2_dft_min_size,
+               s.decode_ms, s.effects_ms, s.encode_ms, s.total_ms, chosen ? "  *" : "");
+    }
+    if (result != RESULT_SUCCESS) {
+        fprintf(stderr, "calibration failed\n");
+        return 1;
+    }
+    printf("best: bufsiz=%zu input_bufsiz=%zu threads=%u log2_dft_min_size=%zu\n",
+           best.bufsiz, best.input_bufsiz, best.threads, best.log2_dft_min_size);
+    return 0;
+}
+
+static int probe(int argc, char * argv[]) {
+    std::vector<std::string> paths;
+    for (int i = 0; i < argc; i++) {
+        DIR * d = opendir(argv[i]);
+        if (d) {
+            closedir(d);
+            std::vector<std::string> files = audio_probe_list_dir(argv[i]);
+            paths.insert(paths.end(), files.begin(), files.end());
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    std::vector<AudioProbe> probes = audio_probe_batch(paths, parallel_decode_threads());
+    printf("%s\n", probes_to_json(probes).c_str());
+    for (AudioProbe const & p : probes) {
+        if (p.result != RESULT_SUCCESS) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int loudness(char const * inPath) {
+    RenderReport report;
+    int result = sox_analyse_loudness(inPath, &report);
+    printf("%s\n", report_to_json(report).c_str());
+    return result == RESULT_SUCCESS ? 0 : 1;
+}
+
+/* The report of the decode, without its samples */
+static int silence(char const * inPath, bool trim) {
+    DecodeOptions options;
+    options.scan_silence = true;
+    options.trim_silence = trim;
+    AudioBuffer buffer;
+    RenderReport report;
+    int result = sox_decode_buffer(inPath, &buffer, &report, options);
+    printf("%s\n", report_to_json(report).c_str());
+    return result == RESULT_SUCCESS ? 0 : 1;
+}
+
+static int bench(std::string const & name, char const * workDir) {
+    int result;
+    if (name == "threads") {
+        result = bench_threads(workDir, stdout);
+    } else if (name == "pipelines") {
+        result = bench_pipelines(workDir, stdout);
+    } else if (name == "allocations") {
+        result = bench_allocations(workDir, stdout);
+    } else if (name == "draft") {
+        result = bench_draft(workDir, stdout);
+    } else if (name == "rate") {
+        result = bench_rate(workDir, stdout);
+    } else if (name == "checkpoint") {
+        result = bench_checkpoint(workDir, stdout);
+    } else if (name == "memory") {
+        result = bench_memory(workDir, stdout);
+    } else if (name == "mp3") {
+        result = bench_mp3(workDir, stdout);
+    } else if (name == "flac") {
+        result = bench_flac(workDir, stdout);
+    } else if (name == "cache") {
+        result = bench_cache(workDir, stdout);
+    } else if (name == "export") {
+        result = bench_export(workDir, stdout);
+    } else if (name == "probe") {
+        result = bench_probe(workDir, stdout);
+    } else if (name == "jobs") {
+        result = bench_jobs(workDir, stdout);
+    } else if (name == "priority") {
+        result = bench_priority(workDir, stdout);
+    } else if (name == "mapped") {
+        result = bench_mapped(workDir, stdout);
+    } else if (name == "loudness") {
+        result = bench_loudness(workDir, stdout);
+    } else if (name == "normalize") {
+        result = bench_normalize(workDir, stdout);
+    } else if (name == "silence") {
+        result = bench_silence(workDir, stdout);
+    } else if (name == "spectrogram") {
+        result = bench_spectrogram(workDir, stdout);
+    } else {
+        return usage();
+    }
+    return result == RESULT_SUCCESS ? 0 : 1;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc == 3 && strcmp(argv[1], "autotune") == 0) {
+        return autotune(argv[2]);
+    }
+    if (argc >= 3 && strcmp(argv[1], "probe") == 0) {
+        return probe(argc - 2, argv + 2);
+    }
+    if (argc == 3 && strcmp(argv[1], "loudness") == 0) {
+        return loudness(argv[2]);
+    }
+    if (argc == 5 && strcmp(argv[1], "loudness") == 0 && strcmp(argv[3], "--cache") == 0) {
+        render_cache_init(argv[4], CLI_CACHE_QUOTA);
+        return loudness(argv[2]);
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "silence") == 0
+            && (argc == 3 || strcmp(argv[3], "--trim") == 0)) {
+        return silence(argv[2], argc == 4);
+    }
+    if (argc == 4 && strcmp(argv[1], "bench") == 0) {
+        return bench(argv[2], argv[3]);
+    }
+
+    std::vector<char *> positional;
+    char const * reportPath = NULL;
+    RenderMode mode = RENDER_FULL;
+    std::vector<std::string> tags;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--report") == 0 && i + 1 < argc) {
+            reportPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpoint_set_interval(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc) {
+            memory_budget_set((uint64_t) (atof(argv[++i]) * 1024 * 1024));
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            render_cache_init(argv[++i], CLI_CACHE_QUOTA);
+        } else if (strcmp(argv[i], "--tag") == 0 && i + 1 < argc) {
+            tags.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--draft") == 0) {
+            mode = RENDER_DRAFT;
+        } else {
+            positional.push_back(argv[i]);
+        }
+    }
+    if (positional.size() < 3) {
+        return usage();
+    }
+
+    std::string command = positional[0];
+    char * inPath = positional[1];
+    char * outPath = positional[2];
+    char * value = positional.size() > 3 ? positional[3] : NULL;
+    RenderReport report;
+    int result;
+
+    if (command == "export") {
+        result = sox_export(inPath, std::vector<std::string>(positional.begin() + 2, positional.end()), tags, &report);
+    } else if (command == "convert") {
+        result = sox_convert(inPath, outPath, &report);
+    } else if (command == "reverse") {
+        result = sox_reverse(inPath, outPath, &report);
+    } else if (command == "tempo" && value) {
+        result = sox_tempo(inPath, outPath, value, &report, mode);
+    } else if (command == "pitch" && value) {
+        result = sox_pitch(inPath, outPath, value, &report, mode);
+    } else if (command == "resample" && value) {
+        RateOptions rate = rate_options_default();
+        if (positional.size() > 4 && strchr("qlmhv", positional[4][0])) {
+            rate.quality = (RateQuality) positional[4][0];
+        }
+        result = sox_resample(inPath, outPath, atof(value), &rate, &report);
+    } else if (command == "gain" && value) {
+        double fadeIn = positional.size() > 5 ? atof(positional[4]) : 0;
+        double fadeOut = positional.size() > 5 ? atof(positional[5]) : 0;
+        result = sox_gain_fade(inPath, outPath, atof(value), fadeIn, fadeOut, &report);
+    } else if (command == "normalize" && value) {
+        result = sox_normalize(inPath, outPath, atof(value), &report);
+    } else {
+        return usage();
+    }
+
+    if (reportPath) {
+        if (report_write_json(report, reportPath) != 0) {
+            fprintf(stderr, "cannot write report: %s\n", reportPath);
+            return 1;
+        }
+    } else {
+        printf("%s\n", report_to_json(report).c_str());
+    }
+
+    return result == RESULT_SUCCESS ? 0 : 1;
+}
@@ -0,0 +1,482 @@
+#include "spectrogram.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include "native-log.h"
+#include "simd.h"
+
+/* Tables of one FFT size: the bit-reversed order the radix-2 passes take
+ * their input in, the twiddles of the longest pass and the window */
+struct FftPlan {
+    unsigned size = 0;
+    std::vector<unsigned> reversed;
+    std::vector<float> cos_table;
+    std::vector<float> sin_table;
+    std::vector<float> window;
+    float ref_db = 0;               /* power of a full-scale sine, in dB */
+};
+
+struct CachedTile {
+    SpectrogramTile tile;
+    uint64_t used = 0;
+};
+
+/* The columns of a level the tap is at, four windows to a batch */
+struct TapLevel {
+    uint64_t next = 0;              /* column whose window comes next */
+    unsigned batched = 0;
+    uint64_t batch_column = 0;      /* of the first window in the batch */
+    std::vector<float> batch;       /* 4 windows */
+    SpectrogramTile tile;           /* being filled */
+};
+
+struct Spectrogram {
+    SpectrogramOptions options;
+    FftPlan plan;
+
+    mutable std::mutex mutex;
+    uint64_t frames = 0;
+    double rate = 0;
+    std::map<std::pair<unsigned, uint64_t>, CachedTile> tiles;
+    uint64_t bytes = 0;
+    uint64_t tick = 0;
+
+    /* Only the tap touches these */
+    unsigned channels = 0;
+    uint64_t tapped = 0;            /* frames through the tap */
+    uint64_t history_start = 0;     /* frame of history[0] */
+    std::vector<float> history;     /* mono, from the oldest window still open */
+    std::vector<TapLevel> levels;
+};
+
+static FftPlan fft_plan(unsigned size) {
+    FftPlan plan;
+    plan.size = size;
+    unsigned bits = 0;
+    while ((1u << bits) < size) {
+        bits++;
+    }
+    plan.reversed.resize(size);
+    for (unsigned i = 0; i < size; i++) {
+        unsigned r = 0;
+        for (unsigned b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan.reversed[i] = r;
+    }
+    plan.cos_table.resize(size / 2);
+    plan.sin_table.resize(size / 2);
+    for (unsigned i = 0; i < size / 2; i++) {
+        plan.cos_table[i] = (float) std::cos(2 * M_PI * i / size);
+        plan.sin_table[i] = (float) -std::sin(2 * M_PI * i / size);
+    }
+    plan.window.resize(size);
+    for (unsigned i = 0; i < size; i++) {
+        plan.window[i] = (float) (0.5 - 0.5 * std::cos(2 * M_PI * i / size));
+    }
+    /* A full-scale sine peaks at size / 4 through a Hann window */
+    plan.ref_db = (float) (20 * std::log10(size / 4.0));
+    return plan;
+}
+
+/* Spectra of four windows (size samples apiece) at once, lane l of every
+ * vector being window l; out[l] gets its size / 2 bins as bytes */
+static void fft_columns(FftPlan const & plan, float const * const windows[4], double floorDb, uint8_t * const out[4]) {
+    unsigned n = plan.size;
+    std::vector<f32x4> re(n), im(n, f32x4_splat(0));
+    for (unsigned i = 0; i < n; i++) {
+        float w = plan.window[i];
+        re[plan.reversed[i]] = f32x4{windows[0][i], windows[1][i], windows[2][i], windows[3][i]} * w;
+    }
+    for (unsigned half = 1; half < n; half <<= 1) {
+        unsigned stride = n / (2 * half);
+        for (unsigned start = 0; start < n; start += 2 * half) {
+            for (unsigned k = 0; k < half; k++) {
+                float c = plan.cos_table[k * stride], s = plan.sin_table[k * stride];
+                unsigned a = start + k, b = a + half;
+                f32x4 tr = re[b] * c - im[b] * s;
+                f32x4 ti = re[b] * s + im[b] * c;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+    /* 10 log10(power) as log2, then floorDb..0 dB onto 0..255 */
+    float scale = (float) (255 / -floorDb);
+    f32x4 offset = f32x4_splat((float) (-floorDb - plan.ref_db) * scale + 0.5f);
+    f32x4 zero = f32x4_splat(0), top = f32x4_splat(255);
+    for (unsigned k = 0; k < n / 2; k++) {
+        f32x4 power = re[k] * re[k] + im[k] * im[k] + 1e-30f;
+        f32x4 v = f32x4_log2(power) * (float) (10 * M_LN2 / M_LN10) * scale + offset;
+        v = f32x4_max(zero, v);
+        v = -f32x4_max(-top, -v);
+        i32x4 bytes = __builtin_convertvector(v, i32x4);
+        for (unsigned l = 0; l < 4; l++) {
+            out[l][k] = (uint8_t) bytes[l];
+        }
+    }
+}
+
+std::shared_ptr<Spectrogram> spectrogram_create(SpectrogramOptions const & options) {
+    auto spectrogram = std::make_shared<Spectrogram>();
+    SpectrogramOptions & o = spectrogram->options;
+    o = options;
+    unsigned size = 8;
+    while (size < o.fft_size && size < (1u << 16)) {
+        size <<= 1;
+    }
+    o.fft_size = size;
+    o.hop = std::max(1u, o.hop);
+    o.levels = std::max(1u, std::min(o.levels, 24u));
+    o.floor_db = std::min(o.floor_db, -1.0);
+    spectrogram->plan = fft_plan(size);
+    return spectrogram;
+}
+
+SpectrogramOptions spectrogram_options(Spectrogram const * spectrogram) {
+    return spectrogram->options;
+}
+
+uint64_t spectrogram_frames(Spectrogram const * spectrogram) {
+    std::lock_guard<std::mutex> lock(spectrogram->mutex);
+    return spectrogram->frames;
+}
+
+double spectrogram_rate(Spectrogram const * spectrogram) {
+    std::lock_guard<std::mutex> lock(spectrogram->mutex);
+    return spectrogram->rate;
+}
+
+static uint64_t level_hop(SpectrogramOptions const & options, unsigned level) {
+    return (uint64_t) options.hop << level;
+}
+
+static uint64_t tile_count(Spectrogram const * s, unsigned level) {
+    if (level >= s->options.levels || s->frames == 0) {
+        return 0;
+    }
+    uint64_t hop = level_hop(s->options, level);
+    uint64_t columns = (s->frames + hop - 1) / hop;
+    return (columns + SPECTROGRAM_TILE_COLUMNS - 1) / SPECTROGRAM_TILE_COLUMNS;
+}
+
+uint64_t spectrogram_tile_count(Spectrogram const * spectrogram, unsigned level) {
+    std::lock_guard<std::mutex> lock(spectrogram->mutex);
+    return tile_count(spectrogram, level);
+}
+
+/* Range clamped to the tiles that exist */
+static uint64_t range_end(Spectrogram const * s, unsigned level, uint64_t first, uint64_t count) {
+    uint64_t tiles = tile_count(s, level);
+    return first >= tiles ? first : first + std::min(count, tiles - first);
+}
+
+bool spectrogram_cached(Spectrogram const * spectrogram, unsigned level, uint64_t first, uint64_t count) {
+    std::lock_guard<std::mutex> lock(spectrogram->mutex);
+    if (spectrogram->frames == 0) {
+        return false;
+    }
+    uint64_t end = range_end(spectrogram, level, first, count);
+    for (uint64_t i = first; i < end; i++) {
+        if (!spectrogram->tiles.count({level, i})) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* With the lock held; least recently used out */
+static void insert_tile(Spectrogram * s, SpectrogramTile tile) {
+    auto key = std::make_pair(tile.level, tile.index);
+    auto found = s->tiles.find(key);
+    if (found != s->tiles.end()) {
+        s->bytes -= found->second.tile.values.size();
+        s->tiles.erase(found);
+    }
+    s->bytes += tile.values.size();
+    s->tiles[key] = CachedTile{std::move(tile), ++s->tick};
+    while (s->bytes > s->options.max_bytes && s->tiles.size() > 1) {
+        auto oldest = s->tiles.begin();
+        for (auto it = s->tiles.begin(); it != s->tiles.end(); ++it) {
+            if (it->second.used < oldest->second.used) {
+                oldest = it;
+            }
+        }
+        s->bytes -= oldest->second.tile.values.size();
+        s->tiles.erase(oldest);
+    }
+}
+
+static SpectrogramTile empty_tile(SpectrogramOptions const & options, unsigned level, uint64_t index,
+                                  unsigned columns) {
+    SpectrogramTile tile;
+    tile.level = level;
+    tile.index = index;
+    tile.columns = columns;
+    tile.bins = options.fft_size / 2;
+    tile.values.resize((size_t) columns * tile.bins);
+    return tile;
+}
+
+/* A tile from the audio: the mix of its channels, zeros past the end */
+static SpectrogramTile compute_tile(Spectrogram const * s, AudioView const & audio, unsigned level,
+                                    uint64_t index, uint64_t frames) {
+    SpectrogramOptions const & o = s->options;
+    uint64_t hop = level_hop(o, level);
+    uint64_t columns = (frames + hop - 1) / hop;
+    uint64_t first = index * SPECTROGRAM_TILE_COLUMNS;
+    unsigned count = (unsigned) std::min<uint64_t>(SPECTROGRAM_TILE_COLUMNS, columns - first);
+    SpectrogramTile tile = empty_tile(o, level, index, count);
+
+    unsigned n = o.fft_size;
+    unsigned channels = std::max(1u, audio.signal.channels);
+    float gain = 1.0f / (2147483648.0f * channels);
+    std::vector<float> windows(4 * (size_t) n);
+    for (unsigned c = 0; c < count; c += 4) {
+        float const * in[4];
+        uint8_t * out[4];
+        for (unsigned l = 0; l < 4; l++) {
+            float * w = windows.data() + (size_t) l * n;
+            in[l] = w;
+            /* Lanes past the last column repeat it and are not kept */
+            unsigned column = std::min(c + l, count - 1);
+            out[l] = tile.values.data() + (size_t) column * tile.bins;
+            uint64_t start = (first + column) * hop;
+            for (unsigned i = 0; i < n; i++) {
+                float sum = 0;
+                if (start + i < frames) {
+                    sox_sample_t const * frame = audio.samples + (start + i) * channels;
+                    for (unsigned ch = 0; ch < channels; ch++) {
+                        sum += (float) frame[ch];
+                    }
+                }
+                w[i] = sum * gain;
+            }
+        }
+        fft_columns(s->plan, in, o.floor_db, out);
+    }
+    return tile;
+}
+
+int spectrogram_fetch(Spectrogram * spectrogram, AudioView const * audio, unsigned level, uint64_t first,
+                      uint64_t count, unsigned threads, std::vector<SpectrogramTile> * tiles) {
+    tiles->clear();
+    std::vector<uint64_t> missing;
+    uint64_t frames;
+    {
+        std::lock_guard<std::mutex> lock(spectrogram->mutex);
+        if (spectrogram->frames == 0 && audio && audio->signal.channels > 0) {
+            spectrogram->frames = audio->count / audio->signal.channels;
+            spectrogram->rate = audio->signal.rate;
+        }
+        frames = spectrogram->frames;
+        uint64_t end = range_end(spectrogram, level, first, count);
+        for (uint64_t i = first; i < end; i++) {
+            auto found = spectrogram->tiles.find({level, i});
+            if (found == spectrogram->tiles.end()) {
+                missing.push_back(i);
+            } else {
+                found->second.used = ++spectrogram->tick;
+                tiles->push_back(found->second.tile);
+            }
+        }
+    }
+    if (missing.empty()) {
+        return RESULT_SUCCESS;
+    }
+    if (!audio || audio->signal.channels == 0 || audio->count / audio->signal.channels < frames) {
+        LOG_E("Spectrogram tiles missing without the audio to compute them from");
+        tiles->clear();
+        return RESULT_ERROR;
+    }
+
+    std::vector<SpectrogramTile> computed(missing.size());
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i = next++; i < missing.size(); i = next++) {
+            computed[i] = compute_tile(spectrogram, *audio, level, missing[i], frames);
+        }
+    };
+    threads = std::max(1u, std::min<unsigned>(threads, missing.size()));
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread & worker : workers) {
+        worker.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(spectrogram->mutex);
+        for (SpectrogramTile const & tile : computed) {
+            insert_tile(spectrogram, tile);
+        }
+    }
+    tiles->insert(tiles->end(), std::make_move_iterator(computed.begin()), std::make_move_iterator(computed.end()));
+    std::sort(tiles->begin(), tiles->end(), [](SpectrogramTile const & a, SpectrogramTile const & b) {
+        return a.index < b.index;
+    });
+    return RESULT_SUCCESS;
+}
+
+/* The tap: the mix goes into a history that keeps the oldest window still
+ * open; every level takes its windows from it as they fill */
+
+static void tap_store(Spectrogram * s, SpectrogramTile * tile) {
+    if (tile->columns == 0) {
+        return;
+    }
+    tile->values.resize((size_t) tile->columns * tile->bins);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    insert_tile(s, std::move(*tile));
+    *tile = SpectrogramTile();
+}
+
+static void tap_run_batch(Spectrogram * s, unsigned level) {
+    TapLevel & t = s->levels[level];
+    unsigned n = s->options.fft_size, bins = n / 2;
+    std::vector<uint8_t> spectra(4 * (size_t) bins);
+    float const * in[4];
+    uint8_t * out[4];
+    for (unsigned l = 0; l < 4; l++) {
+        in[l] = t.batch.data() + (size_t) std::min(l, t.batched - 1) * n;
+        out[l] = spectra.data() + (size_t) l * bins;
+    }
+    fft_columns(s->plan, in, s->options.floor_db, out);
+    for (unsigned l = 0; l < t.batched; l++) {
+        uint64_t column = t.batch_column + l;
+        uint64_t index = column / SPECTROGRAM_TILE_COLUMNS;
+        if (t.tile.columns > 0 && t.tile.index != index) {
+            tap_store(s, &t.tile);
+        }
+        if (t.tile.columns == 0) {
+            t.tile = empty_tile(s->options, level, index, SPECTROGRAM_TILE_COLUMNS);
+        }
+        std::copy(out[l], out[l] + bins, t.tile.values.data() + (column % SPECTROGRAM_TILE_COLUMNS) * bins);
+        t.tile.columns = (unsigned) (column % SPECTROGRAM_TILE_COLUMNS) + 1;
+    }
+    t.batched = 0;
+}
+
+/* Windows of level whose start is before end; past the history, zeros */
+static void tap_take(Spectrogram * s, unsigned level, uint64_t end, bool padded) {
+    TapLevel & t = s->levels[level];
+    unsigned n = s->options.fft_size;
+    uint64_t hop = level_hop(s->options, level);
+    uint64_t available = s->history_start + s->history.size();
+    for (;;) {
+        uint64_t start = t.next * hop;
+        if (start >= end || (!padded && start + n > available)) {
+            break;
+        }
+        if (t.batched == 0) {
+            t.batch_column = t.next;
+        }
+        float * w = t.batch.data() + (size_t) t.batched * n;
+        for (unsigned i = 0; i < n; i++) {
+            uint64_t frame = start + i;
+            w[i] = frame < available ? s->history[frame - s->history_start] : 0;
+        }
+        t.next++;
+        if (++t.batched == 4) {
+            tap_run_batch(s, level);
+        }
+    }
+}
+
+static int LSX_API spectrogram_tap_start(sox_effect_t * effp) {
+    Spectrogram * s = *(Spectrogram **) effp->priv;
+    if (effp->in_signal.channels == 0) {
+        return SOX_EOF;
+    }
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        s->tiles.clear();
+        s->bytes = 0;
+        s->frames = 0;
+        s->rate = effp->in_signal.rate;
+    }
+    s->channels = effp->in_signal.channels;
+    s->tapped = 0;
+    s->history_start = 0;
+    s->history.clear();
+    s->levels.assign(s->options.levels, TapLevel());
+    for (TapLevel & t : s->levels) {
+        t.batch.resize(4 * (size_t) s->options.fft_size);
+    }
+    return SOX_SUCCESS;
+}
+
+static int LSX_API spectrogram_tap_flow(sox_effect_t * effp, sox_sample_t const * ibuf, sox_sample_t * obuf,
+                                        size_t * isamp, size_t * osamp) {
+    Spectrogram * s = *(Spectrogram **) effp->priv;
+    size_t len = std::min(*isamp, *osamp);
+    len -= len % s->channels;
+    std::copy(ibuf, ibuf + len, obuf);
+    *isamp = *osamp = len;
+
+    size_t frames = len / s->channels;
+    float gain = 1.0f / (2147483648.0f * s->channels);
+    for (size_t f = 0; f < frames; f++) {
+        float sum = 0;
+        for (unsigned ch = 0; ch < s->channels; ch++) {
+            sum += (float) ibuf[f * s->channels + ch];
+        }
+        s->history.push_back(sum * gain);
+    }
+    s->tapped += frames;
+
+    uint64_t keep = s->tapped;
+    for (unsigned level = 0; level < s->levels.size(); level++) {
+        tap_take(s, level, UINT64_MAX, false);
+        keep = std::min(keep, s->levels[level].next * level_hop(s->options, level));
+    }
+    if (keep > s->history_start) {
+        s->history.erase(s->history.begin(), s->history.begin() + (keep - s->history_start));
+        s->history_start = keep;
+    }
+    return SOX_SUCCESS;
+}
+
+/* The end of the audio: the windows that run past it, then the tiles */
+static int LSX_API spectrogram_tap_stop(sox_effect_t * effp) {
+    Spectrogram * s = *(Spectrogram **) effp->priv;
+    for (unsigned level = 0; level < s->levels.size(); level++) {
+        TapLevel & t = s->levels[level];
+        tap_take(s, level, s->tapped, true);
+        if (t.batched > 0) {
+            tap_run_batch(s, level);
+        }
+        tap_store(s, &t.tile);
+    }
+    s->levels.clear();
+    s->history.clear();
+    s->history.shrink_to_fit();
+    std::lock_guard<std::mutex> lock(s->mutex);
+    s->frames = s->tapped;
+    return SOX_SUCCESS;
+}
+
+static sox_effect_handler_t const * spectrogram_tap_handler() {
+    static sox_effect_handler_t handler = {
+            SPECTROGRAM_EFFECT, NULL, SOX_EFF_MCHAN | SOX_EFF_MODIFY, NULL, spectrogram_tap_start,
+            spectrogram_tap_flow, NULL, spectrogram_tap_stop, NULL, sizeof(Spectrogram *)
+    };
+    return &handler;
+}
+
+sox_effect_t * spectrogram_tap_create(Spectrogram * spectrogram) {
+    sox_effect_t * e = sox_create_effect(spectrogram_tap_handler());
+    if (e) {
+        *(Spectrogram **) e->priv = spectrogram;
+    }
+    return e;
+}
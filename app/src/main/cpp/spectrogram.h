@@ -0,0 +1,75 @@
+#ifndef SOXTEST_SPECTROGRAM_H
+#define SOXTEST_SPECTROGRAM_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "sox-ops.h"
+
+/* Spectrograms of audio in memory, computed in tiles.
+ *
+ * A tile holds SPECTROGRAM_TILE_COLUMNS STFT columns of fft_size / 2 bins
+ * of the channels' mix, as bytes from floor_db (0) up to a full-scale sine
+ * (255). Zoom level z steps hop << z frames from column to column, so a
+ * tile of level z + 1 spans two of level z; the Hann window stays
+ * fft_size long. Column k of a level starts at frame k * its hop; past the
+ * end of the audio the window reads zeros.
+ *
+ * Missing tiles are computed on a pool of workers, a tile each, four
+ * columns at a time through a radix-2 FFT whose vectors (simd.h) carry one
+ * column per lane. Tiles are cached by level and index up to max_bytes,
+ * least recently used out, so a view that pans asks for the tiles at its
+ * edges and gets the ones it saw before without a computation.
+ *
+ * A tap (SPECTROGRAM_EFFECT in an EffectSpec list, with the spectrogram in
+ * RenderOptions::spectrogram) fills the cache while a render flows: the
+ * columns of every level are computed as the samples pass it, and the
+ * tiles are there when the render is done.
+ *
+ * A spectrogram may be used from several threads at once */
+
+#define SPECTROGRAM_EFFECT "spectrogram"
+#define SPECTROGRAM_TILE_COLUMNS 256
+
+struct SpectrogramOptions {
+    unsigned fft_size = 1024;       /* a power of two, 8 and up */
+    unsigned hop = 256;             /* frames per column at level 0 */
+    unsigned levels = 8;
+    double floor_db = -120;
+    uint64_t max_bytes = 32 << 20;  /* of cached tiles */
+};
+
+struct SpectrogramTile {
+    unsigned level = 0;
+    uint64_t index = 0;
+    unsigned columns = 0;           /* fewer in the last tile of a level */
+    unsigned bins = 0;
+    std::vector<uint8_t> values;    /* column after column, DC first */
+};
+
+struct Spectrogram;
+
+std::shared_ptr<Spectrogram> spectrogram_create(SpectrogramOptions const & options = SpectrogramOptions());
+
+SpectrogramOptions spectrogram_options(Spectrogram const * spectrogram);
+
+/* Frames and rate of the audio the tiles are of: set by a tap at the end
+ * of its render or by a fetch with the audio; 0 while unknown */
+uint64_t spectrogram_frames(Spectrogram const * spectrogram);
+double spectrogram_rate(Spectrogram const * spectrogram);
+uint64_t spectrogram_tile_count(Spectrogram const * spectrogram, unsigned level);
+
+/* Whether tiles first to first + count - 1 of level are all cached */
+bool spectrogram_cached(Spectrogram const * spectrogram, unsigned level, uint64_t first, uint64_t count);
+
+/* The tiles first to first + count - 1 of level (those that exist); the
+ * missing ones are computed from audio, the audio the cached tiles are of,
+ * on threads workers. audio may be NULL if spectrogram_cached() */
+int spectrogram_fetch(Spectrogram * spectrogram, AudioView const * audio, unsigned level, uint64_t first,
+                      uint64_t count, unsigned threads, std::vector<SpectrogramTile> * tiles);
+
+/* The tap; drops the cached tiles when it starts. The spectrogram is
+ * owned by the caller for the length of the flow */
+sox_effect_t * spectrogram_tap_create(Spectrogram * spectrogram);
+
+#endif //SOXTEST_SPECTROGRAM_H
@@ -0,0 +1,80 @@
+#include "test-signal.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "sox.h"
+#include "sox-ops.h"
+
+#define BLOCK_FRAMES 4096
+
+int write_test_signal(char const * path, double rate, unsigned channels, double seconds) {
+    sox_signalinfo_t signal = {rate, channels, 16, 0, NULL};
+    sox_format_t * out = sox_open_write(path, &signal, NULL, NULL, NULL, NULL);
+    if (!out) {
+        return RESULT_ERROR;
+    }
+
+    static const double partials[] = {110.0, 220.0, 329.63, 440.0, 659.26, 1318.5, 3520.0};
+    size_t total = (size_t) (seconds * rate);
+    std::vector<sox_sample_t> block(BLOCK_FRAMES * channels);
+    unsigned noise = 12345;
+    int result = RESULT_SUCCESS;
+
+    for (size_t frame = 0; frame < total && result == RESULT_SUCCESS; ) {
+        size_t frames = std::min((size_t) BLOCK_FRAMES, total - frame);
+        for (size_t i = 0; i < frames; i++, frame++) {
+            double t = frame / rate;
+            /* notes restart every half second and decay */
+            double envelope = std::exp(-4.0 * std::fmod(t, 0.5));
+            for (unsigned c = 0; c < channels; c++) {
+                double value = 0;
+                for (size_t p = 0; p < sizeof(partials) / sizeof(partials[0]); p++) {
+                    value += std::sin(2 * M_PI * partials[p] * (1 + 0.01 * c) * t) / (p + 2);
+                }
+                noise = noise * 1664525u + 1013904223u;
+                value = 0.4 * envelope * value + 0.01 * ((int) (noise >> 16) - 32768) / 32768.0;
+                block[i * channels + c] = (sox_sample_t) (value * 0.5 * SOX_SAMPLE_MAX);
+            }
+        }
+        if (sox_write(out, block.data(), frames * channels) != frames * channels) {
+            result = RESULT_ERROR;
+        }
+    }
+
+    sox_close(out);
+    return result;
+}
+
+int write_test_tones(char const * path, double rate, unsigned channels, double seconds,
+                     std::vector<double> const & freqs) {
+    sox_signalinfo_t signal = {rate, channels, 24, 0, NULL};
+    sox_format_t * out = sox_open_write(path, &signal, NULL, NULL, NULL, NULL);
+    if (!out) {
+        return RESULT_ERROR;
+    }
+
+    size_t total = (size_t) (seconds * rate);
+    std::vector<sox_sample_t> block(BLOCK_FRAMES * channels);
+    double amplitude = 0.5 / std::max((size_t) 1, freqs.size());
+    int result = RESULT_SUCCESS;
+
+    for (size_t frame = 0; frame < total && result == RESULT_SUCCESS; ) {
+        size_t frames = std::min((size_t) BLOCK_FRAMES, total - frame);
+        for (size_t i = 0; i < frames; i++, frame++) {
+            double value = 0;
+            for (double freq : freqs) {
+                value += amplitude * std::sin(2 * M_PI * freq * frame / rate);
+            }
+            for (unsigned c = 0; c < channels; c++) {
+                block[i * channels + c] = (sox_sample_t) (value * SOX_SAMPLE_MAX);
+            }
+        }
+        if (sox_write(out, block.data(), frames * channels) != frames * channels) {
+            result = RESULT_ERROR;
+        }
+    }
+
+    sox_close(out);
+    return result;
+}
@@ -0,0 +1,16 @@
+#ifndef SOXTEST_TEST_SIGNAL_H
+#define SOXTEST_TEST_SIGNAL_H
+
+#include <vector>
+
+/* Writes a deterministic music-like signal (a few decaying partials over
+ * low-level noise) to path; the file type follows the extension. Used as
+ * reference input by the calibration and benchmark code */
+int write_test_signal(char const * path, double rate, unsigned channels, double seconds);
+
+/* Writes steady sine tones of equal amplitude (and the same on every
+ * channel), the reference input of the quality measurements */
+int write_test_tones(char const * path, double rate, unsigned channels, double seconds,
+                     std::vector<double> const & freqs);
+
+#endif //SOXTEST_TEST_SIGNAL_H
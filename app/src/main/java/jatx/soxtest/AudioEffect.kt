@@ -5,6 +5,22 @@ import java.io.File
 sealed class AudioEffect {
     abstract val description: String
     abstract val fileNameModifier: String
+    // Stored in the saved project state
+    abstract val key: String
+
+    companion object {
+        fun fromKey(key: String): AudioEffect? {
+            val value = key.substringAfter(":")
+            return when (key.substringBefore(":")) {
+                "load" -> LoadFile(File(value))
+                "tempo" -> value.toFloatOrNull()?.let { Tempo(it) }
+                "pitch" -> value.toIntOrNull()?.let { Pitch(it) }
+                "reverse" -> Reverse
+                "normalize" -> value.toFloatOrNull()?.let { Normalize(it) }
+                else -> null
+            }
+        }
+    }
 }
 
 data class LoadFile(
@@ -12,23 +28,36 @@ data class LoadFile(
 ): AudioEffect() {
     override val description = "load file: ${file.name}"
     override val fileNameModifier = ""
+    override val key = "load:${file.absolutePath}"
 }
 
 data class Tempo(
-    private val tempo: Float
+    val tempo: Float
 ): AudioEffect() {
     override val description = "tempo: $tempo"
     override val fileNameModifier = "tempo_$tempo"
+    override val key = "tempo:$tempo"
 }
 
 data class Pitch(
-    private val pitch: Int
+    val pitch: Int
 ): AudioEffect() {
     override val description = "pitch: $pitch"
     override val fileNameModifier = "pitch_$pitch"
+    override val key = "pitch:$pitch"
+}
+
+// To a target integrated loudness (EBU R128), true peak held under -1 dBTP
+data class Normalize(
+    val targetLufs: Float
+): AudioEffect() {
+    override val description = "normalize: $targetLufs LUFS"
+    override val fileNameModifier = "normalize_$targetLufs"
+    override val key = "normalize:$targetLufs"
 }
 
 data object Reverse: AudioEffect() {
     override val description = "reverse"
     override val fileNameModifier = "reverse"
+    override val key = "reverse"
 }
\ No newline at end of file
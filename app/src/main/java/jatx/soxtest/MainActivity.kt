@@ -1,11 +1,13 @@
 package jatx.soxtest
 
 import android.Manifest
+import android.app.ActivityManager
 import android.media.AudioAttributes
 import android.media.MediaPlayer
 import android.net.Uri
 import android.os.Build
 import android.os.Bundle
+import android.provider.DocumentsContract
 import android.provider.MediaStore
 import android.util.Log
 import android.view.View
@@ -23,15 +25,9 @@ import kotlinx.coroutines.delay
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
 import org.apache.commons.io.FileUtils
-import org.jaudiotagger.audio.AudioFileIO
-import org.jaudiotagger.audio.flac.FlacTagWriter
-import org.jaudiotagger.audio.mp3.MP3File
-import org.jaudiotagger.tag.FieldKey
-import org.jaudiotagger.tag.flac.FlacTag
 import java.io.File
 import java.io.FileInputStream
 import java.io.FileOutputStream
-import java.io.RandomAccessFile
 import java.text.SimpleDateFormat
 import java.util.Date
 import java.util.Locale
@@ -57,8 +53,21 @@ class MainActivity : AppCompatActivity() {
         }
     }
 
-    private val tmpFiles = arrayListOf<File>()
+    private val saveAllFormatsLauncher = registerForActivityResult(
+        ActivityResultContracts.OpenDocumentTree()
+    ) { uri ->
+        uri?.let { theUri ->
+            trySaveAllFormatsToTree(theUri)
+        }
+    }
+
+    // The decoded source, the effects and their rendered stages
+    private lateinit var session: ProjectSession
+    // Mirrors the effect list of the session for the UI and the saved
+    // state: LoadFile of the source, then the effects
     private val appliedEffects = arrayListOf<AudioEffect>()
+    // Whether each of appliedEffects was rendered as a draft
+    private val appliedDrafts = arrayListOf<Boolean>()
 
     private var mediaPlayer: MediaPlayer? = null
 
@@ -77,13 +86,28 @@ class MainActivity : AppCompatActivity() {
 
     private var outFile: File? = null
 
+    private var pendingRender: PendingRender? = null
+    // The session's source was loaded with its silent head and tail trimmed
+    private var sourceTrimmed = false
+
+    private var runningTasks = 0
+    private var applyBlockingTasks = 0
+
     override fun onCreate(savedInstanceState: Bundle?) {
         super.onCreate(savedInstanceState)
 
         binding = ActivityMainBinding.inflate(layoutInflater)
         setContentView(binding.root)
 
-        cleanProject()
+        initNative()
+        session = ProjectSession(getSessionDir().absolutePath)
+        session.setSpectrograms(true)
+        binding.svSpectrogram.onTilesNeeded = { request ->
+            fetchSpectrogramTiles(request)
+        }
+        if (!restoreProject()) {
+            cleanProject()
+        }
 
         // Example of a call to a native method
         binding.btnLoadFile.setOnClickListener {
@@ -102,6 +126,10 @@ class MainActivity : AppCompatActivity() {
             trySaveAudioFile("ogg")
         }
 
+        binding.btnSaveAll.setOnClickListener {
+            saveAllFormatsLauncher.launch(null)
+        }
+
         binding.btnApplyTempo.setOnClickListener {
             val tempo = binding.etTempo.text.toString()
                 .takeIf { it.isNotEmpty() }
@@ -121,6 +149,13 @@ class MainActivity : AppCompatActivity() {
             applyReverse()
         }
 
+        binding.btnApplyNormalize.setOnClickListener {
+            val targetLufs = binding.etNormalize.text.toString()
+                .toFloatOrNull()
+                ?.takeIf { it < 0 } ?: DEFAULT_TARGET_LUFS
+            applyNormalize(targetLufs)
+        }
+
         binding.btnUndo.setOnClickListener {
             undoEffect()
         }
@@ -149,6 +184,7 @@ class MainActivity : AppCompatActivity() {
     override fun onDestroy() {
         super.onDestroy()
         stopAndReleasePlayer()
+        session.close()
     }
 
     override fun onBackPressed() {
@@ -157,11 +193,143 @@ class MainActivity : AppCompatActivity() {
     }
 
     private fun cleanProject() {
-        tmpFiles.clear()
         appliedEffects.clear()
+        appliedDrafts.clear()
         currentProjectFile = null
         outFile = null
+        pendingRender = null
+        sourceTrimmed = false
         FileUtils.cleanDirectory(getProjectDir())
+        getProjectStateFile().delete()
+    }
+
+    private fun getProjectStateFile() = File(filesDir, "project.json")
+
+    private fun saveProject() {
+        val source = currentProjectFile ?: return
+        ProjectState(
+            source = source.absolutePath,
+            effects = appliedEffects.drop(1),
+            drafts = appliedDrafts.drop(1),
+            pending = pendingRender,
+            trimSilence = sourceTrimmed
+        ).save(getProjectStateFile())
+    }
+
+    // Picks up the project of a process that was killed: decodes the source
+    // again and renders its effects on top; false when there is none or the
+    // source is gone
+    private fun restoreProject(): Boolean {
+        val state = ProjectState.load(getProjectStateFile()) ?: return false
+        val source = File(state.source)
+        if (!source.exists()) return false
+
+        currentProjectFile = source
+        currentTrack = Track().tryToFill(source, probeAudioFileJNI(source.absolutePath))
+        pendingRender = state.pending
+        sourceTrimmed = state.trimSilence
+        performAsync {
+            if (logRenderReport(session.load(source.absolutePath, state.trimSilence)).result != 0) {
+                return@performAsync
+            }
+            withContext(Dispatchers.Main) {
+                appliedEffects.add(LoadFile(source))
+                appliedDrafts.add(false)
+                showAppliedEffects()
+                showSpectrogram()
+            }
+            var restored = 0
+            for ((effect, draft) in state.effects.zip(state.drafts)) {
+                if (logRenderReport(session.apply(restored, effect, draft)).result != 0) {
+                    break
+                }
+                val base = restored++
+                withContext(Dispatchers.Main) {
+                    applyEffect(base, effect, draft)
+                }
+            }
+            state.pending?.let { pending ->
+                if (pending.base == restored) {
+                    renderPending(pending)
+                }
+            }
+        }
+        return true
+    }
+
+    // Runs the render set as pendingRender (on the main thread) and records
+    // it in the project state first, so that it is rendered again if the
+    // process dies before it is done. A newer apply to the same stage
+    // supersedes it: the native job stops, or its result is replaced
+    private suspend fun renderPending(pending: PendingRender) {
+        withContext(Dispatchers.Main) {
+            saveProject()
+        }
+        val report = logRenderReport(session.apply(pending.base, pending.effect, pending.draft))
+        withContext(Dispatchers.Main) {
+            if (pendingRender !== pending) {
+                return@withContext
+            }
+            pendingRender = null
+            if (report.result == 0) {
+                applyEffect(pending.base, pending.effect, pending.draft)
+                showToast("success")
+            } else {
+                saveProject()
+                showToast(report.error.takeIf { it.isNotEmpty() } ?: "an error occured")
+            }
+        }
+    }
+
+    private fun initNative() {
+        val tuningFile = File(filesDir, "sox-tuning.conf")
+        val ratePlansFile = File(filesDir, "rate-plans.conf")
+        val deviceId = "${Build.MANUFACTURER} ${Build.MODEL} ${Build.FINGERPRINT}"
+        val result = initNativeJNI(
+            tuningFile.absolutePath, ratePlansFile.absolutePath, deviceId
+        )
+        setMemoryBudgetJNI(getRenderMemoryBudget())
+        // Outside the project dir, which is wiped for every new project
+        val renderCacheDir = File(externalCacheDir ?: cacheDir, "renders")
+        initRenderCacheJNI(renderCacheDir.absolutePath, getRenderCacheQuota(renderCacheDir))
+        if (result == 1) {
+            performAsync {
+                val sweep = calibrateNativeJNI(cacheDir.absolutePath, tuningFile.absolutePath, deviceId)
+                Log.i("tuning", sweep)
+            }
+        }
+    }
+
+    // Stage files of the last process are left behind if it was killed; only
+    // the checkpoints of its renders are kept, for the restored project to
+    // resume them, and only for a day. Next to the render cache, on the same
+    // filesystem, so that stages are linked into it rather than copied
+    private fun getSessionDir(): File {
+        val dir = File(externalCacheDir ?: cacheDir, "session")
+        val cutoff = System.currentTimeMillis() - CHECKPOINT_MAX_AGE_MS
+        dir.listFiles()?.forEach { file ->
+            val checkpoint = file.name.endsWith(".part") || file.name.endsWith(".ckpt")
+            if (!checkpoint || file.lastModified() < cutoff) {
+                file.deleteRecursively()
+            }
+        }
+        dir.mkdirs()
+        return dir
+    }
+
+    // A render may grow by an eighth of the device's RAM, within 64..512 MB,
+    // before it is stopped with an error
+    private fun getRenderMemoryBudget(): Long {
+        val memoryInfo = ActivityManager.MemoryInfo()
+        (getSystemService(ACTIVITY_SERVICE) as ActivityManager).getMemoryInfo(memoryInfo)
+        return (memoryInfo.totalMem / 8).coerceIn(64L shl 20, 512L shl 20)
+    }
+
+    // Rendered WAVs are kept for later sessions in up to 2 GB, or a quarter
+    // of the free space if that is less
+    private fun getRenderCacheQuota(renderCacheDir: File): Long {
+        val usableSpace = (renderCacheDir.parentFile ?: renderCacheDir).usableSpace
+        return minOf(2L shl 30, usableSpace / 4)
     }
 
     private fun cleanOutFile() {
@@ -178,10 +346,14 @@ class MainActivity : AppCompatActivity() {
         binding.btnSaveMp3.isEnabled = enabled
         binding.btnSaveFlac.isEnabled = enabled
         binding.btnSaveOgg.isEnabled = enabled
+        binding.btnSaveAll.isEnabled = enabled
         binding.btnApplyTempo.isEnabled = enabled
         binding.btnApplyPitch.isEnabled = enabled
         binding.btnApplyReverse.isEnabled = enabled
+        binding.btnApplyNormalize.isEnabled = enabled
         binding.btnUndo.isEnabled = enabled
+        binding.cbDraftPreview.isEnabled = enabled
+        binding.cbTrimSilence.isEnabled = enabled
     }
 
     private fun tryOpenAudioFile() {
@@ -189,15 +361,20 @@ class MainActivity : AppCompatActivity() {
     }
 
     private fun trySaveAudioFile(extension: String) {
-        tmpFiles.lastOrNull()?.let { lastFile ->
+        if (appliedEffects.isNotEmpty()) {
             outFile = generateTmpFileFromCurrentDate(extension)
         }
-        currentProjectFile?.let {theCurrentProjectFile ->
+        getExportFileName(extension)?.let { fileName ->
+            saveAudioFileLauncher.launch(fileName)
+        }
+    }
+
+    private fun getExportFileName(extension: String): String? {
+        return currentProjectFile?.let { theCurrentProjectFile ->
             val fileNameParts = listOf(theCurrentProjectFile.nameWithoutExtension) +
                     appliedEffects.drop(1).map { it.fileNameModifier }
             val fileNameWithoutExtension = fileNameParts.joinToString("_")
-            val fileName = "${fileNameWithoutExtension}.$extension"
-            saveAudioFileLauncher.launch(fileName)
+            "${fileNameWithoutExtension}.$extension"
         }
     }
 
@@ -233,48 +410,48 @@ class MainActivity : AppCompatActivity() {
         fileOutputStream.close()
         inputStream?.close()
 
-        tmpFiles.add(newFile)
         currentProjectFile = newFile
 
-        currentTrack = Track().tryToFill(newFile)
+        currentTrack = Track().tryToFill(newFile, probeAudioFileJNI(newFile.absolutePath))
 
         return newFile.absolutePath
     }
 
     private suspend fun convertLastFileToOutFile(): Boolean {
-        tmpFiles.lastOrNull()?.let { lastFile ->
-            outFile?.let { theOutFile ->
-                val result = convertAudioFileJNI(lastFile.absolutePath, theOutFile.absolutePath)
-                if (result == 0) {
-                    withContext(Dispatchers.Main) {
-                        showToast("success")
-                    }
-                    trySaveTags()
-                    return true
-                } else {
-                    withContext(Dispatchers.Main) {
-                        showToast("an error occured")
-                    }
-                    return false
-                }
-            }
+        return outFile?.let { exportToOutFiles(listOf(it)) } ?: false
+    }
+
+    // Encodes the session's audio to all the outputs side by side, after
+    // rendering draft effects again at full quality
+    private suspend fun exportToOutFiles(outFiles: List<File>): Boolean {
+        if (appliedEffects.isEmpty()) {
+            return false
+        }
+        val outPaths = outFiles.map { it.absolutePath }.toTypedArray()
+        val report = logRenderReport(session.export(outPaths, getExportTags()))
+        withContext(Dispatchers.Main) {
+            showToast(if (report.result == 0) "success" else "an error occured")
         }
-        return false
+        return report.result == 0
     }
 
     private fun copyOutFileToUri(uri: Uri) {
-        val outputStream = contentResolver.openOutputStream(uri)
         outFile?.let { theOutFile ->
-            val fileInputStream = FileInputStream(theOutFile)
+            copyFileToUri(theOutFile, uri)
+        }
+    }
 
-            outputStream?.let {
-                fileInputStream.copyTo(it)
-                it.flush()
-                it.close()
-            }
+    private fun copyFileToUri(file: File, uri: Uri) {
+        val outputStream = contentResolver.openOutputStream(uri)
+        val fileInputStream = FileInputStream(file)
 
-            fileInputStream.close()
+        outputStream?.let {
+            fileInputStream.copyTo(it)
+            it.flush()
+            it.close()
         }
+
+        fileInputStream.close()
     }
 
     private fun tryLoadAudioFileFromUri(uri: Uri) {
@@ -292,19 +469,23 @@ class MainActivity : AppCompatActivity() {
     }
 
     private fun loadAudioFileFromUri(uri: Uri) {
+        stopAndReleasePlayer()
+        val trimSilence = binding.cbTrimSilence.isChecked
         performAsync {
             cleanProject()
             copyFileAndGetPath(uri)?.let { origPath ->
-                val newFile = generateTmpFileFromCurrentDate("wav")
-                val result = convertAudioFileJNI(origPath, newFile.absolutePath)
-                if (result == 0) {
-                    applyEffect(newFile, LoadFile(File(origPath)))
-                    withContext(Dispatchers.Main) {
+                val report = logRenderReport(session.load(origPath, trimSilence))
+                withContext(Dispatchers.Main) {
+                    if (report.result == 0) {
+                        sourceTrimmed = trimSilence
+                        appliedEffects.add(LoadFile(File(origPath)))
+                        appliedDrafts.add(false)
+                        showAppliedEffects()
+                        showSpectrogram()
+                        saveProject()
                         showToast("success")
-                    }
-                } else {
-                    withContext(Dispatchers.Main) {
-                        showToast("an error occured")
+                    } else {
+                        showToast(report.error.takeIf { it.isNotEmpty() } ?: "an error occured")
                     }
                 }
             }
@@ -334,6 +515,47 @@ class MainActivity : AppCompatActivity() {
         }
     }
 
+    private fun trySaveAllFormatsToTree(treeUri: Uri) {
+        val permissionListener = object: PermissionListener {
+            override fun onPermissionGranted() {
+                saveAllFormatsToTree(treeUri)
+            }
+
+            override fun onPermissionDenied(deniedPermissions: MutableList<String>?) {
+                Log.e("access", "no sdcard access")
+            }
+        }
+
+        checkMediaPermissions(permissionListener)
+    }
+
+    private fun saveAllFormatsToTree(treeUri: Uri) {
+        if (appliedEffects.isEmpty()) {
+            return
+        }
+        val extensions = listOf("mp3", "flac", "ogg")
+        performAsync {
+            val outFiles = extensions.map { generateTmpFileFromCurrentDate(it) }
+            if (exportToOutFiles(outFiles)) {
+                val parentUri = DocumentsContract.buildDocumentUriUsingTree(
+                    treeUri, DocumentsContract.getTreeDocumentId(treeUri)
+                )
+                outFiles.forEach { file ->
+                    val mimeType = when (file.extension) {
+                        "mp3" -> "audio/mpeg"
+                        "flac" -> "audio/flac"
+                        else -> "audio/ogg"
+                    }
+                    val fileName = getExportFileName(file.extension) ?: file.name
+                    DocumentsContract.createDocument(contentResolver, parentUri, mimeType, fileName)?.let {
+                        copyFileToUri(file, it)
+                    }
+                }
+            }
+            outFiles.forEach { FileUtils.deleteQuietly(it) }
+        }
+    }
+
     private fun checkMediaPermissions(permissionListener: PermissionListener) {
         if (Build.VERSION.SDK_INT >= 33) {
             TedPermission.create()
@@ -361,123 +583,160 @@ class MainActivity : AppCompatActivity() {
     }
 
     private fun applyTempo(tempo: Float) {
-        performAsync {
-            tmpFiles.lastOrNull()?.let { inFile ->
-                val newFile = generateTmpFileFromCurrentDate("wav")
-                val result = applyTempoJNI(inFile.absolutePath, newFile.absolutePath, tempo.toString())
-                if (result == 0) {
-                    applyEffect(newFile, Tempo(tempo))
-                    withContext(Dispatchers.Main) {
-                        showToast("success")
-                    }
-                } else {
-                    withContext(Dispatchers.Main) {
-                        showToast("an error occured")
-                    }
-                }
-            }
-        }
+        applyAudioEffect(Tempo(tempo))
     }
 
     private fun applyPitch(pitch: Int) {
-        performAsync {
-            tmpFiles.lastOrNull()?.let { inFile ->
-                val newFile = generateTmpFileFromCurrentDate("wav")
-                val result = applyPitchJNI(inFile.absolutePath, newFile.absolutePath, pitch.toString())
-                if (result == 0) {
-                    applyEffect(newFile, Pitch(pitch))
-                    withContext(Dispatchers.Main) {
-                        showToast("success")
-                    }
-                } else {
-                    withContext(Dispatchers.Main) {
-                        showToast("an error occured")
-                    }
-                }
-            }
-        }
+        applyAudioEffect(Pitch(pitch))
     }
 
     private fun applyReverse() {
-        performAsync {
-            tmpFiles.lastOrNull()?.let { inFile ->
-                val newFile = generateTmpFileFromCurrentDate("wav")
-                val result = applyReverseJNI(inFile.absolutePath, newFile.absolutePath)
-                if (result == 0) {
-                    applyEffect(newFile, Reverse)
-                    withContext(Dispatchers.Main) {
-                        showToast("success")
-                    }
-                } else {
-                    withContext(Dispatchers.Main) {
-                        showToast("an error occured")
-                    }
-                }
-            }
+        applyAudioEffect(Reverse)
+    }
+
+    // A gain from the loudness of the stage below, measured when it rendered
+    private fun applyNormalize(targetLufs: Float) {
+        applyAudioEffect(Normalize(targetLufs))
+    }
+
+    // The apply buttons stay enabled while an effect renders: applying again
+    // before it is done replaces the effect being rendered
+    private fun applyAudioEffect(audioEffect: AudioEffect) {
+        if (appliedEffects.isEmpty()) return
+        val draft = binding.cbDraftPreview.isChecked
+        val pending = PendingRender(audioEffect, appliedEffects.size - 1, draft)
+        pendingRender = pending
+        performAsync(blocksApply = false) {
+            renderPending(pending)
         }
     }
 
-    private suspend fun applyEffect(newFile: File, audioEffect: AudioEffect) = withContext(Dispatchers.Main) {
-        tmpFiles.add(newFile)
+    // Effect base + 1 replaces whatever came after stage base, as in the session
+    private fun applyEffect(base: Int, audioEffect: AudioEffect, draft: Boolean) {
+        appliedEffects.subList(base + 1, appliedEffects.size).clear()
         appliedEffects.add(audioEffect)
-        val text = appliedEffects.reversed().joinToString(separator="\n") { it.description }
-        binding.etAppliedEffects.setText(text)
+        appliedDrafts.subList(base + 1, appliedDrafts.size).clear()
+        appliedDrafts.add(draft)
+        showAppliedEffects()
+        showSpectrogram()
+        saveProject()
 
         stopAndReleasePlayer()
     }
 
+    private fun showAppliedEffects() {
+        val text = appliedEffects.reversed().joinToString(separator="\n") { it.description }
+        binding.etAppliedEffects.setText(text)
+    }
+
     private fun undoEffect() {
         val lastEffect = appliedEffects.lastOrNull() ?: return
         if (lastEffect is LoadFile) return
-        val lastFile = tmpFiles.lastOrNull() ?: return
+        if (!session.undo()) return
 
         stopAndReleasePlayer()
 
-        FileUtils.delete(lastFile)
-        tmpFiles.removeLast()
         appliedEffects.removeLast()
-        val text = appliedEffects.reversed().joinToString(separator="\n") { it.description }
-        binding.etAppliedEffects.setText(text)
+        appliedDrafts.removeLast()
+        showAppliedEffects()
+        showSpectrogram()
+        saveProject()
+    }
+
+    // The spectrogram of the current audio, the top stage; rendered with
+    // the stage, its tiles are usually there already
+    private fun showSpectrogram() {
+        val stage = appliedEffects.size - 1
+        lifecycleScope.launch {
+            val info = withContext(Dispatchers.IO) {
+                session.spectrogramInfo(stage)
+            }
+            if (stage == appliedEffects.size - 1) {
+                binding.svSpectrogram.setSpectrogram(stage, info)
+            }
+        }
     }
 
-    private fun performAsync(block: suspend () -> Unit) {
+    private fun fetchSpectrogramTiles(request: SpectrogramTileRequest) {
+        lifecycleScope.launch {
+            val tiles = withContext(Dispatchers.IO) {
+                session.spectrogramTiles(request.stage, request.level, request.first, request.count)
+                    ?.map { SpectrogramView.tileBitmap(it, request.bins) }
+            }
+            if (tiles == null) {
+                Log.e("spectrogram", "no tiles for $request")
+            }
+            binding.svSpectrogram.putTiles(request, tiles)
+        }
+    }
+
+    // Tasks may overlap (an effect applied again while it renders), so the
+    // buttons come back once the last one is done
+    private fun performAsync(blocksApply: Boolean = true, block: suspend () -> Unit) {
         lifecycleScope.launch {
             withContext(Dispatchers.Main) {
-                setButtonsEnables(false)
+                runningTasks++
+                if (blocksApply) applyBlockingTasks++
+                updateButtons()
             }
             withContext(Dispatchers.IO) {
                 block.invoke()
             }
             withContext(Dispatchers.Main) {
-                setButtonsEnables(true)
+                runningTasks--
+                if (blocksApply) applyBlockingTasks--
+                updateButtons()
             }
         }
     }
 
+    private fun updateButtons() {
+        setButtonsEnables(runningTasks == 0)
+        if (runningTasks > 0 && applyBlockingTasks == 0) {
+            binding.btnApplyTempo.isEnabled = true
+            binding.btnApplyPitch.isEnabled = true
+            binding.btnApplyReverse.isEnabled = true
+            binding.btnApplyNormalize.isEnabled = true
+        }
+    }
+
     private fun playResult() {
-        if (mediaPlayer == null) {
-            mediaPlayer = MediaPlayer().apply {
-                setAudioAttributes(
-                    AudioAttributes.Builder()
-                        .setContentType(AudioAttributes.CONTENT_TYPE_MUSIC)
-                        .setUsage(AudioAttributes.USAGE_MEDIA)
-                        .build()
-                )
-            }
+        if (mediaPlayer != null) {
+            mediaPlayer?.start()
+            onPlaybackStarted()
+            return
+        }
+        if (appliedEffects.isEmpty()) return
 
-            tmpFiles.lastOrNull()?.let { lastFile ->
-                mediaPlayer?.setDataSource(applicationContext, lastFile.toUri())
-                mediaPlayer?.prepare()
-                mediaPlayer?.setOnCompletionListener {
-                    stopAndReleasePlayer()
+        // The player reads a file, so the session writes its audio out for it
+        val previewFile = File(getProjectDir(), "preview.wav")
+        performAsync {
+            val report = logRenderReport(session.preview(previewFile.absolutePath))
+            withContext(Dispatchers.Main) {
+                if (report.result != 0 || mediaPlayer != null) {
+                    return@withContext
+                }
+                mediaPlayer = MediaPlayer().apply {
+                    setAudioAttributes(
+                        AudioAttributes.Builder()
+                            .setContentType(AudioAttributes.CONTENT_TYPE_MUSIC)
+                            .setUsage(AudioAttributes.USAGE_MEDIA)
+                            .build()
+                    )
+                    setDataSource(applicationContext, previewFile.toUri())
+                    prepare()
+                    setOnCompletionListener {
+                        stopAndReleasePlayer()
+                    }
                 }
                 binding.seekBar.max = mediaPlayer?.duration ?: 0
                 mediaPlayer?.start()
+                onPlaybackStarted()
             }
-        } else {
-            mediaPlayer?.start()
         }
+    }
 
+    private fun onPlaybackStarted() {
         lifecycleScope.launch {
             while (mediaPlayer?.isPlaying == true) {
                 delay(50L)
@@ -507,65 +766,29 @@ class MainActivity : AppCompatActivity() {
         binding.btnPause.visibility = View.GONE
     }
 
-    private suspend fun trySaveTags() {
-        try {
-            when (outFile?.extension) {
-                "mp3" -> {
-                    saveMP3Tags()
-                }
-                "flac" -> {
-                    saveFLACTags()
-                }
-            }
-        } catch (e: Throwable) {
-            Log.e("error", "save tags", e)
-            withContext(Dispatchers.Main) {
-                showToast("an error occured")
-            }
-            showToast("an error occured")
-        }
-    }
-
-    private fun saveMP3Tags() {
-        outFile?.let { file ->
-
-            val mp3f = MP3File(file)
-            val tag = mp3f.createDefaultTag()
-
-            currentTrack?.let {
-                val artist = "SoxTest"
-                val title = "${it.title} (${it.artist} Cover)"
-                tag.setField(FieldKey.ARTIST, artist)
-                tag.setField(FieldKey.ALBUM_ARTIST, artist)
-                tag.setField(FieldKey.ALBUM, it.album)
-                tag.setField(FieldKey.TITLE, title)
-                tag.setField(FieldKey.YEAR, it.year)
-                tag.setField(FieldKey.COMMENT, "tag created with SoxTest")
-
-                mp3f.tag = tag
-                mp3f.save(file)
-            }
-        }
-    }
-
-    private fun saveFLACTags() {
-        outFile?.let { file ->
-            val af = AudioFileIO.read(file)
-            val tag = af.tagOrCreateDefault as FlacTag
-            currentTrack?.let {
-                val artist = "SoxTest"
-                val title = "${it.title} (${it.artist} Cover)"
-                tag.setField(FieldKey.ARTIST, artist)
-                tag.setField(FieldKey.ALBUM_ARTIST, artist)
-                tag.setField(FieldKey.ALBUM, it.album)
-                tag.setField(FieldKey.TITLE, title)
-                tag.setField(FieldKey.YEAR, it.year)
-                tag.setField(FieldKey.COMMENT, "tag created with SoxTest")
-
-                val raf = RandomAccessFile(file, "rw")
-                FlacTagWriter().write(tag, raf, raf)
-            }
+    // Written by the encoders as ID3v2 frames (MP3) or Vorbis comments (FLAC, OGG)
+    private fun getExportTags(): Array<String> {
+        return currentTrack?.let {
+            val artist = "SoxTest"
+            val title = "${it.title} (${it.artist} Cover)"
+            arrayOf(
+                "Artist=$artist",
+                "Albumartist=$artist",
+                "Album=${it.album}",
+                "Title=$title",
+                "Year=${it.year}",
+                "Comment=tag created with SoxTest"
+            )
+        } ?: arrayOf()
+    }
+
+    private fun logRenderReport(report: RenderReport): RenderReport {
+        if (report.result == 0) {
+            Log.i("render", report.summary)
+        } else {
+            Log.e("render", "${report.operation}: ${report.error}")
         }
+        return report
     }
 
     private fun showToast(msg: String) {
@@ -578,12 +801,21 @@ class MainActivity : AppCompatActivity() {
      */
     external fun stringFromJNI(): String
 
-    external fun convertAudioFileJNI(inPath: String, outPath: String): Int
-    external fun applyTempoJNI(inPath: String, outPath: String, tempo: String): Int
-    external fun applyPitchJNI(inPath: String, outPath: String, pitch: String): Int
-    external fun applyReverseJNI(inPath: String, outPath: String): Int
+    external fun initNativeJNI(
+        tuningPath: String, ratePlansPath: String, deviceId: String
+    ): Int
+    external fun calibrateNativeJNI(workDir: String, tuningPath: String, deviceId: String): String
+    external fun setMemoryBudgetJNI(bytes: Long)
+    external fun initRenderCacheJNI(cacheDir: String, quotaBytes: Long)
+    external fun probeAudioFileJNI(path: String): String
 
     companion object {
+        // Streaming platforms' usual loudness, for an empty or positive entry
+        private const val DEFAULT_TARGET_LUFS = -16f
+
+        // Render checkpoints older than this are not resumed
+        private const val CHECKPOINT_MAX_AGE_MS = 24L * 60 * 60 * 1000
+
         // Used to load the 'soxtest' library on application startup.
         init {
             System.loadLibrary("sox")
@@ -0,0 +1,93 @@
+package jatx.soxtest
+
+// The native project session (project-session.h): the source, the effect
+// list and the rendered stages are held natively, here by handle. Stage n
+// is the audio after n effects, a file in dir; the renders run as
+// RenderJobs and are awaited like them. Stages are shared through the
+// render cache, so that a project restored later links them in instead of
+// rendering them again, and a render cut short resumes from its checkpoint
+class ProjectSession(dir: String) : AutoCloseable {
+
+    private val handle = createJNI(dir)
+
+    val effectCount: Int
+        get() = effectCountJNI(handle)
+
+    // The silent regions of the source come back in the report; trimmed,
+    // its leading and trailing silence never reach the effects
+    suspend fun load(path: String, trimSilence: Boolean = false): RenderReport =
+        RenderJobs.await(submitLoadJNI(handle, path, RenderJobs.PRIORITY_INTERACTIVE, trimSilence), null)
+
+    // Renders the effect on top of stage base; effects above base are
+    // replaced. A newer apply to the same stage supersedes this one
+    suspend fun apply(
+        base: Int, effect: AudioEffect, draft: Boolean,
+        priority: Int = RenderJobs.PRIORITY_INTERACTIVE, onProgress: ((Double) -> Unit)? = null
+    ): RenderReport {
+        val (type, value) = when (effect) {
+            is Tempo -> EFFECT_TEMPO to effect.tempo.toDouble()
+            is Pitch -> EFFECT_PITCH to effect.pitch.toDouble()
+            is Reverse -> EFFECT_REVERSE to 0.0
+            is Normalize -> EFFECT_NORMALIZE to effect.targetLufs.toDouble()
+            is LoadFile -> throw IllegalArgumentException("not an effect: $effect")
+        }
+        return RenderJobs.await(submitApplyJNI(handle, base, type, value, draft, priority), onProgress)
+    }
+
+    fun undo(): Boolean = undoJNI(handle)
+
+    // Writes the current audio to a file for the player
+    suspend fun preview(path: String): RenderReport =
+        RenderJobs.await(submitPreviewJNI(handle, path, RenderJobs.PRIORITY_INTERACTIVE), null)
+
+    // Draft effects are rendered again at full quality first
+    suspend fun export(
+        outPaths: Array<String>, tags: Array<String>, onProgress: ((Double) -> Unit)? = null
+    ): RenderReport =
+        RenderJobs.await(submitExportJNI(handle, outPaths, tags, RenderJobs.PRIORITY_EXPORT), onProgress)
+
+    // Stages and their memory, as JSON
+    fun describe(): String = describeJNI(handle)
+
+    // Spectrograms of the stages rendered from now on are computed while
+    // they render, so a view of them finds the tiles ready
+    fun setSpectrograms(enabled: Boolean) = setSpectrogramsJNI(handle, enabled)
+
+    // The geometry of stage's spectrogram; null if there is no such stage.
+    // May read or render a dropped stage again, so not on the main thread
+    fun spectrogramInfo(stage: Int): SpectrogramInfo? = SpectrogramInfo.fromJson(spectrogramInfoJNI(handle, stage))
+
+    // Tiles first until first + count of level, fewer at the end of the
+    // audio; missing ones are computed, so not on the main thread
+    fun spectrogramTiles(stage: Int, level: Int, first: Long, count: Int): Array<ByteArray>? =
+        spectrogramTilesJNI(handle, stage, level, first, count)
+
+    override fun close() = closeJNI(handle)
+
+    private external fun createJNI(dir: String): Long
+    private external fun closeJNI(handle: Long)
+    private external fun submitLoadJNI(handle: Long, path: String, priority: Int, trimSilence: Boolean): Long
+    private external fun submitApplyJNI(
+        handle: Long, base: Int, type: Int, value: Double, draft: Boolean, priority: Int
+    ): Long
+    private external fun undoJNI(handle: Long): Boolean
+    private external fun submitPreviewJNI(handle: Long, path: String, priority: Int): Long
+    private external fun submitExportJNI(
+        handle: Long, outPaths: Array<String>, tags: Array<String>, priority: Int
+    ): Long
+    private external fun effectCountJNI(handle: Long): Int
+    private external fun describeJNI(handle: Long): String
+    private external fun setSpectrogramsJNI(handle: Long, enabled: Boolean)
+    private external fun spectrogramInfoJNI(handle: Long, stage: Int): String
+    private external fun spectrogramTilesJNI(
+        handle: Long, stage: Int, level: Int, first: Long, count: Int
+    ): Array<ByteArray>?
+
+    companion object {
+        // SessionEffectType
+        private const val EFFECT_TEMPO = 0
+        private const val EFFECT_PITCH = 1
+        private const val EFFECT_REVERSE = 2
+        private const val EFFECT_NORMALIZE = 3
+    }
+}
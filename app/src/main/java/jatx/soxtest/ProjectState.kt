@@ -0,0 +1,70 @@
+package jatx.soxtest
+
+import org.json.JSONArray
+import org.json.JSONObject
+import java.io.File
+
+// An effect that was rendering when the state was saved; it is applied
+// again on top of stage base when the project is restored
+data class PendingRender(
+    val effect: AudioEffect,
+    val base: Int,
+    val draft: Boolean
+)
+
+// What MainActivity needs to pick up an edit after the process was killed.
+// The stages lived in the native session, so the source is decoded and the
+// effects are rendered again
+data class ProjectState(
+    val source: String,
+    val effects: List<AudioEffect>,
+    // Whether each of effects was rendered as a draft, to render it again
+    // the same way
+    val drafts: List<Boolean>,
+    val pending: PendingRender?,
+    // The source was loaded with its leading and trailing silence trimmed
+    val trimSilence: Boolean = false
+) {
+    fun save(file: File) {
+        val obj = JSONObject()
+        obj.put("source", source)
+        obj.put("effects", JSONArray(effects.map { it.key }))
+        obj.put("drafts", JSONArray(drafts))
+        obj.put("trim_silence", trimSilence)
+        pending?.let {
+            val pendingObj = JSONObject()
+            pendingObj.put("effect", it.effect.key)
+            pendingObj.put("base", it.base)
+            pendingObj.put("draft", it.draft)
+            obj.put("pending", pendingObj)
+        }
+        val tmpFile = File(file.parentFile, "${file.name}.tmp")
+        tmpFile.writeText(obj.toString())
+        tmpFile.renameTo(file)
+    }
+
+    companion object {
+        fun load(file: File): ProjectState? {
+            return try {
+                val obj = JSONObject(file.readText())
+                val effectsArray = obj.getJSONArray("effects")
+                val effects = (0 until effectsArray.length()).map {
+                    AudioEffect.fromKey(effectsArray.getString(it)) ?: return null
+                }
+                // States saved before the flag was kept rendered at full quality
+                val draftsArray = obj.optJSONArray("drafts")
+                val drafts = effects.indices.map { draftsArray?.optBoolean(it) ?: false }
+                val pending = obj.optJSONObject("pending")?.let {
+                    PendingRender(
+                        effect = AudioEffect.fromKey(it.getString("effect")) ?: return null,
+                        base = it.getInt("base"),
+                        draft = it.getBoolean("draft")
+                    )
+                }
+                ProjectState(obj.getString("source"), effects, drafts, pending, obj.optBoolean("trim_silence"))
+            } catch (e: Exception) {
+                null
+            }
+        }
+    }
+}
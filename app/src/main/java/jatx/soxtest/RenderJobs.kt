@@ -0,0 +1,75 @@
+package jatx.soxtest
+
+import kotlinx.coroutines.suspendCancellableCoroutine
+import kotlin.coroutines.resume
+
+// Bridge of the native render jobs (render-jobs.h) to coroutines: a job runs
+// on a native worker and its completion resumes the awaiting coroutine from
+// the native callback thread, so no thread of the app waits for a render
+object RenderJobs {
+
+    const val STATE_QUEUED = 0
+    const val STATE_RUNNING = 1
+    const val STATE_SUCCEEDED = 2
+    const val STATE_FAILED = 3
+    const val STATE_CANCELLED = 4
+
+    // Priority classes of the native scheduler
+    const val PRIORITY_INTERACTIVE = 0
+    const val PRIORITY_EXPORT = 1
+    const val PRIORITY_BACKGROUND = 2
+
+    private class Waiter(
+        val onDone: (RenderReport) -> Unit,
+        val onProgress: ((Double) -> Unit)?
+    )
+
+    private val lock = Any()
+    private val waiters = hashMapOf<Long, Waiter>()
+    // Jobs that finished before anybody waited for them
+    private val finished = hashMapOf<Long, RenderReport>()
+
+    init {
+        initJNI()
+    }
+
+    // Awaits any job reported to this listener, ProjectSession's; a job
+    // superseded by a newer one completes with the error "superseded".
+    // Cancelling the coroutine cancels the job at its next block
+    suspend fun await(id: Long, onProgress: ((Double) -> Unit)?): RenderReport =
+        suspendCancellableCoroutine { continuation ->
+            continuation.invokeOnCancellation {
+                cancelJNI(id)
+            }
+            val report = synchronized(lock) {
+                finished.remove(id) ?: run {
+                    waiters[id] = Waiter({ continuation.resume(it) }, onProgress)
+                    null
+                }
+            }
+            report?.let { continuation.resume(it) }
+        }
+
+    @Suppress("unused") // called from the native callback thread
+    fun onJobProgress(id: Long, progress: Double) {
+        val waiter = synchronized(lock) { waiters[id] }
+        waiter?.onProgress?.invoke(progress)
+    }
+
+    @Suppress("unused") // called from the native callback thread
+    fun onJobDone(id: Long, state: Int, reportJson: String) {
+        val report = RenderReport.fromJson(reportJson)
+        val waiter = synchronized(lock) {
+            waiters.remove(id) ?: run {
+                finished[id] = report
+                null
+            }
+        }
+        waiter?.onDone?.invoke(report)
+    }
+
+    private external fun initJNI()
+    external fun cancelJNI(id: Long): Boolean
+    external fun statusJNI(id: Long): String
+    external fun awaitJNI(id: Long, timeoutMs: Long): Int
+}
@@ -0,0 +1,156 @@
+package jatx.soxtest
+
+import org.json.JSONObject
+
+data class StageReport(
+    val name: String,
+    val flows: Int,
+    val flowMs: Double,
+    val drainMs: Double,
+    val flowCalls: Long,
+    val drainCalls: Long,
+    val samplesIn: Long,
+    val samplesOut: Long,
+    val clips: Long
+)
+
+// EBU R128 measurement of a loudness tap in the chain (loudness.h)
+data class LoudnessReport(
+    val frames: Long,
+    val integratedLufs: Double,
+    val rangeLu: Double,
+    val momentaryMaxLufs: Double,
+    val shortTermMaxLufs: Double,
+    val truePeakDbtp: Double,
+    val samplePeakDbfs: Double
+) {
+    val summary: String
+        get() = "${"%.1f".format(integratedLufs)} LUFS, LRA ${"%.1f".format(rangeLu)} LU, " +
+                "true peak ${"%.1f".format(truePeakDbtp)} dBTP"
+}
+
+// Silent regions of an import (silence.h), in frames
+data class SilenceReport(
+    val frames: Long,
+    val leadFrames: Long,
+    val trailFrames: Long,
+    val trimmed: Boolean,
+    val regions: List<Pair<Long, Long>>
+) {
+    fun summary(rate: Double): String {
+        val lead = "%.2f".format(leadFrames / rate)
+        val trail = "%.2f".format(trailFrames / rate)
+        return "silence: ${regions.size} regions, lead $lead s, trail $trail s${if (trimmed) " trimmed" else ""}"
+    }
+}
+
+data class RenderReport(
+    val operation: String = "",
+    val result: Int = 0,
+    val error: String = "",
+    val inRate: Double = 0.0,
+    val outRate: Double = 0.0,
+    val channels: Int = 0,
+    val threads: Int = 0,
+    val totalMs: Double = 0.0,
+    val flowMs: Double = 0.0,
+    val inputBytes: Long = 0,
+    val outputBytes: Long = 0,
+    val readWaitMs: Double = 0.0,
+    val writeWaitMs: Double = 0.0,
+    val clips: Long = 0,
+    val resumedSamples: Long = 0,
+    val peakRssBytes: Long = 0,
+    val rssGrowthBytes: Long = 0,
+    val cacheHit: Boolean = false,
+    val loudness: LoudnessReport? = null,
+    val silence: SilenceReport? = null,
+    val stages: List<StageReport> = listOf()
+) {
+    val summary: String
+        get() {
+            val stagesText = stages.joinToString(separator = "; ") {
+                "${it.name}: ${"%.1f".format(it.flowMs + it.drainMs)} ms, " +
+                        "${it.samplesIn} -> ${it.samplesOut}, clips ${it.clips}"
+            }
+            val resumedText = if (resumedSamples > 0) ", resumed at $resumedSamples" else ""
+            val loudnessText = loudness?.let { ", ${it.summary}" } ?: ""
+            val silenceText = silence?.takeIf { inRate > 0 }?.let { ", ${it.summary(inRate)}" } ?: ""
+            if (cacheHit) {
+                return "$operation: ${"%.1f".format(totalMs)} ms, from the render cache (out $outputBytes B)"
+            }
+            return "$operation: ${"%.1f".format(totalMs)} ms, threads $threads$resumedText$loudnessText$silenceText " +
+                    "(read ${"%.1f".format(readWaitMs)} ms, write ${"%.1f".format(writeWaitMs)} ms, " +
+                    "in $inputBytes B, out $outputBytes B, clips $clips, " +
+                    "rss +${rssGrowthBytes / 1024} KB) [$stagesText]"
+        }
+
+    companion object {
+        fun fromJson(json: String): RenderReport {
+            val obj = JSONObject(json)
+            if (!obj.has("operation")) return RenderReport()
+            val stagesArray = obj.getJSONArray("stages")
+            val stages = (0 until stagesArray.length()).map { i ->
+                val stage = stagesArray.getJSONObject(i)
+                StageReport(
+                    name = stage.getString("name"),
+                    flows = stage.getInt("flows"),
+                    flowMs = stage.getDouble("flow_ms"),
+                    drainMs = stage.getDouble("drain_ms"),
+                    flowCalls = stage.getLong("flow_calls"),
+                    drainCalls = stage.getLong("drain_calls"),
+                    samplesIn = stage.getLong("samples_in"),
+                    samplesOut = stage.getLong("samples_out"),
+                    clips = stage.getLong("clips")
+                )
+            }
+            val loudness = obj.optJSONObject("loudness")?.let {
+                LoudnessReport(
+                    frames = it.getLong("frames"),
+                    integratedLufs = it.getDouble("integrated_lufs"),
+                    rangeLu = it.getDouble("range_lu"),
+                    momentaryMaxLufs = it.getDouble("momentary_max_lufs"),
+                    shortTermMaxLufs = it.getDouble("short_term_max_lufs"),
+                    truePeakDbtp = it.getDouble("true_peak_dbtp"),
+                    samplePeakDbfs = it.getDouble("sample_peak_dbfs")
+                )
+            }
+            val silence = obj.optJSONObject("silence")?.let {
+                val regionsArray = it.getJSONArray("regions")
+                SilenceReport(
+                    frames = it.getLong("frames"),
+                    leadFrames = it.getLong("lead_frames"),
+                    trailFrames = it.getLong("trail_frames"),
+                    trimmed = it.getBoolean("trimmed"),
+                    regions = (0 until regionsArray.length()).map { i ->
+                        val region = regionsArray.getJSONObject(i)
+                        region.getLong("start") to region.getLong("frames")
+                    }
+                )
+            }
+            return RenderReport(
+                operation = obj.getString("operation"),
+                result = obj.getInt("result"),
+                error = obj.getString("error"),
+                inRate = obj.getDouble("in_rate"),
+                outRate = obj.getDouble("out_rate"),
+                channels = obj.getInt("channels"),
+                threads = obj.getInt("threads"),
+                totalMs = obj.getDouble("total_ms"),
+                flowMs = obj.getDouble("flow_ms"),
+                inputBytes = obj.getLong("input_bytes"),
+                outputBytes = obj.getLong("output_bytes"),
+                readWaitMs = obj.getDouble("read_wait_ms"),
+                writeWaitMs = obj.getDouble("write_wait_ms"),
+                clips = obj.getLong("clips"),
+                resumedSamples = obj.optLong("resumed_samples"),
+                peakRssBytes = obj.optLong("peak_rss_bytes"),
+                rssGrowthBytes = obj.optLong("rss_growth_bytes"),
+                cacheHit = obj.optBoolean("cache_hit"),
+                loudness = loudness,
+                silence = silence,
+                stages = stages
+            )
+        }
+    }
+}
@@ -0,0 +1,276 @@
+package jatx.soxtest
+
+import android.content.Context
+import android.graphics.Bitmap
+import android.graphics.Canvas
+import android.graphics.Color
+import android.graphics.Paint
+import android.graphics.Rect
+import android.graphics.RectF
+import android.util.AttributeSet
+import android.util.LruCache
+import android.view.GestureDetector
+import android.view.MotionEvent
+import android.view.ScaleGestureDetector
+import android.view.View
+import org.json.JSONObject
+import kotlin.math.floor
+import kotlin.math.max
+import kotlin.math.min
+
+// Geometry of a native spectrogram (spectrogram.h): tiles of tileColumns
+// columns of bins bytes each, column k of level z starting at frame
+// k * (hop shl z); tileCounts has one entry per level
+data class SpectrogramInfo(
+    val frames: Long,
+    val rate: Double,
+    val bins: Int,
+    val hop: Int,
+    val floorDb: Double,
+    val tileColumns: Int,
+    val tileCounts: List<Long>
+) {
+    val levels: Int
+        get() = tileCounts.size
+
+    fun columns(level: Int): Long {
+        val hop = hop.toLong() shl level
+        return (frames + hop - 1) / hop
+    }
+
+    companion object {
+        fun fromJson(json: String): SpectrogramInfo? {
+            val obj = JSONObject(json)
+            if (!obj.has("frames")) return null
+            val tilesArray = obj.getJSONArray("tiles")
+            return SpectrogramInfo(
+                frames = obj.getLong("frames"),
+                rate = obj.getDouble("rate"),
+                bins = obj.getInt("bins"),
+                hop = obj.getInt("hop"),
+                floorDb = obj.getDouble("floor_db"),
+                tileColumns = obj.getInt("tile_columns"),
+                tileCounts = (0 until tilesArray.length()).map { tilesArray.getLong(it) }
+            )
+        }
+    }
+}
+
+// Tiles the view lacks, first until first + count of level; the answer goes
+// back to putTiles() with the request
+data class SpectrogramTileRequest(
+    val generation: Int, val stage: Int, val level: Int, val first: Long, val count: Int, val bins: Int
+)
+
+// Shows the spectrogram of a session stage tile by tile: drag to pan, pinch
+// to zoom. A pinch to twice or half the size steps a level, so a column is
+// never narrower than a pixel. The view asks for the tiles it lacks at its edges
+// through onTilesNeeded and keeps the ones it got as bitmaps, so panning
+// back over them asks for nothing; while a tile is on its way the coarser
+// one stands in for it
+class SpectrogramView @JvmOverloads constructor(
+    context: Context, attrs: AttributeSet? = null
+) : View(context, attrs) {
+
+    // Called on the main thread; the tiles are fetched off it
+    var onTilesNeeded: ((SpectrogramTileRequest) -> Unit)? = null
+
+    private var info: SpectrogramInfo? = null
+    private var stage = -1
+    // Answers to requests of an older spectrogram are dropped
+    private var generation = 0
+    private var fitPending = false
+
+    private var level = 0
+    // Pixels per column of the level, 1..2 but at the ends of the levels
+    private var scale = 1f
+    // Column of the level at the left edge
+    private var offset = 0f
+
+    private val bitmaps = object : LruCache<Long, Bitmap>(MAX_BITMAP_BYTES) {
+        override fun sizeOf(key: Long, value: Bitmap) = value.byteCount
+    }
+    private val requested = hashSetOf<Long>()
+
+    private val paint = Paint(Paint.FILTER_BITMAP_FLAG)
+    private val src = Rect()
+    private val dst = RectF()
+
+    private val scrollDetector = GestureDetector(context, object : GestureDetector.SimpleOnGestureListener() {
+        override fun onDown(e: MotionEvent) = true
+
+        override fun onScroll(e1: MotionEvent?, e2: MotionEvent, distanceX: Float, distanceY: Float): Boolean {
+            offset += distanceX / scale
+            clampOffset()
+            invalidate()
+            return true
+        }
+    })
+
+    private val scaleDetector = ScaleGestureDetector(context, object : ScaleGestureDetector.SimpleOnScaleGestureListener() {
+        override fun onScale(detector: ScaleGestureDetector): Boolean {
+            zoom(detector.scaleFactor, detector.focusX)
+            return true
+        }
+    })
+
+    // The spectrogram of stage, all of it in view; null clears the view
+    fun setSpectrogram(stage: Int, info: SpectrogramInfo?) {
+        this.stage = stage
+        this.info = info
+        generation++
+        bitmaps.evictAll()
+        requested.clear()
+        fitPending = true
+        invalidate()
+    }
+
+    fun putTiles(request: SpectrogramTileRequest, tiles: List<Bitmap>?) {
+        if (request.generation != generation) return
+        // A failed request is not repeated until the spectrogram changes
+        tiles ?: return
+        tiles.forEachIndexed { i, bitmap ->
+            val key = tileKey(request.level, request.first + i)
+            bitmaps.put(key, bitmap)
+            requested.remove(key)
+        }
+        invalidate()
+    }
+
+    override fun onTouchEvent(event: MotionEvent): Boolean {
+        scaleDetector.onTouchEvent(event)
+        if (!scaleDetector.isInProgress) {
+            scrollDetector.onTouchEvent(event)
+        }
+        return true
+    }
+
+    override fun onSizeChanged(w: Int, h: Int, oldw: Int, oldh: Int) {
+        super.onSizeChanged(w, h, oldw, oldh)
+        fitPending = true
+    }
+
+    // The finest level whose columns fit the width, stretched to it
+    private fun fit(info: SpectrogramInfo) {
+        level = (0 until info.levels).firstOrNull { info.columns(it) <= width } ?: (info.levels - 1)
+        scale = width / max(1L, info.columns(level)).toFloat()
+        offset = 0f
+    }
+
+    // Keeps the column under focusX where it is
+    private fun zoom(factor: Float, focusX: Float) {
+        val info = info ?: return
+        var column = offset + focusX / scale
+        scale *= factor
+        while (scale > 2f && level > 0) {
+            level--
+            scale /= 2f
+            column *= 2f
+        }
+        while (scale < 1f && level < info.levels - 1) {
+            level++
+            scale *= 2f
+            column /= 2f
+        }
+        scale = scale.coerceIn(min(1f, width / max(1L, info.columns(level)).toFloat()), MAX_SCALE)
+        offset = column - focusX / scale
+        clampOffset()
+        invalidate()
+    }
+
+    private fun clampOffset() {
+        val info = info ?: return
+        offset = offset.coerceIn(0f, max(0f, info.columns(level) - width / scale))
+    }
+
+    override fun onDraw(canvas: Canvas) {
+        super.onDraw(canvas)
+        val info = info ?: return
+        if (width == 0 || info.frames == 0L) return
+        if (fitPending) {
+            fit(info)
+            fitPending = false
+        }
+        val tileColumns = info.tileColumns
+        val tileCount = info.tileCounts[level]
+        val firstTile = max(0L, floor(offset / tileColumns).toLong())
+        val lastTile = min(tileCount - 1, floor((offset + width / scale) / tileColumns).toLong())
+        var missingFirst = -1L
+        var missingLast = -1L
+        for (index in firstTile..lastTile) {
+            val left = (index * tileColumns - offset) * scale
+            val bitmap = bitmaps.get(tileKey(level, index))
+            if (bitmap != null) {
+                dst.set(left, 0f, left + bitmap.width * scale, height.toFloat())
+                canvas.drawBitmap(bitmap, null, dst, paint)
+                continue
+            }
+            drawCoarser(canvas, info, index, left)
+            if (tileKey(level, index) !in requested) {
+                if (missingFirst < 0) missingFirst = index
+                missingLast = index
+            }
+        }
+        if (missingFirst >= 0) {
+            for (index in missingFirst..missingLast) {
+                requested.add(tileKey(level, index))
+            }
+            onTilesNeeded?.invoke(
+                SpectrogramTileRequest(
+                    generation, stage, level, missingFirst, (missingLast - missingFirst + 1).toInt(), info.bins
+                )
+            )
+        }
+    }
+
+    // The half of the tile of the next level up that spans tile index
+    private fun drawCoarser(canvas: Canvas, info: SpectrogramInfo, index: Long, left: Float) {
+        if (level + 1 >= info.levels) return
+        val bitmap = bitmaps.get(tileKey(level + 1, index / 2)) ?: return
+        val srcLeft = (index % 2).toInt() * info.tileColumns / 2
+        if (srcLeft >= bitmap.width) return
+        src.set(srcLeft, 0, min(bitmap.width, srcLeft + info.tileColumns / 2), bitmap.height)
+        dst.set(left, 0f, left + src.width() * 2 * scale, height.toFloat())
+        canvas.drawBitmap(bitmap, src, dst, paint)
+    }
+
+    companion object {
+        private const val MAX_BITMAP_BYTES = 24 shl 20
+        private const val MAX_SCALE = 8f
+
+        private fun tileKey(level: Int, index: Long) = (level.toLong() shl 48) or index
+
+        // Black through blue, red and yellow to white
+        private val palette = IntArray(256).also { palette ->
+            val stops = intArrayOf(
+                Color.BLACK, Color.rgb(32, 0, 128), Color.rgb(192, 0, 96), Color.rgb(255, 128, 0),
+                Color.rgb(255, 255, 64), Color.WHITE
+            )
+            for (i in 0 until 256) {
+                val position = i / 255f * (stops.size - 1)
+                val stop = min(stops.size - 2, position.toInt())
+                val t = position - stop
+                val a = stops[stop]
+                val b = stops[stop + 1]
+                palette[i] = Color.rgb(
+                    (Color.red(a) + (Color.red(b) - Color.red(a)) * t).toInt(),
+                    (Color.green(a) + (Color.green(b) - Color.green(a)) * t).toInt(),
+                    (Color.blue(a) + (Color.blue(b) - Color.blue(a)) * t).toInt()
+                )
+            }
+        }
+
+        // A tile as a bitmap, a column of pixels per column, the lowest bin
+        // at the bottom; meant for the thread that fetched it
+        fun tileBitmap(values: ByteArray, bins: Int): Bitmap {
+            val columns = values.size / bins
+            val pixels = IntArray(columns * bins)
+            for (x in 0 until columns) {
+                for (bin in 0 until bins) {
+                    pixels[(bins - 1 - bin) * columns + x] = palette[values[x * bins + bin].toInt() and 0xff]
+                }
+            }
+            return Bitmap.createBitmap(pixels, columns, bins, Bitmap.Config.ARGB_8888)
+        }
+    }
+}
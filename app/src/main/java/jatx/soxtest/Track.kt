@@ -1,10 +1,7 @@
 package jatx.soxtest
 
 import android.util.Log
-import org.jaudiotagger.audio.AudioFile
-import org.jaudiotagger.audio.AudioFileIO
-import org.jaudiotagger.tag.FieldKey
-import org.jaudiotagger.tag.flac.FlacTag
+import org.json.JSONObject
 import java.io.File
 
 data class Track(
@@ -15,25 +12,21 @@ data class Track(
     val length: String = "",
     val number: String = "0"
 ) {
-    fun tryToFill(file: File): Track {
+    // probeJson is the native header probe of the file, see audio-probe.h
+    fun tryToFill(file: File, probeJson: String): Track {
         return try {
-            val af = AudioFileIO.read(file)
-            val len: Int = af.audioHeader.trackLength
+            if (file.extension !in listOf("mp3", "flac", "ogg")) {
+                throw IllegalStateException("wrong file extension")
+            }
+            val probe = JSONObject(probeJson)
+            if (probe.getInt("result") != 0) {
+                throw IllegalStateException(probe.getString("error"))
+            }
+            val len = probe.getDouble("duration_s").toInt()
             val sec = len % 60
             val min = (len - sec) / 60
             val _length = String.format("%02d:%02d", min, sec)
-            val _track = when (file.extension) {
-                "mp3" -> {
-                    fillFromMP3File(af)
-                }
-                "flac" -> {
-                    fillFromFLACFile(af)
-                }
-                "ogg" -> Track()
-                else -> {
-                    throw IllegalStateException("wrong file extension")
-                }
-            }
+            val _track = fillFromProbe(probe)
             val _title = _track.title.takeIf { it.trim().isNotEmpty() } ?: file.name
             _track.copy(title = _title, length = _length)
         } catch (e: Throwable) {
@@ -42,33 +35,12 @@ data class Track(
         }
     }
 
-    private fun fillFromMP3File(af: AudioFile): Track {
-        val tag = af.tag
-        val _artist = tag.getFirst(FieldKey.ARTIST).trim()
-        val _album = tag.getFirst(FieldKey.ALBUM).trim()
-        val _title = tag.getFirst(FieldKey.TITLE).trim()
-        val _year = tag.getFirst(FieldKey.YEAR)
-        var _number = tag.getFirst(FieldKey.TRACK)
-        try {
-            val num = _number.toInt()
-            if (num < 10) {
-                _number = "00$num"
-            } else if (num < 100) {
-                _number = "0$num"
-            }
-        } catch (e: Exception) {
-            e.printStackTrace()
-        }
-        return copy(artist = _artist, album = _album, title = _title, year = _year, number = _number)
-    }
-
-    private fun fillFromFLACFile(af: AudioFile): Track {
-        val tag = af.tag as FlacTag
-        val _artist = tag.getFirst(FieldKey.ARTIST).trim()
-        val _album = tag.getFirst(FieldKey.ALBUM).trim()
-        val _title = tag.getFirst(FieldKey.TITLE).trim()
-        val _year = tag.getFirst(FieldKey.YEAR)
-        var _number = tag.getFirst(FieldKey.TRACK)
+    private fun fillFromProbe(probe: JSONObject): Track {
+        val _artist = probe.getString("artist").trim()
+        val _album = probe.getString("album").trim()
+        val _title = probe.getString("title").trim()
+        val _year = probe.getString("year")
+        var _number = probe.getString("track")
         try {
             val num = _number.toInt()
             if (num < 10) {
@@ -81,4 +53,4 @@ data class Track(
         }
         return copy(artist = _artist, album = _album, title = _title, year = _year, number = _number)
     }
-}
\ No newline at end of file
+}